@@ -6,6 +6,30 @@ fn main() {
 
     cxx_build::bridge("src/backend/rs/MasteringUtil.rs")
         .file("src/backend/cpp/MasteringUtil.cpp")
+        .file("src/backend/cpp/MappedFile.cpp")
+        .file("src/backend/cpp/WavReader.cpp")
+        .file("src/backend/cpp/AudioSource.cpp")
+        .file("src/backend/cpp/Loudness.cpp")
+        .file("src/backend/cpp/ThreadPool.cpp")
+        .file("src/backend/cpp/TagWriter.cpp")
+        .file("src/backend/cpp/Fingerprint.cpp")
+        .file("src/backend/cpp/FlacEncoder.cpp")
+        .file("src/backend/cpp/Dsp.cpp")
+        .file("src/backend/cpp/DspGraph.cpp")
+        .file("src/backend/cpp/SegmentEncoder.cpp")
+        .file("src/backend/cpp/Preflight.cpp")
+        .file("src/backend/cpp/Waveform.cpp")
+        .file("src/backend/cpp/Prefetcher.cpp")
+        .file("src/backend/cpp/JobScheduler.cpp")
+        .file("src/backend/cpp/OutputPublisher.cpp")
+        .file("src/backend/cpp/CacheJournal.cpp")
+        .file("src/backend/cpp/JobServer.cpp")
+        .file("src/backend/cpp/FileWatcher.cpp")
+        .file("src/backend/cpp/Subprocess.cpp")
+        .file("src/backend/cpp/ConcurrencyController.cpp")
+        .file("src/backend/cpp/ThreadBudget.cpp")
+        .file("src/backend/cpp/CpuPlacement.cpp")
+        .file("src/backend/cpp/Watchdog.cpp")
         .include("src/backend/cpp")
         .include("src/backend/rs")
         .std("c++20")
@@ -0,0 +1,139 @@
+/**
+ * @file AudioSource.cpp
+ * @brief Implementation of the sequential audio reader
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "AudioSource.h"
+#include "Subprocess.h"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+void AudioSource::PipeCloser::operator()(FILE *f) const
+{
+#ifdef _WIN32
+	_pclose(f);
+#else
+	pclose(f);
+#endif
+}
+
+void AudioSource::open(const std::filesystem::path &filePath)
+{
+	close();
+
+	if (!std::filesystem::exists(filePath))
+		throw std::runtime_error("File not found: " + filePath.string());
+
+	if (m_wav.open(filePath))
+	{
+		m_native = true;
+		m_channels = m_wav.channels();
+		m_sampleRate = m_wav.sampleRate();
+		return;
+	}
+
+	std::string path = filePath.string();
+
+	// Let ffmpeg decode to float WAV on stdout; the sizes in the header are unknown, so read until EOF. One
+	// decoder thread keeps up with the DSP graph
+	std::string command =
+	    "ffmpeg -v error -nostdin -threads 1 -i " + Subprocess::quote(path) + " -vn -f wav -c:a pcm_f32le -";
+#ifdef _WIN32
+	command += " 2>NUL";
+	m_pipe.reset(_popen(command.c_str(), "rb"));
+#else
+	command += " 2>/dev/null";
+	m_pipe.reset(popen(command.c_str(), "r"));
+#endif
+	if (!m_pipe)
+		throw std::runtime_error("Failed to start ffmpeg for " + path);
+
+	std::uint8_t header[12];
+	if (!readPipe(header, sizeof(header)) || std::memcmp(header, "RIFF", 4) != 0 ||
+	    std::memcmp(header + 8, "WAVE", 4) != 0)
+		throw std::runtime_error("Failed to decode " + path);
+
+	for (;;)
+	{
+		std::uint8_t chunk[8];
+		if (!readPipe(chunk, sizeof(chunk)))
+			throw std::runtime_error("Failed to decode " + path);
+
+		std::uint32_t size =
+		    chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | (static_cast<std::uint32_t>(chunk[7]) << 24);
+		if (std::memcmp(chunk, "data", 4) == 0)
+			break;
+
+		std::vector<std::uint8_t> payload(size + (size & 1));
+		if (!readPipe(payload.data(), payload.size()))
+			throw std::runtime_error("Failed to decode " + path);
+
+		if (std::memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+		{
+			m_channels = payload[2] | (payload[3] << 8);
+			m_sampleRate = payload[4] | (payload[5] << 8) | (payload[6] << 16) |
+			               (static_cast<unsigned>(payload[7]) << 24);
+		}
+	}
+
+	if (m_channels == 0 || m_sampleRate == 0)
+		throw std::runtime_error("Failed to decode " + path);
+}
+
+void AudioSource::close()
+{
+	m_wav.close();
+	m_pipe.reset();
+	m_buffer.clear();
+	m_position = 0;
+	m_channels = m_sampleRate = 0;
+	m_native = false;
+}
+
+size_t AudioSource::read(float *const *planes, size_t maxFrames)
+{
+	if (m_native)
+	{
+		size_t frames = m_wav.read(m_position, maxFrames, planes);
+		m_position += frames;
+		return frames;
+	}
+
+	if (!m_pipe)
+		return 0;
+
+	const size_t frameBytes = m_channels * sizeof(float);
+	m_buffer.resize(maxFrames * frameBytes);
+	size_t bytes = std::fread(m_buffer.data(), 1, m_buffer.size(), m_pipe.get());
+	size_t frames = bytes / frameBytes;
+	if (frames == 0)
+	{
+		m_pipe.reset();
+		return 0;
+	}
+
+	WavReader::convertToPlanar(m_buffer.data(), WavReader::SampleFormat::Float32, m_channels, frames, planes);
+	return frames;
+}
+
+bool AudioSource::readPipe(void *buffer, size_t size)
+{
+	return std::fread(buffer, 1, size, m_pipe.get()) == size;
+}
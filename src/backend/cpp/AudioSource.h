@@ -0,0 +1,103 @@
+/**
+ * @file AudioSource.h
+ * @brief Sequential planar float reader for any input ffmpeg can decode.
+ *
+ * WAV, RF64 and BWF files are read natively through WavReader. Everything
+ * else is decoded once by ffmpeg to 32-bit float WAV on a pipe.
+ *
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "WavReader.h"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <vector>
+
+/// @brief Sequential planar float audio reader
+class AudioSource
+{
+  public:
+	/**
+	 * @brief Open an input
+	 *
+	 * @param filePath File to read
+	 * @throws std::runtime_error if the file cannot be opened or decoded
+	 */
+	void open(const std::filesystem::path &filePath);
+
+	/// @brief Close the input
+	void close();
+
+	/**
+	 * @brief Read the next frames
+	 *
+	 * @param planes One destination buffer per channel
+	 * @param maxFrames Capacity of each buffer in frames
+	 * @return Number of frames read, 0 at the end of the input
+	 */
+	size_t read(float *const *planes, size_t maxFrames);
+
+	/// @brief Number of channels
+	unsigned channels() const
+	{
+		return m_channels;
+	}
+	/// @brief Sample rate in Hz
+	unsigned sampleRate() const
+	{
+		return m_sampleRate;
+	}
+	/// @brief Whether the input is read natively instead of through ffmpeg
+	bool isNative() const
+	{
+		return m_native;
+	}
+	/// @brief Native reader, only valid if isNative()
+	const WavReader &wav() const
+	{
+		return m_wav;
+	}
+
+  private:
+	/// @brief Closes an ffmpeg pipe
+	struct PipeCloser
+	{
+		void operator()(FILE *f) const;
+	};
+
+	/// @brief Read exactly size bytes from the pipe
+	bool readPipe(void *buffer, size_t size);
+
+	/// @brief Native reader
+	WavReader m_wav;
+	/// @brief ffmpeg decoder pipe
+	std::unique_ptr<FILE, PipeCloser> m_pipe;
+	/// @brief Raw pipe buffer
+	std::vector<std::uint8_t> m_buffer;
+	/// @brief Next frame to read natively
+	std::uint64_t m_position = 0;
+	/// @brief Number of channels
+	unsigned m_channels = 0;
+	/// @brief Sample rate
+	unsigned m_sampleRate = 0;
+	/// @brief Reading natively
+	bool m_native = false;
+};
@@ -0,0 +1,184 @@
+/**
+ * @file CacheJournal.cpp
+ * @brief Append-only journal of cache changes between snapshots.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "CacheJournal.h"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <utility>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// @brief Start of the line that closes a record
+static constexpr char COMMIT[] = "; commit ";
+
+/// @brief FNV-1a hash of a record as hex
+static std::string recordHash(const std::string &record)
+{
+	std::uint64_t hash = 0xcbf29ce484222325ull;
+	for (char c : record)
+		hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+	char hex[17];
+	std::snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+	return hex;
+}
+
+/**
+ * @brief Split a journal into its intact records
+ * @param path Journal file
+ * @param records Receives the records, may be null
+ * @return Length of the intact part of the file
+ */
+static std::uint64_t scan(const std::filesystem::path &path, std::vector<std::string> *records)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return 0;
+	const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	std::uint64_t intact = 0;
+	size_t        start = 0;
+	size_t        line = 0;
+	while (line < contents.size())
+	{
+		const size_t end = contents.find('\n', line);
+		if (end == std::string::npos)
+			break; // torn line
+		if (contents.compare(line, sizeof(COMMIT) - 1, COMMIT) == 0)
+		{
+			std::string record = contents.substr(start, line - start);
+			if (contents.substr(line + sizeof(COMMIT) - 1, end - line - sizeof(COMMIT) + 1) != recordHash(record))
+				break; // torn record
+			if (records)
+				records->push_back(std::move(record));
+			start = end + 1;
+			intact = start;
+		}
+		line = end + 1;
+	}
+	return intact;
+}
+
+CacheJournal::CacheJournal(std::filesystem::path path) : m_path(std::move(path))
+{
+	std::error_code     ec;
+	const std::uint64_t size = std::filesystem::file_size(m_path, ec);
+	if (ec)
+		return;
+	m_size = scan(m_path, nullptr);
+	if (m_size < size)
+		std::filesystem::resize_file(m_path, m_size, ec);
+}
+
+CacheJournal::~CacheJournal()
+{
+	if (m_fd >= 0)
+#ifdef _WIN32
+		_close(m_fd);
+#else
+		::close(m_fd);
+#endif
+}
+
+std::vector<std::string> CacheJournal::read(const std::filesystem::path &path)
+{
+	std::vector<std::string> records;
+	scan(path, &records);
+	return records;
+}
+
+bool CacheJournal::open()
+{
+	if (m_fd >= 0)
+		return true;
+	std::error_code ec;
+	std::filesystem::create_directories(m_path.parent_path(), ec);
+#ifdef _WIN32
+	m_fd = _wopen(m_path.c_str(), _O_WRONLY | _O_APPEND | _O_CREAT | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+	const bool created = !std::filesystem::exists(m_path, ec);
+	m_fd = ::open(m_path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+
+	// The first record is only durable once the directory names the new file
+	if (m_fd >= 0 && created)
+	{
+		int directory = ::open(m_path.parent_path().empty() ? "." : m_path.parent_path().c_str(), O_RDONLY | O_CLOEXEC);
+		if (directory >= 0)
+		{
+			fsync(directory);
+			::close(directory);
+		}
+	}
+#endif
+	return m_fd >= 0;
+}
+
+bool CacheJournal::append(const std::string &record)
+{
+	if (!open())
+		return false;
+	const std::string data = record + COMMIT + recordHash(record) + "\n";
+
+	size_t written = 0;
+	while (written < data.size())
+	{
+#ifdef _WIN32
+		const int count = _write(m_fd, data.data() + written, static_cast<unsigned>(data.size() - written));
+#else
+		const ssize_t count = ::write(m_fd, data.data() + written, data.size() - written);
+#endif
+		if (count <= 0)
+		{
+			// A partial record would hide the ones appended after it
+			std::error_code ec;
+			std::filesystem::resize_file(m_path, m_size, ec);
+			return false;
+		}
+		written += static_cast<size_t>(count);
+	}
+	m_size += data.size();
+
+#ifdef _WIN32
+	return _commit(m_fd) == 0;
+#elif defined(__linux__)
+	return fdatasync(m_fd) == 0;
+#else
+	return fsync(m_fd) == 0;
+#endif
+}
+
+void CacheJournal::clear()
+{
+	if (m_size == 0)
+		return;
+	std::error_code ec;
+	std::filesystem::resize_file(m_path, 0, ec);
+	if (!ec)
+		m_size = 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file CacheJournal.h
+ * @brief Append-only journal of cache changes between snapshots.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Durable, append-only log of records next to a cache snapshot
+ *
+ * A record is a block of text lines that is written with one write() and
+ * flushed to disk before append() returns. It is closed by a commit line
+ * holding the FNV-1a hash of its lines, so a record torn by a crash is
+ * recognised and ignored when the journal is read; the constructor cuts
+ * such a tail off before anything is appended after it. Commit lines start
+ * with ';', which cache readers skip as comments.
+ *
+ * A journal is written by one thread at a time.
+ */
+class CacheJournal
+{
+  public:
+	/**
+	 * @brief Open a journal for appending, creating it on the first append()
+	 * @param path Journal file
+	 */
+	explicit CacheJournal(std::filesystem::path path);
+
+	/// @brief Close the journal
+	~CacheJournal();
+
+	CacheJournal(const CacheJournal &) = delete;
+	CacheJournal &operator=(const CacheJournal &) = delete;
+
+	/**
+	 * @brief Read the intact records of a journal
+	 * @param path Journal file
+	 * @return Records in the order they were appended, without their commit lines; empty if there is no journal
+	 */
+	static std::vector<std::string> read(const std::filesystem::path &path);
+
+	/**
+	 * @brief Append a record and flush it to disk
+	 * @param record Complete lines, each ending in '\n'
+	 * @return false if the record could not be written or flushed
+	 */
+	bool append(const std::string &record);
+
+	/// @brief Drop every record, once a snapshot holds them
+	void clear();
+
+	/// @brief Bytes in the journal
+	std::uint64_t size() const
+	{
+		return m_size;
+	}
+
+	/// @brief Journal file
+	const std::filesystem::path &path() const
+	{
+		return m_path;
+	}
+
+  private:
+	/// @brief Open the file for appending if it is not open yet
+	bool open();
+
+	/// @brief Journal file
+	std::filesystem::path m_path;
+	/// @brief File descriptor, -1 while closed
+	int m_fd = -1;
+	/// @brief Bytes in the journal
+	std::uint64_t m_size = 0;
+};
@@ -0,0 +1,199 @@
+/**
+ * @file ConcurrencyController.cpp
+ * @brief Adjusts the number of encodes at once to the measured throughput.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ConcurrencyController.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+ConcurrencyController::ConcurrencyController(const Settings &settings, unsigned initial) : m_settings(settings)
+{
+	if (m_settings.Max == 0)
+		m_settings.Max = 2 * ThreadBudget::availableCpus();
+	m_settings.Min = std::clamp(m_settings.Min, 1u, m_settings.Max);
+	m_stats.Limit = std::clamp(initial, m_settings.Min, m_settings.Max);
+	m_stats.Lowest = m_stats.Highest = m_stats.Limit;
+	m_previousLimit = m_stats.Limit;
+	m_hasCpu = readCpuTimes(m_cpu);
+
+	if (!m_settings.Log.empty())
+	{
+		std::error_code ec;
+		const bool      fresh =
+		    !std::filesystem::exists(m_settings.Log, ec) || std::filesystem::is_empty(m_settings.Log, ec);
+		m_log.open(m_settings.Log, std::ios::app);
+		if (m_log && fresh)
+			m_log << "time,from,to,throughput,cpu,iowait,reason\n" << std::flush;
+	}
+}
+
+bool ConcurrencyController::readCpuTimes(CpuTimes &times)
+#if defined(__linux__)
+{
+	// cpu user nice system idle iowait irq softirq steal; guest time is already part of user
+	std::ifstream stat("/proc/stat");
+	std::string   label;
+	std::uint64_t user, nice, system, idle, iowait, irq = 0, softirq = 0, steal = 0;
+	if (!(stat >> label >> user >> nice >> system >> idle >> iowait) || label != "cpu")
+		return false;
+	stat >> irq >> softirq >> steal;
+	times.Busy = user + nice + system + irq + softirq + steal;
+	times.IoWait = iowait;
+	times.Total = times.Busy + idle + iowait;
+	times.HasIoWait = true;
+	return true;
+}
+#elif defined(_WIN32)
+{
+	FILETIME idle, kernel, user;
+	if (!GetSystemTimes(&idle, &kernel, &user))
+		return false;
+	auto ticks = [](const FILETIME &time) {
+		return (static_cast<std::uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+	};
+	// Kernel time includes the idle time
+	times.Total = ticks(kernel) + ticks(user);
+	times.Busy = times.Total - ticks(idle);
+	times.IoWait = 0;
+	times.HasIoWait = false;
+	return true;
+}
+#else
+{
+	(void)times;
+	return false;
+}
+#endif
+
+ConcurrencyController::Decision ConcurrencyController::update(double throughput)
+{
+	Sample   sample;
+	CpuTimes now;
+	sample.Throughput = throughput;
+	if (readCpuTimes(now))
+	{
+		if (m_hasCpu && now.Total > m_cpu.Total)
+		{
+			const double total = static_cast<double>(now.Total - m_cpu.Total);
+			sample.Cpu = static_cast<double>(now.Busy - m_cpu.Busy) / total;
+			if (now.HasIoWait)
+				sample.IoWait = static_cast<double>(now.IoWait - m_cpu.IoWait) / total;
+		}
+		m_cpu = now;
+		m_hasCpu = true;
+	}
+	return decide(sample);
+}
+
+ConcurrencyController::Decision ConcurrencyController::decide(const Sample &sample)
+{
+	const unsigned limit = m_stats.Limit;
+	const double   throughput = sample.Throughput;
+	const unsigned cut =
+	    std::max(m_settings.Min, std::min(limit - 1, static_cast<unsigned>(limit * m_settings.Backoff)));
+	Decision decision;
+	decision.From = decision.To = limit;
+	decision.Measured = sample;
+
+	if (sample.IoWait >= m_settings.IoWaitLimit && limit > m_settings.Min)
+	{
+		// The devices are the bottleneck; more jobs only make them seek
+		decision.To = cut;
+		decision.Reason = "iowait";
+	}
+	else if (m_previousLimit < limit && m_previousThroughput >= 0.0 &&
+	         throughput < m_previousThroughput * (1.0 + m_settings.Gain))
+	{
+		decision.To = m_previousLimit;
+		decision.Reason = "no gain";
+	}
+	else if (m_throughput >= 0.0 && throughput < m_throughput * (1.0 - m_settings.Gain) && limit > m_settings.Min &&
+	         (sample.Cpu < 0.0 || sample.Cpu >= m_settings.CpuBusy))
+	{
+		// Something else took the CPUs
+		decision.To = cut;
+		decision.Reason = "throughput fell";
+	}
+	else if (m_hold > 0)
+	{
+		--m_hold;
+		decision.Reason = "hold";
+	}
+	else if (limit >= m_settings.Max)
+		decision.Reason = "at most";
+	else if (sample.Cpu >= m_settings.CpuBusy)
+		decision.Reason = "cpu busy";
+	else
+	{
+		decision.To = limit + 1;
+		decision.Reason = sample.Cpu < 0.0 ? "probe" : "cpu idle";
+	}
+
+	++m_stats.Decisions;
+	m_stats.Throughput = throughput;
+	if (decision.To == limit)
+	{
+		m_previousLimit = limit;
+		m_throughput = throughput;
+	}
+	else
+	{
+		if (decision.To > limit)
+			++m_stats.Increases;
+		else
+		{
+			++m_stats.Decreases;
+			m_hold = m_settings.Hold;
+		}
+		m_previousLimit = limit;
+		m_previousThroughput = throughput;
+		m_throughput = -1.0;
+		m_stats.Limit = decision.To;
+		m_stats.Lowest = std::min(m_stats.Lowest, decision.To);
+		m_stats.Highest = std::max(m_stats.Highest, decision.To);
+	}
+	log(decision);
+	return decision;
+}
+
+void ConcurrencyController::log(const Decision &decision)
+{
+	if (!m_log.is_open())
+		return;
+	auto known = [this](double value) {
+		if (value >= 0.0)
+			m_log << value;
+	};
+	const double time =
+	    std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+	m_log << std::fixed << std::setprecision(3) << time << ',' << decision.From << ',' << decision.To << ','
+	      << decision.Measured.Throughput << ',';
+	known(decision.Measured.Cpu);
+	m_log << ',';
+	known(decision.Measured.IoWait);
+	m_log << ',' << decision.Reason << '\n' << std::flush;
+}
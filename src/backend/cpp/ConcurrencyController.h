@@ -0,0 +1,197 @@
+/**
+ * @file ConcurrencyController.h
+ * @brief Adjusts the number of encodes at once to the measured throughput.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+/**
+ * @brief Finds the number of jobs at once that encodes the most audio per second
+ *
+ * JobScheduler measures the throughput of every window of finished jobs,
+ * in seconds of audio per second, and the controller adds the CPU
+ * utilization and iowait of the system since the previous window. It then
+ * climbs: while CPUs are idle it adds a job (additive increase) and keeps
+ * it if the throughput rose; a step that did not pay off is taken back.
+ * High iowait, or a throughput that drops while the CPUs are busy, as when
+ * other programs share the host, cuts the jobs by a factor
+ * (multiplicative decrease). After a step back or a cut it waits a few
+ * windows before it tries to add jobs again.
+ *
+ * Every decision is appended to a CSV file if one is set. CPU utilization
+ * is read from /proc/stat on Linux and from GetSystemTimes() on Windows,
+ * iowait only on Linux; elsewhere the controller climbs on throughput
+ * alone.
+ */
+class ConcurrencyController
+{
+  public:
+	/// @brief Bounds and tuning
+	class Settings
+	{
+	  public:
+		/// @brief Fewest jobs at once
+		unsigned Min = 1;
+		/// @brief Most jobs at once, 0 for twice the available CPUs (ThreadBudget::availableCpus())
+		unsigned Max = 0;
+		/// @brief Shortest window in seconds
+		double Interval = 5.0;
+		/// @brief Relative change of the throughput that counts as a change
+		double Gain = 0.05;
+		/// @brief Factor applied to the jobs by a decrease
+		double Backoff = 0.75;
+		/// @brief Share of CPU time spent waiting for I/O above which jobs are cut
+		double IoWaitLimit = 0.2;
+		/// @brief CPU utilization from which no jobs are added
+		double CpuBusy = 0.9;
+		/// @brief Windows to wait after a step back or a cut before adding jobs again
+		unsigned Hold = 3;
+		/// @brief CSV file the decisions are appended to, empty for none
+		std::filesystem::path Log;
+	};
+
+	/// @brief Measurements of one window
+	class Sample
+	{
+	  public:
+		/// @brief Seconds of audio encoded per second
+		double Throughput = 0.0;
+		/// @brief CPU utilization of the system, 0 to 1, negative if unknown
+		double Cpu = -1.0;
+		/// @brief Share of CPU time spent waiting for I/O, 0 to 1, negative if unknown
+		double IoWait = -1.0;
+	};
+
+	/// @brief Outcome of one window
+	class Decision
+	{
+	  public:
+		/// @brief Jobs at once before
+		unsigned From = 0;
+		/// @brief Jobs at once from now on
+		unsigned To = 0;
+		/// @brief What was measured
+		Sample Measured;
+		/// @brief Why, e.g. "cpu idle", "no gain", "iowait", "throughput fell", "hold"
+		std::string Reason;
+	};
+
+	/// @brief Decisions so far
+	class Stats
+	{
+	  public:
+		/// @brief Jobs at once now
+		unsigned Limit = 0;
+		/// @brief Fewest jobs at once so far
+		unsigned Lowest = 0;
+		/// @brief Most jobs at once so far
+		unsigned Highest = 0;
+		/// @brief Windows judged
+		size_t Decisions = 0;
+		/// @brief Steps up
+		size_t Increases = 0;
+		/// @brief Steps back and cuts
+		size_t Decreases = 0;
+		/// @brief Throughput of the last window
+		double Throughput = 0.0;
+	};
+
+	/**
+	 * @param settings Bounds and tuning; Max is resolved and Min clamped to it
+	 * @param initial Jobs at once to start with, clamped to the bounds
+	 */
+	ConcurrencyController(const Settings &settings, unsigned initial);
+
+	/// @brief Resolved bounds and tuning
+	const Settings &settings() const
+	{
+		return m_settings;
+	}
+
+	/// @brief Jobs at once now
+	unsigned limit() const
+	{
+		return m_stats.Limit;
+	}
+
+	/// @brief Decisions so far
+	const Stats &stats() const
+	{
+		return m_stats;
+	}
+
+	/**
+	 * @brief Judge a window, measuring the CPU since the previous one
+	 * @param throughput Seconds of audio encoded per second in the window
+	 * @return The decision
+	 */
+	Decision update(double throughput);
+
+	/**
+	 * @brief Judge a window whose measurements are given
+	 * @param sample Measurements
+	 * @return The decision
+	 */
+	Decision decide(const Sample &sample);
+
+  private:
+	/// @brief Cumulative CPU times of the system
+	class CpuTimes
+	{
+	  public:
+		/// @brief Busy time
+		std::uint64_t Busy = 0;
+		/// @brief Time waiting for I/O
+		std::uint64_t IoWait = 0;
+		/// @brief All time
+		std::uint64_t Total = 0;
+		/// @brief Whether IoWait is known
+		bool HasIoWait = false;
+	};
+
+	/// @brief Read the CPU times, false where the system does not report them
+	static bool readCpuTimes(CpuTimes &times);
+
+	/// @brief Append a decision to the log
+	void log(const Decision &decision);
+
+	/// @brief Bounds and tuning
+	Settings m_settings;
+	/// @brief Decisions so far
+	Stats m_stats;
+	/// @brief Jobs at once before the last change
+	unsigned m_previousLimit = 0;
+	/// @brief Throughput at m_previousLimit
+	double m_previousThroughput = -1.0;
+	/// @brief Throughput of the last window at the current limit, negative if none yet
+	double m_throughput = -1.0;
+	/// @brief Windows left before jobs may be added
+	unsigned m_hold = 0;
+	/// @brief CPU times at the end of the previous window
+	CpuTimes m_cpu;
+	/// @brief Whether m_cpu was read
+	bool m_hasCpu = false;
+	/// @brief Decision log
+	std::ofstream m_log;
+};
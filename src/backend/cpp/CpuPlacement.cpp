@@ -0,0 +1,193 @@
+/**
+ * @file CpuPlacement.cpp
+ * @brief Places encoder processes on CPUs and NUMA nodes.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "CpuPlacement.h"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <numeric>
+#include <sstream>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+CpuPlacement::CpuPlacement(Policy policy, std::vector<Node> nodes) : m_policy(policy), m_nodes(std::move(nodes))
+{
+	for (const Node &node : m_nodes)
+		m_users.emplace_back(node.Cpus.size());
+}
+
+std::vector<int> CpuPlacement::parseList(const std::string &list)
+{
+	std::vector<int>  cpus;
+	std::stringstream in(list);
+	for (std::string range; std::getline(in, range, ',');)
+	{
+		int first, last;
+		if (std::sscanf(range.c_str(), "%d-%d", &first, &last) == 2)
+		{
+			for (int cpu = first; cpu <= last; ++cpu)
+				cpus.push_back(cpu);
+		}
+		else if (std::sscanf(range.c_str(), "%d", &first) == 1)
+			cpus.push_back(first);
+	}
+	std::sort(cpus.begin(), cpus.end());
+	cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+	return cpus;
+}
+
+std::string CpuPlacement::formatList(const std::vector<int> &cpus)
+{
+	std::string list;
+	for (size_t i = 0; i < cpus.size();)
+	{
+		size_t last = i;
+		while (last + 1 < cpus.size() && cpus[last + 1] == cpus[last] + 1)
+			++last;
+		if (!list.empty())
+			list += ",";
+		list += std::to_string(cpus[i]);
+		if (last > i)
+			list += "-" + std::to_string(cpus[last]);
+		i = last + 1;
+	}
+	return list;
+}
+
+const char *CpuPlacement::name(Policy policy)
+{
+	switch (policy)
+	{
+	case Policy::Compact:
+		return "compact";
+	case Policy::Scatter:
+		return "scatter";
+	default:
+		return "none";
+	}
+}
+
+std::vector<CpuPlacement::Node> CpuPlacement::topology()
+{
+	std::vector<Node> nodes;
+#ifdef __linux__
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return nodes;
+
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator("/sys/devices/system/node", ec))
+	{
+		const std::string name = entry.path().filename().string();
+		if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+		    !std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+			continue;
+		std::ifstream in(entry.path() / "cpulist");
+		std::string   list;
+		std::getline(in, list);
+		Node node;
+		node.Id = std::stoi(name.substr(4));
+		for (int cpu : parseList(list))
+			if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+				node.Cpus.push_back(cpu);
+		if (!node.Cpus.empty())
+			nodes.push_back(std::move(node));
+	}
+	std::sort(nodes.begin(), nodes.end(), [](const Node &a, const Node &b) { return a.Id < b.Id; });
+
+	// Without NUMA support the allowed CPUs form one node
+	if (nodes.empty())
+	{
+		Node node;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+			if (CPU_ISSET(cpu, &allowed))
+				node.Cpus.push_back(cpu);
+		nodes.push_back(std::move(node));
+	}
+#endif
+	return nodes;
+}
+
+CpuPlacement::Slot CpuPlacement::acquire(unsigned width)
+{
+	Slot slot;
+	if (m_policy == Policy::None || m_nodes.empty())
+		return slot;
+
+	auto used = [this](size_t node) { return std::accumulate(m_users[node].begin(), m_users[node].end(), 0u); };
+	auto idle = [this](size_t node) {
+		return static_cast<unsigned>(std::count(m_users[node].begin(), m_users[node].end(), 0u));
+	};
+
+	// Compact takes the first node with room; scatter, and compact once every node is full, the least loaded one
+	size_t best = m_nodes.size();
+	if (m_policy == Policy::Compact)
+	{
+		for (size_t n = 0; n < m_nodes.size() && best == m_nodes.size(); ++n)
+			if (idle(n) >= std::min<size_t>(std::max(1u, width), m_nodes[n].Cpus.size()))
+				best = n;
+	}
+	if (best == m_nodes.size())
+	{
+		best = 0;
+		for (size_t n = 1; n < m_nodes.size(); ++n)
+		{
+			// Fewer jobs per CPU; the products avoid division
+			if (static_cast<size_t>(used(n)) * m_nodes[best].Cpus.size() <
+			    static_cast<size_t>(used(best)) * m_nodes[n].Cpus.size())
+				best = n;
+		}
+	}
+
+	// The CPUs of the node that the fewest jobs use, lowest numbers first
+	const Node         &node = m_nodes[best];
+	std::vector<size_t> order(node.Cpus.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+	                 [&](size_t a, size_t b) { return m_users[best][a] < m_users[best][b]; });
+	order.resize(std::clamp<size_t>(width, 1, order.size()));
+	std::sort(order.begin(), order.end());
+
+	slot.Node = static_cast<int>(best);
+	for (size_t i : order)
+	{
+		++m_users[best][i];
+		slot.Cpus.push_back(node.Cpus[i]);
+	}
+	return slot;
+}
+
+void CpuPlacement::release(const Slot &slot)
+{
+	if (slot.Node < 0 || static_cast<size_t>(slot.Node) >= m_nodes.size())
+		return;
+	const Node &node = m_nodes[slot.Node];
+	for (int cpu : slot.Cpus)
+	{
+		auto it = std::lower_bound(node.Cpus.begin(), node.Cpus.end(), cpu);
+		if (it != node.Cpus.end() && *it == cpu && m_users[slot.Node][it - node.Cpus.begin()] > 0)
+			--m_users[slot.Node][it - node.Cpus.begin()];
+	}
+}
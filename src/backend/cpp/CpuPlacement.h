@@ -0,0 +1,136 @@
+/**
+ * @file CpuPlacement.h
+ * @brief Places encoder processes on CPUs and NUMA nodes.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <string>
+#include <vector>
+
+/**
+ * @brief Hands out the CPUs jobs pin their encoder processes to
+ *
+ * The NUMA nodes and their CPUs are read from sysfs
+ * (/sys/devices/system/node), restricted to the affinity mask of the
+ * process. Every job gets a set of CPUs of one node, so its encoders do not
+ * migrate between sockets and their memory stays local:
+ *
+ * - Compact fills the CPUs of the first node before it uses the next one,
+ *   which keeps a small batch on one socket and its caches warm
+ * - Scatter puts every job on the node with the most free CPUs, which
+ *   spreads the memory bandwidth of a large batch over the sockets
+ * - None does not pin
+ *
+ * Within a node a job takes the CPUs that the fewest jobs use, so jobs
+ * share CPUs only once there are more of them than CPUs. Not thread-safe;
+ * JobScheduler calls it under its lock. Pinning is only available on Linux.
+ */
+class CpuPlacement
+{
+  public:
+	/// @brief How jobs are spread over the nodes
+	enum class Policy
+	{
+		/// @brief No pinning
+		None,
+		/// @brief Fill one node after the other
+		Compact,
+		/// @brief Spread over the nodes
+		Scatter
+	};
+
+	/// @brief NUMA node
+	class Node
+	{
+	  public:
+		/// @brief Node number
+		int Id = 0;
+		/// @brief CPUs of the node the process may use
+		std::vector<int> Cpus;
+	};
+
+	/// @brief Placement of one job
+	class Slot
+	{
+	  public:
+		/// @brief Index into nodes(), -1 if the job is not pinned
+		int Node = -1;
+		/// @brief CPUs the job's encoders run on
+		std::vector<int> Cpus;
+	};
+
+	/**
+	 * @param policy How jobs are spread
+	 * @param nodes Nodes to place jobs on
+	 */
+	explicit CpuPlacement(Policy policy, std::vector<Node> nodes = topology());
+
+	/**
+	 * @brief NUMA nodes with the CPUs the process may use
+	 * @return Nodes that have any; one node 0 where sysfs has none, and none where CPUs cannot be pinned
+	 */
+	static std::vector<Node> topology();
+
+	/**
+	 * @brief Parse a CPU list as sysfs writes it
+	 * @param list E.g. "0-3,8,10-11"
+	 * @return CPU numbers in ascending order
+	 */
+	static std::vector<int> parseList(const std::string &list);
+
+	/**
+	 * @brief Format CPU numbers as a CPU list
+	 * @param cpus CPU numbers in ascending order
+	 * @return E.g. "0-3,8,10-11"
+	 */
+	static std::string formatList(const std::vector<int> &cpus);
+
+	/// @brief Name of a policy, as the launcher takes it
+	static const char *name(Policy policy);
+
+	/**
+	 * @brief Choose the CPUs of a job that starts
+	 * @param width CPUs the job should get, at most the CPUs of a node
+	 * @return The placement, to be passed to release()
+	 */
+	Slot acquire(unsigned width);
+
+	/// @brief Give the CPUs of a job that finished back
+	void release(const Slot &slot);
+
+	/// @brief Spreading of the jobs
+	Policy policy() const
+	{
+		return m_policy;
+	}
+
+	/// @brief Nodes jobs are placed on
+	const std::vector<Node> &nodes() const
+	{
+		return m_nodes;
+	}
+
+  private:
+	/// @brief Spreading of the jobs
+	Policy m_policy;
+	/// @brief Nodes jobs are placed on
+	std::vector<Node> m_nodes;
+	/// @brief Jobs on every CPU, by node and position in its Cpus
+	std::vector<std::vector<unsigned>> m_users;
+};
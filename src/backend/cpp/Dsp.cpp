@@ -0,0 +1,222 @@
+/**
+ * @file Dsp.cpp
+ * @brief Implementation of the resampler and the ditherer
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Dsp.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+static constexpr double pi = 3.14159265358979323846;
+
+/// @brief Modified Bessel function of the first kind, order 0
+static double besselI0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 64 && term > 1e-12 * sum; ++k)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+/**
+ * @brief Dot product of a filter phase and the input
+ * @param taps Coefficients
+ * @param samples Input
+ * @param count Number of taps, a multiple of 4
+ * @return Filter output
+ */
+static float dotProduct(const float *taps, const float *samples, size_t count)
+{
+#if defined(MU_SIMD_SSE2)
+	__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(samples + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(taps + i + 4), _mm_loadu_ps(samples + i + 4)));
+	}
+	if (i < count)
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(taps + i), _mm_loadu_ps(samples + i)));
+	__m128 sum = _mm_add_ps(sum0, sum1);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+#elif defined(MU_SIMD_NEON)
+	float32x4_t sum0 = vdupq_n_f32(0.0f), sum1 = vdupq_n_f32(0.0f);
+	size_t      i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		sum0 = vmlaq_f32(sum0, vld1q_f32(taps + i), vld1q_f32(samples + i));
+		sum1 = vmlaq_f32(sum1, vld1q_f32(taps + i + 4), vld1q_f32(samples + i + 4));
+	}
+	if (i < count)
+		sum0 = vmlaq_f32(sum0, vld1q_f32(taps + i), vld1q_f32(samples + i));
+	float32x4_t sum = vaddq_f32(sum0, sum1);
+	float32x2_t half = vadd_f32(vget_low_f32(sum), vget_high_f32(sum));
+	return vget_lane_f32(vpadd_f32(half, half), 0);
+#else
+	float sum = 0.0f;
+	for (size_t i = 0; i < count; ++i)
+		sum += taps[i] * samples[i];
+	return sum;
+#endif
+}
+
+Resampler::Resampler(unsigned inputRate, unsigned outputRate)
+{
+	if (inputRate == 0 || outputRate == 0)
+		throw std::runtime_error("Invalid sample rate");
+	unsigned divisor = std::gcd(inputRate, outputRate);
+	m_up = outputRate / divisor;
+	m_down = inputRate / divisor;
+	if (m_up > MaxPhases)
+		throw std::runtime_error("Unsupported sample rate ratio " + std::to_string(inputRate) + " -> " +
+		                         std::to_string(outputRate));
+
+	// Kaiser window design, lengths in input samples
+	const double attenuation = 120.0;
+	const double stop = std::min(inputRate, outputRate) / 2.0;
+	const double pass = stop * 0.91;
+	const double width = 2.0 * pi * (stop - pass) / inputRate;
+	const double beta = 0.1102 * (attenuation - 8.7);
+	m_taps = static_cast<unsigned>(std::ceil((attenuation - 8.0) / (2.285 * width)));
+	m_taps = (m_taps + 3) & ~3u;
+
+	const double cutoff = (pass + stop) / inputRate; // twice the normalized cutoff frequency
+	const double half = m_taps / 2.0;
+	const double norm = besselI0(beta);
+	m_phases.resize(static_cast<size_t>(m_up) * m_taps);
+	for (unsigned p = 0; p < m_up; ++p)
+	{
+		float *phase = m_phases.data() + static_cast<size_t>(p) * m_taps;
+		double sum = 0.0;
+		for (unsigned k = 0; k < m_taps; ++k)
+		{
+			// Distance of tap k from the output instant of phase p
+			double t = static_cast<double>(p) / m_up + half - 1.0 - k;
+			double x = t / half;
+			double window = besselI0(beta * std::sqrt(std::max(0.0, 1.0 - x * x))) / norm;
+			double sinc = t == 0.0 ? 1.0 : std::sin(pi * cutoff * t) / (pi * cutoff * t);
+			double tap = cutoff * sinc * window;
+			phase[k] = static_cast<float>(tap);
+			sum += tap;
+		}
+		// Unity DC gain in every phase keeps the phases from modulating the signal
+		for (unsigned k = 0; k < m_taps; ++k)
+			phase[k] = static_cast<float>(phase[k] / sum);
+	}
+
+	m_buffer.assign(m_taps / 2 - 1, 0.0f);
+}
+
+size_t Resampler::drain(float *output, std::uint64_t limit)
+{
+	size_t written = 0;
+	while (m_produced < limit && m_index + m_taps <= m_buffer.size())
+	{
+		output[written++] = dotProduct(m_phases.data() + static_cast<size_t>(m_phase) * m_taps,
+		                               m_buffer.data() + m_index, m_taps);
+		++m_produced;
+		m_phase += m_down;
+		m_index += m_phase / m_up;
+		m_phase %= m_up;
+	}
+
+	size_t consumed = std::min(m_index, m_buffer.size());
+	m_buffer.erase(m_buffer.begin(), m_buffer.begin() + static_cast<std::ptrdiff_t>(consumed));
+	m_index -= consumed;
+	return written;
+}
+
+size_t Resampler::process(const float *input, size_t count, float *output)
+{
+	m_buffer.insert(m_buffer.end(), input, input + count);
+	m_received += count;
+	return drain(output, std::numeric_limits<std::uint64_t>::max());
+}
+
+size_t Resampler::flush(float *output)
+{
+	m_buffer.insert(m_buffer.end(), m_taps, 0.0f);
+	return drain(output, (m_received * m_up + m_down - 1) / m_down);
+}
+
+Ditherer::Ditherer(unsigned bits, Mode mode, unsigned sampleRate, std::uint32_t seed)
+    : m_scale(std::ldexp(1.0, static_cast<int>(bits) - 1)), m_min(-m_scale), m_max(m_scale - 1.0), m_mode(mode),
+      m_state(seed ? seed : 1)
+{
+	if (mode != Mode::Shaped)
+		return;
+
+	// F-weighted error feedback filter (Wannamaker), designed for 44.1 kHz
+	static constexpr std::array<double, 9> fWeighted = {2.412, -3.370, 3.937, -4.174, 3.353,
+	                                                    -2.205, 1.281, -0.569, 0.0847};
+	if (sampleRate == 44100 || sampleRate == 48000)
+	{
+		m_coefs = fWeighted;
+		m_order = 9;
+	}
+	else
+	{
+		m_coefs[0] = 1.0;
+		m_order = 1;
+	}
+}
+
+double Ditherer::uniform()
+{
+	m_state ^= m_state << 13;
+	m_state ^= m_state >> 17;
+	m_state ^= m_state << 5;
+	return (m_state >> 8) * (1.0 / 16777216.0);
+}
+
+void Ditherer::process(const float *input, size_t count, std::int32_t *output)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		double value = input[i] * m_scale;
+		if (m_order > 0)
+		{
+			// Unused coefficients are zero, so the fixed length unrolls; the newest error goes last as it is
+			// the only term that depends on the previous sample
+			const double *past = m_errors.data() + m_position;
+			for (size_t k = m_coefs.size(); k-- > 0;)
+				value -= m_coefs[k] * past[k];
+		}
+
+		double noise = m_mode == Mode::None ? 0.0 : uniform() - uniform();
+		double quantized = std::clamp(std::floor(value + noise + 0.5), m_min, m_max);
+		if (m_order > 0)
+		{
+			// Clipping would feed back full-scale errors, so keep the error to what dithered rounding produces
+			m_position = m_position == 0 ? static_cast<unsigned>(m_coefs.size()) - 1 : m_position - 1;
+			m_errors[m_position] = m_errors[m_position + m_coefs.size()] = std::clamp(quantized - value, -1.5, 1.5);
+		}
+		output[i] = static_cast<std::int32_t>(quantized);
+	}
+}
@@ -0,0 +1,165 @@
+/**
+ * @file Dsp.h
+ * @brief Sample-rate conversion and dithering between the input and the encoder.
+ *
+ * Resampler is a polyphase windowed-sinc converter for rational ratios whose
+ * inner product runs on SSE2 or NEON. Ditherer requantizes float samples to
+ * 16 or 24-bit integers with triangular (TPDF) dither, optionally with
+ * F-weighted noise shaping. Both run as stages of a DspGraph.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * Resampler resampler(96000, 44100);
+ * std::vector<float> output(resampler.maxOutput(input.size()));
+ * output.resize(resampler.process(input.data(), input.size(), output.data()));
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// @brief Streaming polyphase sample-rate converter for one channel
+class Resampler
+{
+  public:
+	/**
+	 * @brief Design the filter bank
+	 *
+	 * The pass band ends at 91 % of the lower Nyquist frequency, the stop
+	 * band starts at the lower Nyquist frequency and is attenuated by 120 dB.
+	 *
+	 * @param inputRate Input sample rate in Hz
+	 * @param outputRate Output sample rate in Hz
+	 * @throws std::runtime_error if the reduced ratio needs more than MaxPhases phases
+	 */
+	Resampler(unsigned inputRate, unsigned outputRate);
+
+	/**
+	 * @brief Convert the next input samples
+	 * @param input Samples
+	 * @param count Number of samples
+	 * @param output Destination with room for maxOutput(count) samples
+	 * @return Number of samples written
+	 */
+	size_t process(const float *input, size_t count, float *output);
+
+	/**
+	 * @brief Emit the samples still held back by the filter
+	 * @param output Destination with room for maxOutput(0) samples
+	 * @return Number of samples written
+	 */
+	size_t flush(float *output);
+
+	/// @brief Upper bound of the samples produced by count more input samples
+	size_t maxOutput(size_t count) const
+	{
+		return static_cast<size_t>((static_cast<std::uint64_t>(count) + m_taps) * m_up / m_down + 2);
+	}
+
+	/// @brief Taps per phase
+	unsigned taps() const
+	{
+		return m_taps;
+	}
+
+	/// @brief Highest number of filter phases
+	static constexpr unsigned MaxPhases = 4096;
+
+  private:
+	/// @brief Produce every output the buffered input allows
+	size_t drain(float *output, std::uint64_t limit);
+
+	/// @brief Interpolation factor
+	unsigned m_up;
+	/// @brief Decimation factor
+	unsigned m_down;
+	/// @brief Taps per phase, a multiple of 4
+	unsigned m_taps;
+	/// @brief Filter bank, m_up phases of m_taps taps
+	std::vector<float> m_phases;
+	/// @brief Input not yet consumed, starting m_taps / 2 - 1 samples before the next output
+	std::vector<float> m_buffer;
+	/// @brief Buffer index of the next output's first tap
+	size_t m_index = 0;
+	/// @brief Phase of the next output
+	unsigned m_phase = 0;
+	/// @brief Input samples received
+	std::uint64_t m_received = 0;
+	/// @brief Output samples produced
+	std::uint64_t m_produced = 0;
+};
+
+/// @brief Requantizer from float to integer samples for one channel
+class Ditherer
+{
+  public:
+	/// @brief Dither types
+	enum class Mode
+	{
+		/// @brief Plain rounding
+		None,
+		/// @brief Triangular PDF dither of +-1 LSB
+		Triangular,
+		/// @brief Triangular dither with F-weighted noise shaping at 44.1 and 48 kHz, first-order shaping otherwise
+		Shaped
+	};
+
+	/**
+	 * @brief Create a requantizer
+	 * @param bits Output bits per sample
+	 * @param mode Dither type
+	 * @param sampleRate Sample rate, selects the noise shaping filter
+	 * @param seed Seed of the dither noise, so renders are reproducible
+	 */
+	Ditherer(unsigned bits, Mode mode, unsigned sampleRate, std::uint32_t seed);
+
+	/**
+	 * @brief Requantize samples
+	 * @param input Samples in [-1, 1)
+	 * @param count Number of samples
+	 * @param output Integers of the output width, clipped to its range
+	 */
+	void process(const float *input, size_t count, std::int32_t *output);
+
+  private:
+	/// @brief Next uniform random number in [0, 1)
+	double uniform();
+
+	/// @brief Scale from [-1, 1) to the integer range
+	double m_scale;
+	/// @brief Smallest output value
+	double m_min;
+	/// @brief Largest output value
+	double m_max;
+	/// @brief Dither type
+	Mode m_mode;
+	/// @brief Noise shaping filter order
+	unsigned m_order = 0;
+	/// @brief Noise shaping coefficients
+	std::array<double, 9> m_coefs{};
+	/// @brief Past quantization errors, stored twice so the newest nine are contiguous from m_position
+	std::array<double, 18> m_errors{};
+	/// @brief Position of the newest error
+	unsigned m_position = 0;
+	/// @brief Random generator state
+	std::uint32_t m_state;
+};
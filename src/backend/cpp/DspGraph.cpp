@@ -0,0 +1,1098 @@
+/**
+ * @file DspGraph.cpp
+ * @brief Implementation of the DSP graph, its stages and sinks, and the delivery stage
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "DspGraph.h"
+#include "AudioSource.h"
+#include "Loudness.h"
+#include "SpscRing.h"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// @brief Multiplies every sample by a constant
+class GainStage : public DspGraph::Stage
+{
+  public:
+	explicit GainStage(double factor) : m_factor(static_cast<float>(factor))
+	{
+	}
+
+	void prepare(unsigned channels, unsigned) override
+	{
+		m_channels = channels;
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		for (size_t i = 0; i < frames * m_channels; ++i)
+			output[i] = input[i] * m_factor;
+		return frames;
+	}
+
+  private:
+	float    m_factor;
+	unsigned m_channels = 0;
+};
+
+/**
+ * @brief Look-ahead peak limiter
+ *
+ * The gain needed by every frame is held for the look-ahead window (a
+ * sliding minimum), released exponentially and then averaged over the same
+ * window, while the audio is delayed by the window. The average at the time
+ * a frame leaves the delay covers only values at or below the gain that
+ * frame needs, so the output never exceeds the limit and the gain never
+ * jumps.
+ */
+class LimiterStage : public DspGraph::Stage
+{
+  public:
+	LimiterStage(double limit, double attack, double release) : m_limit(limit), m_attack(attack), m_release(release)
+	{
+	}
+
+	void prepare(unsigned channels, unsigned sampleRate) override
+	{
+		m_channels = channels;
+		m_window = std::max<size_t>(1, static_cast<size_t>(std::lround(m_attack * sampleRate / 1000.0)));
+		m_releaseCoef = 1.0 - std::exp(-1000.0 / (std::max(m_release, 0.01) * sampleRate));
+		m_delay.assign(m_window * channels, 0.0f);
+		m_gains.assign(m_window, 1.0);
+		m_sum = static_cast<double>(m_window);
+		m_gain = 1.0;
+		m_received = 0;
+		m_minimum.clear();
+	}
+
+	size_t maxOutput(size_t frames) const override
+	{
+		return frames + m_window;
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		size_t written = 0;
+		for (size_t i = 0; i < frames; ++i)
+			written += step(input + i * m_channels, output + written * m_channels);
+		return written;
+	}
+
+	size_t flush(float *output) override
+	{
+		std::vector<float> silence(m_channels, 0.0f);
+		size_t             written = 0;
+		for (size_t i = 0; i + 1 < m_window; ++i)
+			written += step(silence.data(), output + written * m_channels);
+		return written;
+	}
+
+  private:
+	/// @brief Take one frame, emit the frame leaving the delay if there is one
+	size_t step(const float *frame, float *output)
+	{
+		float peak = 0.0f;
+		for (unsigned c = 0; c < m_channels; ++c)
+			peak = std::max(peak, std::abs(frame[c]));
+		double needed = peak > m_limit ? m_limit / peak : 1.0;
+
+		// Sliding minimum of the needed gain over the window
+		while (!m_minimum.empty() && m_minimum.back().second >= needed)
+			m_minimum.pop_back();
+		m_minimum.emplace_back(m_received, needed);
+		if (m_minimum.front().first + m_window <= m_received)
+			m_minimum.pop_front();
+
+		m_gain = std::min(m_minimum.front().second, m_gain + (1.0 - m_gain) * m_releaseCoef);
+		size_t slot = m_received % m_window;
+		m_sum += m_gain - m_gains[slot];
+		m_gains[slot] = m_gain;
+
+		std::copy_n(frame, m_channels, m_delay.data() + slot * m_channels);
+		++m_received;
+		if (m_received < m_window)
+			return 0;
+
+		// The oldest frame is the one after the slot just written
+		const float *oldest = m_delay.data() + (m_received % m_window) * m_channels;
+		float        gain = static_cast<float>(std::min(1.0, m_sum / static_cast<double>(m_window)));
+		for (unsigned c = 0; c < m_channels; ++c)
+			output[c] = oldest[c] * gain;
+		return 1;
+	}
+
+	double   m_limit, m_attack, m_release;
+	double   m_releaseCoef = 0.0;
+	unsigned m_channels = 0;
+	/// @brief Look-ahead in frames
+	size_t m_window = 1;
+	/// @brief Frames received
+	size_t m_received = 0;
+	/// @brief Delayed audio, m_window frames
+	std::vector<float> m_delay;
+	/// @brief Released gains of the window and their sum
+	std::vector<double> m_gains;
+	double              m_sum = 0.0;
+	/// @brief Gain after release
+	double m_gain = 1.0;
+	/// @brief Candidates for the sliding minimum: frame index, needed gain
+	std::deque<std::pair<size_t, double>> m_minimum;
+};
+
+/// @brief Linear fade in or out
+class FadeStage : public DspGraph::Stage
+{
+  public:
+	FadeStage(bool fadeIn, double start, double duration) : m_fadeIn(fadeIn), m_start(start), m_duration(duration)
+	{
+	}
+
+	void prepare(unsigned channels, unsigned sampleRate) override
+	{
+		m_channels = channels;
+		m_sampleRate = sampleRate;
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		for (size_t i = 0; i < frames; ++i, ++m_position)
+		{
+			double t = static_cast<double>(m_position) / m_sampleRate - m_start;
+			double ramp = m_duration > 0.0 ? std::clamp(t / m_duration, 0.0, 1.0) : (t >= 0.0 ? 1.0 : 0.0);
+			float  gain = static_cast<float>(m_fadeIn ? ramp : 1.0 - ramp);
+			for (unsigned c = 0; c < m_channels; ++c)
+				output[i * m_channels + c] = input[i * m_channels + c] * gain;
+		}
+		return frames;
+	}
+
+  private:
+	bool          m_fadeIn;
+	double        m_start, m_duration;
+	unsigned      m_channels = 0, m_sampleRate = 0;
+	std::uint64_t m_position = 0;
+};
+
+/// @brief Passes audio through and prints its loudness at the end
+class MeterStage : public DspGraph::Stage
+{
+  public:
+	void prepare(unsigned channels, unsigned sampleRate) override
+	{
+		m_channels = channels;
+		m_meter = std::make_unique<LoudnessMeter>(channels, sampleRate);
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		std::copy_n(input, frames * m_channels, output);
+		m_planes.resize(m_channels);
+		std::vector<const float *> pointers(m_channels);
+		for (unsigned c = 0; c < m_channels; ++c)
+		{
+			m_planes[c].resize(frames);
+			for (size_t i = 0; i < frames; ++i)
+				m_planes[c][i] = input[i * m_channels + c];
+			pointers[c] = m_planes[c].data();
+		}
+		m_meter->process(pointers.data(), frames);
+		return frames;
+	}
+
+	size_t flush(float *) override
+	{
+		LoudnessMeter::Result result = m_meter->result();
+		std::cout << "  Loudness: " << std::fixed << std::setprecision(1) << result.Integrated << " LUFS, range "
+		          << result.Range << " LU, true peak " << result.TruePeak << " dBTP" << std::defaultfloat << std::endl;
+		return 0;
+	}
+
+  private:
+	unsigned                        m_channels = 0;
+	std::unique_ptr<LoudnessMeter>  m_meter;
+	std::vector<std::vector<float>> m_planes;
+};
+
+/// @brief Sample-rate conversion, one Resampler per channel
+class ResampleStage : public DspGraph::Stage
+{
+  public:
+	ResampleStage(unsigned outputRate, ThreadPool &pool) : m_outputRate(outputRate), m_pool(pool)
+	{
+	}
+
+	void prepare(unsigned channels, unsigned sampleRate) override
+	{
+		m_resamplers.clear();
+		for (unsigned c = 0; c < channels; ++c)
+			m_resamplers.emplace_back(sampleRate, m_outputRate);
+		m_in.assign(channels, {});
+		m_out.assign(channels, {});
+		m_produced.assign(channels, 0);
+	}
+
+	unsigned outputRate(unsigned) const override
+	{
+		return m_outputRate;
+	}
+
+	size_t maxOutput(size_t frames) const override
+	{
+		return m_resamplers.front().maxOutput(frames);
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		return convert(input, frames, output, false);
+	}
+
+	size_t flush(float *output) override
+	{
+		return convert(nullptr, 0, output, true);
+	}
+
+  private:
+	/// @brief Deinterleave, convert the channels in parallel, interleave
+	size_t convert(const float *input, size_t frames, float *output, bool last)
+	{
+		const size_t channels = m_resamplers.size();
+		m_pool.parallelFor(channels, [&](size_t c) {
+			m_in[c].resize(frames);
+			for (size_t i = 0; i < frames; ++i)
+				m_in[c][i] = input[i * channels + c];
+			m_out[c].resize(m_resamplers[c].maxOutput(frames));
+			m_produced[c] = last ? m_resamplers[c].flush(m_out[c].data())
+			                     : m_resamplers[c].process(m_in[c].data(), frames, m_out[c].data());
+		});
+		for (size_t i = 0; i < m_produced[0]; ++i)
+			for (size_t c = 0; c < channels; ++c)
+				output[i * channels + c] = m_out[c][i];
+		return m_produced[0];
+	}
+
+	unsigned                        m_outputRate;
+	ThreadPool                     &m_pool;
+	std::vector<Resampler>          m_resamplers;
+	std::vector<std::vector<float>> m_in, m_out;
+	std::vector<size_t>             m_produced;
+};
+
+/// @brief Requantization, one Ditherer per channel
+class DitherStage : public DspGraph::Stage
+{
+  public:
+	DitherStage(unsigned bits, Ditherer::Mode mode) : m_bits(bits), m_mode(mode)
+	{
+	}
+
+	void prepare(unsigned channels, unsigned sampleRate) override
+	{
+		m_ditherers.clear();
+		for (unsigned c = 0; c < channels; ++c)
+			m_ditherers.emplace_back(m_bits, m_mode, sampleRate, 0x9E3779B9u * (c + 1));
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		const size_t channels = m_ditherers.size();
+		const float  scale = 1.0f / static_cast<float>(1u << (m_bits - 1));
+		m_plane.resize(frames);
+		m_quantized.resize(frames);
+		for (size_t c = 0; c < channels; ++c)
+		{
+			for (size_t i = 0; i < frames; ++i)
+				m_plane[i] = input[i * channels + c];
+			m_ditherers[c].process(m_plane.data(), frames, m_quantized.data());
+			for (size_t i = 0; i < frames; ++i)
+				output[i * channels + c] = static_cast<float>(m_quantized[i]) * scale;
+		}
+		return frames;
+	}
+
+  private:
+	unsigned                  m_bits;
+	Ditherer::Mode            m_mode;
+	std::vector<Ditherer>     m_ditherers;
+	std::vector<float>        m_plane;
+	std::vector<std::int32_t> m_quantized;
+};
+
+/**
+ * @brief Convert float samples to little-endian integers
+ * @param samples Samples in [-1, 1)
+ * @param count Number of samples
+ * @param bits 16 or 24
+ * @param bytes Destination, resized
+ */
+static void toPcm(const float *samples, size_t count, unsigned bits, std::vector<char> &bytes)
+{
+	const unsigned width = bits / 8;
+	const double   scale = static_cast<double>(1u << (bits - 1));
+	bytes.resize(count * width);
+	char *p = bytes.data();
+	for (size_t i = 0; i < count; ++i)
+	{
+		auto value = static_cast<std::int32_t>(std::lrint(std::clamp(samples[i] * scale, -scale, scale - 1.0)));
+		for (unsigned b = 0; b < width; ++b)
+			*p++ = static_cast<char>(value >> (8 * b));
+	}
+}
+
+/// @brief Header of a PCM WAV file
+static std::string wavHeader(unsigned channels, unsigned sampleRate, unsigned bits, std::uint64_t dataSize)
+{
+	auto le = [](std::string &out, std::uint32_t value, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			out += static_cast<char>((value >> (8 * i)) & 0xFF);
+	};
+
+	const unsigned blockAlign = channels * bits / 8;
+	std::string    header = "RIFF";
+	le(header, static_cast<std::uint32_t>(dataSize + 36), 4);
+	header += "WAVEfmt ";
+	le(header, 16, 4);
+	le(header, 1, 2); // PCM
+	le(header, channels, 2);
+	le(header, sampleRate, 4);
+	le(header, sampleRate * blockAlign, 4);
+	le(header, blockAlign, 2);
+	le(header, bits, 2);
+	header += "data";
+	le(header, static_cast<std::uint32_t>(dataSize), 4);
+	return header;
+}
+
+DspGraph::WavSink::WavSink(std::filesystem::path filePath, unsigned bits)
+    : m_filePath(std::move(filePath)), m_bits(bits)
+{
+}
+
+void DspGraph::WavSink::open(unsigned channels, unsigned sampleRate)
+{
+	m_channels = channels;
+	m_sampleRate = sampleRate;
+	m_file.open(m_filePath, std::ios::binary | std::ios::trunc);
+	if (!m_file)
+		throw std::runtime_error("Failed to open " + m_filePath.string());
+	std::string header = wavHeader(channels, sampleRate, m_bits, 0);
+	m_file.write(header.data(), static_cast<std::streamsize>(header.size()));
+}
+
+void DspGraph::WavSink::write(const float *frames, size_t count)
+{
+	toPcm(frames, count * m_channels, m_bits, m_bytes);
+	m_file.write(m_bytes.data(), static_cast<std::streamsize>(m_bytes.size()));
+	m_dataSize += m_bytes.size();
+}
+
+void DspGraph::WavSink::close()
+{
+	if (m_dataSize > 0xFFFFFFFFull - 36)
+		throw std::runtime_error("Rendered audio exceeds the WAV size limit: " + m_filePath.string());
+	std::string header = wavHeader(m_channels, m_sampleRate, m_bits, m_dataSize);
+	m_file.seekp(0);
+	m_file.write(header.data(), static_cast<std::streamsize>(header.size()));
+	m_file.close();
+	if (!m_file)
+		throw std::runtime_error("Failed to write " + m_filePath.string());
+}
+
+DspGraph::PipeSink::PipeSink(std::string before, std::string after, unsigned bits)
+    : m_before(std::move(before)), m_after(std::move(after)), m_bits(bits)
+{
+}
+
+DspGraph::PipeSink::~PipeSink()
+{
+	Subprocess::SigPipeGuard guard;
+	m_encoder.reset();
+}
+
+void DspGraph::PipeSink::open(unsigned channels, unsigned sampleRate)
+{
+	m_channels = channels;
+	std::string command = m_before + "-f s" + std::to_string(m_bits) + "le -ar " + std::to_string(sampleRate) +
+	                      " -ac " + std::to_string(channels) + " -i pipe:0 " + m_after;
+	m_encoder = std::make_unique<Subprocess>(command, Subprocess::Mode::Write);
+}
+
+void DspGraph::PipeSink::write(const float *frames, size_t count)
+{
+	// A failing encoder has to surface as a write error, not kill the process
+	Subprocess::SigPipeGuard guard;
+	toPcm(frames, count * m_channels, m_bits, m_bytes);
+	if (std::fwrite(m_bytes.data(), 1, m_bytes.size(), m_encoder->stream()) != m_bytes.size())
+		throw std::runtime_error("The encoder stopped reading its input");
+}
+
+void DspGraph::PipeSink::close()
+{
+	Subprocess::SigPipeGuard guard;
+	m_status = m_encoder->close();
+	m_encoder.reset();
+}
+
+/// @brief Bytes handed to the encoders at once, at most one pipe buffer so tee() never copies part of it
+static constexpr size_t fanOutChunk = 4096;
+
+DspGraph::FanOutSink::FanOutSink(std::vector<std::pair<std::string, std::string>> commands, unsigned bits)
+    : m_commands(std::move(commands)), m_bits(bits)
+{
+}
+
+DspGraph::FanOutSink::~FanOutSink()
+{
+	Subprocess::SigPipeGuard guard;
+	closeSource();
+	m_encoders.clear();
+}
+
+void DspGraph::FanOutSink::open(unsigned channels, unsigned sampleRate)
+{
+	m_channels = channels;
+	for (const auto &[before, after] : m_commands)
+	{
+		std::string command = before + "-f s" + std::to_string(m_bits) + "le -ar " + std::to_string(sampleRate) +
+		                      " -ac " + std::to_string(channels) + " -i pipe:0 " + after;
+		m_encoders.push_back(std::make_unique<Subprocess>(command, Subprocess::Mode::Write));
+	}
+	m_reading.assign(m_encoders.size(), true);
+
+#ifdef __linux__
+	// Larger encoder pipes let a fast encoder run ahead of a slow one for a while; the kernel may refuse
+	if (pipe2(m_source, O_CLOEXEC) != 0)
+		m_source[0] = m_source[1] = -1;
+	for (const auto &encoder : m_encoders)
+		fcntl(fileno(encoder->stream()), F_SETPIPE_SZ, 1 << 20);
+#endif
+}
+
+void DspGraph::FanOutSink::write(const float *frames, size_t count)
+{
+	// Encoders that exit early are dropped, see PipeSink::write()
+	Subprocess::SigPipeGuard guard;
+	toPcm(frames, count * m_channels, m_bits, m_bytes);
+	if (m_source[1] >= 0)
+	{
+		writeSpliced();
+		return;
+	}
+
+	bool reading = false;
+	for (size_t i = 0; i < m_encoders.size(); ++i)
+	{
+		if (m_reading[i] &&
+		    std::fwrite(m_bytes.data(), 1, m_bytes.size(), m_encoders[i]->stream()) != m_bytes.size())
+			m_reading[i] = false;
+		reading = reading || m_reading[i];
+	}
+	if (!reading)
+		throw std::runtime_error("The encoders stopped reading their input");
+}
+
+void DspGraph::FanOutSink::writeSpliced()
+{
+#ifdef __linux__
+	for (size_t done = 0; done < m_bytes.size();)
+	{
+		// Write the chunk once, give every encoder but the last a reference with tee() and move it to the last
+		// one with splice(), which empties the source pipe for the next chunk
+		const size_t chunk = std::min(fanOutChunk, m_bytes.size() - done);
+		for (size_t written = 0; written < chunk;)
+		{
+			ssize_t result = ::write(m_source[1], m_bytes.data() + done + written, chunk - written);
+			if (result < 0 && errno != EINTR)
+				throw std::runtime_error("Failed to write the encoder input");
+			written += result > 0 ? static_cast<size_t>(result) : 0;
+		}
+
+		size_t last = m_encoders.size();
+		while (last > 0 && !m_reading[last - 1])
+			--last;
+		if (last == 0)
+			throw std::runtime_error("The encoders stopped reading their input");
+		--last;
+		for (size_t i = 0; i < last; ++i)
+		{
+			if (!m_reading[i])
+				continue;
+			ssize_t result;
+			do
+				result = tee(m_source[0], fileno(m_encoders[i]->stream()), chunk, 0);
+			while (result < 0 && errno == EINTR);
+			if (result < 0 && errno == EPIPE)
+				m_reading[i] = false;
+			else if (result != static_cast<ssize_t>(chunk))
+				throw std::runtime_error("Failed to pass the input to the encoders");
+		}
+
+		size_t moved = 0;
+		while (moved < chunk)
+		{
+			ssize_t result =
+			    splice(m_source[0], nullptr, fileno(m_encoders[last]->stream()), nullptr, chunk - moved, 0);
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+			{
+				if (result < 0 && errno != EPIPE)
+					throw std::runtime_error("Failed to pass the input to the encoders");
+				m_reading[last] = false;
+				break;
+			}
+			moved += static_cast<size_t>(result);
+		}
+		// The last encoder is gone, the rest of the chunk has reached the others already
+		char discard[fanOutChunk];
+		while (moved < chunk)
+		{
+			ssize_t result = read(m_source[0], discard, chunk - moved);
+			if (result < 0 && errno != EINTR)
+				throw std::runtime_error("Failed to pass the input to the encoders");
+			moved += result > 0 ? static_cast<size_t>(result) : 0;
+		}
+		done += chunk;
+	}
+	if (std::find(m_reading.begin(), m_reading.end(), true) == m_reading.end())
+		throw std::runtime_error("The encoders stopped reading their input");
+#endif
+}
+
+void DspGraph::FanOutSink::closeSource()
+{
+#ifdef __linux__
+	for (int &fd : m_source)
+	{
+		if (fd >= 0)
+			::close(fd);
+		fd = -1;
+	}
+#endif
+}
+
+void DspGraph::FanOutSink::close()
+{
+	Subprocess::SigPipeGuard guard;
+	closeSource();
+	m_status.clear();
+	for (const auto &encoder : m_encoders)
+		m_status.push_back(encoder->close());
+	m_encoders.clear();
+}
+
+void DspGraph::add(std::unique_ptr<Stage> stage)
+{
+	m_stages.push_back(std::move(stage));
+}
+
+/**
+ * @brief Parse a filter option value
+ * @param text Number, with a "dB" suffix if @p decibels
+ * @param decibels Allow decibels, converted to a linear factor
+ * @return Value
+ * @throws std::runtime_error if @p text is not a plain number (e.g. an ffmpeg expression)
+ */
+static double filterNumber(const std::string &text, bool decibels = false)
+{
+	std::string_view number = text;
+	bool             db = decibels && number.size() > 2 && number.substr(number.size() - 2) == "dB";
+	if (db)
+		number.remove_suffix(2);
+	double value;
+	auto [end, ec] = std::from_chars(number.data(), number.data() + number.size(), value);
+	if (ec != std::errc() || end != number.data() + number.size())
+		throw std::runtime_error("Unsupported filter value: " + text);
+	return db ? std::pow(10.0, value / 20.0) : value;
+}
+
+void DspGraph::addFilters(const std::string &filters)
+{
+	std::vector<std::unique_ptr<Stage>> stages;
+	std::istringstream                  chain(filters);
+	for (std::string filter; std::getline(chain, filter, ',');)
+	{
+		size_t      equals = filter.find('=');
+		std::string name = filter.substr(0, equals);
+
+		// Options are key=value pairs separated by ':', a value without a key is the first option
+		std::vector<std::pair<std::string, std::string>> options;
+		if (equals != std::string::npos)
+		{
+			std::istringstream list(filter.substr(equals + 1));
+			for (std::string option; std::getline(list, option, ':');)
+			{
+				size_t split = option.find('=');
+				if (split == std::string::npos)
+				{
+					if (!options.empty())
+						throw std::runtime_error("Unsupported positional option in filter: " + filter);
+					options.emplace_back("", option);
+				}
+				else
+					options.emplace_back(option.substr(0, split), option.substr(split + 1));
+			}
+		}
+		auto unsupported = [&filter]() -> std::runtime_error {
+			return std::runtime_error("Unsupported filter: " + filter);
+		};
+
+		if (name == "volume")
+		{
+			double factor = 1.0;
+			for (const auto &[key, value] : options)
+			{
+				if (key != "" && key != "volume")
+					throw unsupported();
+				factor = filterNumber(value, true);
+			}
+			stages.push_back(gain(factor));
+		}
+		else if (name == "alimiter")
+		{
+			// Same defaults as ffmpeg, including the make-up gain back to 0 dBFS
+			double levelIn = 1.0, levelOut = 1.0, limit = 1.0, attack = 5.0, release = 50.0;
+			bool   autoLevel = true;
+			for (const auto &[key, value] : options)
+			{
+				if (key == "level_in")
+					levelIn = filterNumber(value, true);
+				else if (key == "level_out")
+					levelOut = filterNumber(value, true);
+				else if (key == "limit")
+					limit = filterNumber(value, true);
+				else if (key == "attack")
+					attack = filterNumber(value);
+				else if (key == "release")
+					release = filterNumber(value);
+				else if (key == "level" && (value == "0" || value == "false" || value == "disabled"))
+					autoLevel = false;
+				else if (key == "level" && (value == "1" || value == "true" || value == "enabled"))
+					autoLevel = true;
+				else
+					throw unsupported();
+			}
+			if (limit <= 0.0 || attack <= 0.0 || release <= 0.0)
+				throw unsupported();
+			if (levelIn != 1.0)
+				stages.push_back(gain(levelIn));
+			stages.push_back(limiter(limit, attack, release));
+			if ((autoLevel ? levelOut / limit : levelOut) != 1.0)
+				stages.push_back(gain(autoLevel ? levelOut / limit : levelOut));
+		}
+		else if (name == "afade")
+		{
+			bool   fadeIn = true;
+			double start = 0.0, duration = 1.0;
+			for (const auto &[key, value] : options)
+			{
+				if ((key == "t" || key == "type" || key == "") && (value == "in" || value == "out"))
+					fadeIn = value == "in";
+				else if (key == "st" || key == "start_time")
+					start = filterNumber(value);
+				else if (key == "d" || key == "duration")
+					duration = filterNumber(value);
+				else if ((key == "c" || key == "curve") && value == "tri")
+					continue;
+				else
+					throw unsupported();
+			}
+			stages.push_back(fade(fadeIn, start, duration));
+		}
+		else if (name == "ebur128")
+			stages.push_back(meter()); // Its options only select what ffmpeg logs
+		else
+			throw unsupported();
+	}
+
+	for (auto &stage : stages)
+		m_stages.push_back(std::move(stage));
+}
+
+bool DspGraph::supports(const std::string &filters)
+{
+	try
+	{
+		DspGraph graph;
+		graph.addFilters(filters);
+		return true;
+	}
+	catch (const std::exception &)
+	{
+		return false;
+	}
+}
+
+void DspGraph::run(AudioSource &source, Sink &sink, const Settings &settings)
+{
+	const unsigned channels = source.channels();
+	const size_t   block = std::max<size_t>(settings.BlockSize, 64);
+
+	// A stage takes a block from its ring, or whatever its predecessor produced when not threaded
+	unsigned                        rate = source.sampleRate();
+	size_t                          frames = block;
+	std::vector<std::vector<float>> outputs(m_stages.size());
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		m_stages[i]->prepare(channels, rate);
+		rate = m_stages[i]->outputRate(rate);
+		frames = std::max(m_stages[i]->maxOutput(std::max(frames, block)), m_stages[i]->maxOutput(0));
+		outputs[i].resize(frames * channels);
+	}
+	sink.open(channels, rate);
+
+	std::vector<std::vector<float>> planes(channels, std::vector<float>(block));
+	std::vector<float *>            planePointers;
+	for (auto &plane : planes)
+		planePointers.push_back(plane.data());
+	std::vector<float> interleaved(block * channels);
+	auto readSource = [&]() -> size_t {
+		size_t count = source.read(planePointers.data(), block);
+		for (size_t i = 0; i < count; ++i)
+			for (unsigned c = 0; c < channels; ++c)
+				interleaved[i * channels + c] = planes[c][i];
+		return count;
+	};
+
+	if (!settings.Threaded)
+	{
+		auto feed = [&](size_t first, const float *data, size_t count) {
+			for (size_t i = first; i < m_stages.size() && count > 0; ++i)
+			{
+				count = m_stages[i]->process(data, count, outputs[i].data());
+				data = outputs[i].data();
+			}
+			if (count > 0)
+				sink.write(data, count);
+		};
+		for (size_t count; (count = readSource()) > 0;)
+			feed(0, interleaved.data(), count);
+		for (size_t i = 0; i < m_stages.size(); ++i)
+			feed(i + 1, outputs[i].data(), m_stages[i]->flush(outputs[i].data()));
+		sink.close();
+		return;
+	}
+
+	// rings[i] feeds stage i, the last ring feeds the sink
+	std::vector<std::unique_ptr<SpscRing<float>>> rings;
+	for (size_t i = 0; i <= m_stages.size(); ++i)
+		rings.push_back(std::make_unique<SpscRing<float>>(std::max<size_t>(settings.RingBlocks, 2) * block * channels));
+
+	std::mutex         errorMutex;
+	std::exception_ptr error;
+	auto               fail = [&]() {
+		std::lock_guard lock(errorMutex);
+		if (!error)
+			error = std::current_exception();
+		for (auto &ring : rings)
+			ring->cancel();
+	};
+
+	std::vector<std::thread> threads;
+	threads.emplace_back([&]() {
+		try
+		{
+			for (size_t count; (count = readSource()) > 0;)
+				if (!rings[0]->write(interleaved.data(), count * channels))
+					break;
+		}
+		catch (...)
+		{
+			fail();
+		}
+		rings[0]->close();
+	});
+	for (size_t i = 0; i < m_stages.size(); ++i)
+	{
+		threads.emplace_back([&, i]() {
+			try
+			{
+				Stage             &stage = *m_stages[i];
+				std::vector<float> input(block * channels);
+				for (size_t count; (count = rings[i]->read(input.data(), input.size(), channels)) > 0;)
+				{
+					size_t produced = stage.process(input.data(), count / channels, outputs[i].data());
+					if (!rings[i + 1]->write(outputs[i].data(), produced * channels))
+						break;
+				}
+				size_t produced = stage.flush(outputs[i].data());
+				rings[i + 1]->write(outputs[i].data(), produced * channels);
+			}
+			catch (...)
+			{
+				fail();
+			}
+			rings[i + 1]->close();
+		});
+	}
+
+	try
+	{
+		std::vector<float> input(block * channels);
+		for (size_t count; (count = rings.back()->read(input.data(), input.size(), channels)) > 0;)
+			sink.write(input.data(), count / channels);
+	}
+	catch (...)
+	{
+		fail();
+	}
+	for (auto &thread : threads)
+		thread.join();
+	if (error)
+		std::rethrow_exception(error);
+	sink.close();
+}
+
+std::unique_ptr<DspGraph::Stage> DspGraph::gain(double factor)
+{
+	return std::make_unique<GainStage>(factor);
+}
+
+std::unique_ptr<DspGraph::Stage> DspGraph::limiter(double limit, double attack, double release)
+{
+	return std::make_unique<LimiterStage>(limit, attack, release);
+}
+
+std::unique_ptr<DspGraph::Stage> DspGraph::fade(bool fadeIn, double start, double duration)
+{
+	return std::make_unique<FadeStage>(fadeIn, start, duration);
+}
+
+std::unique_ptr<DspGraph::Stage> DspGraph::meter()
+{
+	return std::make_unique<MeterStage>();
+}
+
+std::unique_ptr<DspGraph::Stage> DspGraph::resample(unsigned outputRate, ThreadPool &pool)
+{
+	return std::make_unique<ResampleStage>(outputRate, pool);
+}
+
+std::unique_ptr<DspGraph::Stage> DspGraph::dither(unsigned bits, Ditherer::Mode mode)
+{
+	return std::make_unique<DitherStage>(bits, mode);
+}
+
+/**
+ * @brief Build the graph of a delivery format: resampler, filters, dither
+ * @param graph Empty graph
+ * @param source Opened input
+ * @param format Delivery format
+ * @param pool Workers for the resampler
+ * @param unchanged Set if the input is an integer PCM WAV file in the delivery format without filters
+ * @return Output bits per sample
+ */
+static unsigned buildDelivery(DspGraph &graph, const AudioSource &source, const DspStage::Format &format,
+                              ThreadPool &pool, bool &unchanged)
+{
+	const unsigned inputRate = source.sampleRate();
+	const unsigned rate = format.SampleRate ? format.SampleRate : inputRate;
+
+	unsigned sourceBits = 0;
+	if (source.isNative())
+	{
+		using SampleFormat = WavReader::SampleFormat;
+		SampleFormat sampleFormat = source.wav().format();
+		if (sampleFormat != SampleFormat::Float32 && sampleFormat != SampleFormat::Float64)
+			sourceBits = WavReader::bytesPerSample(sampleFormat) * 8;
+	}
+	const unsigned bits = format.Bits ? format.Bits : (sourceBits == 8 || sourceBits == 16 ? 16 : 24);
+	if (bits != 16 && bits != 24)
+		throw std::runtime_error("Unsupported output bit depth: " + std::to_string(bits));
+
+	unchanged = rate == inputRate && bits == sourceBits && format.Filters.empty();
+	if (rate != inputRate)
+		graph.add(DspGraph::resample(rate, pool));
+	if (!format.Filters.empty())
+		graph.addFilters(format.Filters);
+	graph.add(DspGraph::dither(bits, format.Dither));
+	return bits;
+}
+
+/// @brief Writes the frames of each track to its own WAV file
+class SplitSink : public DspGraph::Sink
+{
+  public:
+	SplitSink(std::vector<DspStage::Track> &tracks, unsigned bits) : m_tracks(tracks), m_bits(bits)
+	{
+	}
+
+	void open(unsigned channels, unsigned sampleRate) override
+	{
+		m_channels = channels;
+		m_sampleRate = sampleRate;
+		auto frame = [sampleRate](double seconds) {
+			return static_cast<std::uint64_t>(std::llround(std::max(seconds, 0.0) * sampleRate));
+		};
+
+		m_first.clear();
+		m_last.clear();
+		for (const auto &track : m_tracks)
+			m_first.push_back(frame(track.Start));
+		for (size_t i = 0; i < m_tracks.size(); ++i)
+		{
+			m_last.push_back(m_tracks[i].End < 0.0 ? std::numeric_limits<std::uint64_t>::max()
+			                                       : frame(m_tracks[i].End));
+			if (m_last[i] <= m_first[i])
+				throw std::runtime_error("Track ends before it starts: " + m_tracks[i].Output.string());
+			m_tracks[i].Frames = 0;
+		}
+		m_sinks.clear();
+		m_sinks.resize(m_tracks.size());
+		m_position = 0;
+	}
+
+	void write(const float *frames, size_t count) override
+	{
+		const std::uint64_t end = m_position + count;
+		for (size_t i = 0; i < m_tracks.size(); ++i)
+		{
+			std::uint64_t from = std::max(m_first[i], m_position), to = std::min(m_last[i], end);
+			if (from >= to)
+				continue;
+			if (!m_sinks[i])
+			{
+				m_sinks[i] = std::make_unique<DspGraph::WavSink>(m_tracks[i].Output, m_bits);
+				m_sinks[i]->open(m_channels, m_sampleRate);
+			}
+			m_sinks[i]->write(frames + (from - m_position) * m_channels, static_cast<size_t>(to - from));
+			m_tracks[i].Frames += to - from;
+			// Finished tracks are closed right away, so only overlapping tracks are open at once
+			if (to == m_last[i])
+				m_sinks[i]->close();
+		}
+		m_position = end;
+	}
+
+	void close() override
+	{
+		for (size_t i = 0; i < m_tracks.size(); ++i)
+		{
+			if (!m_sinks[i])
+				throw std::runtime_error("Track starts after the end of the input: " + m_tracks[i].Output.string());
+			if (m_first[i] + m_tracks[i].Frames == m_last[i])
+				continue;
+			m_sinks[i]->close();
+			if (m_last[i] != std::numeric_limits<std::uint64_t>::max())
+				std::cerr << "  Track ends after the end of the input: " << m_tracks[i].Output.string() << std::endl;
+		}
+	}
+
+  private:
+	/// @brief Tracks
+	std::vector<DspStage::Track> &m_tracks;
+	/// @brief Bits per sample
+	unsigned m_bits;
+	/// @brief Number of channels
+	unsigned m_channels = 0;
+	/// @brief Sample rate
+	unsigned m_sampleRate = 0;
+	/// @brief First frame of each track
+	std::vector<std::uint64_t> m_first;
+	/// @brief Frame behind the end of each track
+	std::vector<std::uint64_t> m_last;
+	/// @brief Output of each track, created when the track starts
+	std::vector<std::unique_ptr<DspGraph::WavSink>> m_sinks;
+	/// @brief Frames received
+	std::uint64_t m_position = 0;
+};
+
+bool DspStage::render(const std::filesystem::path &input, const std::filesystem::path &output, const Format &format,
+                      ThreadPool &pool, const DspGraph::Settings &settings)
+{
+	AudioSource source;
+	source.open(input);
+	DspGraph graph;
+	bool     unchanged;
+	unsigned bits = buildDelivery(graph, source, format, pool, unchanged);
+	if (unchanged)
+		return false;
+
+	DspGraph::WavSink sink(output, bits);
+	graph.run(source, sink, settings);
+	return true;
+}
+
+int DspStage::stream(const std::filesystem::path &input, const std::string &before, const std::string &after,
+                     const Format &format, ThreadPool &pool, const DspGraph::Settings &settings,
+                     std::unique_ptr<DspGraph::Stage> tap)
+{
+	AudioSource source;
+	source.open(input);
+	DspGraph graph;
+	bool     unchanged;
+	unsigned bits = buildDelivery(graph, source, format, pool, unchanged);
+	if (tap)
+		graph.add(std::move(tap));
+
+	DspGraph::PipeSink sink(before, after, bits);
+	graph.run(source, sink, settings);
+	return sink.status();
+}
+
+std::vector<int> DspStage::fanOut(const std::filesystem::path                           &input,
+                                  const std::vector<std::pair<std::string, std::string>> &commands,
+                                  const Format &format, ThreadPool &pool, const DspGraph::Settings &settings,
+                                  std::unique_ptr<DspGraph::Stage> tap)
+{
+	AudioSource source;
+	source.open(input);
+	DspGraph graph;
+	bool     unchanged;
+	unsigned bits = buildDelivery(graph, source, format, pool, unchanged);
+
+	// As in split(), integer PCM in the delivery format goes to the encoders as it is
+	DspGraph  passThrough;
+	DspGraph &used = unchanged ? passThrough : graph;
+	if (tap)
+		used.add(std::move(tap));
+
+	DspGraph::FanOutSink sink(commands, bits);
+	used.run(source, sink, settings);
+	return sink.status();
+}
+
+void DspStage::split(const std::filesystem::path &input, std::vector<Track> &tracks, const Format &format,
+                     ThreadPool &pool, const DspGraph::Settings &settings)
+{
+	AudioSource source;
+	source.open(input);
+	DspGraph graph;
+	bool     unchanged;
+	unsigned bits = buildDelivery(graph, source, format, pool, unchanged);
+
+	// Dither would touch samples that are on the integer grid already, so such inputs are only cut
+	DspGraph  passThrough;
+	SplitSink sink(tracks, bits);
+	(unchanged ? passThrough : graph).run(source, sink, settings);
+}
@@ -0,0 +1,432 @@
+/**
+ * @file DspGraph.h
+ * @brief Streaming chain of DSP stages between the decoder and the encoder.
+ *
+ * A graph is a source, a list of stages and a sink. Audio moves through it
+ * in interleaved float blocks. In threaded mode the source, every stage and
+ * the sink run on their own threads, connected by lock-free SPSC rings
+ * (SpscRing), so a chain runs as fast as its slowest stage. The sink is
+ * typically a WAV file or the stdin of an encoder process.
+ *
+ * Stages can be built from ffmpeg filter syntax (see addFilters()), so
+ * chains in the markup arguments run natively when every filter is known.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * DspGraph graph;
+ * graph.addFilters("volume=-3dB,alimiter=limit=0.9");
+ * graph.add(DspGraph::dither(16, Ditherer::Mode::Shaped));
+ * AudioSource source;
+ * source.open("mix.wav");
+ * DspGraph::WavSink sink("master.wav", 16);
+ * graph.run(source, sink);
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "Dsp.h"
+#include "Subprocess.h"
+#include "ThreadPool.h"
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class AudioSource;
+
+/// @brief Chain of DSP stages
+class DspGraph
+{
+  public:
+	/// @brief Processing stage working on interleaved float frames
+	class Stage
+	{
+	  public:
+		virtual ~Stage() = default;
+
+		/**
+		 * @brief Called once before the first block
+		 * @param channels Number of channels
+		 * @param sampleRate Input sample rate
+		 */
+		virtual void prepare(unsigned channels, unsigned sampleRate)
+		{
+			(void)channels;
+			(void)sampleRate;
+		}
+
+		/// @brief Output sample rate for an input rate
+		virtual unsigned outputRate(unsigned inputRate) const
+		{
+			return inputRate;
+		}
+
+		/// @brief Upper bound of the frames produced by process() for @p frames input frames, or by flush() for 0
+		virtual size_t maxOutput(size_t frames) const
+		{
+			return frames;
+		}
+
+		/**
+		 * @brief Process a block
+		 * @param input Interleaved input frames
+		 * @param frames Number of input frames
+		 * @param output Room for maxOutput(frames) frames
+		 * @return Number of frames written
+		 */
+		virtual size_t process(const float *input, size_t frames, float *output) = 0;
+
+		/**
+		 * @brief Emit frames held back at the end of the stream
+		 * @param output Room for maxOutput(0) frames
+		 * @return Number of frames written
+		 */
+		virtual size_t flush(float *output)
+		{
+			(void)output;
+			return 0;
+		}
+	};
+
+	/// @brief Final consumer of the audio
+	class Sink
+	{
+	  public:
+		virtual ~Sink() = default;
+
+		/// @brief Called once before the first block with the format of the last stage
+		virtual void open(unsigned channels, unsigned sampleRate) = 0;
+		/// @brief Consume interleaved frames
+		virtual void write(const float *frames, size_t count) = 0;
+		/// @brief Called after the last block
+		virtual void close() = 0;
+	};
+
+	/// @brief Writes 16 or 24-bit PCM WAV files
+	class WavSink : public Sink
+	{
+	  public:
+		/**
+		 * @param filePath Output file
+		 * @param bits Bits per sample, 16 or 24
+		 */
+		WavSink(std::filesystem::path filePath, unsigned bits);
+
+		void open(unsigned channels, unsigned sampleRate) override;
+		void write(const float *frames, size_t count) override;
+		void close() override;
+
+	  private:
+		/// @brief Output file
+		std::filesystem::path m_filePath;
+		/// @brief Output stream
+		std::ofstream m_file;
+		/// @brief Bits per sample
+		unsigned m_bits;
+		/// @brief Number of channels
+		unsigned m_channels = 0;
+		/// @brief Sample rate
+		unsigned m_sampleRate = 0;
+		/// @brief Bytes of sample data written
+		std::uint64_t m_dataSize = 0;
+		/// @brief Conversion buffer
+		std::vector<char> m_bytes;
+	};
+
+	/// @brief Streams raw 16 or 24-bit PCM into the stdin of an encoder process
+	class PipeSink : public Sink
+	{
+	  public:
+		/**
+		 * @brief The command is @p before, the raw input options ("-f s16le -ar ... -i pipe:0") and @p after
+		 * @param before Start of the command
+		 * @param after Rest of the command
+		 * @param bits Bits per sample, 16 or 24
+		 */
+		PipeSink(std::string before, std::string after, unsigned bits);
+		~PipeSink() override;
+
+		void open(unsigned channels, unsigned sampleRate) override;
+		void write(const float *frames, size_t count) override;
+		void close() override;
+
+		/// @brief Exit status of the encoder, valid after close()
+		int status() const
+		{
+			return m_status;
+		}
+
+	  private:
+		/// @brief Start of the command
+		std::string m_before;
+		/// @brief Rest of the command
+		std::string m_after;
+		/// @brief Bits per sample
+		unsigned m_bits;
+		/// @brief Number of channels
+		unsigned m_channels = 0;
+		/// @brief Encoder, its stdin connected
+		std::unique_ptr<Subprocess> m_encoder;
+		/// @brief Exit status of the encoder
+		int m_status = -1;
+		/// @brief Conversion buffer
+		std::vector<char> m_bytes;
+	};
+
+	/**
+	 * @brief Streams raw 16 or 24-bit PCM into the stdin of several encoder processes
+	 *
+	 * On Linux the PCM is written once into a pipe and handed to the
+	 * encoders page by page with tee() and splice(), which only pass
+	 * references to the kernel's pipe pages instead of copying the audio
+	 * once per encoder. A slow encoder holds the others back once its pipe
+	 * is full; an encoder that stops reading is dropped and the others go
+	 * on. Elsewhere every encoder gets its own copy.
+	 */
+	class FanOutSink : public Sink
+	{
+	  public:
+		/**
+		 * @param commands Start and rest of each encoder command, see PipeSink
+		 * @param bits Bits per sample, 16 or 24
+		 */
+		FanOutSink(std::vector<std::pair<std::string, std::string>> commands, unsigned bits);
+		~FanOutSink() override;
+
+		void open(unsigned channels, unsigned sampleRate) override;
+		void write(const float *frames, size_t count) override;
+		void close() override;
+
+		/// @brief Exit status of each encoder, valid after close()
+		const std::vector<int> &status() const
+		{
+			return m_status;
+		}
+
+	  private:
+		/// @brief Hand the converted block to the encoders through the splice pipe
+		void writeSpliced();
+		/// @brief Close the splice pipe
+		void closeSource();
+
+		/// @brief Start and rest of each encoder command
+		std::vector<std::pair<std::string, std::string>> m_commands;
+		/// @brief Bits per sample
+		unsigned m_bits;
+		/// @brief Number of channels
+		unsigned m_channels = 0;
+		/// @brief Encoders, their stdin connected
+		std::vector<std::unique_ptr<Subprocess>> m_encoders;
+		/// @brief Whether each encoder still reads its input
+		std::vector<bool> m_reading;
+		/// @brief Exit status of each encoder
+		std::vector<int> m_status;
+		/// @brief Read and write end of the pipe the PCM is written to once, -1 without splicing
+		int m_source[2] = {-1, -1};
+		/// @brief Conversion buffer
+		std::vector<char> m_bytes;
+	};
+
+	/// @brief Execution settings
+	class Settings
+	{
+	  public:
+		/// @brief Frames per block
+		size_t BlockSize = 4096;
+		/// @brief Capacity of each ring in blocks
+		size_t RingBlocks = 4;
+		/// @brief Run every stage on its own thread; otherwise the calling thread runs the whole chain
+		bool Threaded = true;
+	};
+
+	/// @brief Append a stage
+	void add(std::unique_ptr<Stage> stage);
+
+	/**
+	 * @brief Append the stages of an ffmpeg filter chain
+	 *
+	 * Understood filters: volume, alimiter (limit, attack, release), afade
+	 * (t, st, d and their long names) and ebur128 (prints loudness and true
+	 * peak at the end of the stream).
+	 *
+	 * @param filters Comma-separated filters, as given to "-af"
+	 * @throws std::runtime_error for unknown filters or options
+	 */
+	void addFilters(const std::string &filters);
+
+	/// @brief Whether addFilters() understands every filter of a chain
+	static bool supports(const std::string &filters);
+
+	/// @brief Whether there are no stages
+	bool empty() const
+	{
+		return m_stages.empty();
+	}
+
+	/**
+	 * @brief Stream a source through the stages into a sink
+	 * @param source Opened input
+	 * @param sink Output
+	 * @param settings Execution settings
+	 * @throws The first exception thrown by the source, a stage or the sink
+	 */
+	void run(AudioSource &source, Sink &sink, const Settings &settings);
+
+	/// @brief Gain stage
+	static std::unique_ptr<Stage> gain(double factor);
+	/**
+	 * @brief Look-ahead peak limiter
+	 * @param limit Ceiling as a linear sample value
+	 * @param attack Look-ahead in milliseconds
+	 * @param release Release time in milliseconds
+	 */
+	static std::unique_ptr<Stage> limiter(double limit, double attack, double release);
+	/**
+	 * @brief Linear fade
+	 * @param fadeIn Fade in (silence before @p start) or out (silence after @p start + @p duration)
+	 * @param start Start in seconds
+	 * @param duration Length in seconds
+	 */
+	static std::unique_ptr<Stage> fade(bool fadeIn, double start, double duration);
+	/// @brief Loudness meter that prints its result at the end of the stream and passes the audio through
+	static std::unique_ptr<Stage> meter();
+	/// @brief Sample-rate conversion, channels in parallel on @p pool
+	static std::unique_ptr<Stage> resample(unsigned outputRate, ThreadPool &pool);
+	/// @brief Requantization to @p bits with dither; the output stays float but on the integer grid
+	static std::unique_ptr<Stage> dither(unsigned bits, Ditherer::Mode mode);
+
+  private:
+	/// @brief Stages in order
+	std::vector<std::unique_ptr<Stage>> m_stages;
+};
+
+/// @brief Resample, process and requantize an input for delivery
+class DspStage
+{
+  public:
+	/// @brief Delivery format
+	class Format
+	{
+	  public:
+		/// @brief Sample rate in Hz, 0 to keep the input rate
+		unsigned SampleRate = 0;
+		/// @brief Bits per sample (16 or 24), 0 to keep 16-bit inputs at 16 bits and use 24 otherwise
+		unsigned Bits = 0;
+		/// @brief Dither type
+		Ditherer::Mode Dither = Ditherer::Mode::Triangular;
+		/// @brief ffmpeg filter chain run natively before the dither, see DspGraph::addFilters()
+		std::string Filters;
+
+		/// @brief Whether anything is requested
+		bool empty() const
+		{
+			return SampleRate == 0 && Bits == 0 && Filters.empty();
+		}
+	};
+
+	/// @brief Track cut out of a longer input by split()
+	class Track
+	{
+	  public:
+		/// @brief Start in seconds
+		double Start = 0.0;
+		/// @brief End in seconds, negative for the end of the input
+		double End = -1.0;
+		/// @brief WAV file to write
+		std::filesystem::path Output;
+		/// @brief Number of frames written, set by split()
+		std::uint64_t Frames = 0;
+	};
+
+	/**
+	 * @brief Render an input to an integer PCM WAV file
+	 *
+	 * @param input Any file AudioSource can read
+	 * @param output WAV file to write
+	 * @param format Delivery format
+	 * @param pool Workers for the channels of the resampler
+	 * @param settings Graph settings
+	 * @return false if the input is a PCM WAV file in the delivery format already; nothing is written then
+	 * @throws std::runtime_error if the input cannot be read or the output cannot be written
+	 */
+	static bool render(const std::filesystem::path &input, const std::filesystem::path &output, const Format &format,
+	                   ThreadPool &pool, const DspGraph::Settings &settings = DspGraph::Settings());
+
+	/**
+	 * @brief Stream an input into an encoder process
+	 *
+	 * @param input Any file AudioSource can read
+	 * @param before Start of the encoder command
+	 * @param after Rest of the encoder command, see DspGraph::PipeSink
+	 * @param format Delivery format
+	 * @param pool Workers for the channels of the resampler
+	 * @param settings Graph settings
+	 * @param tap Optional last stage, sees the audio exactly as the encoder gets it
+	 * @return Exit status of the encoder
+	 * @throws std::runtime_error if the input cannot be read or the encoder cannot be started
+	 */
+	static int stream(const std::filesystem::path &input, const std::string &before, const std::string &after,
+	                  const Format &format, ThreadPool &pool,
+	                  const DspGraph::Settings &settings = DspGraph::Settings(),
+	                  std::unique_ptr<DspGraph::Stage> tap = nullptr);
+
+	/**
+	 * @brief Decode an input once and stream it into several encoder processes
+	 *
+	 * Integer PCM inputs in the delivery format are passed through without
+	 * requantizing.
+	 *
+	 * @param input Any file AudioSource can read
+	 * @param commands Start and rest of each encoder command, see DspGraph::PipeSink
+	 * @param format Delivery format
+	 * @param pool Workers for the channels of the resampler
+	 * @param settings Graph settings
+	 * @param tap Optional last stage, sees the audio exactly as the encoders get it
+	 * @return Exit status of each encoder
+	 * @throws std::runtime_error if the input cannot be read, an encoder cannot be started or none reads its input
+	 */
+	static std::vector<int> fanOut(const std::filesystem::path                           &input,
+	                               const std::vector<std::pair<std::string, std::string>> &commands,
+	                               const Format &format, ThreadPool &pool,
+	                               const DspGraph::Settings        &settings = DspGraph::Settings(),
+	                               std::unique_ptr<DspGraph::Stage> tap = nullptr);
+
+	/**
+	 * @brief Decode an input once and cut it into tracks
+	 *
+	 * Track points are rounded to the nearest frame at the output rate, so
+	 * times given to the microsecond are sample-accurate. The delivery format
+	 * is applied to the whole input before the cut, so consecutive tracks
+	 * join without a gap. Integer PCM inputs in the delivery format are cut
+	 * without requantizing.
+	 *
+	 * @param input Any file AudioSource can read
+	 * @param tracks Tracks to write, in any order and possibly overlapping
+	 * @param format Delivery format
+	 * @param pool Workers for the channels of the resampler
+	 * @param settings Graph settings
+	 * @throws std::runtime_error if the input cannot be read, an output cannot be written or a track is empty
+	 */
+	static void split(const std::filesystem::path &input, std::vector<Track> &tracks, const Format &format,
+	                  ThreadPool &pool, const DspGraph::Settings &settings = DspGraph::Settings());
+};
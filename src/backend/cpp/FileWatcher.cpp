@@ -0,0 +1,183 @@
+/**
+ * @file FileWatcher.cpp
+ * @brief Debounced change notification for a set of files.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "FileWatcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+/// @brief Size and date of a file, empty if it does not exist
+static std::string stamp(const std::filesystem::path &path)
+{
+	std::error_code ec;
+	const auto      size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return "";
+	const auto time = std::filesystem::last_write_time(path, ec);
+	if (ec)
+		return "";
+	return std::to_string(size) + ":" + std::to_string(time.time_since_epoch().count());
+}
+
+FileWatcher::FileWatcher(std::chrono::milliseconds debounce) : m_debounce(debounce)
+{
+#ifdef __linux__
+	m_inotify = inotify_init1(IN_CLOEXEC);
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+	if (m_inotify >= 0)
+		::close(m_inotify);
+#endif
+}
+
+std::filesystem::path FileWatcher::normal(const std::filesystem::path &path)
+{
+	std::error_code ec;
+	auto            absolute = std::filesystem::absolute(path, ec);
+	return (ec ? path : absolute).lexically_normal();
+}
+
+void FileWatcher::watch(const std::vector<std::filesystem::path> &files)
+{
+	m_files.clear();
+	for (const auto &file : files)
+		m_files.insert(normal(file));
+
+	m_stamps.clear();
+	for (const auto &file : m_files)
+		m_stamps[file] = stamp(file);
+
+#ifdef __linux__
+	if (m_inotify < 0)
+		return;
+	std::set<std::filesystem::path> directories;
+	for (const auto &file : m_files)
+		directories.insert(file.parent_path());
+
+	for (auto it = m_directories.begin(); it != m_directories.end();)
+	{
+		if (directories.erase(it->second) == 0)
+		{
+			inotify_rm_watch(m_inotify, it->first);
+			it = m_directories.erase(it);
+		}
+		else
+			++it;
+	}
+	// Watching the directory sees renames over a file, which a watch on the file itself would lose
+	for (const auto &directory : directories)
+	{
+		int wd = inotify_add_watch(m_inotify, directory.c_str(),
+		                           IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB);
+		if (wd >= 0)
+			m_directories[wd] = directory;
+	}
+#endif
+}
+
+std::vector<std::filesystem::path> FileWatcher::wait()
+{
+	std::set<std::filesystem::path> changed;
+	Clock::time_point               last;
+
+#ifdef __linux__
+	if (m_inotify >= 0 && !m_directories.empty())
+	{
+		alignas(inotify_event) char buffer[16384];
+		for (;;)
+		{
+			int timeout = -1;
+			if (!changed.empty())
+			{
+				auto left = std::chrono::duration_cast<std::chrono::milliseconds>(last + m_debounce - Clock::now());
+				if (left.count() <= 0)
+					break;
+				timeout = static_cast<int>(left.count());
+			}
+			pollfd pfd{m_inotify, POLLIN, 0};
+			int    ready = poll(&pfd, 1, timeout);
+			if (ready < 0 && errno != EINTR)
+				break;
+			if (ready <= 0)
+				continue;
+
+			const ssize_t count = ::read(m_inotify, buffer, sizeof(buffer));
+			for (ssize_t offset = 0; offset < count;)
+			{
+				const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset);
+				offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+				if (event->mask & IN_Q_OVERFLOW)
+				{
+					// Events were lost, so any file may have changed
+					changed.insert(m_files.begin(), m_files.end());
+					last = Clock::now();
+					continue;
+				}
+				auto directory = m_directories.find(event->wd);
+				if (directory == m_directories.end() || event->len == 0)
+					continue;
+				std::filesystem::path file = directory->second / event->name;
+				if (!m_files.contains(file))
+					continue;
+				changed.insert(file);
+				last = Clock::now();
+			}
+		}
+		for (const auto &file : changed)
+			m_stamps[file] = stamp(file);
+		return {changed.begin(), changed.end()};
+	}
+#endif
+
+	// Without change notification, the files are compared once a second
+	for (;;)
+	{
+		bool moved = false;
+		for (auto &[file, known] : m_stamps)
+		{
+			std::string current = stamp(file);
+			if (current == known)
+				continue;
+			known = current;
+			changed.insert(file);
+			moved = true;
+		}
+		if (moved)
+			last = Clock::now();
+		else if (!changed.empty() && Clock::now() - last >= m_debounce)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(changed.empty() ? 1000 : 100));
+	}
+	return {changed.begin(), changed.end()};
+}
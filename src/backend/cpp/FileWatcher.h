@@ -0,0 +1,84 @@
+/**
+ * @file FileWatcher.h
+ * @brief Debounced change notification for a set of files.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <chrono>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Waits until files change and reports them in batches
+ *
+ * On Linux the directories that hold the files are watched with inotify,
+ * so files that are replaced by a rename (as most editors save) are seen
+ * as well as files written in place, and nothing is read while nothing
+ * changes. Elsewhere the size and date of every file are compared once a
+ * second.
+ *
+ * A burst of changes, such as an editor saving or a tool copying a batch
+ * of files, is reported once: wait() returns when no watched file has
+ * changed for the debounce time.
+ */
+class FileWatcher
+{
+  public:
+	/// @param debounce Quiet time that ends a batch of changes
+	explicit FileWatcher(std::chrono::milliseconds debounce = std::chrono::milliseconds(500));
+
+	/// @brief Stop watching
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher &) = delete;
+	FileWatcher &operator=(const FileWatcher &) = delete;
+
+	/**
+	 * @brief Set the files to watch, replacing the previous ones
+	 *
+	 * Files need not exist yet; creating one is a change.
+	 *
+	 * @param files Files to watch
+	 */
+	void watch(const std::vector<std::filesystem::path> &files);
+
+	/**
+	 * @brief Wait for the next batch of changes
+	 * @return Changed files, as absolute paths without duplicates; empty if the system stopped reporting changes
+	 */
+	std::vector<std::filesystem::path> wait();
+
+	/// @brief How a path is compared: absolute and lexically normal
+	static std::filesystem::path normal(const std::filesystem::path &path);
+
+  private:
+	/// @brief Quiet time that ends a batch
+	std::chrono::milliseconds m_debounce;
+	/// @brief Watched files
+	std::set<std::filesystem::path> m_files;
+	/// @brief inotify descriptor, -1 where there is none
+	int m_inotify = -1;
+	/// @brief Watched directories by watch descriptor
+	std::map<int, std::filesystem::path> m_directories;
+	/// @brief Size and date of every file when polling
+	std::map<std::filesystem::path, std::string> m_stamps;
+};
@@ -0,0 +1,199 @@
+/**
+ * @file Fingerprint.cpp
+ * @brief Implementation of the stream hash and audio fingerprints
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Fingerprint.h"
+#include "Simd.h"
+#include "WavReader.h"
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+
+/// @brief Per-lane keys mixed into every stripe
+alignas(16) static constexpr std::uint64_t stripeKeys[8] = {
+    0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+    0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull};
+
+/// @brief Per-lane keys of the block scramble
+static constexpr std::uint64_t scrambleKeys[8] = {
+    0xcb00c391bb52283cull, 0xa32e531b8b65d088ull, 0x4ef90da297486471ull, 0xd8acdea946ef1938ull,
+    0x3f349ce33f76faa8ull, 0x1d4f0bc7c7bbdcf9ull, 0x3159b4cd4be0518aull, 0x647378d9c97e9fc8ull};
+
+/// @brief 32-bit prime of the block scramble
+static constexpr std::uint64_t scramblePrime = 0x9E3779B1ull;
+
+/// @brief SplitMix64 finalizer
+static std::uint64_t mix64(std::uint64_t x)
+{
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+/**
+ * @brief Accumulate whole stripes
+ *
+ * Every 64-bit word is multiplied high half by low half after keying and
+ * added to its own lane, while the raw word goes to the neighbouring lane.
+ *
+ * @param acc Accumulator lanes
+ * @param data Input
+ * @param stripes Number of stripes
+ */
+static void accumulate(std::uint64_t *acc, const std::uint8_t *data, size_t stripes)
+{
+#if defined(MU_SIMD_SSE2)
+	__m128i lanes[4], keys[4];
+	for (int j = 0; j < 4; ++j)
+	{
+		lanes[j] = _mm_load_si128(reinterpret_cast<const __m128i *>(acc + 2 * j));
+		keys[j] = _mm_load_si128(reinterpret_cast<const __m128i *>(stripeKeys + 2 * j));
+	}
+	for (size_t s = 0; s < stripes; ++s, data += StreamHash::StripeSize)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			__m128i word = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + 16 * j));
+			__m128i keyed = _mm_xor_si128(word, keys[j]);
+			__m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+			__m128i swapped = _mm_shuffle_epi32(word, _MM_SHUFFLE(1, 0, 3, 2));
+			lanes[j] = _mm_add_epi64(lanes[j], _mm_add_epi64(swapped, product));
+		}
+	}
+	for (int j = 0; j < 4; ++j)
+		_mm_store_si128(reinterpret_cast<__m128i *>(acc + 2 * j), lanes[j]);
+#elif defined(MU_SIMD_NEON)
+	uint64x2_t lanes[4], keys[4];
+	for (int j = 0; j < 4; ++j)
+	{
+		lanes[j] = vld1q_u64(acc + 2 * j);
+		keys[j] = vld1q_u64(stripeKeys + 2 * j);
+	}
+	for (size_t s = 0; s < stripes; ++s, data += StreamHash::StripeSize)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			uint64x2_t word = vreinterpretq_u64_u8(vld1q_u8(data + 16 * j));
+			uint64x2_t keyed = veorq_u64(word, keys[j]);
+			uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+			lanes[j] = vaddq_u64(lanes[j], vaddq_u64(vextq_u64(word, word, 1), product));
+		}
+	}
+	for (int j = 0; j < 4; ++j)
+		vst1q_u64(acc + 2 * j, lanes[j]);
+#else
+	for (size_t s = 0; s < stripes; ++s, data += StreamHash::StripeSize)
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			std::uint64_t word;
+			std::memcpy(&word, data + 8 * i, sizeof(word));
+			std::uint64_t keyed = word ^ stripeKeys[i];
+			acc[i ^ 1] += word;
+			acc[i] += (keyed & 0xFFFFFFFFull) * (keyed >> 32);
+		}
+	}
+#endif
+}
+
+StreamHash::StreamHash()
+{
+	for (int i = 0; i < 8; ++i)
+		m_acc[i] = mix64(stripeKeys[i] + static_cast<std::uint64_t>(i));
+}
+
+void StreamHash::consume(const std::uint8_t *data, size_t stripes)
+{
+	while (stripes > 0)
+	{
+		size_t count = std::min(stripes, StripesPerBlock - m_blockStripes);
+		accumulate(m_acc, data, count);
+		data += count * StripeSize;
+		stripes -= count;
+		m_blockStripes += count;
+
+		// Keep the lanes from settling into patterns on long inputs
+		if (m_blockStripes == StripesPerBlock)
+		{
+			for (int i = 0; i < 8; ++i)
+				m_acc[i] = ((m_acc[i] ^ (m_acc[i] >> 47)) ^ scrambleKeys[i]) * scramblePrime;
+			m_blockStripes = 0;
+		}
+	}
+}
+
+void StreamHash::update(const void *data, size_t size)
+{
+	auto bytes = static_cast<const std::uint8_t *>(data);
+	m_length += size;
+
+	if (m_pendingSize > 0)
+	{
+		size_t take = std::min(size, StripeSize - m_pendingSize);
+		std::memcpy(m_pending + m_pendingSize, bytes, take);
+		m_pendingSize += take;
+		bytes += take;
+		size -= take;
+		if (m_pendingSize < StripeSize)
+			return;
+		consume(m_pending, 1);
+		m_pendingSize = 0;
+	}
+
+	consume(bytes, size / StripeSize);
+	m_pendingSize = size % StripeSize;
+	std::memcpy(m_pending, bytes + size - m_pendingSize, m_pendingSize);
+}
+
+std::uint64_t StreamHash::digest() const
+{
+	StreamHash last = *this;
+	if (last.m_pendingSize > 0)
+	{
+		std::memset(last.m_pending + last.m_pendingSize, 0, StripeSize - last.m_pendingSize);
+		last.consume(last.m_pending, 1);
+	}
+
+	std::uint64_t hash = mix64(m_length * 0x9E3779B97F4A7C15ull);
+	for (std::uint64_t lane : last.m_acc)
+		hash = mix64(hash ^ lane);
+	return hash;
+}
+
+std::string AudioFingerprint::compute(const std::filesystem::path &filePath)
+{
+	WavReader wav;
+	if (!wav.open(filePath))
+		return "";
+
+	// The format belongs to the content: the same bytes at another rate are different audio
+	const std::uint32_t format[] = {static_cast<std::uint32_t>(wav.format()), wav.channels(), wav.sampleRate(),
+	                                wav.bitsPerSample()};
+	StreamHash hash;
+	hash.update(format, sizeof(format));
+	hash.update(wav.sampleData(), static_cast<size_t>(wav.sampleDataSize()));
+
+	std::stringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill('0') << hash.digest();
+	return ss.str();
+}
@@ -0,0 +1,92 @@
+/**
+ * @file Fingerprint.h
+ * @brief Audio content fingerprints for the processing cache.
+ *
+ * A fingerprint covers only the decoded samples and their format, so
+ * re-exports that change nothing but BWF, LIST or other header chunks keep
+ * their fingerprint. The samples are hashed with StreamHash, a streaming
+ * 64-bit hash whose inner loop runs on SSE2 or NEON.
+ *
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief Streaming non-cryptographic 64-bit hash
+ *
+ * Input is consumed in 64-byte stripes by eight 64-bit multiply-accumulate
+ * lanes that are scrambled every kilobyte. The SIMD and scalar paths produce
+ * identical digests.
+ */
+class StreamHash
+{
+  public:
+	StreamHash();
+
+	/**
+	 * @brief Hash more data
+	 * @param data Bytes to add
+	 * @param size Number of bytes
+	 */
+	void update(const void *data, size_t size);
+
+	/// @brief Digest of everything hashed so far
+	std::uint64_t digest() const;
+
+	/// @brief Bytes consumed per accumulator step
+	static constexpr size_t StripeSize = 64;
+	/// @brief Stripes between two accumulator scrambles
+	static constexpr size_t StripesPerBlock = 16;
+
+  private:
+	/// @brief Accumulate whole stripes
+	void consume(const std::uint8_t *data, size_t stripes);
+
+	/// @brief Accumulator lanes
+	alignas(16) std::uint64_t m_acc[8];
+	/// @brief Bytes that do not fill a stripe yet
+	std::uint8_t m_pending[StripeSize];
+	/// @brief Number of pending bytes
+	size_t m_pendingSize = 0;
+	/// @brief Stripes accumulated since the last scramble
+	size_t m_blockStripes = 0;
+	/// @brief Total number of bytes hashed
+	std::uint64_t m_length = 0;
+};
+
+/// @brief Audio content fingerprint
+class AudioFingerprint
+{
+  public:
+	/**
+	 * @brief Fingerprint the samples of a file
+	 *
+	 * Only inputs the library reads natively (WAV, RF64, BWF) get a
+	 * fingerprint; hashing them runs at memory speed from the mapped data
+	 * chunk.
+	 *
+	 * @param filePath Input
+	 * @return 16 hex digits, empty if the file is not read natively
+	 * @throws std::runtime_error if the file is a damaged WAV file
+	 */
+	static std::string compute(const std::filesystem::path &filePath);
+};
@@ -0,0 +1,1412 @@
+/**
+ * @file FlacEncoder.cpp
+ * @brief Implementation of the native FLAC encoder
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "FlacEncoder.h"
+#include "Simd.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+/// @brief Highest LPC order the encoder uses
+static constexpr unsigned maxLpcOrder = 32;
+/// @brief Highest Rice partition order the encoder uses
+static constexpr unsigned maxPartitionOrder = 8;
+/// @brief Seconds between two seek points
+static constexpr unsigned seekInterval = 10;
+
+/// @brief Encoder parameters of a compression level
+struct LevelConfig
+{
+	/// @brief Samples per frame
+	unsigned BlockSize;
+	/// @brief Try left/side, right/side and mid/side for stereo frames
+	bool Stereo;
+	/// @brief Highest LPC order, 0 for fixed predictors only
+	unsigned MaxLpcOrder;
+	/// @brief Highest Rice partition order
+	unsigned MaxPartitionOrder;
+	/// @brief Code the residual of every LPC order instead of the estimated best one
+	bool Exhaustive;
+};
+
+/// @brief Compression levels 0 to 8, following the reference encoder
+static constexpr std::array<LevelConfig, 9> levels = {{
+    {1152, false, 0, 3, false},
+    {1152, true, 0, 3, false},
+    {1152, true, 0, 3, false},
+    {4096, false, 6, 4, false},
+    {4096, true, 8, 4, false},
+    {4096, true, 8, 5, false},
+    {4096, true, 8, 6, false},
+    {4096, true, 12, 6, false},
+    {4096, true, 12, 6, true},
+}};
+
+/// @brief CRC-8 (polynomial 0x07) of frame headers
+static constexpr std::array<std::uint8_t, 256> crc8Table = [] {
+	std::array<std::uint8_t, 256> table{};
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		unsigned crc = i;
+		for (int bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1);
+		table[i] = static_cast<std::uint8_t>(crc);
+	}
+	return table;
+}();
+
+/// @brief CRC-16 (polynomial 0x8005) of whole frames
+static constexpr std::array<std::uint16_t, 256> crc16Table = [] {
+	std::array<std::uint16_t, 256> table{};
+	for (unsigned i = 0; i < 256; ++i)
+	{
+		unsigned crc = i << 8;
+		for (int bit = 0; bit < 8; ++bit)
+			crc = (crc & 0x8000) ? ((crc << 1) ^ 0x8005) : (crc << 1);
+		table[i] = static_cast<std::uint16_t>(crc);
+	}
+	return table;
+}();
+
+static std::uint8_t crc8(const std::uint8_t *data, size_t size)
+{
+	std::uint8_t crc = 0;
+	for (size_t i = 0; i < size; ++i)
+		crc = crc8Table[crc ^ data[i]];
+	return crc;
+}
+
+static std::uint16_t crc16(const std::uint8_t *data, size_t size)
+{
+	std::uint16_t crc = 0;
+	for (size_t i = 0; i < size; ++i)
+		crc = static_cast<std::uint16_t>((crc << 8) ^ crc16Table[(crc >> 8) ^ data[i]]);
+	return crc;
+}
+
+/// @brief MD5 of the unencoded audio, as stored in STREAMINFO
+class Md5
+{
+  public:
+	/// @brief Hash more data
+	void update(const std::uint8_t *data, size_t size)
+	{
+		m_length += size;
+		if (m_buffered > 0)
+		{
+			size_t take = std::min(size, sizeof(m_buffer) - m_buffered);
+			std::memcpy(m_buffer + m_buffered, data, take);
+			m_buffered += take;
+			data += take;
+			size -= take;
+			if (m_buffered < sizeof(m_buffer))
+				return;
+			block(m_buffer);
+			m_buffered = 0;
+		}
+		for (; size >= 64; data += 64, size -= 64)
+			block(data);
+		std::memcpy(m_buffer, data, size);
+		m_buffered = size;
+	}
+
+	/// @brief Digest of everything hashed
+	std::array<std::uint8_t, 16> finish()
+	{
+		std::uint64_t bits = m_length * 8;
+		std::uint8_t  pad[72] = {0x80};
+		size_t        padSize = (m_buffered < 56 ? 56 : 120) - m_buffered;
+		for (int i = 0; i < 8; ++i)
+			pad[padSize + i] = static_cast<std::uint8_t>(bits >> (8 * i));
+		update(pad, padSize + 8);
+
+		std::array<std::uint8_t, 16> digest{};
+		for (int i = 0; i < 16; ++i)
+			digest[i] = static_cast<std::uint8_t>(m_state[i / 4] >> (8 * (i % 4)));
+		return digest;
+	}
+
+  private:
+	/// @brief Process one 64-byte block
+	void block(const std::uint8_t *p)
+	{
+		static constexpr std::uint32_t k[64] = {
+		    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391};
+		static constexpr int shifts[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+		std::uint32_t m[16];
+		for (int i = 0; i < 16; ++i)
+			m[i] = static_cast<std::uint32_t>(p[4 * i]) | (static_cast<std::uint32_t>(p[4 * i + 1]) << 8) |
+			       (static_cast<std::uint32_t>(p[4 * i + 2]) << 16) | (static_cast<std::uint32_t>(p[4 * i + 3]) << 24);
+
+		std::uint32_t a = m_state[0], b = m_state[1], c = m_state[2], d = m_state[3];
+		for (int i = 0; i < 64; ++i)
+		{
+			std::uint32_t f;
+			int           g;
+			if (i < 16)
+			{
+				f = (b & c) | (~b & d);
+				g = i;
+			}
+			else if (i < 32)
+			{
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) % 16;
+			}
+			else if (i < 48)
+			{
+				f = b ^ c ^ d;
+				g = (3 * i + 5) % 16;
+			}
+			else
+			{
+				f = c ^ (b | ~d);
+				g = (7 * i) % 16;
+			}
+			f += a + k[i] + m[g];
+			a = d;
+			d = c;
+			c = b;
+			b += std::rotl(f, shifts[(i / 16) * 4 + i % 4]);
+		}
+		m_state[0] += a;
+		m_state[1] += b;
+		m_state[2] += c;
+		m_state[3] += d;
+	}
+
+	/// @brief Chaining state
+	std::uint32_t m_state[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+	/// @brief Bytes that do not fill a block yet
+	std::uint8_t m_buffer[64];
+	/// @brief Number of buffered bytes
+	size_t m_buffered = 0;
+	/// @brief Total number of bytes hashed
+	std::uint64_t m_length = 0;
+};
+
+/// @brief MSB-first bit writer
+class BitWriter
+{
+  public:
+	explicit BitWriter(std::vector<std::uint8_t> &out) : m_out(out)
+	{
+	}
+
+	/// @brief Write the low bits (at most 32) of a value
+	void put(std::uint64_t value, unsigned bits)
+	{
+		m_acc = (m_acc << bits) | (value & ((1ull << bits) - 1));
+		m_bits += bits;
+		if (m_bits >= 32)
+		{
+			m_bits -= 32;
+			auto word = static_cast<std::uint32_t>(m_acc >> m_bits);
+			m_out.push_back(static_cast<std::uint8_t>(word >> 24));
+			m_out.push_back(static_cast<std::uint8_t>(word >> 16));
+			m_out.push_back(static_cast<std::uint8_t>(word >> 8));
+			m_out.push_back(static_cast<std::uint8_t>(word));
+		}
+	}
+
+	/// @brief Write a two's complement value
+	void putSigned(std::int32_t value, unsigned bits)
+	{
+		put(static_cast<std::uint32_t>(value), bits);
+	}
+
+	/// @brief Write a Rice code with parameter k
+	void putRice(std::uint32_t value, unsigned k)
+	{
+		std::uint32_t quotient = value >> k;
+		std::uint32_t low = value & ((1u << k) - 1);
+		if (quotient + 1 + k <= 32)
+		{
+			put((1ull << k) | low, quotient + 1 + k);
+			return;
+		}
+		for (; quotient >= 32; quotient -= 32)
+			put(0, 32);
+		put(1, quotient + 1);
+		put(low, k);
+	}
+
+	/// @brief Pad to a byte boundary and move all bits to the output
+	void flush()
+	{
+		if (m_bits % 8)
+			put(0, 8 - m_bits % 8);
+		for (; m_bits > 0; m_bits -= 8)
+			m_out.push_back(static_cast<std::uint8_t>(m_acc >> (m_bits - 8)));
+	}
+
+  private:
+	/// @brief Output bytes
+	std::vector<std::uint8_t> &m_out;
+	/// @brief Pending bits in the low end
+	std::uint64_t m_acc = 0;
+	/// @brief Number of pending bits
+	unsigned m_bits = 0;
+};
+
+/// @brief MSB-first bit reader used to verify frames
+class BitReader
+{
+  public:
+	BitReader(const std::uint8_t *data, size_t size) : m_data(data), m_size(size)
+	{
+	}
+
+	/// @brief Read up to 32 bits
+	std::uint32_t get(unsigned bits)
+	{
+		std::uint32_t value = 0;
+		while (bits > 0)
+		{
+			size_t byte = m_position >> 3;
+			if (byte >= m_size)
+				throw std::runtime_error("FLAC verification failed: frame ends early");
+			unsigned available = 8 - static_cast<unsigned>(m_position & 7);
+			unsigned take = std::min(available, bits);
+			value = (value << take) | ((m_data[byte] >> (available - take)) & ((1u << take) - 1));
+			m_position += take;
+			bits -= take;
+		}
+		return value;
+	}
+
+	/// @brief Read a two's complement value
+	std::int32_t getSigned(unsigned bits)
+	{
+		if (bits == 0)
+			return 0;
+		std::uint32_t value = get(bits);
+		if (bits < 32 && (value >> (bits - 1)))
+			value |= ~0u << bits;
+		return static_cast<std::int32_t>(value);
+	}
+
+	/// @brief Read a unary code (zeros terminated by a one)
+	std::uint32_t getUnary()
+	{
+		std::uint32_t zeros = 0;
+		while (get(1) == 0)
+			++zeros;
+		return zeros;
+	}
+
+	/// @brief Bytes consumed, rounded up
+	size_t bytePosition() const
+	{
+		return static_cast<size_t>((m_position + 7) >> 3);
+	}
+
+  private:
+	/// @brief Input
+	const std::uint8_t *m_data;
+	/// @brief Input size in bytes
+	size_t m_size;
+	/// @brief Position in bits
+	std::uint64_t m_position = 0;
+};
+
+/// @brief Fold a signed residual into an unsigned Rice input
+static std::uint32_t zigzag(std::int32_t value)
+{
+	return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+/**
+ * @brief Dot product of two double vectors
+ * @param a First vector
+ * @param b Second vector
+ * @param n Length
+ * @return Sum of a[i] * b[i]
+ */
+static double dotProduct(const double *a, const double *b, size_t n)
+{
+	size_t i = 0;
+	double sum = 0.0;
+#if defined(MU_SIMD_SSE2)
+	__m128d sum0 = _mm_setzero_pd(), sum1 = _mm_setzero_pd();
+	for (; i + 4 <= n; i += 4)
+	{
+		sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+		sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+	}
+	double lanes[2];
+	_mm_storeu_pd(lanes, _mm_add_pd(sum0, sum1));
+	sum = lanes[0] + lanes[1];
+#elif defined(MU_SIMD_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+	float64x2_t sum0 = vdupq_n_f64(0.0), sum1 = vdupq_n_f64(0.0);
+	for (; i + 4 <= n; i += 4)
+	{
+		sum0 = vfmaq_f64(sum0, vld1q_f64(a + i), vld1q_f64(b + i));
+		sum1 = vfmaq_f64(sum1, vld1q_f64(a + i + 2), vld1q_f64(b + i + 2));
+	}
+	sum = vaddvq_f64(vaddq_f64(sum0, sum1));
+#endif
+	for (; i < n; ++i)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+#if defined(MU_SIMD_SSE2)
+/**
+ * @brief LPC residual with 32-bit sums on SSE4.1
+ * @return Index of the first sample left to the scalar loop
+ */
+MU_TARGET_SSE41 static size_t lpcResidualSse41(const std::int32_t *x, size_t n, const std::int32_t *coefs,
+                                               unsigned order, int shift, std::int32_t *residual)
+{
+	const __m128i vshift = _mm_cvtsi32_si128(shift);
+	size_t        i = order;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128i sum = _mm_setzero_si128();
+		for (unsigned j = 0; j < order; ++j)
+		{
+			__m128i history = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i - 1 - j));
+			sum = _mm_add_epi32(sum, _mm_mullo_epi32(_mm_set1_epi32(coefs[j]), history));
+		}
+		__m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i *>(x + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(residual + i), _mm_sub_epi32(current, _mm_sra_epi32(sum, vshift)));
+	}
+	return i;
+}
+#endif
+
+/**
+ * @brief LPC residual when every partial sum fits into 32 bits
+ * @param x Samples
+ * @param n Number of samples
+ * @param coefs Quantized coefficients, coefs[j] weighs x[i - 1 - j]
+ * @param order Predictor order
+ * @param shift Quantization shift
+ * @param residual Output, from index order on
+ */
+static void lpcResidual32(const std::int32_t *x, size_t n, const std::int32_t *coefs, unsigned order, int shift,
+                          std::int32_t *residual)
+{
+	size_t i = order;
+#if defined(MU_SIMD_SSE2)
+	if (cpuHasSse41())
+		i = lpcResidualSse41(x, n, coefs, order, shift, residual);
+#elif defined(MU_SIMD_NEON)
+	const int32x4_t vshift = vdupq_n_s32(-shift);
+	for (; i + 4 <= n; i += 4)
+	{
+		int32x4_t sum = vdupq_n_s32(0);
+		for (unsigned j = 0; j < order; ++j)
+			sum = vmlaq_n_s32(sum, vld1q_s32(x + i - 1 - j), coefs[j]);
+		vst1q_s32(residual + i, vsubq_s32(vld1q_s32(x + i), vshlq_s32(sum, vshift)));
+	}
+#endif
+	for (; i < n; ++i)
+	{
+		std::int32_t sum = 0;
+		for (unsigned j = 0; j < order; ++j)
+			sum += coefs[j] * x[i - 1 - j];
+		residual[i] = x[i] - (sum >> shift);
+	}
+}
+
+/**
+ * @brief LPC residual with 64-bit sums
+ * @return false if a residual does not fit the Rice coder
+ */
+static bool lpcResidual64(const std::int32_t *x, size_t n, const std::int32_t *coefs, unsigned order, int shift,
+                          std::int32_t *residual)
+{
+	for (size_t i = order; i < n; ++i)
+	{
+		std::int64_t sum = 0;
+		for (unsigned j = 0; j < order; ++j)
+			sum += static_cast<std::int64_t>(coefs[j]) * x[i - 1 - j];
+		std::int64_t value = x[i] - (sum >> shift);
+		if (value < -(1ll << 30) || value >= (1ll << 30))
+			return false;
+		residual[i] = static_cast<std::int32_t>(value);
+	}
+	return true;
+}
+
+/**
+ * @brief Residual of a fixed polynomial predictor
+ * @param x Samples
+ * @param n Number of samples
+ * @param order Predictor order, 0 to 4
+ * @param residual Output, from index order on
+ */
+static void fixedResidual(const std::int32_t *x, size_t n, unsigned order, std::int32_t *residual)
+{
+	switch (order)
+	{
+	case 0:
+		std::copy(x, x + n, residual);
+		break;
+	case 1:
+		for (size_t i = 1; i < n; ++i)
+			residual[i] = x[i] - x[i - 1];
+		break;
+	case 2:
+		for (size_t i = 2; i < n; ++i)
+			residual[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+		break;
+	case 3:
+		for (size_t i = 3; i < n; ++i)
+			residual[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+		break;
+	default:
+		for (size_t i = 4; i < n; ++i)
+			residual[i] = x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+		break;
+	}
+}
+
+/// @brief Rice coding of a residual
+struct RicePlan
+{
+	/// @brief Partition order
+	unsigned PartitionOrder = 0;
+	/// @brief Use 5-bit parameters (RICE2)
+	bool Extended = false;
+	/// @brief Parameter of each partition
+	std::array<std::uint8_t, 1u << maxPartitionOrder> Params{};
+	/// @brief Estimated size in bits
+	std::uint64_t Bits = 0;
+};
+
+/// @brief Subframe coding of one channel
+struct Subframe
+{
+	enum class Type
+	{
+		Constant,
+		Verbatim,
+		Fixed,
+		Lpc
+	};
+
+	Type Kind = Type::Verbatim;
+	/// @brief Predictor order
+	unsigned Order = 0;
+	/// @brief Coefficient precision in bits (LPC)
+	unsigned Precision = 0;
+	/// @brief Quantization shift (LPC)
+	int Shift = 0;
+	/// @brief Quantized coefficients (LPC)
+	std::array<std::int32_t, maxLpcOrder> Coefs{};
+	/// @brief Residual, valid from index Order on
+	std::vector<std::int32_t> Residual;
+	/// @brief Rice coding of the residual
+	RicePlan Rice;
+	/// @brief Estimated size in bits
+	std::uint64_t Bits = 0;
+};
+
+/**
+ * @brief Best Rice parameter for a partition
+ * @param sum Sum of the folded residuals
+ * @param count Number of residuals
+ * @param[out] bits Estimated size of the partition without its parameter
+ * @return Parameter
+ */
+static unsigned riceParameter(std::uint64_t sum, std::uint64_t count, std::uint64_t &bits)
+{
+	if (count == 0)
+	{
+		bits = 0;
+		return 0;
+	}
+	std::uint64_t mean = sum / count;
+	unsigned      guess = mean > 0 ? static_cast<unsigned>(std::bit_width(mean)) - 1 : 0;
+	unsigned      best = 0;
+	bits = std::numeric_limits<std::uint64_t>::max();
+	for (unsigned k = guess > 0 ? guess - 1 : 0; k <= std::min(guess + 1, 30u); ++k)
+	{
+		std::uint64_t cost = count * (k + 1) + (sum >> k);
+		if (cost < bits)
+		{
+			bits = cost;
+			best = k;
+		}
+	}
+	return best;
+}
+
+/**
+ * @brief Choose the partition order and parameters of a residual
+ * @param residual Residual, valid from index order on
+ * @param n Block size
+ * @param order Predictor order
+ * @param maxOrder Highest partition order to try
+ * @param sums Scratch buffer
+ * @param[out] plan Chosen coding
+ */
+static void planRice(const std::int32_t *residual, size_t n, unsigned order, unsigned maxOrder,
+                     std::vector<std::uint64_t> &sums, RicePlan &plan)
+{
+	// Partitions must divide the block and the first one must hold more than the warm-up samples
+	while (maxOrder > 0 && ((n & ((size_t(1) << maxOrder) - 1)) != 0 || (n >> maxOrder) <= order))
+		--maxOrder;
+
+	size_t partitions = size_t(1) << maxOrder;
+	size_t partitionSize = n >> maxOrder;
+	sums.assign(partitions, 0);
+	for (size_t p = 0; p < partitions; ++p)
+	{
+		std::uint64_t sum = 0;
+		for (size_t i = p == 0 ? order : p * partitionSize; i < (p + 1) * partitionSize; ++i)
+			sum += zigzag(residual[i]);
+		sums[p] = sum;
+	}
+
+	plan.Bits = std::numeric_limits<std::uint64_t>::max();
+	std::array<std::uint8_t, 1u << maxPartitionOrder> params{};
+	for (unsigned partitionOrder = maxOrder;; --partitionOrder)
+	{
+		partitions = size_t(1) << partitionOrder;
+		partitionSize = n >> partitionOrder;
+		std::uint64_t bits = 6;
+		unsigned      highest = 0;
+		for (size_t p = 0; p < partitions; ++p)
+		{
+			std::uint64_t cost;
+			unsigned      k = riceParameter(sums[p], partitionSize - (p == 0 ? order : 0), cost);
+			params[p] = static_cast<std::uint8_t>(k);
+			highest = std::max(highest, k);
+			bits += cost;
+		}
+		bool extended = highest > 14;
+		bits += partitions * (extended ? 5 : 4);
+		if (bits < plan.Bits)
+		{
+			plan.Bits = bits;
+			plan.PartitionOrder = partitionOrder;
+			plan.Extended = extended;
+			plan.Params = params;
+		}
+
+		if (partitionOrder == 0)
+			break;
+		for (size_t p = 0; p < partitions / 2; ++p)
+			sums[p] = sums[2 * p] + sums[2 * p + 1];
+	}
+}
+
+/// @brief Format of the stream and its frame header codes
+struct StreamFormat
+{
+	WavReader::SampleFormat Format;
+	unsigned                Channels;
+	unsigned                BitsPerSample;
+	unsigned                SampleRate;
+	unsigned                BlockAlign;
+	/// @brief Sample rate code of the frame header
+	unsigned RateCode;
+	/// @brief Sample size code of the frame header
+	unsigned SizeCode;
+};
+
+/// @brief Frame header code of a sample rate
+static unsigned sampleRateCode(unsigned rate)
+{
+	switch (rate)
+	{
+	case 88200:
+		return 1;
+	case 176400:
+		return 2;
+	case 192000:
+		return 3;
+	case 8000:
+		return 4;
+	case 16000:
+		return 5;
+	case 22050:
+		return 6;
+	case 24000:
+		return 7;
+	case 32000:
+		return 8;
+	case 44100:
+		return 9;
+	case 48000:
+		return 10;
+	case 96000:
+		return 11;
+	}
+	if (rate % 1000 == 0 && rate / 1000 < 256)
+		return 12;
+	if (rate < 65536)
+		return 13;
+	if (rate % 10 == 0 && rate / 10 < 65536)
+		return 14;
+	return 0; // taken from STREAMINFO
+}
+
+/// @brief Frame header code of a block size
+static unsigned blockSizeCode(unsigned n)
+{
+	if (n == 192)
+		return 1;
+	for (unsigned code = 2; code <= 5; ++code)
+		if (n == 576u << (code - 2))
+			return code;
+	for (unsigned code = 8; code <= 15; ++code)
+		if (n == 256u << (code - 8))
+			return code;
+	return n <= 256 ? 6 : 7;
+}
+
+/// @brief Block size of a frame header code, 0 if it follows the header
+static unsigned blockSizeOf(unsigned code)
+{
+	if (code == 1)
+		return 192;
+	if (code >= 2 && code <= 5)
+		return 576u << (code - 2);
+	if (code >= 8)
+		return 256u << (code - 8);
+	return 0;
+}
+
+/// @brief Whether subframe c of a frame holds the side channel, which has one extra bit
+static bool isSide(unsigned assignment, unsigned c)
+{
+	return assignment == 9 ? c == 0 : assignment >= 8 && c == 1;
+}
+
+/// @brief Per-worker frame encoder with its scratch buffers
+class FrameEncoder
+{
+  public:
+	FrameEncoder(const StreamFormat &format, const LevelConfig &config, bool verify)
+	    : m_format(format), m_config(config), m_verify(verify),
+	      m_precision(config.BlockSize <= 1152 ? 10 : config.BlockSize <= 2304 ? 11 : 12)
+	{
+		size_t planes = format.Channels == 2 && config.Stereo ? 4 : format.Channels;
+		m_samples.assign(planes, std::vector<std::int32_t>(config.BlockSize));
+		m_subframes.resize(planes);
+		for (auto &subframe : m_subframes)
+			subframe.Residual.resize(config.BlockSize);
+		m_trial.Residual.resize(config.BlockSize);
+		m_window.reserve(config.BlockSize);
+		m_windowed.resize(config.BlockSize);
+	}
+
+	/**
+	 * @brief Encode one frame
+	 * @param pcm Interleaved input
+	 * @param n Number of samples per channel
+	 * @param frameNumber Index of the frame
+	 * @param out Encoded frame
+	 */
+	void encode(const std::uint8_t *pcm, unsigned n, std::uint32_t frameNumber, std::vector<std::uint8_t> &out)
+	{
+		unpack(pcm, n);
+		const unsigned bps = m_format.BitsPerSample;
+
+		// Channel assignment 0-7 is independent channels, 8-10 are left/side, right/side and mid/side
+		unsigned assignment = m_format.Channels - 1;
+		unsigned first = 0, second = 1;
+		if (m_samples.size() == 4)
+		{
+			const std::int32_t *left = m_samples[0].data(), *right = m_samples[1].data();
+			std::int32_t       *mid = m_samples[2].data(), *side = m_samples[3].data();
+			for (unsigned i = 0; i < n; ++i)
+			{
+				mid[i] = (left[i] + right[i]) >> 1;
+				side[i] = left[i] - right[i];
+			}
+			for (unsigned c = 0; c < 4; ++c)
+				planSubframe(m_samples[c].data(), n, c == 3 ? bps + 1 : bps, m_subframes[c]);
+
+			const std::uint64_t l = m_subframes[0].Bits, r = m_subframes[1].Bits, m = m_subframes[2].Bits,
+			                    s = m_subframes[3].Bits;
+			const std::array<std::uint64_t, 4> costs = {l + r, l + s, s + r, m + s};
+			auto best = std::min_element(costs.begin(), costs.end()) - costs.begin();
+			static constexpr unsigned pairs[4][3] = {{1, 0, 1}, {8, 0, 3}, {9, 3, 1}, {10, 2, 3}};
+			assignment = pairs[best][0];
+			first = pairs[best][1];
+			second = pairs[best][2];
+		}
+		else
+		{
+			for (unsigned c = 0; c < m_format.Channels; ++c)
+				planSubframe(m_samples[c].data(), n, bps, m_subframes[c]);
+		}
+
+		out.clear();
+		BitWriter writer(out);
+		writeHeader(writer, n, frameNumber, assignment);
+		writer.flush();
+		writer.put(crc8(out.data(), out.size()), 8);
+
+		for (unsigned c = 0; c < m_format.Channels; ++c)
+		{
+			unsigned plane = m_samples.size() == 4 ? (c == 0 ? first : second) : c;
+			unsigned planeBps = isSide(assignment, c) ? bps + 1 : bps;
+			writeSubframe(writer, m_subframes[plane], m_samples[plane].data(), n, planeBps);
+		}
+		writer.flush();
+		std::uint16_t crc = crc16(out.data(), out.size());
+		writer.put(crc, 16);
+		writer.flush();
+
+		if (m_verify)
+			verify(out, n);
+	}
+
+  private:
+	/// @brief Convert interleaved PCM to one integer plane per channel
+	void unpack(const std::uint8_t *pcm, unsigned n)
+	{
+		const unsigned channels = m_format.Channels;
+		for (unsigned c = 0; c < channels; ++c)
+		{
+			std::int32_t       *dst = m_samples[c].data();
+			const std::uint8_t *src = pcm;
+			switch (m_format.Format)
+			{
+			case WavReader::SampleFormat::UInt8:
+				for (unsigned i = 0; i < n; ++i)
+					dst[i] = static_cast<std::int32_t>(src[i * channels + c]) - 128;
+				break;
+			case WavReader::SampleFormat::Int16:
+				for (unsigned i = 0; i < n; ++i)
+				{
+					const std::uint8_t *p = src + (i * channels + c) * 2;
+					dst[i] = static_cast<std::int16_t>(p[0] | (p[1] << 8));
+				}
+				break;
+			default:
+				for (unsigned i = 0; i < n; ++i)
+				{
+					const std::uint8_t *p = src + (i * channels + c) * 3;
+					auto value = static_cast<std::uint32_t>(p[0]) << 8 | static_cast<std::uint32_t>(p[1]) << 16 |
+					             static_cast<std::uint32_t>(p[2]) << 24;
+					dst[i] = static_cast<std::int32_t>(value) >> 8;
+				}
+				break;
+			}
+		}
+	}
+
+	/// @brief Choose the smallest coding of one channel
+	void planSubframe(const std::int32_t *x, unsigned n, unsigned bps, Subframe &best)
+	{
+		if (std::all_of(x + 1, x + n, [x](std::int32_t v) { return v == x[0]; }))
+		{
+			best.Kind = Subframe::Type::Constant;
+			best.Bits = 8 + bps;
+			return;
+		}
+		best.Kind = Subframe::Type::Verbatim;
+		best.Bits = 8 + static_cast<std::uint64_t>(n) * bps;
+		if (n <= 4)
+			return;
+
+		// Fixed predictor with the smallest sum of absolute residuals
+		std::uint64_t errors[5] = {};
+		for (unsigned i = 4; i < n; ++i)
+		{
+			std::int32_t e0 = x[i], e1 = e0 - x[i - 1], e2 = e1 - (x[i - 1] - x[i - 2]),
+			             e3 = e2 - (x[i - 1] - 2 * x[i - 2] + x[i - 3]),
+			             e4 = e3 - (x[i - 1] - 3 * x[i - 2] + 3 * x[i - 3] - x[i - 4]);
+			errors[0] += static_cast<std::uint32_t>(std::abs(e0));
+			errors[1] += static_cast<std::uint32_t>(std::abs(e1));
+			errors[2] += static_cast<std::uint32_t>(std::abs(e2));
+			errors[3] += static_cast<std::uint32_t>(std::abs(e3));
+			errors[4] += static_cast<std::uint32_t>(std::abs(e4));
+		}
+		auto fixedOrder = static_cast<unsigned>(std::min_element(errors, errors + 5) - errors);
+		m_trial.Kind = Subframe::Type::Fixed;
+		m_trial.Order = fixedOrder;
+		fixedResidual(x, n, fixedOrder, m_trial.Residual.data());
+		planRice(m_trial.Residual.data(), n, fixedOrder, m_config.MaxPartitionOrder, m_sums, m_trial.Rice);
+		m_trial.Bits = 8 + fixedOrder * bps + m_trial.Rice.Bits;
+		if (m_trial.Bits < best.Bits)
+			std::swap(best, m_trial);
+
+		if (m_config.MaxLpcOrder > 0 && n > m_config.MaxLpcOrder)
+			planLpc(x, n, bps, best);
+	}
+
+	/// @brief Try linear prediction
+	void planLpc(const std::int32_t *x, unsigned n, unsigned bps, Subframe &best)
+	{
+		// Tukey(0.5) window
+		if (m_window.size() != n)
+		{
+			m_window.assign(n, 1.0);
+			unsigned taper = n / 4;
+			for (unsigned i = 0; i < taper; ++i)
+			{
+				double w = 0.5 - 0.5 * std::cos(3.14159265358979323846 * i / taper);
+				m_window[i] = w;
+				m_window[n - 1 - i] = w;
+			}
+		}
+		for (unsigned i = 0; i < n; ++i)
+			m_windowed[i] = x[i] * m_window[i];
+
+		const unsigned maxOrder = m_config.MaxLpcOrder;
+		double         autoc[maxLpcOrder + 1];
+		for (unsigned lag = 0; lag <= maxOrder; ++lag)
+			autoc[lag] = dotProduct(m_windowed.data(), m_windowed.data() + lag, n - lag);
+		if (autoc[0] <= 0.0)
+			return;
+
+		// Levinson-Durbin recursion: coefs[m - 1][j] predicts from x[i - 1 - j] with order m
+		double   coefs[maxLpcOrder][maxLpcOrder];
+		double   errors[maxLpcOrder];
+		double   a[maxLpcOrder] = {};
+		double   error = autoc[0];
+		unsigned orders = 0;
+		for (unsigned m = 0; m < maxOrder; ++m)
+		{
+			double k = autoc[m + 1];
+			for (unsigned j = 0; j < m; ++j)
+				k -= a[j] * autoc[m - j];
+			k /= error;
+			double previous[maxLpcOrder];
+			std::copy(a, a + m, previous);
+			for (unsigned j = 0; j < m; ++j)
+				a[j] = previous[j] - k * previous[m - 1 - j];
+			a[m] = k;
+			error *= 1.0 - k * k;
+			if (!(error > 0.0) || !std::isfinite(error))
+				break;
+			std::copy(a, a + m + 1, coefs[m]);
+			errors[m] = error;
+			orders = m + 1;
+		}
+		if (orders == 0)
+			return;
+
+		auto tryOrder = [&](unsigned order) {
+			if (quantize(coefs[order - 1], order, bps, m_trial) && lpcResidual(x, n, bps, m_trial))
+			{
+				planRice(m_trial.Residual.data(), n, order, m_config.MaxPartitionOrder, m_sums, m_trial.Rice);
+				m_trial.Bits = 8 + order * bps + 9 + order * m_trial.Precision + m_trial.Rice.Bits;
+				if (m_trial.Bits < best.Bits)
+					std::swap(best, m_trial);
+			}
+		};
+
+		if (m_config.Exhaustive)
+		{
+			for (unsigned order = 1; order <= orders; ++order)
+				tryOrder(order);
+			return;
+		}
+
+		// Estimate the residual size of each order from the prediction error
+		unsigned bestOrder = 1;
+		double   bestBits = std::numeric_limits<double>::max();
+		for (unsigned order = 1; order <= orders; ++order)
+		{
+			double perSample = std::max(0.0, 0.5 * std::log2(errors[order - 1] * 0.5 / n));
+			double bits = perSample * (n - order) + order * (bps + m_precision);
+			if (bits < bestBits)
+			{
+				bestBits = bits;
+				bestOrder = order;
+			}
+		}
+		tryOrder(bestOrder);
+	}
+
+	/// @brief Quantize LPC coefficients into a subframe
+	bool quantize(const double *lpc, unsigned order, unsigned bps, Subframe &subframe) const
+	{
+		// Keep the predictor sums within 32 bits for 16-bit decoders, as the reference encoder does
+		unsigned precision = m_precision;
+		if (bps <= 16)
+			precision = std::min(precision, 32 - bps - (static_cast<unsigned>(std::bit_width(order)) - 1));
+		if (precision < 5)
+			return false;
+
+		double cmax = 0.0;
+		for (unsigned j = 0; j < order; ++j)
+			cmax = std::max(cmax, std::fabs(lpc[j]));
+		if (cmax <= 0.0)
+			return false;
+
+		int log2cmax;
+		std::frexp(cmax, &log2cmax);
+		int shift = static_cast<int>(precision) - 1 - log2cmax;
+		if (shift < 0)
+			return false;
+		shift = std::min(shift, 15);
+
+		const std::int32_t qmax = (1 << (precision - 1)) - 1, qmin = -(1 << (precision - 1));
+		double             carry = 0.0;
+		for (unsigned j = 0; j < order; ++j)
+		{
+			carry += lpc[j] * static_cast<double>(1 << shift);
+			auto q = static_cast<std::int32_t>(std::clamp<long>(std::lround(carry), qmin, qmax));
+			carry -= q;
+			subframe.Coefs[j] = q;
+		}
+		subframe.Kind = Subframe::Type::Lpc;
+		subframe.Order = order;
+		subframe.Precision = precision;
+		subframe.Shift = shift;
+		return true;
+	}
+
+	/// @brief Compute the residual of a quantized predictor
+	static bool lpcResidual(const std::int32_t *x, unsigned n, unsigned bps, Subframe &subframe)
+	{
+		std::uint64_t magnitude = 0;
+		for (unsigned j = 0; j < subframe.Order; ++j)
+			magnitude += static_cast<std::uint64_t>(std::abs(subframe.Coefs[j]));
+		if ((magnitude << (bps - 1)) < (1ull << 30))
+		{
+			lpcResidual32(x, n, subframe.Coefs.data(), subframe.Order, subframe.Shift, subframe.Residual.data());
+			return true;
+		}
+		return lpcResidual64(x, n, subframe.Coefs.data(), subframe.Order, subframe.Shift, subframe.Residual.data());
+	}
+
+	/// @brief Write the frame header without its CRC
+	void writeHeader(BitWriter &writer, unsigned n, std::uint32_t frameNumber, unsigned assignment) const
+	{
+		unsigned sizeCode = blockSizeCode(n);
+		writer.put(0xFFF8, 16); // sync code, fixed block size
+		writer.put(sizeCode, 4);
+		writer.put(m_format.RateCode, 4);
+		writer.put(assignment, 4);
+		writer.put(m_format.SizeCode, 3);
+		writer.put(0, 1);
+
+		// Frame number in the extended UTF-8 coding
+		if (frameNumber < 0x80)
+		{
+			writer.put(frameNumber, 8);
+		}
+		else
+		{
+			unsigned bytes = frameNumber < 0x800 ? 2 : frameNumber < 0x10000 ? 3 : frameNumber < 0x200000 ? 4
+			                                       : frameNumber < 0x4000000 ? 5
+			                                                                 : 6;
+			writer.put(((0xFF00u >> bytes) & 0xFF) | (frameNumber >> (6 * (bytes - 1))), 8);
+			for (unsigned i = bytes - 1; i-- > 0;)
+				writer.put(0x80 | ((frameNumber >> (6 * i)) & 0x3F), 8);
+		}
+
+		if (sizeCode == 6)
+			writer.put(n - 1, 8);
+		else if (sizeCode == 7)
+			writer.put(n - 1, 16);
+		if (m_format.RateCode == 12)
+			writer.put(m_format.SampleRate / 1000, 8);
+		else if (m_format.RateCode == 13)
+			writer.put(m_format.SampleRate, 16);
+		else if (m_format.RateCode == 14)
+			writer.put(m_format.SampleRate / 10, 16);
+	}
+
+	/// @brief Write a planned subframe
+	static void writeSubframe(BitWriter &writer, const Subframe &subframe, const std::int32_t *x, unsigned n,
+	                          unsigned bps)
+	{
+		switch (subframe.Kind)
+		{
+		case Subframe::Type::Constant:
+			writer.put(0x00, 8);
+			writer.putSigned(x[0], bps);
+			return;
+		case Subframe::Type::Verbatim:
+			writer.put(0x02, 8);
+			for (unsigned i = 0; i < n; ++i)
+				writer.putSigned(x[i], bps);
+			return;
+		case Subframe::Type::Fixed:
+			writer.put((0x08 | subframe.Order) << 1, 8);
+			break;
+		case Subframe::Type::Lpc:
+			writer.put((0x20 | (subframe.Order - 1)) << 1, 8);
+			break;
+		}
+
+		for (unsigned i = 0; i < subframe.Order; ++i)
+			writer.putSigned(x[i], bps);
+		if (subframe.Kind == Subframe::Type::Lpc)
+		{
+			writer.put(subframe.Precision - 1, 4);
+			writer.putSigned(subframe.Shift, 5);
+			for (unsigned j = 0; j < subframe.Order; ++j)
+				writer.putSigned(subframe.Coefs[j], subframe.Precision);
+		}
+
+		const RicePlan &rice = subframe.Rice;
+		writer.put(rice.Extended ? 1 : 0, 2);
+		writer.put(rice.PartitionOrder, 4);
+		const unsigned partitionSize = n >> rice.PartitionOrder;
+		for (unsigned p = 0; p < (1u << rice.PartitionOrder); ++p)
+		{
+			unsigned k = rice.Params[p];
+			writer.put(k, rice.Extended ? 5 : 4);
+			for (unsigned i = p == 0 ? subframe.Order : p * partitionSize; i < (p + 1) * partitionSize; ++i)
+				writer.putRice(zigzag(subframe.Residual[i]), k);
+		}
+	}
+
+	/// @brief Decode a frame and compare it with the input
+	void verify(const std::vector<std::uint8_t> &frame, unsigned n)
+	{
+		if (crc16(frame.data(), frame.size()) != 0)
+			throw std::runtime_error("FLAC verification failed: frame CRC");
+
+		BitReader reader(frame.data(), frame.size());
+		if (reader.get(16) != 0xFFF8)
+			throw std::runtime_error("FLAC verification failed: frame sync");
+		unsigned sizeCode = reader.get(4);
+		unsigned rateCode = reader.get(4);
+		unsigned assignment = reader.get(4);
+		reader.get(4);
+		std::uint32_t lead = reader.get(8);
+		if (lead & 0x80)
+			for (lead <<= 1; lead & 0x80; lead <<= 1)
+				reader.get(8);
+		unsigned blockSize = blockSizeOf(sizeCode);
+		if (sizeCode == 6 || sizeCode == 7)
+			blockSize = reader.get(sizeCode == 6 ? 8 : 16) + 1;
+		if (rateCode >= 12)
+			reader.get(rateCode == 12 ? 8 : 16);
+		size_t headerSize = reader.bytePosition();
+		if (reader.get(8) != crc8(frame.data(), headerSize) || blockSize != n)
+			throw std::runtime_error("FLAC verification failed: frame header");
+
+		const unsigned channels = assignment < 8 ? assignment + 1 : 2;
+		m_decoded.resize(channels);
+		for (unsigned c = 0; c < channels; ++c)
+		{
+			decodeSubframe(reader, n, m_format.BitsPerSample + (isSide(assignment, c) ? 1 : 0), m_decoded[c]);
+		}
+
+		std::vector<std::int32_t> &a = m_decoded[0];
+		std::vector<std::int32_t> *b = channels > 1 ? &m_decoded[1] : nullptr;
+		for (unsigned i = 0; assignment >= 8 && i < n; ++i)
+		{
+			std::int32_t left, right;
+			if (assignment == 8)
+			{
+				left = a[i];
+				right = left - (*b)[i];
+			}
+			else if (assignment == 9)
+			{
+				right = (*b)[i];
+				left = a[i] + right;
+			}
+			else
+			{
+				std::int32_t sum = (a[i] * 2) | ((*b)[i] & 1);
+				left = (sum + (*b)[i]) >> 1;
+				right = (sum - (*b)[i]) >> 1;
+			}
+			a[i] = left;
+			(*b)[i] = right;
+		}
+
+		for (unsigned c = 0; c < channels; ++c)
+			if (!std::equal(m_decoded[c].begin(), m_decoded[c].begin() + n, m_samples[c].begin()))
+				throw std::runtime_error("FLAC verification failed: decoded samples differ");
+	}
+
+	/// @brief Decode one subframe
+	static void decodeSubframe(BitReader &reader, unsigned n, unsigned bps, std::vector<std::int32_t> &out)
+	{
+		out.resize(n);
+		std::uint32_t header = reader.get(8);
+		if (header & 0x81)
+			throw std::runtime_error("FLAC verification failed: subframe header");
+		unsigned type = header >> 1;
+		if (type == 0)
+		{
+			std::fill(out.begin(), out.end(), reader.getSigned(bps));
+			return;
+		}
+		if (type == 1)
+		{
+			for (auto &sample : out)
+				sample = reader.getSigned(bps);
+			return;
+		}
+
+		bool                                 lpc = type >= 0x20;
+		unsigned                             order = lpc ? (type & 0x1F) + 1 : type & 0x07;
+		unsigned                             precision = 0;
+		int                                  shift = 0;
+		std::array<std::int32_t, maxLpcOrder> coefs{};
+		for (unsigned i = 0; i < order; ++i)
+			out[i] = reader.getSigned(bps);
+		if (lpc)
+		{
+			precision = reader.get(4) + 1;
+			shift = reader.getSigned(5);
+			for (unsigned j = 0; j < order; ++j)
+				coefs[j] = reader.getSigned(precision);
+		}
+
+		unsigned paramBits = reader.get(2) == 1 ? 5 : 4;
+		unsigned partitionOrder = reader.get(4);
+		unsigned partitionSize = n >> partitionOrder;
+		for (unsigned p = 0, i = order; p < (1u << partitionOrder); ++p)
+		{
+			unsigned k = reader.get(paramBits);
+			for (unsigned end = (p + 1) * partitionSize; i < end; ++i)
+			{
+				std::uint32_t value = (reader.getUnary() << k) | reader.get(k);
+				out[i] = static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+			}
+		}
+
+		for (unsigned i = order; i < n; ++i)
+		{
+			std::int64_t prediction = 0;
+			if (lpc)
+			{
+				for (unsigned j = 0; j < order; ++j)
+					prediction += static_cast<std::int64_t>(coefs[j]) * out[i - 1 - j];
+				prediction >>= shift;
+			}
+			else
+			{
+				static constexpr std::int64_t weights[5][4] = {
+				    {0, 0, 0, 0}, {1, 0, 0, 0}, {2, -1, 0, 0}, {3, -3, 1, 0}, {4, -6, 4, -1}};
+				for (unsigned j = 0; j < order; ++j)
+					prediction += weights[order][j] * out[i - 1 - j];
+			}
+			out[i] += static_cast<std::int32_t>(prediction);
+		}
+	}
+
+	/// @brief Stream format
+	const StreamFormat &m_format;
+	/// @brief Compression level parameters
+	const LevelConfig &m_config;
+	/// @brief Decode and compare every frame
+	bool m_verify;
+	/// @brief LPC coefficient precision
+	unsigned m_precision;
+	/// @brief Channel planes, followed by mid and side for stereo decorrelation
+	std::vector<std::vector<std::int32_t>> m_samples;
+	/// @brief Chosen subframe of each plane
+	std::vector<Subframe> m_subframes;
+	/// @brief Candidate being evaluated
+	Subframe m_trial;
+	/// @brief Analysis window of the current block size
+	std::vector<double> m_window;
+	/// @brief Windowed samples
+	std::vector<double> m_windowed;
+	/// @brief Partition sums
+	std::vector<std::uint64_t> m_sums;
+	/// @brief Decoded planes during verification
+	std::vector<std::vector<std::int32_t>> m_decoded;
+};
+
+/// @brief Append a big-endian value
+static void appendBE(std::string &out, std::uint64_t value, int bytes)
+{
+	for (int i = bytes - 1; i >= 0; --i)
+		out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+/// @brief Append a metadata block header
+static void appendBlockHeader(std::string &out, unsigned type, size_t length, bool last)
+{
+	out += static_cast<char>(type | (last ? 0x80 : 0));
+	appendBE(out, length, 3);
+}
+
+bool FlacEncoder::canEncode(const WavReader &wav)
+{
+	using Format = WavReader::SampleFormat;
+	return (wav.format() == Format::UInt8 || wav.format() == Format::Int16 || wav.format() == Format::Int24) &&
+	       wav.channels() >= 1 && wav.channels() <= 8 && wav.sampleRate() >= 1 && wav.sampleRate() < (1u << 20) &&
+	       wav.frames() < (1ull << 36);
+}
+
+void FlacEncoder::encode(const WavReader &wav, const std::filesystem::path &filePath, const TagWriter::Tags &tags,
+                         const Settings &settings, ThreadPool &pool)
+{
+	if (!canEncode(wav))
+		throw std::runtime_error("Input format not supported by the FLAC encoder");
+
+	const LevelConfig  &config = levels[static_cast<size_t>(std::clamp(settings.CompressionLevel, 0, 8))];
+	const unsigned      bits = WavReader::bytesPerSample(wav.format()) * 8;
+	const StreamFormat  format = {wav.format(), wav.channels(), bits, wav.sampleRate(), wav.blockAlign(),
+	                              sampleRateCode(wav.sampleRate()), bits == 8 ? 1u : bits == 16 ? 4u : 6u};
+	const std::uint64_t totalSamples = wav.frames();
+	const std::uint64_t frameCount = (totalSamples + config.BlockSize - 1) / config.BlockSize;
+
+	// One seek point per interval, on the frame that contains its target sample
+	std::vector<std::uint64_t> seekFrames;
+	for (std::uint64_t target = 0; target < totalSamples; target += std::uint64_t(seekInterval) * format.SampleRate)
+		if (seekFrames.empty() || seekFrames.back() != target / config.BlockSize)
+			seekFrames.push_back(target / config.BlockSize);
+
+	std::string comments = TagWriter::vorbisComments(tags);
+	if (comments.size() >= (1u << 24))
+		throw std::runtime_error("Vorbis comment too large");
+
+	std::string header = "fLaC";
+	appendBlockHeader(header, 0, 34, false);
+	const size_t streamInfoOffset = header.size();
+	header.append(34, '\0');
+	size_t seekTableOffset = 0;
+	if (!seekFrames.empty())
+	{
+		appendBlockHeader(header, 3, seekFrames.size() * 18, false);
+		seekTableOffset = header.size();
+		header.append(seekFrames.size() * 18, '\0');
+	}
+	appendBlockHeader(header, 4, comments.size(), false);
+	header += comments;
+	appendBlockHeader(header, 1, TagWriter::Padding, true);
+	header.append(TagWriter::Padding, '\0');
+
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("Failed to open " + filePath.string());
+	file.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+	// Frames are encoded in windows: workers claim the next frame of the window until none is left,
+	// then the window is written in order. The first worker also hashes the window's audio.
+	const unsigned workers = std::max(1u, pool.size());
+	const size_t   window = std::max<size_t>(32, size_t(workers) * 8);
+	std::vector<FrameEncoder> encoders;
+	encoders.reserve(workers);
+	for (unsigned i = 0; i < workers; ++i)
+		encoders.emplace_back(format, config, settings.Verify);
+	std::vector<std::vector<std::uint8_t>> frames(static_cast<size_t>(std::min<std::uint64_t>(window, frameCount)));
+
+	Md5                        md5;
+	std::vector<std::uint8_t>  signedBytes;
+	std::vector<std::uint64_t> seekOffsets;
+	std::uint64_t              position = 0;
+	std::uint32_t              minFrameSize = std::numeric_limits<std::uint32_t>::max(), maxFrameSize = 0;
+	const std::uint8_t        *pcm = wav.sampleData();
+	for (std::uint64_t firstFrame = 0; firstFrame < frameCount; firstFrame += window)
+	{
+		const auto count = static_cast<size_t>(std::min<std::uint64_t>(window, frameCount - firstFrame));
+		const std::uint64_t firstSample = firstFrame * config.BlockSize;
+		const std::uint64_t lastSample = std::min(totalSamples, (firstFrame + count) * config.BlockSize);
+		std::atomic<size_t> next{0};
+
+		pool.parallelFor(workers, [&](size_t worker) {
+			if (worker == 0)
+			{
+				const std::uint8_t *begin = pcm + firstSample * format.BlockAlign;
+				const auto          size = static_cast<size_t>((lastSample - firstSample) * format.BlockAlign);
+				if (format.Format == WavReader::SampleFormat::UInt8)
+				{
+					// FLAC hashes 8-bit audio as signed bytes
+					signedBytes.resize(size);
+					for (size_t i = 0; i < size; ++i)
+						signedBytes[i] = static_cast<std::uint8_t>(begin[i] ^ 0x80);
+					md5.update(signedBytes.data(), size);
+				}
+				else
+				{
+					md5.update(begin, size);
+				}
+			}
+
+			for (size_t i; (i = next.fetch_add(1)) < count;)
+			{
+				std::uint64_t frame = firstFrame + i;
+				std::uint64_t start = frame * config.BlockSize;
+				auto n = static_cast<unsigned>(std::min<std::uint64_t>(config.BlockSize, totalSamples - start));
+				encoders[worker].encode(pcm + start * format.BlockAlign, n, static_cast<std::uint32_t>(frame),
+				                        frames[i]);
+			}
+		});
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (seekOffsets.size() < seekFrames.size() && seekFrames[seekOffsets.size()] == firstFrame + i)
+				seekOffsets.push_back(position);
+			auto size = static_cast<std::uint32_t>(frames[i].size());
+			minFrameSize = std::min(minFrameSize, size);
+			maxFrameSize = std::max(maxFrameSize, size);
+			file.write(reinterpret_cast<const char *>(frames[i].data()), static_cast<std::streamsize>(size));
+			position += size;
+		}
+	}
+	if (frameCount == 0)
+		minFrameSize = 0;
+
+	// STREAMINFO and the seek table are only known now
+	std::string streamInfo;
+	appendBE(streamInfo, config.BlockSize, 2);
+	appendBE(streamInfo, config.BlockSize, 2);
+	appendBE(streamInfo, minFrameSize, 3);
+	appendBE(streamInfo, maxFrameSize, 3);
+	appendBE(streamInfo,
+	         (std::uint64_t(format.SampleRate) << 44) | (std::uint64_t(format.Channels - 1) << 41) |
+	             (std::uint64_t(format.BitsPerSample - 1) << 36) | totalSamples,
+	         8);
+	for (std::uint8_t byte : md5.finish())
+		streamInfo += static_cast<char>(byte);
+	file.seekp(static_cast<std::streamoff>(streamInfoOffset));
+	file.write(streamInfo.data(), static_cast<std::streamsize>(streamInfo.size()));
+
+	if (!seekFrames.empty())
+	{
+		std::string seekTable;
+		for (size_t i = 0; i < seekFrames.size(); ++i)
+		{
+			std::uint64_t sample = seekFrames[i] * config.BlockSize;
+			appendBE(seekTable, sample, 8);
+			appendBE(seekTable, seekOffsets[i], 8);
+			appendBE(seekTable, std::min<std::uint64_t>(config.BlockSize, totalSamples - sample), 2);
+		}
+		file.seekp(static_cast<std::streamoff>(seekTableOffset));
+		file.write(seekTable.data(), static_cast<std::streamsize>(seekTable.size()));
+	}
+
+	file.close();
+	if (!file)
+		throw std::runtime_error("Failed to write " + filePath.string());
+}
@@ -0,0 +1,82 @@
+/**
+ * @file FlacEncoder.h
+ * @brief Native multithreaded FLAC encoder for PCM WAV inputs.
+ *
+ * The stream is cut into fixed-size frames, which FLAC codes independently,
+ * so the frames are encoded in parallel: every worker of the pool takes the
+ * next unclaimed frame until a window of frames is done, and the window is
+ * then written in order. Autocorrelation and LPC residuals run on SSE2/SSE4.1
+ * or NEON. STREAMINFO (with the MD5 of the audio), a seek table and the
+ * Vorbis comments are written directly, followed by padding for retagging.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * WavReader wav;
+ * if (wav.open("master.wav") && FlacEncoder::canEncode(wav))
+ * {
+ *     ThreadPool pool;
+ *     FlacEncoder::encode(wav, "master.flac", tags, FlacEncoder::Settings(), pool);
+ * }
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "TagWriter.h"
+#include "ThreadPool.h"
+#include "WavReader.h"
+#include <filesystem>
+#include <string_view>
+
+/// @brief Native FLAC encoder
+class FlacEncoder
+{
+  public:
+	/// @brief Encoder settings
+	class Settings
+	{
+	  public:
+		/// @brief Compression level 0 (fastest) to 8 (smallest), as in the reference encoder
+		int CompressionLevel = 5;
+		/// @brief Decode every frame after encoding it and compare it with the input
+		bool Verify = false;
+	};
+
+	/// @brief Codec name that selects the encoder in the markup
+	static constexpr std::string_view CodecName = "flac-native";
+
+	/**
+	 * @brief Check whether a file can be encoded natively
+	 * @param wav Opened input
+	 * @return true for 8, 16 and 24-bit integer PCM with 1 to 8 channels
+	 */
+	static bool canEncode(const WavReader &wav);
+
+	/**
+	 * @brief Encode a WAV file to FLAC
+	 *
+	 * @param wav Opened input, see canEncode()
+	 * @param filePath Output file, replaced if it exists
+	 * @param tags Vorbis comments
+	 * @param settings Encoder settings
+	 * @param pool Workers that encode the frames
+	 * @throws std::runtime_error if the output cannot be written or verification fails
+	 */
+	static void encode(const WavReader &wav, const std::filesystem::path &filePath, const TagWriter::Tags &tags,
+	                   const Settings &settings, ThreadPool &pool);
+};
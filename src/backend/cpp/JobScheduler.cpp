@@ -0,0 +1,752 @@
+/**
+ * @file JobScheduler.cpp
+ * @brief Runs encoder jobs in parallel with per-device I/O limits.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "JobScheduler.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#endif
+
+JobScheduler::JobScheduler(unsigned slots, unsigned deviceJobs) : m_slots(slots), m_deviceJobs(deviceJobs)
+{
+	if (m_slots == 0)
+		m_slots = ThreadBudget::availableCpus();
+}
+
+void JobScheduler::setPolicy(const Policy &policy)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_policy = policy;
+	m_wake.notify_all();
+}
+
+void JobScheduler::setConcurrency(const ConcurrencyController::Settings &settings)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto                        controller = std::make_unique<ConcurrencyController>(settings, m_slots);
+	m_slots = controller->limit();
+	if (controller->settings().Min < controller->settings().Max)
+		m_controller = std::move(controller);
+	else
+		m_controller.reset();
+	m_window = Window();
+	m_window.Start = m_window.Counted = std::chrono::steady_clock::now();
+	m_wake.notify_all();
+}
+
+unsigned JobScheduler::slots() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_slots;
+}
+
+void JobScheduler::setPlacement(CpuPlacement::Policy policy)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (policy == CpuPlacement::Policy::None)
+		m_placement.reset();
+	else
+		m_placement = std::make_shared<CpuPlacement>(policy);
+}
+
+CpuPlacement::Policy JobScheduler::placement() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_placement ? m_placement->policy() : CpuPlacement::Policy::None;
+}
+
+std::map<int, JobScheduler::NodeStats> JobScheduler::nodeStats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_nodes;
+}
+
+std::optional<ConcurrencyController::Stats> JobScheduler::concurrency() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_controller)
+		return std::nullopt;
+	return m_controller->stats();
+}
+
+void JobScheduler::setWatchdog(const Watchdog::Settings &settings)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_watchdog = std::make_unique<Watchdog>(settings);
+	m_wake.notify_all();
+}
+
+std::optional<JobScheduler::StragglerStats> JobScheduler::stragglerStats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_watchdog)
+		return std::nullopt;
+	StragglerStats stats = m_stragglers;
+	stats.Factors = m_watchdog->factors();
+	return stats;
+}
+
+thread_local JobScheduler::Active *JobScheduler::t_active = nullptr;
+
+unsigned JobScheduler::copy()
+{
+	return t_active ? t_active->Copy : 0;
+}
+
+bool JobScheduler::claim()
+{
+	if (!t_active)
+		return true;
+	std::lock_guard<std::mutex> lock(t_active->Scheduler->m_mutex);
+	return t_active->Scheduler->keep(*t_active);
+}
+
+bool JobScheduler::keep(Active &active)
+{
+	Task &task = *active.Of;
+	if (active.Dropped)
+		return false;
+	if (task.Winner)
+		return task.Winner == &active;
+	task.Winner = &active;
+	for (Active *other : task.Copies)
+	{
+		if (other == &active)
+			continue;
+		other->Dropped = true;
+		other->Processes->kill();
+	}
+	if (active.Copy > 0)
+		++m_stragglers.CopiesKept;
+	return true;
+}
+
+double JobScheduler::runningSeconds(const Active &active, std::chrono::steady_clock::time_point now)
+{
+	double seconds = std::chrono::duration<double>(now - active.Started).count() - active.LentSeconds;
+	if (active.LentTo)
+		seconds -= std::chrono::duration<double>(now - active.LentAt).count();
+	return std::max(0.0, seconds);
+}
+
+void JobScheduler::expire(Active &active)
+{
+	// A job that still has another copy running leaves the job to it; the last copy is run again while retries
+	// are left, otherwise its failure is kept
+	const Task &task = *active.Of;
+	const bool  alone = std::none_of(task.Copies.begin(), task.Copies.end(),
+	                                 [&active](const Active *other) { return other != &active && !other->Dropped; });
+	active.Killed = true;
+	active.Retry = alone && task.Retries < m_watchdog->settings().Retries;
+	active.Dropped = !alone || active.Retry;
+	++m_stragglers.TimedOut;
+	active.Processes->kill();
+}
+
+std::map<std::uint64_t, JobScheduler::DeviceStats> JobScheduler::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+JobScheduler::LaneStats JobScheduler::laneStats(Lane lane) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_lanes[static_cast<size_t>(lane)];
+}
+
+/// @brief The file itself if it exists, otherwise its nearest existing parent
+static std::filesystem::path existingPath(const std::filesystem::path &path)
+{
+	std::error_code       ec;
+	std::filesystem::path existing = path.empty() ? std::filesystem::path(".") : path;
+	while (!std::filesystem::exists(existing, ec) && existing.has_parent_path() && existing != existing.parent_path())
+		existing = existing.parent_path();
+	if (!std::filesystem::exists(existing, ec))
+		existing = ".";
+	return existing;
+}
+
+JobScheduler::Device JobScheduler::device(const std::filesystem::path &path)
+#ifdef _WIN32
+{
+	// Drive letters and UNC shares stand in for the volume
+	Device                device;
+	std::error_code       ec;
+	std::filesystem::path absolute = std::filesystem::absolute(existingPath(path), ec);
+	device.Name = absolute.root_name().string();
+	device.Id = std::hash<std::string>()(device.Name) | 1;
+	return device;
+}
+#else  // !_WIN32
+{
+	Device      device;
+	struct stat st;
+	if (stat(existingPath(path).c_str(), &st) != 0)
+		return device;
+	device.Id = static_cast<std::uint64_t>(st.st_dev);
+	device.Name = "dev " + std::to_string(device.Id);
+
+#ifdef __linux__
+	const std::string number = std::to_string(major(st.st_dev)) + ":" + std::to_string(minor(st.st_dev));
+	device.Name = number;
+	std::error_code       ec;
+	std::filesystem::path sysfs = std::filesystem::canonical("/sys/dev/block/" + number, ec);
+	if (ec)
+		return device; // network, memory and pooled file systems have no block device of their own
+	device.Name = sysfs.filename().string();
+
+	// Partitions take the queue settings of their disk
+	for (const auto &dir : {sysfs, sysfs.parent_path()})
+	{
+		std::ifstream rotational(dir / "queue" / "rotational");
+		int           value;
+		if (rotational >> value)
+		{
+			device.Rotational = value != 0;
+			break;
+		}
+	}
+#endif
+	return device;
+}
+#endif // _WIN32
+
+std::uint64_t JobScheduler::diskOffset(const std::filesystem::path &path)
+{
+#ifdef __linux__
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	alignas(fiemap) char buffer[sizeof(fiemap) + sizeof(fiemap_extent)] = {};
+	auto                *map = reinterpret_cast<fiemap *>(buffer);
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+	std::uint64_t offset = 0;
+	if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0)
+		offset = map->fm_extents[0].fe_physical;
+	::close(fd);
+	return offset;
+#else
+	(void)path;
+	return 0;
+#endif
+}
+
+unsigned JobScheduler::limit(std::uint64_t device) const
+{
+	if (m_deviceJobs > 0)
+		return m_deviceJobs;
+	auto it = m_devices.find(device);
+	return it != m_devices.end() && it->second.Rotational ? 2u : capacity();
+}
+
+unsigned JobScheduler::capacity() const
+{
+	return m_controller ? m_controller->settings().Max : m_slots;
+}
+
+void JobScheduler::account(std::chrono::steady_clock::time_point now)
+{
+	const unsigned running = m_running[0] + m_running[1];
+	m_window.SlotSeconds += running * std::chrono::duration<double>(now - m_window.Counted).count();
+	m_window.Counted = now;
+}
+
+void JobScheduler::measure(std::chrono::steady_clock::time_point now)
+{
+	if (!m_controller)
+		return;
+	const double elapsed = std::chrono::duration<double>(now - m_window.Start).count();
+	if (elapsed < m_controller->settings().Interval || m_window.Jobs < m_slots)
+		return;
+	account(now);
+
+	// Slots that stood empty for want of jobs say nothing about how many jobs the system takes
+	if (m_window.SlotSeconds >= 0.9 * m_slots * elapsed)
+	{
+		const ConcurrencyController::Decision decision = m_controller->update(m_window.Work / elapsed);
+		if (decision.To != m_slots)
+		{
+			m_slots = decision.To;
+			m_wake.notify_all();
+		}
+	}
+	m_window = Window();
+	m_window.Start = m_window.Counted = now;
+}
+
+std::vector<std::vector<JobScheduler::Entry>> JobScheduler::queues(const std::vector<Job> &jobs)
+{
+	std::map<std::uint64_t, size_t> queueOf;
+	std::vector<std::vector<Entry>> result;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		Entry entry;
+		entry.Index = i;
+		for (const auto *paths : {&jobs[i].Reads, &jobs[i].Writes})
+		{
+			for (const auto &path : *paths)
+			{
+				Device device = JobScheduler::device(path);
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_devices.try_emplace(device.Id, device);
+				}
+				if (std::find(entry.Devices.begin(), entry.Devices.end(), device.Id) == entry.Devices.end())
+					entry.Devices.push_back(device.Id);
+			}
+		}
+		if (!jobs[i].Reads.empty())
+			entry.Offset = diskOffset(jobs[i].Reads.front());
+
+		// A job queues on the device of its first input
+		const std::uint64_t primary = entry.Devices.empty() ? 0 : entry.Devices.front();
+		auto [it, added] = queueOf.try_emplace(primary, result.size());
+		if (added)
+			result.emplace_back();
+		result[it->second].push_back(std::move(entry));
+	}
+
+	// Files the system does not place keep their order in front of the others
+	for (auto &queue : result)
+		std::stable_sort(queue.begin(), queue.end(),
+		                 [](const Entry &a, const Entry &b) { return a.Offset < b.Offset; });
+	return result;
+}
+
+std::vector<size_t> JobScheduler::plan(const std::vector<Job> &jobs)
+{
+	std::vector<std::vector<Entry>> pending = queues(jobs);
+	std::vector<size_t>             order;
+	for (size_t round = 0; order.size() < jobs.size(); ++round)
+		for (const auto &queue : pending)
+			if (round < queue.size())
+				order.push_back(queue[round].Index);
+	return order;
+}
+
+bool JobScheduler::admit(Lane lane, bool aged) const
+{
+	const unsigned running = m_running[0] + m_running[1];
+	if (lane == Lane::Interactive || aged)
+		return running < m_slots;
+	const unsigned reserved = std::min(m_policy.Reserved, m_slots - 1);
+	return m_waiting[static_cast<size_t>(Lane::Interactive)] == 0 && running + reserved < m_slots;
+}
+
+bool JobScheduler::preempt(Active &by)
+{
+	if (m_policy.Preempt == Preemption::None)
+		return false;
+
+	// The batch job started last has done the least work and is the furthest from finishing. Only encoder
+	// processes can be paused or reniced, so a job that runs none right now would keep its CPU
+	auto victim = std::find_if(m_active.rbegin(), m_active.rend(), [](const Active *active) {
+		return active->Kind == Lane::Batch && !active->LentTo && !active->Deprioritized &&
+		       active->Processes->size() > 0;
+	});
+	if (victim == m_active.rend())
+		return false;
+	Active &batch = **victim;
+	++m_lanes[static_cast<size_t>(Lane::Batch)].Preempted;
+
+	// Either way the batch job lends its slot to the interactive job until that one is done. Reniced, it keeps
+	// running on the CPU time the interactive job leaves, so the slots in use never exceed slots()
+	if (m_policy.Preempt == Preemption::Nice)
+	{
+		batch.Processes->deprioritize(10);
+		batch.Deprioritized = true;
+	}
+	else
+		batch.Processes->pause();
+	const auto now = std::chrono::steady_clock::now();
+	batch.LentTo = &by;
+	batch.LentAt = now;
+	by.Borrowed = &batch;
+	account(now);
+	--m_running[static_cast<size_t>(Lane::Batch)];
+	return true;
+}
+
+void JobScheduler::run(std::vector<Job> &jobs, const std::function<void(size_t)> &started, Lane lane)
+{
+	using Clock = std::chrono::steady_clock;
+	auto after = [](Clock::time_point from, double seconds) {
+		return from + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+	};
+
+	std::vector<std::vector<Entry>>                   pending = queues(jobs);
+	std::vector<size_t>                               heads(pending.size());
+	std::vector<Task>                                 tasks(jobs.size());
+	std::vector<std::pair<Clock::time_point, Task *>> retries;
+	size_t                                            remaining = jobs.size();
+	size_t                                            cursor = 0;
+	bool                                              done = false;
+	std::exception_ptr                                error;
+	const size_t                                      index = static_cast<size_t>(lane);
+
+	// Someone waits for an interactive job, so it does not wait for its devices
+	auto room = [&](const Entry &entry) {
+		return lane == Lane::Interactive ||
+		       std::all_of(entry.Devices.begin(), entry.Devices.end(),
+		                   [&](std::uint64_t device) { return m_inFlight[device] < limit(device); });
+	};
+
+	// Retries that are due come first; then devices take turns, and the head of a queue waits while any of its
+	// devices is at its limit
+	auto next = [&](Clock::time_point now) -> Task * {
+		for (auto it = retries.begin(); it != retries.end(); ++it)
+		{
+			if (it->first > now || !room(*it->second->Source))
+				continue;
+			Task *task = it->second;
+			retries.erase(it);
+			return task;
+		}
+		for (size_t k = 0; k < pending.size(); ++k)
+		{
+			const size_t q = (cursor + k) % pending.size();
+			if (heads[q] == pending[q].size() || !room(pending[q][heads[q]]))
+				continue;
+			const Entry &entry = pending[q][heads[q]++];
+			cursor = q + 1;
+			tasks[entry.Index].Source = &entry;
+			return &tasks[entry.Index];
+		}
+		return nullptr;
+	};
+
+	// Whether a job is ready to start once it has a slot
+	auto startable = [&](Clock::time_point now) {
+		for (size_t q = 0; q < pending.size(); ++q)
+			if (heads[q] < pending[q].size())
+				return true;
+		return std::any_of(retries.begin(), retries.end(), [now](const auto &retry) { return retry.first <= now; });
+	};
+
+	// The watchdog only judges jobs whose length is known; an estimate may be far too short
+	auto timeoutOf = [&](const Task &task) {
+		const Job &job = jobs[task.Source->Index];
+		return m_watchdog && !job.Estimated ? m_watchdog->timeout(job.Kind, job.Work) : 0.0;
+	};
+	auto stragglingOf = [&](const Task &task) {
+		const Job &job = jobs[task.Source->Index];
+		return m_watchdog && !job.Estimated ? m_watchdog->straggling(job.Kind, job.Work) : 0.0;
+	};
+
+	// Whether a job with a single copy running may still get a second one
+	auto speculation = [&](const Task &task) {
+		return m_watchdog && task.Copies.size() == 1 && !task.Speculated && !task.Winner &&
+		       !task.Copies.front()->Dropped && jobs[task.Source->Index].Speculative && stragglingOf(task) > 0.0;
+	};
+
+	// Once no job waits, the slowest straggler gets a second copy; due is moved up to the time the next job
+	// becomes one
+	auto straggler = [&](Clock::time_point now, Clock::time_point &due) -> Task * {
+		Task  *slowest = nullptr;
+		double worst = 1.0;
+		if (remaining > 0)
+			return slowest;
+		for (Task &task : tasks)
+		{
+			if (!speculation(task))
+				continue;
+			const double threshold = stragglingOf(task);
+			const double ran = runningSeconds(*task.Copies.front(), now);
+			if (ran < threshold)
+				due = std::min(due, after(now, threshold - ran));
+			else if (ran / threshold >= worst)
+			{
+				worst = ran / threshold;
+				slowest = &task;
+			}
+		}
+		return slowest;
+	};
+
+	// Kills the encoders of copies that ran longer than their timeout
+	auto watch = [&] {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!done)
+		{
+			const auto now = Clock::now();
+			auto       due = Clock::time_point::max();
+			for (Task &task : tasks)
+			{
+				for (Active *copy : task.Copies)
+				{
+					const double timeout = timeoutOf(task);
+					if (timeout <= 0.0 || copy->Killed || copy->Dropped)
+						continue;
+
+					// Work the utility does itself is not killed, only encoders that hang
+					const double ran = runningSeconds(*copy, now);
+					if (ran < timeout)
+						due = std::min(due, after(now, timeout - ran));
+					else if (copy->Processes->size() == 0)
+						due = std::min(due, after(now, 1.0));
+					else
+						expire(*copy);
+				}
+			}
+			if (due == Clock::time_point::max())
+				m_wake.wait(lock);
+			else
+				m_wake.wait_until(lock, due);
+		}
+	};
+
+	auto worker = [&] {
+		Active                       active;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		active.Kind = lane;
+		active.Scheduler = this;
+		for (;;)
+		{
+			// A batch job that waited too long stops giving way to interactive ones
+			Task      *task = nullptr;
+			bool       second = false;
+			const auto since = Clock::now();
+			const auto aging = after(since, m_policy.Aging);
+			bool       aged = false;
+			++m_waiting[index];
+			for (;;)
+			{
+				const auto now = Clock::now();
+				auto       due = lane == Lane::Batch && !aged ? aging : Clock::time_point::max();
+				if (admit(lane, aged))
+				{
+					if ((task = next(now)) != nullptr)
+						break;
+					if ((task = straggler(now, due)) != nullptr)
+					{
+						second = true;
+						break;
+					}
+				}
+				else if (lane == Lane::Interactive && startable(now) && preempt(active))
+				{
+					task = next(now);
+					break;
+				}
+				if (remaining == 0 && std::none_of(tasks.begin(), tasks.end(), speculation))
+					break;
+				for (const auto &retry : retries)
+					due = std::min(due, retry.first);
+				if (due == Clock::time_point::max())
+					m_wake.wait(lock);
+				else
+					m_wake.wait_until(lock, due);
+				aged = aged || (lane == Lane::Batch && Clock::now() >= aging);
+			}
+			--m_waiting[index];
+			if (!task)
+				return;
+
+			const auto   start = Clock::now();
+			const Entry *entry = task->Source;
+			Job         &job = jobs[entry->Index];
+			if (!second)
+				--remaining;
+			account(start);
+			++m_running[index];
+			active.Processes = std::make_unique<Subprocess::Group>();
+			active.Of = task;
+			active.Copy = second ? 1 : 0;
+			active.Started = start;
+			task->Copies.push_back(&active);
+			if (second)
+			{
+				task->Speculated = true;
+				++m_stragglers.Copies;
+			}
+			m_active.push_back(&active);
+
+			job.Node = -1;
+			if (m_placement)
+			{
+				const unsigned width = std::max(1u, ThreadBudget::availableCpus() / m_slots);
+				active.Placed = m_placement->acquire(width);
+				active.Placement = m_placement;
+				if (active.Placed.Node >= 0)
+				{
+					const CpuPlacement::Node &node = m_placement->nodes()[active.Placed.Node];
+					NodeStats                &placed = m_nodes[node.Id];
+					placed.Cpus = CpuPlacement::formatList(node.Cpus);
+					++placed.Jobs;
+					job.Node = node.Id;
+					active.Processes->pin(active.Placed.Cpus);
+				}
+			}
+
+			LaneStats   &stats = m_lanes[index];
+			const double waited = std::chrono::duration<double>(start - since).count();
+			++stats.Jobs;
+			stats.WaitSeconds += waited;
+			stats.MaxWaitSeconds = std::max(stats.MaxWaitSeconds, waited);
+			for (std::uint64_t device : entry->Devices)
+				if (m_inFlight[device]++ == 0)
+					m_busySince[device] = start;
+			if (started && !second && task->Retries == 0)
+				started(entry->Index);
+			lock.unlock();
+
+			Active *const outer = t_active;
+			t_active = &active;
+			try
+			{
+				Subprocess::Scope scope(active.Processes.get());
+				job.Run();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> guard(m_mutex);
+				if (keep(active) && !error)
+					error = std::current_exception();
+			}
+			t_active = outer;
+
+			// Outputs only have their size once the job is done
+			std::vector<std::pair<std::uint64_t, std::uint64_t>> transfers;
+			for (const auto *paths : {&job.Reads, &job.Writes})
+			{
+				for (const auto &path : *paths)
+				{
+					std::error_code     ec;
+					const std::uint64_t size = std::filesystem::file_size(path, ec);
+					if (!ec)
+						transfers.emplace_back(device(path).Id, size);
+				}
+			}
+
+			// Only the copy that is kept counts; a job that timed out did not encode its audio
+			lock.lock();
+			const auto now = Clock::now();
+			const bool kept = keep(active);
+			account(now);
+			if (kept && !active.Killed && job.Work > 0.0)
+			{
+				m_window.Work += job.Work;
+				++m_window.Jobs;
+				if (m_watchdog && !job.Estimated)
+					m_watchdog->record(job.Kind, job.Work, runningSeconds(active, now));
+			}
+			for (std::uint64_t device : entry->Devices)
+			{
+				DeviceStats &stats = m_stats[device];
+				stats.Name = m_devices[device].Name;
+				stats.Jobs += kept ? 1 : 0;
+				if (--m_inFlight[device] == 0)
+					stats.BusySeconds += std::chrono::duration<double>(now - m_busySince[device]).count();
+			}
+			if (kept)
+				for (const auto &[device, bytes] : transfers)
+					m_stats[device].Bytes += bytes;
+
+			// A reniced job, or a paused one whose encoder had just exited, can finish while its slot is lent
+			std::erase(m_active, &active);
+			if (active.LentTo)
+			{
+				active.LentTo->Borrowed = nullptr;
+				active.LentTo = nullptr;
+			}
+			else
+				--m_running[index];
+			if (active.Borrowed)
+			{
+				if (active.Borrowed->Processes->paused())
+					active.Borrowed->Processes->resume();
+				active.Borrowed->LentTo = nullptr;
+				active.Borrowed->LentSeconds += std::chrono::duration<double>(now - active.Borrowed->LentAt).count();
+				active.Borrowed = nullptr;
+				++m_running[static_cast<size_t>(Lane::Batch)];
+			}
+			// A job that started before the policy changed gives its CPUs back to the placement they came from
+			if (active.Placement)
+				active.Placement->release(active.Placed);
+			active.Placement.reset();
+			active.Placed = CpuPlacement::Slot();
+
+			// A job that timed out waits before it runs again, in case what held it up passes
+			std::erase(task->Copies, &active);
+			if (active.Retry)
+			{
+				++task->Retries;
+				++m_stragglers.Retried;
+				retries.emplace_back(after(now, m_watchdog->backoff(task->Retries)), task);
+				++remaining;
+			}
+			active.Of = nullptr;
+			active.LentSeconds = 0.0;
+			active.Killed = active.Dropped = active.Retry = false;
+			active.Deprioritized = false;
+			active.Processes.reset();
+			measure(now);
+			m_wake.notify_all();
+		}
+	};
+
+	// The calling thread is one of the workers
+	size_t      threads;
+	std::thread watchdog;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		threads = std::min<size_t>(capacity(), jobs.size());
+		if (m_watchdog && threads > 0)
+			watchdog = std::thread(watch);
+	}
+	std::vector<std::thread> helpers;
+	for (size_t i = 1; i < threads; ++i)
+		helpers.emplace_back(worker);
+	if (threads > 0)
+		worker();
+	for (auto &thread : helpers)
+		thread.join();
+	if (watchdog.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			done = true;
+		}
+		m_wake.notify_all();
+		watchdog.join();
+	}
+
+	if (error)
+		std::rethrow_exception(error);
+}
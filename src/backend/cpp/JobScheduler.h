@@ -0,0 +1,469 @@
+/**
+ * @file JobScheduler.h
+ * @brief Runs encoder jobs in parallel with per-device I/O limits.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "ConcurrencyController.h"
+#include "CpuPlacement.h"
+#include "Subprocess.h"
+#include "Watchdog.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Runs jobs on a fixed number of slots without overloading any storage device
+ *
+ * Every job names the files it reads and writes. They are mapped to the
+ * device that holds them (st_dev), and a job only starts while each of its
+ * devices has fewer jobs in flight than its limit, independently of the
+ * number of slots. Devices take turns, so a slow disk with a long queue
+ * does not keep jobs on a fast one waiting, and the jobs of one device run
+ * in the order their first input lies on the disk where the system reports
+ * it (FIEMAP on Linux).
+ *
+ * Several threads may call run() at once; their jobs share the slots. Jobs
+ * of the interactive lane, such as a single song someone waits for, start
+ * before queued batch jobs, may use slots that are reserved for them and
+ * are not held back by device limits. If every slot is taken, a running
+ * batch job is preempted: its encoder processes (Subprocess) are paused
+ * until the interactive job is done, or run at a lower priority from then
+ * on, and its slot is the interactive job's meanwhile. Only a batch job
+ * that is running an encoder process can be preempted. A batch job that
+ * has waited for a slot longer than the aging time stops giving way to
+ * interactive jobs, so a steady stream of them cannot starve the batch.
+ *
+ * With setConcurrency() the number of slots follows the measured
+ * throughput within bounds (ConcurrencyController). Jobs finished in a
+ * window of at least the controller's interval, and at least as many as
+ * there are slots, are summed up in seconds of audio per second; windows in
+ * which slots stood empty for want of jobs are not judged.
+ *
+ * With setPlacement() every job's encoder processes are pinned to CPUs of
+ * one NUMA node (CpuPlacement), as many as its share of the available CPUs.
+ *
+ * With setWatchdog() a job that runs much longer than the audio it encodes
+ * lets expect (Watchdog) has its encoder processes killed and is run again
+ * after a pause, a few times at most. Time a job spends paused does not
+ * count. Once no jobs of a run are waiting, a worker with nothing to do may
+ * start a second copy of a slow job; the copy that calls claim() first is
+ * kept and the other one is killed. The job must then keep its results
+ * only if claim() succeeds, and a copy with copy() > 0 must write files of
+ * its own.
+ */
+class JobScheduler
+{
+  public:
+	/// @brief Priority class of a run()
+	enum class Lane
+	{
+		/// @brief Someone waits for the result
+		Interactive,
+		/// @brief Catalog work
+		Batch
+	};
+
+	/// @brief What happens to a running batch job when an interactive job finds every slot taken
+	enum class Preemption
+	{
+		/// @brief Nothing, the interactive job waits for a slot
+		None,
+		/// @brief The batch job's encoders run at nice 10 from then on, and its slot is lent to the interactive job
+		/// until that one is done
+		Nice,
+		/// @brief The batch job's encoders are paused (SIGSTOP) until the interactive job is done
+		Pause
+	};
+
+	/// @brief How the lanes share the slots
+	class Policy
+	{
+	  public:
+		/// @brief Slots batch jobs leave free for interactive ones; at least one slot stays open to batch jobs
+		unsigned Reserved = 0;
+		/// @brief Seconds after which a waiting batch job no longer gives way to interactive jobs
+		double Aging = 30.0;
+		/// @brief Preemption of batch jobs
+		Preemption Preempt = Preemption::Pause;
+	};
+
+	/// @brief Storage device of a file
+	class Device
+	{
+	  public:
+		/// @brief Device number
+		std::uint64_t Id = 0;
+		/// @brief Name for the statistics, e.g. "sda1"
+		std::string Name;
+		/// @brief Whether it is a spinning disk
+		bool Rotational = false;
+	};
+
+	/// @brief Work of one job
+	class Job
+	{
+	  public:
+		/// @brief Files the job reads
+		std::vector<std::filesystem::path> Reads;
+		/// @brief Files the job writes, they need not exist yet
+		std::vector<std::filesystem::path> Writes;
+		/// @brief Runs the job
+		std::function<void()> Run;
+		/// @brief Seconds of audio the job encodes, which adaptive concurrency measures throughput in; 0 if unknown
+		double Work = 0.0;
+		/// @brief Whether Work is only estimated; the watchdog then neither times out nor learns from the job
+		bool Estimated = false;
+		/// @brief Kind of work, such as the encoder; the watchdog learns the speed of every kind on its own
+		std::string Kind;
+		/// @brief NUMA node the job's encoders were pinned to, set by run(); -1 if they were not
+		int Node = -1;
+		/// @brief Whether a second copy may run beside a slow one, see claim() and copy()
+		bool Speculative = false;
+	};
+
+	/// @brief Transfer statistics of a device
+	class DeviceStats
+	{
+	  public:
+		/// @brief Device name
+		std::string Name;
+		/// @brief Jobs that used the device
+		size_t Jobs = 0;
+		/// @brief Bytes of the files read from and written to it
+		std::uint64_t Bytes = 0;
+		/// @brief Time with at least one job of the device in flight
+		double BusySeconds = 0.0;
+	};
+
+	/// @brief Jobs placed on a NUMA node
+	class NodeStats
+	{
+	  public:
+		/// @brief CPUs of the node, e.g. "0-7"
+		std::string Cpus;
+		/// @brief Jobs pinned to the node
+		size_t Jobs = 0;
+	};
+
+	/// @brief Timeouts and speculative copies
+	class StragglerStats
+	{
+	  public:
+		/// @brief Jobs killed by the watchdog
+		size_t TimedOut = 0;
+		/// @brief Jobs run again after they timed out
+		size_t Retried = 0;
+		/// @brief Second copies started of slow jobs
+		size_t Copies = 0;
+		/// @brief Second copies that finished first
+		size_t CopiesKept = 0;
+		/// @brief Realtime factors the timeouts are based on, by kind of job
+		std::map<std::string, double> Factors;
+	};
+
+	/// @brief Waiting and preemption statistics of a lane
+	class LaneStats
+	{
+	  public:
+		/// @brief Jobs started
+		size_t Jobs = 0;
+		/// @brief Total time jobs waited for a slot
+		double WaitSeconds = 0.0;
+		/// @brief Longest time a job waited for a slot
+		double MaxWaitSeconds = 0.0;
+		/// @brief Times a job of the lane was preempted
+		size_t Preempted = 0;
+	};
+
+	/**
+	 * @param slots Jobs to run at once, 0 for one per available CPU (ThreadBudget::availableCpus())
+	 * @param deviceJobs Jobs per device at once, 0 for 2 on spinning disks and no limit elsewhere
+	 */
+	explicit JobScheduler(unsigned slots = 0, unsigned deviceJobs = 0);
+
+	/// @brief Set how the lanes share the slots
+	void setPolicy(const Policy &policy);
+
+	/**
+	 * @brief Let the number of slots follow the measured throughput
+	 *
+	 * Starts from the current number of slots, clamped to the bounds. Equal
+	 * bounds fix the number of slots instead.
+	 *
+	 * @param settings Bounds and tuning of the controller
+	 */
+	void setConcurrency(const ConcurrencyController::Settings &settings);
+
+	/// @brief Jobs to run at once now
+	unsigned slots() const;
+
+	/**
+	 * @brief Pin the encoder processes of the jobs that start from now on
+	 * @param policy How jobs are spread over the NUMA nodes, None to stop pinning
+	 */
+	void setPlacement(CpuPlacement::Policy policy);
+
+	/// @brief How jobs are spread over the NUMA nodes
+	CpuPlacement::Policy placement() const;
+
+	/// @brief Jobs placed on every NUMA node so far, by node number
+	std::map<int, NodeStats> nodeStats() const;
+
+	/// @brief Decisions of the concurrency controller, none if the number of slots is fixed
+	std::optional<ConcurrencyController::Stats> concurrency() const;
+
+	/**
+	 * @brief Time jobs out, run them again and speculate on slow ones
+	 * @param settings Timeouts, retries and speculation
+	 */
+	void setWatchdog(const Watchdog::Settings &settings);
+
+	/// @brief Timeouts and speculative copies so far, none without a watchdog
+	std::optional<StragglerStats> stragglerStats() const;
+
+	/**
+	 * @brief Copy of its job the calling thread runs
+	 * @return 0 for the first copy and for retries, 1 for a speculative copy, 0 outside of a job
+	 */
+	static unsigned copy();
+
+	/**
+	 * @brief Keep the results of the copy of its job the calling thread runs
+	 *
+	 * Another copy is killed. A job that does not call it claims when it
+	 * returns.
+	 *
+	 * @return False if another copy claimed first, or if the watchdog killed this one and runs the job again;
+	 * true outside of a job
+	 */
+	static bool claim();
+
+	/**
+	 * @brief Run jobs and wait for all of them
+	 *
+	 * @param jobs Jobs in their preferred order
+	 * @param started Called with the index of each job right before it runs, under the scheduler's lock
+	 * @param lane Priority class of the jobs
+	 * @throws The first exception thrown by a copy of a job that was kept
+	 */
+	void run(std::vector<Job> &jobs, const std::function<void(size_t)> &started = nullptr,
+	         Lane lane = Lane::Batch);
+
+	/**
+	 * @brief Order in which run() starts jobs if every one takes as long
+	 * @param jobs Jobs in their preferred order
+	 * @return Job indices
+	 */
+	std::vector<size_t> plan(const std::vector<Job> &jobs);
+
+	/// @brief Statistics of every device used so far, by device number
+	std::map<std::uint64_t, DeviceStats> stats() const;
+
+	/// @brief Statistics of a lane so far
+	LaneStats laneStats(Lane lane) const;
+
+	/**
+	 * @brief Device that holds a file
+	 * @param path File, or a file to be created; the nearest existing parent is used
+	 * @return The device, Id 0 if it cannot be determined
+	 */
+	static Device device(const std::filesystem::path &path);
+
+	/**
+	 * @brief Physical position of the start of a file on its device
+	 * @param path File
+	 * @return Byte offset, 0 if the system does not report it
+	 */
+	static std::uint64_t diskOffset(const std::filesystem::path &path);
+
+  private:
+	/// @brief Job with its devices resolved
+	class Entry
+	{
+	  public:
+		/// @brief Index into the jobs
+		size_t Index = 0;
+		/// @brief Devices of the files, without duplicates
+		std::vector<std::uint64_t> Devices;
+		/// @brief Physical position of the first input
+		std::uint64_t Offset = 0;
+	};
+
+	class Active;
+
+	/// @brief Copies of a job of a run()
+	class Task
+	{
+	  public:
+		/// @brief The job, null until it first started
+		const Entry *Source = nullptr;
+		/// @brief Running copies
+		std::vector<Active *> Copies;
+		/// @brief Copy whose results are kept, null while none claimed
+		Active *Winner = nullptr;
+		/// @brief Times the job was run again after it timed out
+		unsigned Retries = 0;
+		/// @brief Whether a second copy was started
+		bool Speculated = false;
+	};
+
+	/// @brief Job that holds or held a slot
+	class Active
+	{
+	  public:
+		/// @brief Lane of the job
+		JobScheduler::Lane Kind = JobScheduler::Lane::Batch;
+		/// @brief Encoder processes of the job
+		std::unique_ptr<Subprocess::Group> Processes;
+		/// @brief Interactive job that paused or deprioritized this one and holds its slot
+		Active *LentTo = nullptr;
+		/// @brief Batch job whose slot this one holds
+		Active *Borrowed = nullptr;
+		/// @brief Whether its encoders were deprioritized
+		bool Deprioritized = false;
+		/// @brief CPUs its encoders are pinned to
+		CpuPlacement::Slot Placed;
+		/// @brief Placement the CPUs came from
+		std::shared_ptr<CpuPlacement> Placement;
+		/// @brief Scheduler that runs it
+		JobScheduler *Scheduler = nullptr;
+		/// @brief Job it is a copy of
+		Task *Of = nullptr;
+		/// @brief Number of the copy, see copy()
+		unsigned Copy = 0;
+		/// @brief Start of the copy
+		std::chrono::steady_clock::time_point Started;
+		/// @brief Since when its slot is lent, valid while LentTo is set
+		std::chrono::steady_clock::time_point LentAt;
+		/// @brief Time its slot was lent before, which the watchdog does not count as running
+		double LentSeconds = 0.0;
+		/// @brief Whether the watchdog killed its encoders
+		bool Killed = false;
+		/// @brief Whether its results are dropped: it lost to another copy, or it timed out and is run again
+		bool Dropped = false;
+		/// @brief Whether the job is run again once the copy returned
+		bool Retry = false;
+	};
+
+	/// @brief Resolve the devices of the jobs and sort them into per-device queues
+	std::vector<std::vector<Entry>> queues(const std::vector<Job> &jobs);
+
+	/// @brief Throughput measured since the last decision of the concurrency controller
+	class Window
+	{
+	  public:
+		/// @brief Start of the window
+		std::chrono::steady_clock::time_point Start;
+		/// @brief Time up to which SlotSeconds is counted
+		std::chrono::steady_clock::time_point Counted;
+		/// @brief Seconds of audio of the finished jobs
+		double Work = 0.0;
+		/// @brief Finished jobs with known work
+		size_t Jobs = 0;
+		/// @brief Running jobs integrated over time
+		double SlotSeconds = 0.0;
+	};
+
+	/// @brief Jobs per device at once
+	unsigned limit(std::uint64_t device) const;
+
+	/// @brief Most jobs that may run at once
+	unsigned capacity() const;
+
+	/// @brief Count the running jobs up to now into the window, before their number changes
+	void account(std::chrono::steady_clock::time_point now);
+
+	/// @brief Let the concurrency controller judge the window once it is long enough, and start a new one
+	void measure(std::chrono::steady_clock::time_point now);
+
+	/// @brief Whether a job of a lane may take a slot now
+	bool admit(Lane lane, bool aged) const;
+
+	/// @brief Seconds a copy has run, without the time it was paused
+	static double runningSeconds(const Active &active, std::chrono::steady_clock::time_point now);
+
+	/// @brief Keep the results of a copy unless they were dropped or another copy claimed first
+	bool keep(Active &active);
+
+	/// @brief Kill a copy that timed out and decide whether its job is run again
+	void expire(Active &active);
+
+	/**
+	 * @brief Make room for an interactive job by preempting the batch job started last
+	 *
+	 * Only batch jobs with running encoder processes are candidates. The
+	 * preempted job's slot is lent to @p by.
+	 *
+	 * @param by The interactive job
+	 * @return Whether a batch job was preempted
+	 */
+	bool preempt(Active &by);
+
+	/// @brief Jobs to run at once
+	unsigned m_slots;
+	/// @brief Adjusts m_slots, null if it is fixed
+	std::unique_ptr<ConcurrencyController> m_controller;
+	/// @brief Throughput since the controller's last decision
+	Window m_window;
+	/// @brief Hands out the CPUs of jobs, null if they are not pinned
+	std::shared_ptr<CpuPlacement> m_placement;
+	/// @brief Jobs per NUMA node
+	std::map<int, NodeStats> m_nodes;
+	/// @brief Copy of a job the calling thread runs, null outside of a job
+	static thread_local Active *t_active;
+	/// @brief Times jobs out, null if they are not
+	std::unique_ptr<Watchdog> m_watchdog;
+	/// @brief Timeouts and speculative copies
+	StragglerStats m_stragglers;
+	/// @brief Jobs per device at once, 0 for automatic
+	unsigned m_deviceJobs;
+	/// @brief Devices seen so far
+	std::map<std::uint64_t, Device> m_devices;
+	/// @brief Statistics per device
+	std::map<std::uint64_t, DeviceStats> m_stats;
+	/// @brief Slot sharing of the lanes
+	Policy m_policy;
+	/// @brief Jobs holding a slot per lane; paused jobs do not
+	std::array<unsigned, 2> m_running = {};
+	/// @brief Workers waiting for a slot per lane
+	std::array<unsigned, 2> m_waiting = {};
+	/// @brief Statistics per lane
+	std::array<LaneStats, 2> m_lanes;
+	/// @brief Running jobs of every run(), in the order they started
+	std::vector<Active *> m_active;
+	/// @brief Jobs in flight per device
+	std::map<std::uint64_t, unsigned> m_inFlight;
+	/// @brief Start of the current busy period per device
+	std::map<std::uint64_t, std::chrono::steady_clock::time_point> m_busySince;
+	/// @brief Guards the state shared by the run() calls
+	mutable std::mutex m_mutex;
+	/// @brief Signals freed slots
+	std::condition_variable m_wake;
+};
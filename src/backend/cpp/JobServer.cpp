@@ -0,0 +1,597 @@
+/**
+ * @file JobServer.cpp
+ * @brief Local socket server that queues mastering jobs for a resident engine.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "JobServer.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <streambuf>
+#include <utility>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Parse the number of a request line
+ * @param line Line, for the error message
+ * @param value Its value
+ * @throws std::invalid_argument if the value is not a whole number
+ */
+static int parseNumber(const std::string &line, const std::string &value)
+{
+	try
+	{
+		size_t used = 0;
+		int    result = std::stoi(value, &used);
+		if (used == value.size())
+			return result;
+	}
+	catch (const std::exception &)
+	{
+	}
+	throw std::invalid_argument("Not a number: " + line);
+}
+
+std::string JobServer::Request::format() const
+{
+	std::ostringstream out;
+	out << "markup " << Markup.string() << "\n";
+	if (!Directory.empty())
+		out << "directory " << Directory.string() << "\n";
+	if (Album)
+		out << "album " << *Album << "\n";
+	if (Song)
+		out << "song " << *Song << "\n";
+	if (Priority != 0)
+		out << "priority " << Priority << "\n";
+	out << "\n";
+	return out.str();
+}
+
+JobServer::Request JobServer::Request::parse(const std::string &text)
+{
+	Request            request;
+	std::istringstream lines(text);
+	std::string        line;
+	while (std::getline(lines, line))
+	{
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			break;
+		const size_t      space = line.find(' ');
+		const std::string key = line.substr(0, space);
+		const std::string value = space == std::string::npos ? "" : line.substr(space + 1);
+		if (key == "markup")
+			request.Markup = value;
+		else if (key == "directory")
+			request.Directory = value;
+		else if (key == "album")
+			request.Album = parseNumber(line, value);
+		else if (key == "song")
+			request.Song = parseNumber(line, value);
+		else if (key == "priority")
+			request.Priority = parseNumber(line, value);
+		else
+			throw std::invalid_argument("Unknown request line: " + line);
+	}
+	if (request.Markup.empty())
+		throw std::invalid_argument("No markup file in request");
+	if (request.Song && !request.Album)
+		throw std::invalid_argument("A song needs its album");
+	return request;
+}
+
+std::filesystem::path JobServer::defaultSocket()
+{
+	if (const char *runtime = std::getenv("XDG_RUNTIME_DIR"); runtime && *runtime)
+		return std::filesystem::path(runtime) / "masteringutil.sock";
+#ifdef _WIN32
+	return std::filesystem::temp_directory_path() / "masteringutil.sock";
+#else
+	return std::filesystem::temp_directory_path() / ("masteringutil-" + std::to_string(getuid()) + ".sock");
+#endif
+}
+
+#ifdef _WIN32
+
+JobServer::JobServer(std::filesystem::path socket) : m_socket(std::move(socket))
+{
+	throw std::runtime_error("The job server needs Unix domain sockets, which this build does not support");
+}
+
+JobServer::~JobServer() = default;
+
+void JobServer::run(const Handler &)
+{
+}
+
+void JobServer::stop()
+{
+}
+
+void JobServer::acceptLoop()
+{
+}
+
+void JobServer::serve(const Handler &, bool)
+{
+}
+
+bool JobServer::submit(const std::filesystem::path &, const Request &, std::ostream &)
+{
+	throw std::runtime_error("The job server needs Unix domain sockets, which this build does not support");
+}
+
+#else // !_WIN32
+
+/// @brief Write all of a string to a socket; a client that hung up is not an error of the job
+static bool sendAll(int fd, const std::string &data)
+{
+	size_t sent = 0;
+	while (sent < data.size())
+	{
+#ifdef MSG_NOSIGNAL
+		const ssize_t count = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+#else
+		const ssize_t count = ::send(fd, data.data() + sent, data.size() - sent, 0);
+#endif
+		if (count <= 0)
+			return false;
+		sent += static_cast<size_t>(count);
+	}
+	return true;
+}
+
+/// @brief Keep a socket from leaking into encoders and from raising SIGPIPE where send() cannot be told not to
+static int configure(int fd)
+{
+	if (fd >= 0)
+	{
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+		int on = 1;
+		setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	}
+	return fd;
+}
+
+/// @brief Socket address of a path
+static sockaddr_un socketAddress(const std::filesystem::path &path)
+{
+	sockaddr_un       address{};
+	const std::string name = path.string();
+	if (name.size() >= sizeof(address.sun_path))
+		throw std::runtime_error("Socket path too long: " + name);
+	address.sun_family = AF_UNIX;
+	name.copy(address.sun_path, name.size());
+	return address;
+}
+
+/// @brief Connect to a socket, -1 if nothing listens on it
+static int connectTo(const std::filesystem::path &path)
+{
+	const sockaddr_un address = socketAddress(path);
+	int               fd = configure(::socket(AF_UNIX, SOCK_STREAM, 0));
+	if (fd < 0)
+		return -1;
+	if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		::close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Stream buffer that sends whole lines to a client as progress, and echoes them to another buffer
+ *
+ * Unbuffered, so writes from several threads are serialised by its lock.
+ */
+class ProgressBuffer : public std::streambuf
+{
+  public:
+	/**
+	 * @param client Connection of the client
+	 * @param echo Buffer that also receives everything
+	 * @param mutex Lock shared by the buffers of one client
+	 */
+	ProgressBuffer(int client, std::streambuf *echo, std::mutex &mutex)
+	    : m_client(client), m_echo(echo), m_mutex(mutex)
+	{
+	}
+
+	/// @brief Send an unfinished last line
+	~ProgressBuffer() override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_line.empty())
+			sendAll(m_client, "progress " + m_line + "\n");
+	}
+
+  protected:
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof()))
+			return traits_type::not_eof(ch);
+		const char c = traits_type::to_char_type(ch);
+		xsputn(&c, 1);
+		return ch;
+	}
+
+	std::streamsize xsputn(const char *data, std::streamsize count) override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_echo->sputn(data, count);
+		for (std::streamsize i = 0; i < count; ++i)
+		{
+			if (data[i] != '\n')
+			{
+				m_line += data[i];
+				continue;
+			}
+			sendAll(m_client, "progress " + m_line + "\n");
+			m_line.clear();
+		}
+		return count;
+	}
+
+	int sync() override
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_echo->pubsync();
+	}
+
+  private:
+	/// @brief Connection of the client
+	int m_client;
+	/// @brief Buffer that also receives everything
+	std::streambuf *m_echo;
+	/// @brief Lock shared by the buffers of one client
+	std::mutex &m_mutex;
+	/// @brief Unfinished line
+	std::string m_line;
+};
+
+/**
+ * @brief Stream buffer that passes output on to the buffer of the job of the writing thread
+ *
+ * Threads without a job of their own write to the default buffer, and to
+ * the original one while no job runs.
+ */
+class RouteBuffer : public std::streambuf
+{
+  public:
+	/**
+	 * @param stream Stream that is routed, 0 for std::cout and 1 for std::cerr
+	 * @param original Buffer of the stream
+	 */
+	RouteBuffer(size_t stream, std::streambuf *original) : m_stream(stream), m_original(original)
+	{
+	}
+
+	/// @brief Buffer of the stream
+	std::streambuf *original() const
+	{
+		return m_original;
+	}
+
+	/// @brief Route the output of the calling thread, null to write to the default
+	void thread(std::streambuf *target)
+	{
+		t_targets[m_stream] = target;
+	}
+
+	/// @brief Route the output of the other threads, null to write to the original buffer
+	void fallback(std::streambuf *target)
+	{
+		m_default = target;
+	}
+
+  protected:
+	int_type overflow(int_type ch) override
+	{
+		if (traits_type::eq_int_type(ch, traits_type::eof()))
+			return traits_type::not_eof(ch);
+		return target()->sputc(traits_type::to_char_type(ch));
+	}
+
+	std::streamsize xsputn(const char *data, std::streamsize count) override
+	{
+		return target()->sputn(data, count);
+	}
+
+	int sync() override
+	{
+		return target()->pubsync();
+	}
+
+  private:
+	/// @brief Buffer the calling thread writes to
+	std::streambuf *target() const
+	{
+		if (std::streambuf *own = t_targets[m_stream])
+			return own;
+		std::streambuf *other = m_default;
+		return other ? other : m_original;
+	}
+
+	/// @brief Target of each stream on this thread
+	static thread_local std::array<std::streambuf *, 2> t_targets;
+
+	/// @brief Stream that is routed
+	size_t m_stream;
+	/// @brief Buffer of the stream
+	std::streambuf *m_original;
+	/// @brief Target of threads without a job
+	std::atomic<std::streambuf *> m_default = nullptr;
+};
+
+thread_local std::array<std::streambuf *, 2> RouteBuffer::t_targets = {};
+
+JobServer::JobServer(std::filesystem::path socket) : m_socket(std::move(socket))
+{
+	// A socket file nobody answers on was left by a server that is gone
+	if (int other = connectTo(m_socket); other >= 0)
+	{
+		::close(other);
+		throw std::runtime_error("A server is already listening on " + m_socket.string());
+	}
+	std::error_code ec;
+	std::filesystem::remove(m_socket, ec);
+
+	const sockaddr_un address = socketAddress(m_socket);
+	m_listener = configure(::socket(AF_UNIX, SOCK_STREAM, 0));
+	if (m_listener < 0)
+		throw std::runtime_error("Could not create a socket");
+
+	// Jobs run with the rights of the server, so only its user may submit them
+	const mode_t mask = umask(077);
+	const bool   bound = ::bind(m_listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == 0;
+	umask(mask);
+	if (!bound || ::listen(m_listener, 16) != 0)
+	{
+		::close(m_listener);
+		throw std::runtime_error("Could not listen on " + m_socket.string());
+	}
+	m_acceptor = std::thread(&JobServer::acceptLoop, this);
+}
+
+JobServer::~JobServer()
+{
+	stop();
+
+	// Not every system wakes accept() on shutdown(), so a connection of our own wakes it
+	::shutdown(m_listener, SHUT_RDWR);
+	if (int wake = connectTo(m_socket); wake >= 0)
+		::close(wake);
+	if (m_acceptor.joinable())
+		m_acceptor.join();
+	::close(m_listener);
+	for (const Pending &pending : m_queue)
+		::close(pending.Client);
+	std::error_code ec;
+	std::filesystem::remove(m_socket, ec);
+}
+
+void JobServer::acceptLoop()
+{
+	for (;;)
+	{
+		int client = configure(::accept(m_listener, nullptr, nullptr));
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			return; // shut down
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stop)
+			{
+				::close(client);
+				return;
+			}
+		}
+
+		// A client that does not finish its request in time does not hold up the others
+		timeval timeout{5, 0};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		std::string text;
+		char        buffer[1024];
+		while (text.find("\n\n") == std::string::npos && text.size() < 65536)
+		{
+			const ssize_t count = ::recv(client, buffer, sizeof(buffer), 0);
+			if (count <= 0)
+				break;
+			text.append(buffer, static_cast<size_t>(count));
+		}
+
+		try
+		{
+			Request                     request = Request::parse(text);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			const auto ahead = std::count_if(m_queue.begin(), m_queue.end(), [&request](const Pending &pending) {
+				return pending.Job.Song.has_value() == request.Song.has_value();
+			});
+			sendAll(client, "queued " + std::to_string(ahead) + "\n");
+			m_queue.push_back({std::move(request), client, m_arrivals++});
+			m_wake.notify_all();
+		}
+		catch (const std::exception &ex)
+		{
+			sendAll(client, std::string("failed ") + ex.what() + "\n");
+			::close(client);
+		}
+	}
+}
+
+void JobServer::run(const Handler &handler)
+{
+	RouteBuffer     out(0, std::cout.rdbuf()), err(1, std::cerr.rdbuf());
+	std::streambuf *oldOut = std::cout.rdbuf(&out);
+	std::streambuf *oldErr = std::cerr.rdbuf(&err);
+	m_routes = {&out, &err};
+
+	std::thread songs([this, &handler] { serve(handler, true); });
+	serve(handler, false);
+	songs.join();
+
+	m_routes = {};
+	std::cout.rdbuf(oldOut);
+	std::cerr.rdbuf(oldErr);
+}
+
+void JobServer::serve(const Handler &handler, bool songs)
+{
+	const size_t runner = songs ? 1 : 0;
+	auto        *out = static_cast<RouteBuffer *>(m_routes[0]);
+	auto        *err = static_cast<RouteBuffer *>(m_routes[1]);
+
+	// The working directory belongs to the process, so the runners only share it
+	auto mine = [this, songs, runner](const Pending &pending) {
+		const auto &other = m_running[1 - runner];
+		return pending.Job.Song.has_value() == songs && (!other || *other == pending.Job.Directory);
+	};
+	for (;;)
+	{
+		Pending pending;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || std::any_of(m_queue.begin(), m_queue.end(), mine); });
+			if (m_stop)
+				return;
+			auto next = m_queue.end();
+			for (auto it = m_queue.begin(); it != m_queue.end(); ++it)
+				if (mine(*it) && (next == m_queue.end() || it->Job.Priority > next->Job.Priority ||
+				                  (it->Job.Priority == next->Job.Priority && it->Order < next->Order)))
+					next = it;
+			pending = std::move(*next);
+			m_queue.erase(next);
+			m_running[runner] = pending.Job.Directory;
+		}
+
+		const auto  start = std::chrono::steady_clock::now();
+		std::string result;
+		{
+			std::mutex     mutex;
+			ProgressBuffer progress(pending.Client, out->original(), mutex);
+			ProgressBuffer errors(pending.Client, err->original(), mutex);
+			out->thread(&progress);
+			err->thread(&errors);
+			if (!songs)
+			{
+				out->fallback(&progress);
+				err->fallback(&errors);
+			}
+			try
+			{
+				handler(pending.Job);
+				std::ostringstream seconds;
+				seconds << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				result = "done " + seconds.str() + "\n";
+			}
+			catch (const std::exception &ex)
+			{
+				result = std::string("failed ") + ex.what() + "\n";
+			}
+			catch (...)
+			{
+				result = "failed Unknown error\n";
+			}
+			out->thread(nullptr);
+			err->thread(nullptr);
+			if (!songs)
+			{
+				out->fallback(nullptr);
+				err->fallback(nullptr);
+			}
+		}
+		sendAll(pending.Client, result);
+		::close(pending.Client);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_running[runner].reset();
+		m_wake.notify_all();
+	}
+}
+
+void JobServer::stop()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_stop = true;
+	m_wake.notify_all();
+}
+
+bool JobServer::submit(const std::filesystem::path &socket, const Request &request, std::ostream &out)
+{
+	int fd = connectTo(socket);
+	if (fd < 0)
+		throw std::runtime_error("No server is listening on " + socket.string());
+	if (!sendAll(fd, request.format()))
+	{
+		::close(fd);
+		return false;
+	}
+
+	std::string pending;
+	char        buffer[4096];
+	bool        finished = false;
+	for (;;)
+	{
+		const ssize_t count = ::recv(fd, buffer, sizeof(buffer), 0);
+		if (count <= 0)
+			break;
+		pending.append(buffer, static_cast<size_t>(count));
+		for (size_t end; (end = pending.find('\n')) != std::string::npos; pending.erase(0, end + 1))
+		{
+			const std::string line = pending.substr(0, end);
+			if (line.rfind("progress ", 0) == 0)
+				out << line.substr(9) << "\n";
+			else if (line.rfind("queued ", 0) == 0 && line != "queued 0")
+				out << "Queued behind " << line.substr(7) << " jobs\n";
+			else if (line.rfind("done ", 0) == 0)
+			{
+				out << "Finished in " << line.substr(5) << " s\n";
+				finished = true;
+			}
+			else if (line.rfind("failed ", 0) == 0)
+				out << "Failed: " << line.substr(7) << "\n";
+		}
+	}
+	::close(fd);
+	out.flush();
+	return finished;
+}
+
+#endif // _WIN32
@@ -0,0 +1,185 @@
+/**
+ * @file JobServer.h
+ * @brief Local socket server that queues mastering jobs for a resident engine.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Accepts jobs on a Unix domain socket and runs them one at a time
+ *
+ * A client sends one request and keeps the connection open while its job
+ * is queued and runs. The protocol is line based text:
+ *
+ * @code
+ * markup /music/catalog.mas      (required)
+ * directory /music               (working directory of the job)
+ * album 3                        (only this album)
+ * song 7                         (only this song of the album)
+ * priority 10                    (higher runs first, default 0)
+ * <empty line>
+ * @endcode
+ *
+ * The server answers with "queued <jobs ahead>", then one "progress <text>"
+ * line for every line the job writes to std::cout or std::cerr (which are
+ * also still written to the server's own streams), and finally
+ * "done <seconds>" or "failed <message>". Queued jobs run by priority,
+ * then in the order they arrived.
+ *
+ * Jobs for a single song have a runner of their own, so someone waiting
+ * for one song does not wait for a catalog job to finish: one job of each
+ * kind runs at a time. A song job whose directory differs from the running
+ * catalog job's waits for it, as the working directory is shared.
+ *
+ * Unix domain sockets are not supported on Windows builds; the constructor
+ * and submit() throw there.
+ */
+class JobServer
+{
+  public:
+	/// @brief Job of a client
+	class Request
+	{
+	  public:
+		/// @brief Markup file
+		std::filesystem::path Markup;
+		/// @brief Working directory of the job, the server's own if empty
+		std::filesystem::path Directory;
+		/// @brief Album to process, all albums if not set
+		std::optional<int> Album;
+		/// @brief Song of the album to process, all songs if not set
+		std::optional<int> Song;
+		/// @brief Queue priority, higher runs first
+		int Priority = 0;
+
+		/// @brief The request as sent over the socket, including the closing empty line
+		std::string format() const;
+
+		/**
+		 * @brief Parse a request
+		 * @param text Request lines, with or without the closing empty line
+		 * @return The request
+		 * @throws std::invalid_argument if a line is unknown or malformed, or the markup file is missing
+		 */
+		static Request parse(const std::string &text);
+	};
+
+	/// @brief Runs a job, a song job and another one possibly at the same time; exceptions fail it
+	using Handler = std::function<void(const Request &)>;
+
+	/**
+	 * @brief Listen on a socket
+	 *
+	 * A socket file left by a server that is gone is replaced. The socket
+	 * is only accessible to the user that runs the server.
+	 *
+	 * @param socket Socket path
+	 * @throws std::runtime_error if the socket cannot be created or another server is listening on it
+	 */
+	explicit JobServer(std::filesystem::path socket);
+
+	/// @brief Stop listening and remove the socket file
+	~JobServer();
+
+	JobServer(const JobServer &) = delete;
+	JobServer &operator=(const JobServer &) = delete;
+
+	/**
+	 * @brief Run queued jobs until stop() is called
+	 *
+	 * Song jobs run on a second thread. Output to std::cout and std::cerr
+	 * goes to the client of the job of the writing thread; threads a job
+	 * starts count as those of the job that is not a song job.
+	 *
+	 * @param handler Runs a job
+	 */
+	void run(const Handler &handler);
+
+	/// @brief Make run() return once the current job is done; safe to call from any thread
+	void stop();
+
+	/**
+	 * @brief Submit a job to a server and wait for it
+	 * @param socket Socket path of the server
+	 * @param request Job
+	 * @param out Receives the job's progress and result
+	 * @return true if the job ran and finished
+	 * @throws std::runtime_error if no server listens on the socket
+	 */
+	static bool submit(const std::filesystem::path &socket, const Request &request, std::ostream &out);
+
+	/// @brief Socket path used if none is given: in $XDG_RUNTIME_DIR, else per user in the temporary directory
+	static std::filesystem::path defaultSocket();
+
+  private:
+	/// @brief Queued job
+	class Pending
+	{
+	  public:
+		/// @brief Job
+		Request Job;
+		/// @brief Connection of the client
+		int Client = -1;
+		/// @brief Arrival order
+		std::uint64_t Order = 0;
+	};
+
+	/// @brief Accept connections and queue their requests
+	void acceptLoop();
+
+	/**
+	 * @brief Run queued jobs of one kind until stop() is called
+	 * @param handler Runs a job
+	 * @param songs Run the song jobs rather than the others
+	 */
+	void serve(const Handler &handler, bool songs);
+
+	/// @brief Socket path
+	std::filesystem::path m_socket;
+	/// @brief Listening socket
+	int m_listener = -1;
+	/// @brief Thread of acceptLoop()
+	std::thread m_acceptor;
+	/// @brief Queued jobs
+	std::vector<Pending> m_queue;
+	/// @brief Jobs queued so far
+	std::uint64_t m_arrivals = 0;
+	/// @brief Buffers that route std::cout and std::cerr while run() runs
+	std::array<std::streambuf *, 2> m_routes = {};
+	/// @brief Working directory of the running catalog job and song job
+	std::array<std::optional<std::filesystem::path>, 2> m_running;
+	/// @brief Set by stop()
+	bool m_stop = false;
+	/// @brief Guards the queue and m_stop
+	std::mutex m_mutex;
+	/// @brief Signals queued jobs and stop()
+	std::condition_variable m_wake;
+};
@@ -0,0 +1,462 @@
+/**
+ * @file Loudness.cpp
+ * @brief Implementation of the BS.1770 loudness meter
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Loudness.h"
+#include "AudioSource.h"
+#include "Simd.h"
+#include <algorithm>
+#include <array>
+
+/// @brief Two double lanes, one channel each
+struct Lanes
+{
+#if defined(MU_SIMD_SSE2)
+	__m128d v;
+
+	static Lanes set(double a, double b)
+	{
+		return {_mm_set_pd(b, a)};
+	}
+	static Lanes splat(double a)
+	{
+		return {_mm_set1_pd(a)};
+	}
+	friend Lanes operator+(Lanes x, Lanes y)
+	{
+		return {_mm_add_pd(x.v, y.v)};
+	}
+	friend Lanes operator-(Lanes x, Lanes y)
+	{
+		return {_mm_sub_pd(x.v, y.v)};
+	}
+	friend Lanes operator*(Lanes x, Lanes y)
+	{
+		return {_mm_mul_pd(x.v, y.v)};
+	}
+	double lane(int i) const
+	{
+		alignas(16) double out[2];
+		_mm_store_pd(out, v);
+		return out[i];
+	}
+#elif defined(MU_SIMD_NEON) && (defined(__aarch64__) || defined(_M_ARM64))
+	float64x2_t v;
+
+	static Lanes set(double a, double b)
+	{
+		return {vcombine_f64(vdup_n_f64(a), vdup_n_f64(b))};
+	}
+	static Lanes splat(double a)
+	{
+		return {vdupq_n_f64(a)};
+	}
+	friend Lanes operator+(Lanes x, Lanes y)
+	{
+		return {vaddq_f64(x.v, y.v)};
+	}
+	friend Lanes operator-(Lanes x, Lanes y)
+	{
+		return {vsubq_f64(x.v, y.v)};
+	}
+	friend Lanes operator*(Lanes x, Lanes y)
+	{
+		return {vmulq_f64(x.v, y.v)};
+	}
+	double lane(int i) const
+	{
+		return i == 0 ? vgetq_lane_f64(v, 0) : vgetq_lane_f64(v, 1);
+	}
+#else
+	double v[2];
+
+	static Lanes set(double a, double b)
+	{
+		return {{a, b}};
+	}
+	static Lanes splat(double a)
+	{
+		return {{a, a}};
+	}
+	friend Lanes operator+(Lanes x, Lanes y)
+	{
+		return {{x.v[0] + y.v[0], x.v[1] + y.v[1]}};
+	}
+	friend Lanes operator-(Lanes x, Lanes y)
+	{
+		return {{x.v[0] - y.v[0], x.v[1] - y.v[1]}};
+	}
+	friend Lanes operator*(Lanes x, Lanes y)
+	{
+		return {{x.v[0] * y.v[0], x.v[1] * y.v[1]}};
+	}
+	double lane(int i) const
+	{
+		return v[i];
+	}
+#endif
+};
+
+/// @brief Loudness of a mean square energy in LUFS
+static double energyToLoudness(double energy)
+{
+	return -0.691 + 10.0 * std::log10(energy);
+}
+
+/// @brief Mean square energy of a loudness in LUFS
+static double loudnessToEnergy(double loudness)
+{
+	return std::pow(10.0, (loudness + 0.691) / 10.0);
+}
+
+/// @brief Pi
+static constexpr double pi = 3.14159265358979323846;
+
+/// @brief Absolute gate in LUFS
+static constexpr double absoluteGate = -70.0;
+
+LoudnessMeter::LoudnessMeter(unsigned channels, unsigned sampleRate) : m_channels(channels)
+{
+	const double rate = static_cast<double>(sampleRate);
+	m_subBlockFrames = std::max<size_t>(1, static_cast<size_t>(std::lround(rate / 10.0)));
+
+	// K-weighting, BS.1770 Annex 1, with the coefficients re-derived for the actual sample rate
+	{
+		const double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+		const double k = std::tan(pi * f0 / rate);
+		const double vh = std::pow(10.0, gain / 20.0);
+		const double vb = std::pow(vh, 0.4996667741545416);
+		const double a0 = 1.0 + k / q + k * k;
+		m_shelf = {(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+		           2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+	}
+	{
+		const double f0 = 38.13547087602444, q = 0.5003270373238773;
+		const double k = std::tan(pi * f0 / rate);
+		const double a0 = 1.0 + k / q + k * k;
+		m_highPass = {1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+	}
+
+	// Channel weights: surrounds count +1.5 dB, LFE is ignored
+	const size_t padded = (channels + 1) & ~size_t(1);
+	m_weights.assign(padded, 0.0);
+	for (unsigned c = 0; c < channels; ++c)
+		m_weights[c] = 1.0;
+	if (channels == 5)
+		m_weights[3] = m_weights[4] = 1.41;
+	else if (channels == 6)
+	{
+		m_weights[3] = 0.0;
+		m_weights[4] = m_weights[5] = 1.41;
+	}
+
+	m_state.assign(padded * 4, 0.0);
+	m_sums.assign(padded, 0.0);
+
+	// True peak: 4x below 96 kHz, 2x below 192 kHz, as recommended by BS.1770-4 Annex 2
+	m_oversample = sampleRate < 96000 ? 4 : sampleRate < 192000 ? 2 : 1;
+	m_phases.assign(TapsPerPhase * 4, 0.0f);
+	if (m_oversample > 1)
+	{
+		// Windowed sinc low pass at the input Nyquist frequency, split into phases and
+		// stored tap-major with the taps reversed so the history is read oldest first
+		const unsigned taps = TapsPerPhase * m_oversample;
+		const double   centre = (taps - 1) / 2.0;
+		for (unsigned n = 0; n < taps; ++n)
+		{
+			double x = (n - centre) / m_oversample;
+			double sinc = x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+			double window = 0.42 - 0.5 * std::cos(2.0 * pi * (n + 0.5) / taps) +
+			                0.08 * std::cos(4.0 * pi * (n + 0.5) / taps); // Blackman
+			unsigned phase = n % m_oversample;
+			unsigned tap = n / m_oversample;
+			m_phases[(TapsPerPhase - 1 - tap) * 4 + phase] = static_cast<float>(sinc * window);
+		}
+	}
+	m_history.assign(static_cast<size_t>(channels) * TapsPerPhase * 2, 0.0f);
+}
+
+void LoudnessMeter::process(const float *const *planes, size_t frames)
+{
+	size_t offset = 0;
+	while (offset < frames)
+	{
+		size_t block = std::min(frames - offset, m_subBlockFrames - m_subBlockFill);
+		filterBlock(planes, offset, block);
+		truePeakBlock(planes, offset, block);
+		m_subBlockFill += block;
+		offset += block;
+		if (m_subBlockFill == m_subBlockFrames)
+			finishSubBlock();
+	}
+}
+
+void LoudnessMeter::filterBlock(const float *const *planes, size_t offset, size_t frames)
+{
+	const Lanes sb0 = Lanes::splat(m_shelf.b0), sb1 = Lanes::splat(m_shelf.b1), sb2 = Lanes::splat(m_shelf.b2);
+	const Lanes sa1 = Lanes::splat(m_shelf.a1), sa2 = Lanes::splat(m_shelf.a2);
+	const Lanes hb0 = Lanes::splat(m_highPass.b0), hb1 = Lanes::splat(m_highPass.b1);
+	const Lanes hb2 = Lanes::splat(m_highPass.b2), ha1 = Lanes::splat(m_highPass.a1);
+	const Lanes ha2 = Lanes::splat(m_highPass.a2);
+
+	for (unsigned c = 0; c < m_channels; c += 2)
+	{
+		// Odd channel counts filter the last channel against itself and drop the copy
+		const float *left = planes[c] + offset;
+		const float *right = (c + 1 < m_channels ? planes[c + 1] : planes[c]) + offset;
+		double      *state = &m_state[c * 4];
+
+		Lanes z1s = Lanes::set(state[0], state[4]), z2s = Lanes::set(state[1], state[5]);
+		Lanes z1h = Lanes::set(state[2], state[6]), z2h = Lanes::set(state[3], state[7]);
+		Lanes sum = Lanes::splat(0.0);
+
+		// Transposed direct form II, both biquads back to back
+		for (size_t n = 0; n < frames; ++n)
+		{
+			Lanes x = Lanes::set(left[n], right[n]);
+			Lanes y = sb0 * x + z1s;
+			z1s = sb1 * x - sa1 * y + z2s;
+			z2s = sb2 * x - sa2 * y;
+
+			Lanes k = hb0 * y + z1h;
+			z1h = hb1 * y - ha1 * k + z2h;
+			z2h = hb2 * y - ha2 * k;
+
+			sum = sum + k * k;
+		}
+
+		const Lanes *lanes[] = {&z1s, &z2s, &z1h, &z2h};
+		for (int i = 0; i < 4; ++i)
+		{
+			state[i] = lanes[i]->lane(0);
+			state[i + 4] = lanes[i]->lane(1);
+		}
+		m_sums[c] += sum.lane(0);
+		if (c + 1 < m_channels)
+			m_sums[c + 1] += sum.lane(1);
+	}
+}
+
+void LoudnessMeter::truePeakBlock(const float *const *planes, size_t offset, size_t frames)
+{
+	if (m_oversample == 1)
+	{
+		for (unsigned c = 0; c < m_channels; ++c)
+			for (size_t n = 0; n < frames; ++n)
+				m_peak = std::max(m_peak, std::fabs(planes[c][offset + n]));
+		return;
+	}
+
+	for (unsigned c = 0; c < m_channels; ++c)
+	{
+		const float *input = planes[c] + offset;
+		float       *history = &m_history[static_cast<size_t>(c) * TapsPerPhase * 2];
+		unsigned     pos = m_historyPos;
+
+#if defined(MU_SIMD_SSE2)
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		__m128       peak = _mm_set1_ps(m_peak);
+		for (size_t n = 0; n < frames; ++n)
+		{
+			history[pos] = history[pos + TapsPerPhase] = input[n];
+			pos = (pos + 1) % TapsPerPhase;
+
+			// All phases at once: lane p accumulates the output of phase p
+			const float *window = history + pos;
+			__m128       acc = _mm_setzero_ps();
+			for (unsigned t = 0; t < TapsPerPhase; ++t)
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(window[t]), _mm_loadu_ps(&m_phases[t * 4])));
+			peak = _mm_max_ps(peak, _mm_and_ps(acc, absMask));
+		}
+		alignas(16) float lanes[4];
+		_mm_store_ps(lanes, peak);
+		m_peak = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+#elif defined(MU_SIMD_NEON)
+		float32x4_t peak = vdupq_n_f32(m_peak);
+		for (size_t n = 0; n < frames; ++n)
+		{
+			history[pos] = history[pos + TapsPerPhase] = input[n];
+			pos = (pos + 1) % TapsPerPhase;
+
+			const float *window = history + pos;
+			float32x4_t  acc = vdupq_n_f32(0.0f);
+			for (unsigned t = 0; t < TapsPerPhase; ++t)
+				acc = vmlaq_n_f32(acc, vld1q_f32(&m_phases[t * 4]), window[t]);
+			peak = vmaxq_f32(peak, vabsq_f32(acc));
+		}
+		float lanes[4];
+		vst1q_f32(lanes, peak);
+		m_peak = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+#else
+		for (size_t n = 0; n < frames; ++n)
+		{
+			history[pos] = history[pos + TapsPerPhase] = input[n];
+			pos = (pos + 1) % TapsPerPhase;
+
+			const float *window = history + pos;
+			for (unsigned p = 0; p < m_oversample; ++p)
+			{
+				float acc = 0.0f;
+				for (unsigned t = 0; t < TapsPerPhase; ++t)
+					acc += window[t] * m_phases[t * 4 + p];
+				m_peak = std::max(m_peak, std::fabs(acc));
+			}
+		}
+#endif
+		// Every channel advances by the same amount; only commit after the last one
+		if (c + 1 == m_channels)
+			m_historyPos = pos;
+	}
+}
+
+void LoudnessMeter::finishSubBlock()
+{
+	double energy = 0.0;
+	for (unsigned c = 0; c < m_channels; ++c)
+	{
+		energy += m_weights[c] * m_sums[c];
+		m_sums[c] = 0.0;
+	}
+	m_subBlocks.push_back(energy / static_cast<double>(m_subBlockFrames));
+	m_subBlockFill = 0;
+
+	// 400 ms gating blocks and 3 s short-term blocks, both hopping by one sub-block
+	auto window = [this](size_t count) {
+		double sum = 0.0;
+		for (size_t i = m_subBlocks.size() - count; i < m_subBlocks.size(); ++i)
+			sum += m_subBlocks[i];
+		return sum / static_cast<double>(count);
+	};
+	if (m_subBlocks.size() >= 4)
+		m_blocks.push_back(window(4));
+	if (m_subBlocks.size() >= 30)
+		m_shortTerm.push_back(window(30));
+}
+
+double LoudnessMeter::gatedLoudness(const std::vector<double> &blocks)
+{
+	const double absoluteEnergy = loudnessToEnergy(absoluteGate);
+
+	double sum = 0.0;
+	size_t count = 0;
+	for (double block : blocks)
+	{
+		if (block > absoluteEnergy)
+		{
+			sum += block;
+			++count;
+		}
+	}
+	if (count == 0)
+		return -std::numeric_limits<double>::infinity();
+
+	// Relative gate 10 LU below the loudness of the absolute-gated blocks
+	const double relativeEnergy = (sum / static_cast<double>(count)) * 0.1;
+	const double gate = std::max(absoluteEnergy, relativeEnergy);
+
+	sum = 0.0;
+	count = 0;
+	for (double block : blocks)
+	{
+		if (block > gate)
+		{
+			sum += block;
+			++count;
+		}
+	}
+	if (count == 0)
+		return -std::numeric_limits<double>::infinity();
+	return energyToLoudness(sum / static_cast<double>(count));
+}
+
+double LoudnessMeter::loudnessRange(const std::vector<double> &blocks)
+{
+	const double absoluteEnergy = loudnessToEnergy(absoluteGate);
+
+	double sum = 0.0;
+	size_t count = 0;
+	for (double block : blocks)
+	{
+		if (block > absoluteEnergy)
+		{
+			sum += block;
+			++count;
+		}
+	}
+	if (count == 0)
+		return 0.0;
+
+	const double        relativeGate = energyToLoudness(sum / static_cast<double>(count)) - 20.0;
+	std::vector<double> loudness;
+	loudness.reserve(count);
+	for (double block : blocks)
+		if (block > absoluteEnergy && energyToLoudness(block) > relativeGate)
+			loudness.push_back(energyToLoudness(block));
+	if (loudness.empty())
+		return 0.0;
+
+	std::sort(loudness.begin(), loudness.end());
+	auto percentile = [&loudness](double p) {
+		return loudness[static_cast<size_t>(std::lround(p * static_cast<double>(loudness.size() - 1)))];
+	};
+	return percentile(0.95) - percentile(0.10);
+}
+
+LoudnessMeter::Result LoudnessMeter::result() const
+{
+	return combine({this});
+}
+
+LoudnessMeter::Result LoudnessMeter::combine(const std::vector<const LoudnessMeter *> &meters)
+{
+	std::vector<double> blocks, shortTerm;
+	float               peak = 0.0f;
+	for (const LoudnessMeter *meter : meters)
+	{
+		blocks.insert(blocks.end(), meter->m_blocks.begin(), meter->m_blocks.end());
+		shortTerm.insert(shortTerm.end(), meter->m_shortTerm.begin(), meter->m_shortTerm.end());
+		peak = std::max(peak, meter->m_peak);
+	}
+
+	Result result;
+	result.Integrated = gatedLoudness(blocks);
+	result.Range = loudnessRange(shortTerm);
+	result.TruePeak = 20.0 * std::log10(static_cast<double>(peak));
+	return result;
+}
+
+LoudnessMeter LoudnessMeter::analyzeFile(const std::filesystem::path &filePath)
+{
+	AudioSource source;
+	source.open(filePath);
+
+	LoudnessMeter meter(source.channels(), source.sampleRate());
+
+	constexpr size_t                blockFrames = 8192;
+	std::vector<std::vector<float>> buffers(source.channels(), std::vector<float>(blockFrames));
+	std::vector<float *>            planes;
+	for (auto &buffer : buffers)
+		planes.push_back(buffer.data());
+
+	while (size_t frames = source.read(planes.data(), blockFrames))
+		meter.process(planes.data(), frames);
+
+	return meter;
+}
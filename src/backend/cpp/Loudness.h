@@ -0,0 +1,154 @@
+/**
+ * @file Loudness.h
+ * @brief ITU-R BS.1770 / EBU R128 loudness and true-peak measurement.
+ *
+ * Implements K-weighting, the gated integrated loudness, loudness range
+ * (EBU Tech 3342) and the 4x oversampled true peak. Channels are filtered in
+ * pairs in double precision SIMD lanes.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * LoudnessMeter::Result result = LoudnessMeter::analyzeFile("master.wav").result();
+ * std::cout << result.Integrated << " LUFS\n";
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <vector>
+
+/// @brief BS.1770 loudness meter
+class LoudnessMeter
+{
+  public:
+	/// @brief Measurement result
+	class Result
+	{
+	  public:
+		/// @brief Integrated loudness in LUFS
+		double Integrated = std::numeric_limits<double>::quiet_NaN();
+		/// @brief Loudness range in LU
+		double Range = std::numeric_limits<double>::quiet_NaN();
+		/// @brief True peak in dBTP
+		double TruePeak = std::numeric_limits<double>::quiet_NaN();
+
+		/// @brief Whether a measurement is present
+		bool valid() const
+		{
+			return !std::isnan(Integrated);
+		}
+	};
+
+	/**
+	 * @brief Create a meter
+	 * @param channels Number of channels
+	 * @param sampleRate Sample rate in Hz
+	 */
+	LoudnessMeter(unsigned channels, unsigned sampleRate);
+
+	/**
+	 * @brief Feed planar samples
+	 * @param planes One buffer per channel
+	 * @param frames Number of frames
+	 */
+	void process(const float *const *planes, size_t frames);
+
+	/// @brief Result for everything processed so far
+	Result result() const;
+
+	/**
+	 * @brief Combined result of several meters, e.g. the tracks of an album
+	 *
+	 * Gating runs over the blocks of all meters together as if the tracks
+	 * were played back to back.
+	 *
+	 * @param meters Meters to combine
+	 * @return Combined result
+	 */
+	static Result combine(const std::vector<const LoudnessMeter *> &meters);
+
+	/**
+	 * @brief Measure a whole file
+	 *
+	 * @param filePath Input, read natively if it is a WAV file
+	 * @return Meter that has processed the whole file
+	 * @throws std::runtime_error if the file cannot be read
+	 */
+	static LoudnessMeter analyzeFile(const std::filesystem::path &filePath);
+
+	/// @brief ReplayGain 2.0 reference loudness in LUFS
+	static constexpr double ReplayGainReference = -18.0;
+
+  private:
+	/// @brief Biquad coefficients
+	struct Biquad
+	{
+		double b0, b1, b2, a1, a2;
+	};
+
+	/// @brief K-weight, square and accumulate a block of frames
+	void filterBlock(const float *const *planes, size_t offset, size_t frames);
+	/// @brief Track the oversampled peak of a block of frames
+	void truePeakBlock(const float *const *planes, size_t offset, size_t frames);
+	/// @brief Close the current 100 ms sub-block
+	void finishSubBlock();
+
+	/// @brief Gated integrated loudness of a set of 400 ms block energies
+	static double gatedLoudness(const std::vector<double> &blocks);
+	/// @brief Loudness range of a set of 3 s block energies
+	static double loudnessRange(const std::vector<double> &blocks);
+
+	/// @brief Number of channels
+	unsigned m_channels;
+	/// @brief Frames per 100 ms sub-block
+	size_t m_subBlockFrames;
+	/// @brief Frames accumulated in the current sub-block
+	size_t m_subBlockFill = 0;
+	/// @brief Pre-filter (high shelf)
+	Biquad m_shelf;
+	/// @brief RLB filter (high pass)
+	Biquad m_highPass;
+	/// @brief Channel weights, padded to an even count
+	std::vector<double> m_weights;
+	/// @brief Filter state per channel: shelf z1, z2, high pass z1, z2
+	std::vector<double> m_state;
+	/// @brief Squared sums of the current sub-block per channel
+	std::vector<double> m_sums;
+	/// @brief Weighted mean square of every completed sub-block
+	std::vector<double> m_subBlocks;
+	/// @brief Gating blocks (400 ms, 75 % overlap)
+	std::vector<double> m_blocks;
+	/// @brief Short-term blocks (3 s, 100 ms hop) for the loudness range
+	std::vector<double> m_shortTerm;
+
+	/// @brief Oversampling factor for the true peak
+	unsigned m_oversample;
+	/// @brief Interpolation taps per phase
+	static constexpr unsigned TapsPerPhase = 12;
+	/// @brief Polyphase interpolation filter, m_oversample phases of TapsPerPhase taps
+	std::vector<float> m_phases;
+	/// @brief Interpolator history per channel, stored twice for wrap-free reads
+	std::vector<float> m_history;
+	/// @brief Write position in the history
+	unsigned m_historyPos = 0;
+	/// @brief Largest absolute (oversampled) sample value
+	float m_peak = 0.0f;
+};
@@ -0,0 +1,170 @@
+/**
+ * @file MappedFile.cpp
+ * @brief Implementation of the read-only memory mapped file
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "MappedFile.h"
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		m_data = std::exchange(other.m_data, nullptr);
+		m_size = std::exchange(other.m_size, 0);
+		m_open = std::exchange(other.m_open, false);
+#ifdef _WIN32
+		m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+	}
+	return *this;
+}
+
+bool MappedFile::open(const std::filesystem::path &filePath)
+#ifdef _WIN32
+{
+	close();
+
+	HANDLE file = CreateFileW(filePath.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+	                          FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	m_size = static_cast<size_t>(size.QuadPart);
+	if (m_size == 0)
+	{
+		CloseHandle(file);
+		m_open = true;
+		return true;
+	}
+
+	m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!m_mapping)
+		return false;
+
+	m_data = static_cast<const std::uint8_t *>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+		return false;
+	}
+
+	m_open = true;
+	return true;
+}
+#else  // !_WIN32
+{
+	close();
+
+	int fd = ::open(filePath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		::close(fd);
+		return false;
+	}
+
+	m_size = static_cast<size_t>(st.st_size);
+	if (m_size == 0)
+	{
+		::close(fd);
+		m_open = true;
+		return true;
+	}
+
+	void *mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED)
+	{
+		m_size = 0;
+		return false;
+	}
+
+	m_data = static_cast<const std::uint8_t *>(mapping);
+	m_open = true;
+	return true;
+}
+#endif // _WIN32
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	m_mapping = nullptr;
+#else
+	if (m_data)
+		munmap(const_cast<std::uint8_t *>(m_data), m_size);
+#endif
+	m_data = nullptr;
+	m_size = 0;
+	m_open = false;
+}
+
+void MappedFile::adviseSequential(size_t offset, size_t length) const
+{
+	if (!m_data || offset >= m_size)
+		return;
+#ifndef _WIN32
+	// madvise wants a page aligned start
+	const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	size_t       aligned = offset - (offset % page);
+	length = std::min(length, m_size - offset) + (offset - aligned);
+	auto *start = const_cast<std::uint8_t *>(m_data) + aligned;
+	madvise(start, length, MADV_SEQUENTIAL);
+	madvise(start, length, MADV_WILLNEED);
+#else
+	(void)length;
+#endif
+}
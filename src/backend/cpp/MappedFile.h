@@ -0,0 +1,89 @@
+/**
+ * @file MappedFile.h
+ * @brief Read-only memory mapped file.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+/// @brief Read-only memory mapping of a whole file
+class MappedFile
+{
+  public:
+	MappedFile() = default;
+	~MappedFile();
+
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	MappedFile(MappedFile &&other) noexcept;
+	MappedFile &operator=(MappedFile &&other) noexcept;
+
+	/**
+	 * @brief Map a file
+	 *
+	 * Any previous mapping is released first. Empty files map successfully
+	 * with a null data pointer.
+	 *
+	 * @param filePath File to map
+	 * @return true if the file is mapped
+	 */
+	bool open(const std::filesystem::path &filePath);
+
+	/// @brief Release the mapping
+	void close();
+
+	/**
+	 * @brief Hint that a range will be read sequentially soon
+	 * @param offset Byte offset into the file
+	 * @param length Number of bytes
+	 */
+	void adviseSequential(size_t offset, size_t length) const;
+
+	/// @brief Mapped bytes
+	const std::uint8_t *data() const
+	{
+		return m_data;
+	}
+
+	/// @brief Size of the mapping in bytes
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	/// @brief Whether a file is mapped
+	bool isOpen() const
+	{
+		return m_open;
+	}
+
+  private:
+	/// @brief Start of the mapping
+	const std::uint8_t *m_data = nullptr;
+	/// @brief Size of the mapping
+	size_t m_size = 0;
+	/// @brief Whether open() succeeded
+	bool m_open = false;
+#ifdef _WIN32
+	/// @brief File mapping object handle
+	void *m_mapping = nullptr;
+#endif
+};
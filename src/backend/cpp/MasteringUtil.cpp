@@ -20,18 +20,46 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "MasteringUtil.h"
+#include "CacheJournal.h"
+#include "FileWatcher.h"
+#include "Fingerprint.h"
+#include "FlacEncoder.h"
+#include "JobScheduler.h"
+#include "OutputPublisher.h"
+#include "PatternScanner.h"
+#include "SegmentEncoder.h"
+#include "Subprocess.h"
+#include "TagWriter.h"
+#include "ThreadBudget.h"
+#include "ThreadPool.h"
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <unordered_set>
 
 #ifdef _WIN32
@@ -66,6 +94,44 @@ bool NTFS(const std::filesystem::path &path)
 }
 #endif // _WIN32
 
+/// @brief Instances created so far in this process
+static std::atomic<unsigned> instances{0};
+
+MasteringUtility::MasteringUtility() : m_instance(instances++)
+{
+}
+
+MasteringUtility::~MasteringUtility()
+{
+	clearRenders();
+}
+
+void MasteringUtility::SetScheduler(std::shared_ptr<JobScheduler> scheduler)
+{
+	m_sharedScheduler = scheduler != nullptr;
+	m_scheduler = std::move(scheduler);
+}
+
+ThreadPool &MasteringUtility::pool()
+{
+	if (!m_pool)
+		m_pool = std::make_unique<ThreadPool>();
+	return *m_pool;
+}
+
+JobScheduler &MasteringUtility::scheduler()
+{
+	if (!m_scheduler)
+	{
+		m_scheduler = std::make_shared<JobScheduler>(0, m_options.DeviceJobs);
+		m_scheduler->setPolicy(m_options.Lanes);
+		m_scheduler->setConcurrency(m_options.Concurrency);
+		m_scheduler->setPlacement(m_options.Placement);
+		m_scheduler->setWatchdog(m_options.Timeouts);
+	}
+	return *m_scheduler;
+}
+
 /**
  * @brief Grab file modifed information
  * @param filePath File
@@ -90,6 +156,80 @@ static std::string calculateFileHash(const std::filesystem::path &filePath)
 	return ss.str();
 }
 
+/**
+ * @brief Find the cache entry of a song
+ * @param albumCache Album cache
+ * @param song Song to look up
+ * @return Iterator to the entry, or end() if there is none
+ */
+static std::vector<MasteringUtility::SongCacheEntry>::iterator findCacheEntry(
+    MasteringUtility::AlbumCacheEntry &albumCache, const MasteringUtility::Song &song)
+{
+	std::string songId = std::to_string(song.ID);
+	return std::find_if(albumCache.Songs.begin(), albumCache.Songs.end(),
+	                    [&songId, &song](const MasteringUtility::SongCacheEntry &entry) {
+		                    return entry.SongID == songId && entry.Path == song.Path;
+	                    });
+}
+
+/**
+ * @brief Peak file of an output
+ * @param output Output file
+ * @return The output's path with ".peaks" appended
+ */
+static std::filesystem::path peaksPath(const std::filesystem::path &output)
+{
+	std::filesystem::path peaks = output;
+	return peaks += ".peaks";
+}
+
+/**
+ * @brief Directory the encoders of an album write into before their outputs are published
+ * @param album Album
+ * @return Directory inside the album's cache directory, on the same file system as the outputs
+ */
+static std::filesystem::path stagingDir(const MasteringUtility::Album &album)
+{
+	return album.NewPath / ".mas" / "staging" / std::to_string(album.ID);
+}
+
+/// @brief Guards stagingUsers
+static std::mutex stagingMutex;
+/// @brief Instances of this process that process an album, by staging directory
+static std::map<std::filesystem::path, unsigned> stagingUsers;
+
+/// @brief Registers an instance as a user of an album's staging directory for its lifetime
+class StagingUse
+{
+  public:
+	/**
+	 * @brief Clear what an interrupted run left in the directory, unless another instance uses it
+	 * @param directory Staging directory
+	 */
+	explicit StagingUse(std::filesystem::path directory) : m_directory(std::move(directory))
+	{
+		std::lock_guard<std::mutex> lock(stagingMutex);
+		if (stagingUsers[m_directory]++ > 0)
+			return;
+		std::error_code ec;
+		std::filesystem::remove_all(m_directory, ec);
+	}
+
+	~StagingUse()
+	{
+		std::lock_guard<std::mutex> lock(stagingMutex);
+		if (--stagingUsers[m_directory] == 0)
+			stagingUsers.erase(m_directory);
+	}
+
+	StagingUse(const StagingUse &) = delete;
+	StagingUse &operator=(const StagingUse &) = delete;
+
+  private:
+	/// @brief Staging directory
+	std::filesystem::path m_directory;
+};
+
 /**
  * @brief Get Audio Codecs
  * Requests audio codecs from FFMPEG
@@ -181,6 +321,422 @@ static std::string trim(const std::string &input)
 	return (start == std::string::npos) ? "" : input.substr(start, end - start + 1);
 }
 
+/**
+ * @brief Hash a list of settings into a cache key
+ * @param values Values to hash
+ * @return 64-bit FNV-1a hash as hex
+ */
+template <typename Range> static std::string settingsKey(const Range &values)
+{
+	std::uint64_t hash = 0xcbf29ce484222325ull;
+	for (std::string_view value : values)
+	{
+		for (char c : value)
+			hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001b3ull;
+		hash = (hash ^ 0xFF) * 0x100000001b3ull; // separator, never part of UTF-8
+	}
+	std::stringstream ss;
+	ss << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return ss.str();
+}
+
+/**
+ * @brief Whether ffmpeg embeds the album art into a song
+ * @param song Song
+ * @param album Parent album
+ */
+static bool embedsAlbumArt(const MasteringUtility::Song &song, const MasteringUtility::Album &album)
+{
+	return song.Codec != "flac" && song.Codec != "FLAC" && song.Codec != FlacEncoder::CodecName &&
+	       song.Codec != "wav" && song.Codec != "WAV" && !song.Codec.empty() && !album.AlbumArt.empty();
+}
+
+/**
+ * @brief Key of everything that affects the encoded audio of a song
+ * @param song Song
+ * @param album Parent album
+ * @return Settings key
+ */
+static std::string encodeKey(const MasteringUtility::Song &song, const MasteringUtility::Album &album)
+{
+	std::string                           output = (album.NewPath / song.NewPath).string();
+	std::string                           art = embedsAlbumArt(song, album) ? album.AlbumArt.string() : "";
+	const std::array<std::string_view, 5> values = {song.Codec, song.arguments, album.arguments, output, art};
+	return settingsKey(values);
+}
+
+/**
+ * @brief Key of a rendered input
+ * @param song Song
+ * @param format Delivery format
+ * @param hash Hash of the input file
+ * @return Key
+ */
+static std::string renderKey(const MasteringUtility::Song &song, const DspStage::Format &format,
+                             const std::string &hash)
+{
+	const std::array<std::string, 6> values = {std::filesystem::absolute(song.Path).string(),
+	                                           hash,
+	                                           std::to_string(format.SampleRate),
+	                                           std::to_string(format.Bits),
+	                                           std::to_string(static_cast<int>(format.Dither)),
+	                                           format.Filters};
+	return settingsKey(values);
+}
+
+/// @brief Readable summary of a delivery format
+static std::string describeFormat(const DspStage::Format &format)
+{
+	std::string text;
+	auto        add = [&text](const std::string &part) { text += (text.empty() ? "" : ", ") + part; };
+	if (format.SampleRate)
+		add(std::to_string(format.SampleRate) + " Hz");
+	if (format.Bits)
+		add(std::to_string(format.Bits) + "-bit");
+	if (!format.Filters.empty())
+		add(format.Filters);
+	return text;
+}
+
+/// @brief DSP graph settings from the processing options
+static DspGraph::Settings graphSettings(const MasteringUtility::Options &options)
+{
+	DspGraph::Settings settings;
+	settings.BlockSize = options.BlockSize;
+	return settings;
+}
+
+/**
+ * @brief Take the delivery format options out of ffmpeg arguments
+ *
+ * -ar, -sample_fmt s16/s16p, -dither_method and filter chains (-af) that
+ * DspGraph understands are handled by DspStage, so they are removed from
+ * @p arguments.
+ *
+ * @param arguments Arguments, the remaining ones are left in place
+ * @param format Format to update
+ */
+static void takeRenderFormat(std::string &arguments, DspStage::Format &format)
+{
+	std::istringstream args(arguments);
+	std::string        rest;
+	for (std::string arg, value; args >> arg;)
+	{
+		unsigned rate;
+		if (arg == "-ar" && args >> value &&
+		    std::from_chars(value.data(), value.data() + value.size(), rate).ec == std::errc() && rate > 0)
+			format.SampleRate = rate;
+		else if (arg == "-sample_fmt" && args >> value && (value == "s16" || value == "s16p"))
+			format.Bits = 16;
+		else if (arg == "-dither_method" && args >> value)
+		{
+			// Every other swresample method is a noise shaping curve
+			if (value == "none")
+				format.Dither = Ditherer::Mode::None;
+			else if (value == "rectangular" || value.starts_with("triangular"))
+				format.Dither = Ditherer::Mode::Triangular;
+			else
+				format.Dither = Ditherer::Mode::Shaped;
+		}
+		else if (arg == "-af" && args >> value && DspGraph::supports(value))
+			format.Filters = value;
+		else
+		{
+			// ffmpeg applies the last -af only
+			if (arg == "-af")
+				format.Filters.clear();
+			rest += (rest.empty() ? "" : " ") + arg;
+			if (!value.empty())
+				rest += " " + value;
+		}
+		value.clear();
+	}
+	arguments = rest;
+}
+
+/**
+ * @brief Whether ffmpeg applies filters that the native graph does not run
+ *
+ * Peaks are taken before ffmpeg, so they would miss what such filters do to the audio.
+ *
+ * @param albumArgs Album arguments
+ * @param songArgs Song arguments
+ */
+static bool ffmpegFilters(std::string albumArgs, std::string songArgs)
+{
+	DspStage::Format format;
+	takeRenderFormat(albumArgs, format);
+	takeRenderFormat(songArgs, format);
+	const std::string rest = albumArgs + " " + songArgs;
+	return rest.find("-af") != std::string::npos || rest.find("-filter") != std::string::npos;
+}
+
+/**
+ * @brief Parse an ffmpeg time duration
+ *
+ * Accepts [-][HH:]MM:SS[.m...] and [-]S+[.m...][s|ms|us].
+ *
+ * @param text Duration
+ * @param seconds Parsed value
+ * @return false if @p text is not a duration
+ */
+static bool parseDuration(std::string_view text, double &seconds)
+{
+	const bool negative = text.starts_with('-');
+	if (negative)
+		text.remove_prefix(1);
+	double scale = 1.0;
+	if (text.find(':') == std::string_view::npos)
+	{
+		if (text.ends_with("ms") || text.ends_with("us"))
+		{
+			scale = text.ends_with("ms") ? 1e-3 : 1e-6;
+			text.remove_suffix(2);
+		}
+		else if (text.ends_with('s'))
+			text.remove_suffix(1);
+	}
+
+	seconds = 0.0;
+	for (int field = 0;; ++field)
+	{
+		size_t           colon = text.find(':');
+		std::string_view part = text.substr(0, colon);
+		double           value;
+		auto [end, ec] = std::from_chars(part.data(), part.data() + part.size(), value, std::chars_format::fixed);
+		if (field > 2 || part.empty() || ec != std::errc() || end != part.data() + part.size() || value < 0.0)
+			return false;
+		seconds = seconds * 60.0 + value;
+		if (colon == std::string_view::npos)
+			break;
+		text.remove_prefix(colon + 1);
+	}
+	seconds *= negative ? -scale : scale;
+	return true;
+}
+
+/**
+ * @brief Take the track points out of ffmpeg arguments
+ *
+ * -ss, -to and -t cut a track out of the input. DspStage::split() does that
+ * sample-accurately, so they are removed from @p arguments.
+ *
+ * @param arguments Arguments, the remaining ones are left in place
+ * @param track Track to update; End stays negative if no end is given
+ * @return Whether any track point was given
+ */
+static bool takeTrackRange(std::string &arguments, DspStage::Track &track)
+{
+	std::istringstream args(arguments);
+	std::string        rest;
+	double             duration = -1.0;
+	bool               found = false;
+	for (std::string arg, value; args >> arg;)
+	{
+		double seconds;
+		if ((arg == "-ss" || arg == "-to" || arg == "-t") && args >> value && parseDuration(value, seconds) &&
+		    seconds >= 0.0)
+		{
+			if (arg == "-ss")
+				track.Start = seconds;
+			else if (arg == "-to")
+				track.End = seconds;
+			else
+				duration = seconds;
+			found = true;
+		}
+		else
+		{
+			rest += (rest.empty() ? "" : " ") + arg;
+			if (!value.empty())
+				rest += " " + value;
+		}
+		value.clear();
+	}
+	// As in ffmpeg, -t wins over -to
+	if (duration >= 0.0)
+		track.End = track.Start + duration;
+	arguments = rest;
+	return found;
+}
+
+/**
+ * @brief Start of the track that follows a track of the same input
+ * @param song Song of the track
+ * @param album Parent album
+ * @param start Start of the track in seconds
+ * @return Earliest later start of another track of the same input, -1 if there is none
+ */
+static double nextTrackStart(const MasteringUtility::Song &song, const MasteringUtility::Album &album, double start)
+{
+	double next = -1.0;
+	for (const auto &other : album.SongsList)
+	{
+		std::string     arguments = other.arguments;
+		DspStage::Track track;
+		if (&other == &song || other.Path != song.Path || !takeTrackRange(arguments, track) || track.Start <= start)
+			continue;
+		if (next < 0.0 || track.Start < next)
+			next = track.Start;
+	}
+	return next;
+}
+
+/**
+ * @brief Native FLAC encoder settings from arguments
+ *
+ * Only -compression_level is understood; other arguments are reported and ignored.
+ *
+ * @param arguments Album and song arguments
+ * @return Settings
+ */
+static FlacEncoder::Settings flacSettings(const std::string &arguments)
+{
+	FlacEncoder::Settings settings;
+	std::istringstream    args(arguments);
+	for (std::string arg; args >> arg;)
+	{
+		int level;
+		if (arg == "-compression_level" && args >> arg &&
+		    std::from_chars(arg.data(), arg.data() + arg.size(), level).ec == std::errc())
+			settings.CompressionLevel = std::clamp(level, 0, 8);
+		else
+			std::cerr << "  Ignoring argument for the native FLAC encoder: " << arg << std::endl;
+	}
+	return settings;
+}
+
+/**
+ * @brief Tags written to the output of a song
+ * @param song Song
+ * @param entry Cache entry of the song with its loudness, may be null
+ * @param albumCache Album cache with the album loudness
+ * @param replayGain Include ReplayGain tags
+ * @return Tags
+ */
+static TagWriter::Tags songTags(const MasteringUtility::Song &song, const MasteringUtility::SongCacheEntry *entry,
+                                const MasteringUtility::AlbumCacheEntry &albumCache, bool replayGain)
+{
+	using Field = TagWriter::Field;
+	TagWriter::Tags tags;
+	auto            set = [&tags](Field field, std::string value) {
+		tags[static_cast<size_t>(field)] = std::move(value);
+	};
+
+	set(Field::Title, song.Title);
+	set(Field::Artist, song.Artist);
+	set(Field::Album, song.Album);
+	set(Field::Genre, song.Genre);
+	set(Field::Date, song.Year);
+	set(Field::Comment, song.Comment);
+	set(Field::Copyright, song.Copyright);
+	set(Field::Track, std::to_string(song.TrackNumber));
+
+	if (replayGain && entry && entry->Loudness.valid())
+	{
+		auto gain = [](double loudness) {
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(2) << LoudnessMeter::ReplayGainReference - loudness << " dB";
+			return ss.str();
+		};
+		auto peak = [](double truePeak) {
+			std::stringstream ss;
+			ss << std::fixed << std::setprecision(6) << std::pow(10.0, truePeak / 20.0);
+			return ss.str();
+		};
+
+		set(Field::TrackGain, gain(entry->Loudness.Integrated));
+		set(Field::TrackPeak, peak(entry->Loudness.TruePeak));
+		if (albumCache.Loudness.valid())
+		{
+			set(Field::AlbumGain, gain(albumCache.Loudness.Integrated));
+			set(Field::AlbumPeak, peak(albumCache.Loudness.TruePeak));
+		}
+	}
+	return tags;
+}
+
+/**
+ * @brief Run a command with its output discarded
+ * @param command Command line
+ * @return Exit status
+ * @throws std::runtime_error if the command cannot be started
+ */
+static int runCommand(std::string command)
+{
+#ifdef _WIN32
+	command += " 2>&1 1>NUL";
+#else
+	command += " 2>&1 1>/dev/null";
+#endif
+	Subprocess process(command, Subprocess::Mode::Read);
+	char       buffer[4096];
+	while (fgets(buffer, sizeof(buffer), process.stream()))
+	{
+	}
+	return process.close();
+}
+
+/// @brief Discards the output of an encoder that reads its input from a pipe
+#ifdef _WIN32
+static constexpr std::string_view quietRedirect = " 1>NUL 2>&1";
+#else
+static constexpr std::string_view quietRedirect = " 1>/dev/null 2>&1";
+#endif
+
+/// @brief Whether an input is 16 or 24-bit PCM WAV, which a fan-out passes to the encoders unchanged
+static bool isPlainPcm(const std::filesystem::path &input)
+{
+	WavReader wav;
+	return wav.open(input) &&
+	       (wav.format() == WavReader::SampleFormat::Int16 || wav.format() == WavReader::SampleFormat::Int24);
+}
+
+/**
+ * @brief Length of an input in seconds
+ *
+ * Read from the header of WAV and FLAC files; other inputs are estimated
+ * from their size as if they were CD audio, which keeps the estimates of
+ * one input format comparable, but may be several times too short for a
+ * compressed one.
+ *
+ * @param input Audio file
+ * @param[out] exact Whether the length was read rather than estimated
+ * @return Seconds, 0 if the file cannot be read
+ */
+static double inputSeconds(const std::filesystem::path &input, bool &exact)
+{
+	exact = true;
+	try
+	{
+		WavReader wav;
+		if (wav.open(input) && wav.sampleRate() > 0)
+			return static_cast<double>(wav.frames()) / wav.sampleRate();
+	}
+	catch (const std::exception &)
+	{
+	}
+
+	// FLAC starts with STREAMINFO: 20 bits of sample rate at byte 18, 36 bits of total samples at byte 21
+	std::array<unsigned char, 26> head{};
+	std::ifstream                 file(input, std::ios::binary);
+	if (file.read(reinterpret_cast<char *>(head.data()), head.size()) && std::memcmp(head.data(), "fLaC", 4) == 0 &&
+	    (head[4] & 0x7F) == 0)
+	{
+		const unsigned      rate = (head[18] << 12) | (head[19] << 4) | (head[20] >> 4);
+		const std::uint64_t samples = (static_cast<std::uint64_t>(head[21] & 0x0F) << 32) |
+		                              (static_cast<std::uint64_t>(head[22]) << 24) | (head[23] << 16) |
+		                              (head[24] << 8) | head[25];
+		if (rate > 0 && samples > 0)
+			return static_cast<double>(samples) / rate;
+	}
+
+	exact = false;
+	std::error_code     ec;
+	const std::uint64_t size = std::filesystem::file_size(input, ec);
+	return ec ? 0.0 : size / 176400.0;
+}
+
 /**
  * @brief Clean a string
  *
@@ -236,11 +792,38 @@ static std::vector<std::string> splitArgs(const std::string &input)
 	return args;
 }
 
+/// @brief Shell control sequences that must never reach the ffmpeg command line
+static constexpr std::array<std::string_view, 9> shellPatterns = {"&&", "||", "|", ";", "$(", "`", ">", "<", ">>"};
+
+/// @brief Shell control sequences plus options that would overwrite the ones ProcessSong() sets
+static constexpr std::array<std::string_view, 19> overwritePatterns = {
+    "-i ", "--input", "ffmpeg", "ffprobe", "-metadata", "-c:a", "-codec:a", "-map", "&&", "||",
+    "|",   ";",       "$(",     "`",       ">",         "<",    ">>",       "-y",   "-n"};
+
+/// @brief Compiled shellPatterns
+static constexpr PatternScanner<patternStates(shellPatterns)> shellScanner(shellPatterns);
+/// @brief Compiled overwritePatterns
+static constexpr PatternScanner<patternStates(overwritePatterns)> overwriteScanner(overwritePatterns);
+
+/**
+ * @brief Blank out every pattern match in place
+ * @param scanner Compiled pattern set
+ * @param text Text to clean
+ */
+template <typename Scanner> static void blankMatches(const Scanner &scanner, std::string &text)
+{
+	scanner.scan(text, [&text](size_t end, size_t length) {
+		for (size_t i = end - length; i < end; ++i)
+			text[i] = ' ';
+	});
+}
+
 /**
  * @brief Sanitize arguments to prevent command injection
  *
  * Ensures arguments don't contain dangerous patterns that could
  * overwrite critical ffmpeg parameters or inject shell commands.
+ * Matching patterns are replaced with spaces.
  *
  * @param args Raw arguments string
  * @return Sanitized arguments string
@@ -255,33 +838,10 @@ static std::string sanitizeArguments(const std::string &args, const bool prevent
 
 	std::string sanitized = trim(args);
 
-	std::vector<std::string> dangerousPatternsNonOverwrite = {"&&", "||", "|", ";", "$(", "`", ">", "<", ">>"};
-
-	std::vector<std::string> dangerousPatternsOverwrite = {
-	    "-i ", "--input", "ffmpeg", "ffprobe", "-metadata", "-c:a", "-codec:a", "-map", "&&", "||",
-	    "|",   ";",       "$(",     "`",       ">",         "<",    ">>",       "-y",   "-n"};
-
-	std::string lower = sanitized;
-	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
-
-	// Check for dangerous patterns
-	const std::vector<std::string> *patternsToCheck =
-	    preventOverwrite ? &dangerousPatternsOverwrite : &dangerousPatternsNonOverwrite;
-
-	for (const std::string &pattern : *patternsToCheck)
-	{
-		size_t pos = lower.find(pattern);
-		while (pos != std::string::npos)
-		{
-			// Replace or remove the dangerous pattern.
-			// For simplicity, we'll replace it with spaces or remove it.
-			// A more robust solution might involve throwing an exception or
-			// returning an error code.
-			sanitized.replace(pos, pattern.length(), std::string(pattern.length(), ' '));
-			lower.replace(pos, pattern.length(), std::string(pattern.length(), ' '));
-			pos = lower.find(pattern, pos + 1);
-		}
-	}
+	if (preventOverwrite)
+		blankMatches(overwriteScanner, sanitized);
+	else
+		blankMatches(shellScanner, sanitized);
 
 #ifdef _DEBUG
 	std::cout << "Cleaned: " << sanitized << '\n';
@@ -289,145 +849,209 @@ static std::string sanitizeArguments(const std::string &args, const bool prevent
 	return sanitized;
 }
 
-void MasteringUtility::ParseMarkup(const std::filesystem::path &markupFile, Albums &albums)
+/**
+ * @brief Read a whole file into memory
+ *
+ * @param filePath File to read
+ * @param[out] contents File contents
+ * @return true if the file was read
+ */
+static bool readWholeFile(const std::filesystem::path &filePath, std::string &contents)
 {
-	try
+	std::ifstream file(filePath, std::ios::binary);
+	if (!file.is_open())
+		return false;
+
+	std::error_code ec;
+	auto            size = std::filesystem::file_size(filePath, ec);
+	if (ec)
+		return false;
+
+	contents.resize(static_cast<size_t>(size));
+	file.read(contents.data(), static_cast<std::streamsize>(contents.size()));
+	contents.resize(static_cast<size_t>(file.gcount()));
+	return true;
+}
+
+/**
+ * @brief Parse markup text
+ *
+ * Records the byte range of every album block so SaveMarkup() can splice
+ * unchanged blocks back verbatim. A block runs from its `album` line up to the
+ * next `album` line (or the end of the text), so trailing comments and blank
+ * lines stay with the album that precedes them.
+ *
+ * @param text Markup text
+ * @param markupFile Markup file the text belongs to
+ * @param[out] albums Vector of albums
+ */
+static void parseMarkupText(std::string_view text, const std::filesystem::path &markupFile,
+                            MasteringUtility::Albums &albums)
+{
+	using Album = MasteringUtility::Album;
+	using Song = MasteringUtility::Song;
+
+	Album  currentAlbum;
+	bool   insideAlbum = false;
+	size_t albumStart = 0;
+	size_t lastAlbum = std::string::npos;
+
+	size_t pos = 0;
+	while (pos < text.size())
 	{
-		std::ifstream file(markupFile);
-		if (!file.is_open())
-		{
-			std::cerr << "[ParseMarkup] Could not open Markup file: " << markupFile << std::endl;
-			return;
-		}
+		size_t eol = text.find('\n', pos);
+		size_t next = (eol == std::string_view::npos) ? text.size() : eol + 1;
+		size_t lineStart = pos;
+		pos = next;
 
-		std::string line;
-		Album       currentAlbum;
-		bool        insideAlbum = false;
+		std::string line = trim(std::string(text.substr(lineStart, next - lineStart)));
+		if (line.empty() || line[0] == ';' || line[0] == '[')
+			continue;
 
-		while (std::getline(file, line))
+		if (line.rfind("album", 0) == 0)
 		{
-			line = trim(line);
-			if (line.empty() || line[0] == ';' || line[0] == '[')
-				continue;
-
-			if (line.rfind("album", 0) == 0)
+			if (lastAlbum != std::string::npos)
 			{
-				insideAlbum = true;
-				currentAlbum = Album();
+				albums[lastAlbum].MarkupLength = lineStart - albums[lastAlbum].MarkupOffset;
+				lastAlbum = std::string::npos;
+			}
+
+			insideAlbum = true;
+			currentAlbum = Album();
+			albumStart = lineStart;
 
-				currentAlbum.markup = markupFile;
-				auto idStart = std::string("album").size();
-				auto idEnd = line.find('(');
-				if (idEnd != std::string::npos)
+			currentAlbum.markup = markupFile;
+			auto idStart = std::string("album").size();
+			auto idEnd = line.find('(');
+			if (idEnd != std::string::npos)
+			{
+				std::string idStr = trim(line.substr(idStart, idEnd - idStart));
+				try
 				{
-					std::string idStr = trim(line.substr(idStart, idEnd - idStart));
-					try
-					{
-						if (!idStr.empty())
-							currentAlbum.ID = std::stoi(idStr);
-					}
-					catch (...)
-					{
-						std::cerr << "[ParseMarkup] Warning: invalid album ID '" << idStr << "'\n";
-					}
+					if (!idStr.empty())
+						currentAlbum.ID = std::stoi(idStr);
+				}
+				catch (...)
+				{
+					std::cerr << "[ParseMarkup] Warning: invalid album ID '" << idStr << "'\n";
 				}
+			}
 
-				auto start = line.find('(');
-				auto end = line.find_last_of(')');
-				if (start != std::string::npos && end != std::string::npos)
+			auto start = line.find('(');
+			auto end = line.find_last_of(')');
+			if (start != std::string::npos && end != std::string::npos)
+			{
+				auto args = splitArgs(line.substr(start + 1, end - start - 1));
+				if (args.size() >= 8)
 				{
-					auto args = splitArgs(line.substr(start + 1, end - start - 1));
-					if (args.size() >= 8)
+					currentAlbum.Title = cleanString(args[0]);
+					currentAlbum.Artist = cleanString(args[1]);
+					currentAlbum.Copyright = cleanString(args[2]);
+					currentAlbum.AlbumArt = cleanString(args[3]);
+					currentAlbum.Path = cleanString(args[4]);
+					currentAlbum.NewPath = cleanString(args[5]);
+					currentAlbum.Genre = cleanString(args[6]);
+					currentAlbum.Year = cleanString(args[7]);
+					if (args.size() > 8)
+						currentAlbum.Comment = cleanString(args[8]);
+					if (args.size() > 9)
+						currentAlbum.arguments = sanitizeArguments(cleanString(args[9]));
+					if (args.size() > 10)
 					{
-						currentAlbum.Title = cleanString(args[0]);
-						currentAlbum.Artist = cleanString(args[1]);
-						currentAlbum.Copyright = cleanString(args[2]);
-						currentAlbum.AlbumArt = cleanString(args[3]);
-						currentAlbum.Path = cleanString(args[4]);
-						currentAlbum.NewPath = cleanString(args[5]);
-						currentAlbum.Genre = cleanString(args[6]);
-						currentAlbum.Year = cleanString(args[7]);
-						if (args.size() > 8)
-							currentAlbum.Comment = cleanString(args[8]);
-						if (args.size() > 9)
-							currentAlbum.arguments = sanitizeArguments(cleanString(args[9]));
-						if (args.size() > 10)
-						{
-							std::string AFS = cleanString(args[10]);
-							if (AFS == "true" || AFS == "TRUE" || AFS == "yes" || AFS == "YES" || AFS == "1")
-								currentAlbum.AFS = true;
-							else if (AFS == "false" || AFS == "FALSE" || AFS == "no" || AFS == "NO" || AFS == "0" ||
-							         AFS == "")
-								currentAlbum.AFS = false;
-							else
-								throw std::runtime_error("Invalid AFS value: " + AFS + " (" + line + " token 11)");
-						}
+						std::string AFS = cleanString(args[10]);
+						if (AFS == "true" || AFS == "TRUE" || AFS == "yes" || AFS == "YES" || AFS == "1")
+							currentAlbum.AFS = true;
+						else if (AFS == "false" || AFS == "FALSE" || AFS == "no" || AFS == "NO" || AFS == "0" ||
+						         AFS == "")
+							currentAlbum.AFS = false;
+						else
+							throw std::runtime_error("Invalid AFS value: " + AFS + " (" + line + " token 11)");
 					}
 				}
 			}
-			else if (line.rfind("song", 0) == 0 && insideAlbum)
+		}
+		else if (line.rfind("song", 0) == 0 && insideAlbum)
+		{
+			Song song;
+
+			auto idStart = std::string("song").size();
+			auto idEnd = line.find('(');
+			if (idEnd != std::string::npos)
 			{
-				Song song;
+				std::string idStr = trim(line.substr(idStart, idEnd - idStart));
+				try
+				{
+					if (!idStr.empty())
+						song.ID = std::stoi(idStr);
+				}
+				catch (...)
+				{
+					std::cerr << "[ParseMarkup] Warning: invalid song ID '" << idStr << "'\n";
+				}
+			}
 
-				auto idStart = std::string("song").size();
-				auto idEnd = line.find('(');
-				if (idEnd != std::string::npos)
+			auto start = line.find('(');
+			auto end = line.find_last_of(')');
+			if (start != std::string::npos && end != std::string::npos)
+			{
+				auto args = splitArgs(line.substr(start + 1, end - start - 1));
+				if (args.size() >= 8)
 				{
-					std::string idStr = trim(line.substr(idStart, idEnd - idStart));
+					song.Title = cleanString(args[0]);
+					song.Artist = cleanString(args[1]);
 					try
 					{
-						if (!idStr.empty())
-							song.ID = std::stoi(idStr);
+						song.TrackNumber = std::stoi(args[2]);
 					}
 					catch (...)
 					{
-						std::cerr << "[ParseMarkup] Warning: invalid song ID '" << idStr << "'\n";
+						std::cerr << "[ParseMarkup] Warning: invalid track "
+						             "number '"
+						          << args[2] << "'\n";
+						song.TrackNumber = 1;
 					}
+					song.Path = cleanString(args[3]);
+					song.NewPath = cleanString(args[4]);
+					song.Codec = cleanString(args[5]);
+					song.Genre = cleanString(args[6]);
+					song.Year = cleanString(args[7]);
+					if (args.size() > 8)
+						song.Comment = cleanString(args[8]);
+					if (args.size() > 9)
+						song.arguments = sanitizeArguments(cleanString(args[9]));
 				}
+			}
 
-				auto start = line.find('(');
-				auto end = line.find_last_of(')');
-				if (start != std::string::npos && end != std::string::npos)
-				{
-					auto args = splitArgs(line.substr(start + 1, end - start - 1));
-					if (args.size() >= 8)
-					{
-						song.Title = cleanString(args[0]);
-						song.Artist = cleanString(args[1]);
-						try
-						{
-							song.TrackNumber = std::stoi(args[2]);
-						}
-						catch (...)
-						{
-							std::cerr << "[ParseMarkup] Warning: invalid track "
-							             "number '"
-							          << args[2] << "'\n";
-							song.TrackNumber = 1;
-						}
-						song.Path = cleanString(args[3]);
-						song.NewPath = cleanString(args[4]);
-						song.Codec = cleanString(args[5]);
-						song.Genre = cleanString(args[6]);
-						song.Year = cleanString(args[7]);
-						if (args.size() > 8)
-							song.Comment = cleanString(args[8]);
-						if (args.size() > 9)
-							song.arguments = sanitizeArguments(cleanString(args[9]));
-					}
-				}
+			song.Album = currentAlbum.Title;
+			song.Copyright = currentAlbum.Copyright;
 
-				song.Album = currentAlbum.Title;
-				song.Copyright = currentAlbum.Copyright;
+			currentAlbum.SongsList.push_back(song);
+		}
+		else if (line.find("}") != std::string::npos && insideAlbum)
+		{
+			currentAlbum.MarkupOffset = albumStart;
+			albums.push_back(currentAlbum);
+			lastAlbum = albums.size() - 1;
+			insideAlbum = false;
+		}
+	}
 
-				currentAlbum.SongsList.push_back(song);
-			}
-			else if (line.find("}") != std::string::npos && insideAlbum)
-			{
-				albums.push_back(currentAlbum);
-				insideAlbum = false;
-			}
+	if (lastAlbum != std::string::npos)
+		albums[lastAlbum].MarkupLength = text.size() - albums[lastAlbum].MarkupOffset;
+}
+
+void MasteringUtility::ParseMarkup(const std::filesystem::path &markupFile, Albums &albums)
+{
+	try
+	{
+		std::string text;
+		if (!readWholeFile(markupFile, text))
+		{
+			std::cerr << "[ParseMarkup] Could not open Markup file: " << markupFile << std::endl;
+			return;
 		}
+
+		parseMarkupText(text, markupFile, albums);
 	}
 	catch (const std::exception &ex)
 	{
@@ -439,75 +1063,231 @@ void MasteringUtility::ParseMarkup(const std::filesystem::path &markupFile, Albu
 	}
 }
 
-void MasteringUtility::SaveMarkup(const Albums &albums, const std::filesystem::path &markupFile)
+/**
+ * @brief Append an integer to a string
+ * @param out String to append to
+ * @param value Value to append
+ */
+static void appendInt(std::string &out, int value)
 {
-	try
+	std::array<char, 16> buffer;
+	auto [ptr, ec] = std::to_chars(buffer.data(), buffer.data() + buffer.size(), value);
+	out.append(buffer.data(), ptr);
+}
+
+/**
+ * @brief Append a quoted markup field
+ * @param out String to append to
+ * @param value Field value
+ * @param separator Emit a leading ", " separator
+ */
+static void appendQuoted(std::string &out, const std::string &value, bool separator = true)
+{
+	if (separator)
+		out += ", ";
+	out += '"';
+	out += value;
+	out += '"';
+}
+
+/**
+ * @brief Serialize an album block
+ *
+ * @param[out] out String to append the block to
+ * @param album Album to serialize
+ */
+static void appendAlbumBlock(std::string &out, const MasteringUtility::Album &album)
+{
+	out += "album ";
+	appendInt(out, album.ID);
+	out += " (";
+	appendQuoted(out, cleanString(album.Title), false);
+	appendQuoted(out, cleanString(album.Artist));
+	appendQuoted(out, cleanString(album.Copyright));
+	appendQuoted(out, cleanString(album.AlbumArt.string()));
+	appendQuoted(out, cleanString(album.Path.string()));
+	appendQuoted(out, cleanString(album.NewPath.string()));
+	appendQuoted(out, cleanString(album.Genre));
+	appendQuoted(out, cleanString(album.Year));
+
+	bool hasComment = !album.Comment.empty();
+	bool hasArgs = !album.arguments.empty();
+
+	if (hasComment && hasArgs)
 	{
-		std::ofstream file(markupFile);
-		if (!file.is_open())
+		appendQuoted(out, cleanString(album.Comment));
+		appendQuoted(out, cleanString(album.arguments));
+		appendQuoted(out, album.AFS ? "true" : "false");
+	}
+	else if (hasComment && !hasArgs)
+		appendQuoted(out, cleanString(album.Comment));
+	else if (!hasComment && hasArgs)
+	{
+		appendQuoted(out, "");
+		appendQuoted(out, cleanString(album.arguments));
+		appendQuoted(out, album.AFS ? "true" : "false");
+	}
+
+	out += ")\n{\n";
+
+	for (const auto &song : album.SongsList)
+	{
+		out += "    song ";
+		appendInt(out, song.ID);
+		out += " (";
+		appendQuoted(out, cleanString(song.Title), false);
+		appendQuoted(out, cleanString(song.Artist));
+		out += ", ";
+		appendInt(out, song.TrackNumber);
+		appendQuoted(out, cleanString(song.Path.string()));
+		appendQuoted(out, cleanString(song.NewPath.string()));
+		appendQuoted(out, cleanString(song.Codec));
+		appendQuoted(out, cleanString(song.Genre));
+		appendQuoted(out, cleanString(song.Year));
+
+		if (!song.Comment.empty())
+			appendQuoted(out, trim(song.Comment));
+
+		if (!song.arguments.empty())
 		{
-			std::cerr << "[SaveMarkup] Could not open output Markup file: " << markupFile << std::endl;
-			return;
+			if (song.Comment.empty())
+				appendQuoted(out, " ");
+			appendQuoted(out, trim(song.arguments));
 		}
-		file << "; Mastering Utility\n";
-		for (const auto &album : albums)
-		{
-			file << "album " << album.ID << " ("
-			     << "\"" << cleanString(album.Title) << "\", "
-			     << "\"" << cleanString(album.Artist) << "\", "
-			     << "\"" << cleanString(album.Copyright) << "\", "
-			     << "\"" << cleanString(album.AlbumArt.string()) << "\", "
-			     << "\"" << cleanString(album.Path.string()) << "\", "
-			     << "\"" << cleanString(album.NewPath.string()) << "\", "
-			     << "\"" << cleanString(album.Genre) << "\", "
-			     << "\"" << cleanString(album.Year) << "\"";
 
-			bool hasComment = !album.Comment.empty();
-			bool hasArgs = !album.arguments.empty();
+		out += ")\n";
+	}
 
-			if (hasComment && hasArgs)
-			{
-				file << ", \"" << cleanString(album.Comment) << "\"";
-				file << ", \"" << cleanString(album.arguments) << "\"";
-				file << ", \"" << (album.AFS ? "true" : "false") << "\"";
-			}
-			else if (hasComment && !hasArgs)
-				file << ", \"" << cleanString(album.Comment) << "\"";
-			else if (!hasComment && hasArgs)
-			{
-				file << ", \"\"";
-				file << ", \"" << cleanString(album.arguments) << "\"";
-				file << ", \"" << (album.AFS ? "true" : "false") << "\"";
-			}
+	out += "}\n\n";
+}
 
-			file << ")\n{\n";
+/**
+ * @brief Find the original markup block of an album, if it is still current
+ *
+ * The block recorded by ParseMarkup() is reparsed and both sides are
+ * serialized; the original bytes are only reused when they describe exactly
+ * what would be written for the album now.
+ *
+ * @param original Current contents of the markup file
+ * @param markupFile Markup file being saved
+ * @param album Album to look up
+ * @param serialized Freshly serialized block of the album
+ * @return Original block, or an empty view if the album has to be rewritten
+ */
+static std::string_view unchangedAlbumBlock(std::string_view original, const std::filesystem::path &markupFile,
+                                            const MasteringUtility::Album &album, const std::string &serialized)
+{
+	if (album.MarkupLength == 0 || album.MarkupOffset > original.size() ||
+	    album.MarkupLength > original.size() - album.MarkupOffset)
+		return {};
+	if (album.markup != markupFile)
+		return {};
+	if (album.MarkupOffset != 0 && original[album.MarkupOffset - 1] != '\n')
+		return {};
+
+	std::string_view block = original.substr(album.MarkupOffset, album.MarkupLength);
+	if (block.rfind("album", 0) != 0)
+		return {};
+
+	MasteringUtility::Albums parsed;
+	parseMarkupText(block, markupFile, parsed);
+	if (parsed.size() != 1)
+		return {};
+
+	std::string reserialized;
+	reserialized.reserve(serialized.size());
+	appendAlbumBlock(reserialized, parsed.front());
+	return reserialized == serialized ? block : std::string_view{};
+}
 
-			for (const auto &song : album.SongsList)
-			{
-				file << "    song " << song.ID << " ("
-				     << "\"" << cleanString(song.Title) << "\", "
-				     << "\"" << cleanString(song.Artist) << "\", " << song.TrackNumber << ", "
-				     << "\"" << cleanString(song.Path.string()) << "\", "
-				     << "\"" << cleanString(song.NewPath.string()) << "\", "
-				     << "\"" << cleanString(song.Codec) << "\", "
-				     << "\"" << cleanString(song.Genre) << "\", "
-				     << "\"" << cleanString(song.Year) << "\"";
+void MasteringUtility::SaveMarkup(Albums &albums, const std::filesystem::path &markupFile)
+{
+	try
+	{
+		std::string original;
+		bool        hasOriginal = readWholeFile(markupFile, original) && !original.empty();
 
-				if (!song.Comment.empty())
-					file << ", \"" << trim(song.Comment) << "\"";
+		std::string out;
+		out.reserve(original.size() + 1024);
 
-				if (!song.arguments.empty())
+		if (hasOriginal)
+		{
+			// Keep everything in front of the first album (header comments etc.) as-is
+			size_t firstAlbum = original.size();
+			for (size_t pos = 0; pos < original.size();)
+			{
+				size_t eol = original.find('\n', pos);
+				size_t next = (eol == std::string::npos) ? original.size() : eol + 1;
+				if (trim(original.substr(pos, next - pos)).rfind("album", 0) == 0)
 				{
-					if (song.Comment.empty())
-						file << ", \" \"";
-					file << ", \"" << trim(song.arguments) << "\"";
+					firstAlbum = pos;
+					break;
 				}
+				pos = next;
+			}
+			out.append(original, 0, firstAlbum);
+		}
+		else
+		{
+			out += "; Mastering Utility\n";
+		}
 
-				file << ")\n";
+		// Where every block ends up, recorded once the file is saved so the next save splices again
+		std::vector<std::pair<size_t, size_t>> ranges;
+		ranges.reserve(albums.size());
+		std::string serialized;
+		for (const auto &album : albums)
+		{
+			serialized.clear();
+			appendAlbumBlock(serialized, album);
+
+			std::string_view block =
+			    hasOriginal ? unchangedAlbumBlock(original, markupFile, album, serialized) : std::string_view{};
+			ranges.emplace_back(out.size(), block.empty() ? serialized.size() : block.size());
+			if (!block.empty())
+				out += block;
+			else
+				out += serialized;
+		}
+		auto record = [&] {
+			for (size_t i = 0; i < albums.size(); ++i)
+			{
+				albums[i].markup = markupFile;
+				albums[i].MarkupOffset = ranges[i].first;
+				albums[i].MarkupLength = ranges[i].second;
 			}
+		};
 
-			file << "}\n\n";
+		if (hasOriginal && out == original)
+		{
+			record();
+			return;
+		}
+
+		// Write everything with a single call into a sibling file, make it durable, then swap it in
+		std::filesystem::path tempFile = markupFile;
+		tempFile += ".tmp";
+		{
+			std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+			if (!file.is_open())
+			{
+				std::cerr << "[SaveMarkup] Could not open output Markup file: " << tempFile << std::endl;
+				return;
+			}
+			file.write(out.data(), static_cast<std::streamsize>(out.size()));
+			file.close();
+			if (file.fail())
+			{
+				std::filesystem::remove(tempFile);
+				throw std::runtime_error("Failed to write " + tempFile.string());
+			}
 		}
+		if (!OutputPublisher::flush({tempFile}))
+			std::cerr << "[SaveMarkup] Could not flush " << tempFile << " to disk" << std::endl;
+		std::filesystem::rename(tempFile, markupFile);
+		if (!OutputPublisher::flush({markupFile}))
+			std::cerr << "[SaveMarkup] Could not flush " << markupFile << " to disk" << std::endl;
+		record();
 	}
 	catch (const std::exception &ex)
 	{
@@ -520,6 +1300,11 @@ void MasteringUtility::SaveMarkup(const Albums &albums, const std::filesystem::p
 }
 
 void MasteringUtility::ProcessAlbum(const Album &album)
+{
+	processAlbum(album, nullptr);
+}
+
+void MasteringUtility::processAlbum(const Album &album, const std::vector<const Song *> *only)
 {
 	try
 	{
@@ -528,11 +1313,14 @@ void MasteringUtility::ProcessAlbum(const Album &album)
 		if (!album.NewPath.empty())
 			std::filesystem::create_directories(album.NewPath);
 
+		// Whatever an interrupted run left in the staging directory was never published
+		StagingUse staging(stagingDir(album));
+
 		if (album.SongsList.empty())
 			throw std::runtime_error("No songs in album");
 
 		auto codec = album.SongsList[0].Codec;
-		if (codec == "wav" || codec == "WAV" || codec == "flac" || codec == "FLAC")
+		if (codec == "wav" || codec == "WAV" || codec == "flac" || codec == "FLAC" || codec == FlacEncoder::CodecName)
 		{
 			std::filesystem::path source = album.Path / album.AlbumArt;
 			std::filesystem::path destination = album.NewPath / ("cover" + album.AlbumArt.extension().string());
@@ -558,8 +1346,20 @@ void MasteringUtility::ProcessAlbum(const Album &album)
 			if (cacheIt->second.MarkupHash != currentMarkupHash)
 			{
 				if (std::filesystem::exists(getCacheFilePath(album)))
-					std::cout << "Markup file changed - remastering entire album\n";
-				cacheIt->second.Songs.clear();
+					std::cout << "Markup file changed - checking songs\n";
+
+				// Songs compare their encode and tag keys with the markup; drop songs that are gone and
+				// force entries from caches without keys to re-encode
+				auto &songs = cacheIt->second.Songs;
+				std::erase_if(songs, [&album](const SongCacheEntry &entry) {
+					auto matches = [&entry](const Song &song) {
+						return std::to_string(song.ID) == entry.SongID && song.Path == entry.Path;
+					};
+					return std::none_of(album.SongsList.begin(), album.SongsList.end(), matches);
+				});
+				for (auto &entry : songs)
+					if (entry.EncodeKey.empty())
+						entry.Hash.clear();
 				cacheIt->second.MarkupHash = currentMarkupHash;
 			}
 		}
@@ -568,10 +1368,27 @@ void MasteringUtility::ProcessAlbum(const Album &album)
 			m_albumCaches[album.ID].MarkupHash = currentMarkupHash;
 		}
 
+		refreshSourceHashes(album);
+
+		if (m_options.Preflight || m_options.PreflightStrict || !m_options.PreflightReport.empty())
+			preflightAlbum(album);
+
+		if (m_options.Analyze || m_options.ReplayGain)
+			analyzeAlbum(album);
+
+		// Scans and measurements survive an encode that is interrupted
+		commitCache(album);
+
+		// The whole album goes to the scheduler at once, so inputs shared by several songs are decoded once
+		std::vector<EncodeJob> jobs;
 		for (const Song &song : album.SongsList)
-			ProcessSong(song, album);
+			if (EncodeJob job; (!only || std::find(only->begin(), only->end(), &song) != only->end()) &&
+			                   prepareEncode(song, album, job))
+				jobs.push_back(std::move(job));
+		encodeTracks(jobs, only ? JobScheduler::Lane::Interactive : JobScheduler::Lane::Batch);
 
-		saveCache(album);
+		// Retagged songs
+		commitCache(album);
 	}
 	catch (const std::exception &ex)
 	{
@@ -587,92 +1404,221 @@ void MasteringUtility::ProcessSong(const Song &song, const Album &album)
 {
 	try
 	{
+		std::vector<EncodeJob> jobs(1);
+		if (prepareEncode(song, album, jobs.front()))
+			encodeTracks(jobs, JobScheduler::Lane::Interactive);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "[ProcessSong] Exception: " << ex.what() << std::endl;
+	}
+	catch (...)
+	{
+		std::cerr << "[ProcessSong] Unknown exception" << std::endl;
+	}
+}
+
+bool MasteringUtility::prepareEncode(const Song &song, const Album &album, EncodeJob &job)
+{
+	try
+	{
+		if (m_preflightFailed.contains(&song))
+			return false;
+
 		std::string currentHash = calculateFileHash(song.Path);
-		std::string songId = std::to_string(song.ID);
 
 		auto &albumCache = m_albumCaches[album.ID];
+		auto  cacheIt = findCacheEntry(albumCache, song);
+		bool  cached = cacheIt != albumCache.Songs.end();
 
-		auto cacheIt = std::find_if(albumCache.Songs.begin(), albumCache.Songs.end(),
-		                            [&songId, &song](const SongCacheEntry &entry) {
-			                            return entry.SongID == songId && entry.Path == song.Path;
-		                            });
+		std::filesystem::path new_songPath = album.NewPath / song.NewPath;
+		TagWriter::Tags       tags = songTags(song, cached ? &*cacheIt : nullptr, albumCache, m_options.ReplayGain);
+		std::string           songEncodeKey = encodeKey(song, album);
+		std::string           songTagKey = settingsKey(tags);
+
+		// Entries from caches without keys are only kept by ProcessAlbum while the markup is unchanged
+		bool sourceUnchanged =
+		    cached && !currentHash.empty() && cacheIt->Hash == currentHash && !m_forced.contains(&song);
+		bool sameAudio = sourceUnchanged && (cacheIt->EncodeKey.empty() || cacheIt->EncodeKey == songEncodeKey);
+
+		// An output that stays gets its peak file from the input if it is missing or was built for other audio.
+		// Outputs that ffmpeg filters get none, and a peak file left from before is removed
+		const std::array<std::string, 2> peaksValues = {currentHash, songEncodeKey};
+		job.Peaks = m_options.Peaks && !ffmpegFilters(album.arguments, song.arguments);
+		if (m_options.Peaks && !job.Peaks)
+		{
+			std::error_code ec;
+			std::filesystem::remove(peaksPath(new_songPath), ec);
+		}
+		const bool missingPeaks = job.Peaks && (!cached || cacheIt->PeaksKey != settingsKey(peaksValues) ||
+		                                        !std::filesystem::exists(peaksPath(new_songPath)));
+		if (sameAudio && (cacheIt->EncodeKey.empty() || cacheIt->TagKey == songTagKey))
+		{
+			cacheIt->EncodeKey = songEncodeKey;
+			cacheIt->TagKey = songTagKey;
+			if (!missingPeaks)
+			{
+				std::cout << "Skipping: " << song.Title << " (File hash matches cache)\n";
+				return false;
+			}
+			job.PeaksOnly = true;
+		}
 
-		if (cacheIt != albumCache.Songs.end() && cacheIt->Hash == currentHash)
+		// Only the tags changed: update them in the existing output instead of encoding again
+		if (!job.PeaksOnly && sameAudio && std::filesystem::exists(new_songPath))
 		{
-			std::cout << "Skipping: " << song.Title << " (File hash matches cache)\n";
-			return;
+			try
+			{
+				TagWriter::Result result = TagWriter::write(new_songPath, tags);
+				if (result != TagWriter::Result::Unsupported)
+				{
+					std::cout << "Retagging: " << song.Title << " -> " << song.NewPath
+					          << (result == TagWriter::Result::InPlace ? " (in place)" : " (rewritten)") << std::endl;
+					cacheIt->TagKey = songTagKey;
+					if (!missingPeaks)
+						return false;
+					job.PeaksOnly = true;
+				}
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "  Retagging failed, encoding instead: " << ex.what() << std::endl;
+			}
 		}
 
-		if (!m_audioCodecs.contains(trim(song.Codec)))
-			throw std::runtime_error("Invalid audio codec: " + trim(song.Codec));
+		std::string codec = trim(song.Codec);
+		if (shellScanner.contains(codec) || (!m_audioCodecs.contains(codec) && codec != FlacEncoder::CodecName))
+			throw std::runtime_error("Invalid audio codec: " + codec);
 		if (!std::filesystem::exists(song.Path))
 			throw std::runtime_error("File not found: " + song.Path.string());
-		std::cout << "Encoding: " << song.Title << " -> " << song.NewPath << " [" << song.Codec << "]" << std::endl;
+		if (job.PeaksOnly)
+			std::cout << "Peaks: " << song.Title << " -> " << peaksPath(song.NewPath) << std::endl;
+		else
+			std::cout << "Encoding: " << song.Title << " -> " << song.NewPath << " [" << song.Codec << "]" << std::endl;
 
-		std::filesystem::path new_songPath = album.NewPath / song.NewPath;
 		std::filesystem::create_directories(new_songPath.parent_path());
+		std::filesystem::create_directories(stagingDir(album));
+
+		// Resampling and requantizing run natively and once per input and format; song settings win
+		std::string      albumArgs = album.arguments, songArgs = song.arguments;
+		DspStage::Format format;
+		takeRenderFormat(albumArgs, format);
+		takeRenderFormat(songArgs, format);
+
+		job.Item = &song;
+		job.Parent = &album;
+		job.Input = song.Path;
+		job.Output = new_songPath;
+		// Instances of one process that encode the same song do not share its staged file
+		const std::array<std::string, 1> stagedValues = {new_songPath.string()};
+		job.Staged = stagingDir(album) / (settingsKey(stagedValues) + "-" + std::to_string(m_instance) +
+		                                  new_songPath.extension().string());
+		job.Format = format;
+		job.Tags = tags;
+		job.Hash = currentHash;
+		job.EncodeKey = songEncodeKey;
+		job.TagKey = songTagKey;
+
+		// A track cut out of a longer input is written by the split, see encodeTracks()
+		job.Split = takeTrackRange(songArgs, job.Cut);
+		if (job.Split)
+		{
+			if (job.Cut.End < 0.0)
+				job.Cut.End = nextTrackStart(song, album, job.Cut.Start);
+			const std::array<std::string, 4> values = {renderKey(song, format, currentHash), std::to_string(song.ID),
+			                                           std::to_string(job.Cut.Start), std::to_string(job.Cut.End)};
+			job.Input = job.Cut.Output = renderDir() / (settingsKey(values) + ".wav");
+		}
+		job.Arguments = albumArgs + " " + songArgs;
+
+		// The native FLAC encoder takes integer PCM WAV inputs, everything else goes to ffmpeg's encoder
+		job.Codec = codec;
+		if (codec == FlacEncoder::CodecName)
+		{
+			if (job.Split)
+				return true;
+			if (!format.empty())
+				job.Input = renderInput(song, format, currentHash);
+			WavReader wav;
+			if (wav.open(job.Input) && FlacEncoder::canEncode(wav))
+				return true;
+			std::cout << "  Input is not 8/16/24-bit PCM WAV, encoding with ffmpeg" << std::endl;
+			codec = job.Codec = "flac";
+		}
+
+		// Long inputs are encoded in segments on all cores; filters may depend on the time, so they keep it whole
+		const unsigned threads = ThreadBudget::availableCpus();
+		const bool     filtered = (albumArgs + " " + songArgs).find("-af") != std::string::npos ||
+		                      (albumArgs + " " + songArgs).find("-filter") != std::string::npos;
+		WavReader      wav;
+		if (!job.Split && !job.PeaksOnly && m_options.SegmentThreshold > 0.0 && threads > 1 && !filtered &&
+		    wav.open(song.Path))
+		{
+			unsigned      rate = format.SampleRate ? format.SampleRate : wav.sampleRate();
+			std::uint64_t frames = (wav.frames() * rate + wav.sampleRate() - 1) / wav.sampleRate();
+			if (SegmentEncoder::find(codec, rate) && frames >= m_options.SegmentThreshold * rate)
+			{
+				job.Segmented = true;
+				job.Frames = frames;
+				job.SampleRate = rate;
+				const std::array<std::string, 2> values = {renderKey(song, format, currentHash), songEncodeKey};
+				job.WorkDir = renderDir() / settingsKey(values);
+			}
+		}
+
+		// Processed audio is streamed into ffmpeg unless another rendition has rendered it already; without an
+		// encode it is rendered for the peaks
+		if (!format.empty() && !job.Split && !job.Segmented)
+		{
+			if (auto it = m_renders.find(renderKey(song, format, currentHash)); it != m_renders.end())
+				job.Input = it->second;
+			else if (job.PeaksOnly)
+				job.Input = renderInput(song, format, currentHash);
+			else
+				job.Streamed = true;
+		}
 
-		std::ostringstream cmd;
-		cmd << "ffmpeg -y "
-		    << "-i \"" << song.Path.string() << "\" ";
-		if (song.Codec != "flac" && song.Codec != "FLAC" && song.Codec != "wav" && song.Codec != "WAV")
-			if (!song.Codec.empty() && !album.AlbumArt.empty())
-				cmd << "-i \"" << album.AlbumArt.string() << "\" -map 0:a -map 1:v -id3v2_version 3 ";
+		// Everything after the audio input: tags and album art, then the encoder settings. Values are quoted,
+		// so quotes and shell characters in titles and paths reach ffmpeg as they are
+		std::ostringstream cmd, encoding;
+		if (embedsAlbumArt(song, album))
+			cmd << "-i " << Subprocess::quote(album.AlbumArt.string()) << " -map 0:a -map 1:v -id3v2_version 3 ";
 		if (!song.Title.empty())
-			cmd << "-metadata title=\"" << song.Title << "\" ";
+			cmd << "-metadata title=" << Subprocess::quote(song.Title) << " ";
 		if (!song.Artist.empty())
-			cmd << "-metadata artist=\"" << song.Artist << "\" ";
+			cmd << "-metadata artist=" << Subprocess::quote(song.Artist) << " ";
 		if (!song.Album.empty())
-			cmd << "-metadata album=\"" << song.Album << "\" ";
+			cmd << "-metadata album=" << Subprocess::quote(song.Album) << " ";
 		if (!song.Genre.empty())
-			cmd << "-metadata genre=\"" << song.Genre << "\" ";
+			cmd << "-metadata genre=" << Subprocess::quote(song.Genre) << " ";
 		if (!song.Year.empty())
-			cmd << "-metadata date=\"" << song.Year << "\" ";
+			cmd << "-metadata date=" << Subprocess::quote(song.Year) << " ";
 		if (!song.Copyright.empty())
-			cmd << "-metadata copyright=\"" << song.Copyright << "\" ";
+			cmd << "-metadata copyright=" << Subprocess::quote(song.Copyright) << " ";
 		if (!song.Comment.empty())
-			cmd << "-metadata comment=\"" << song.Comment << "\" ";
+			cmd << "-metadata comment=" << Subprocess::quote(song.Comment) << " ";
 		cmd << "-metadata encoder-info=\"Daniel's Mastering Utility\" ";
-		if (!song.Codec.empty())
-			cmd << "-c:a \"" << song.Codec << "\" ";
-
-		if (!album.arguments.empty())
-			cmd << album.arguments << " ";
-		if (!song.arguments.empty())
-			cmd << song.arguments << " ";
-
-		cmd << "-metadata track=\"" << song.TrackNumber << "\" "
-		    << "\"" << new_songPath.string() << "\"";
-
-		std::string command = cmd.str();
-
-#ifdef _WIN32
-		command += " 2>&1 1>NUL";
-		std::unique_ptr<FILE, int (*)(FILE *)> pipe(_popen(command.c_str(), "r"), _pclose);
-#else
-		command += " 2>&1 1>/dev/null";
-		std::unique_ptr<FILE, int (*)(FILE *)> pipe(popen(command.c_str(), "r"), pclose);
-#endif
-		if (!pipe)
-		{
-			std::cerr << "  Failed to open pipe for command execution\n";
-			return;
-		}
-
-		std::string output;
-		char        buffer[BUFFER_SIZE];
-		while (fgets(buffer, sizeof(buffer), pipe.get()))
-			output += buffer;
-
-		if (cacheIt != albumCache.Songs.end())
-		{
-			cacheIt->Hash = currentHash;
-		}
-		else
-		{
-			SongCacheEntry newEntry = {songId, song.Path, currentHash};
-			albumCache.Songs.push_back(newEntry);
-		}
+		static constexpr std::array<std::pair<TagWriter::Field, const char *>, 4> replayGainTags = {{
+		    {TagWriter::Field::TrackGain, "REPLAYGAIN_TRACK_GAIN"},
+		    {TagWriter::Field::TrackPeak, "REPLAYGAIN_TRACK_PEAK"},
+		    {TagWriter::Field::AlbumGain, "REPLAYGAIN_ALBUM_GAIN"},
+		    {TagWriter::Field::AlbumPeak, "REPLAYGAIN_ALBUM_PEAK"},
+		}};
+		for (const auto &[field, key] : replayGainTags)
+			if (!tags[static_cast<size_t>(field)].empty())
+				cmd << "-metadata " << key << "=" << Subprocess::quote(tags[static_cast<size_t>(field)]) << " ";
+		cmd << "-metadata track=\"" << song.TrackNumber << "\" ";
+
+		if (!codec.empty())
+			encoding << "-c:a " << Subprocess::quote(codec) << " ";
+		if (!albumArgs.empty())
+			encoding << albumArgs << " ";
+		if (!songArgs.empty())
+			encoding << songArgs << " ";
+
+		job.Tagging = cmd.str();
+		job.Encoding = encoding.str();
+		return true;
 	}
 	catch (const std::exception &ex)
 	{
@@ -682,113 +1628,1604 @@ void MasteringUtility::ProcessSong(const Song &song, const Album &album)
 	{
 		std::cerr << "[ProcessSong] Unknown exception" << std::endl;
 	}
+	return false;
 }
 
-void MasteringUtility::Master(const std::filesystem::path &markupFile)
+void MasteringUtility::writePeaks(EncodeJob &job, const std::function<PeakFile()> &build)
 {
+	if (!job.Peaks)
+		return;
 	try
 	{
-		m_markupFile = markupFile;
-		m_audioCodecs = getAudioCodecs();
-		Albums                      albums;
-		const std::filesystem::path oldDir = std::filesystem::current_path();
-		ParseMarkup(markupFile, albums);
-		for (const auto &album : albums)
-			ProcessAlbum(album);
-		std::filesystem::current_path(oldDir);
+		build().save(peaksPath(job.Staged));
+		job.PeaksWritten = true;
 	}
 	catch (const std::exception &ex)
 	{
-		std::cerr << "[Master] Exception: " << ex.what() << std::endl;
-	}
-	catch (...)
-	{
-		std::cerr << "[Master] Unknown exception" << std::endl;
+		std::cerr << "  Writing peaks failed: " << ex.what() << std::endl;
 	}
 }
 
-std::filesystem::path MasteringUtility::getCacheFilePath(const Album &album) const
-{
-	// See info on file streams in NTFS:
-	// https://learn.microsoft.com/en-us/openspecs/windows_protocols/ms-fscc/c54dec26-1551-4d3a-a0ea-4fa40f848eb3
-	if (album.AFS)
-		return NTFS(album.markup) ? album.NewPath.string() + ":MASC" + std::to_string(album.ID)
-		                          : (album.NewPath / ".mas" / (std::to_string(album.ID) + ".masc")).string();
-	else
-		return (album.NewPath / ".mas" / (std::to_string(album.ID) + ".masc")).string();
-}
-void MasteringUtility::loadCache(const Album &album)
+void MasteringUtility::runEncode(EncodeJob &job)
 {
-	m_albumCaches[album.ID].Songs.clear();
-	std::filesystem::path cachePath = getCacheFilePath(album);
+	auto fromInput = [&job] { return PeakBuilder::fromFile(job.Input); };
+	if (job.PeaksOnly)
+	{
+		writePeaks(job, fromInput);
+		return;
+	}
 
-	if (!std::filesystem::exists(cachePath))
+	if (job.Codec == FlacEncoder::CodecName)
+	{
+		WavReader wav;
+		if (!wav.open(job.Input))
+			throw std::runtime_error("Failed to open " + job.Input.string());
+		FlacEncoder::encode(wav, job.Staged, job.Tags, flacSettings(job.Arguments), pool());
+		if (m_options.Peaks)
+			writePeaks(job, fromInput);
 		return;
+	}
 
-	std::ifstream cacheFile(cachePath);
-	if (!cacheFile.is_open())
+	if (job.Segmented)
+	{
+		encodeSegments(job);
+		if (m_options.Peaks)
+			writePeaks(job, fromInput);
 		return;
+	}
 
-	std::string line;
-	bool        firstLine = true;
+	const std::string output = Subprocess::quote(job.Staged.string());
+	if (job.Streamed)
+	{
+		// The peaks are taken from the stream, after the filters and the dither
+		std::optional<PeakBuilder> peaks;
+		const std::string          arguments = job.Tagging + threadOptions(job, scheduler().slots(), false) +
+		                              job.Encoding + output + std::string(quietRedirect);
+		int status = DspStage::stream(job.Input, "ffmpeg -y ", arguments, job.Format, pool(), graphSettings(m_options),
+		                              m_options.Peaks ? PeakBuilder::tap(peaks) : nullptr);
+		if (status != 0)
+			throw std::runtime_error("ffmpeg exited with status " + std::to_string(status));
+		if (peaks)
+			writePeaks(job, [&peaks] { return peaks->result(); });
+		return;
+	}
 
-	while (std::getline(cacheFile, line))
+	// The peaks are built on the worker pool while ffmpeg reads the same input
+	std::future<void> peaks;
+	if (m_options.Peaks)
+		peaks = pool().submit([&job, fromInput] { writePeaks(job, fromInput); });
+	int status;
+	try
 	{
-		line = trim(line);
-		if (line.empty() || line[0] == ';')
-			continue;
+		const unsigned share = scheduler().slots();
+		status = runCommand("ffmpeg -y " + threadOptions(job, share, true) + "-i " +
+		                    Subprocess::quote(job.Input.string()) + " " + job.Tagging +
+		                    threadOptions(job, share, false) + job.Encoding + output);
+	}
+	catch (...)
+	{
+		if (peaks.valid())
+			peaks.wait();
+		throw;
+	}
+	if (peaks.valid())
+		peaks.get();
+	if (status != 0)
+		throw std::runtime_error("ffmpeg exited with status " + std::to_string(status));
 
-		if (firstLine)
+	// MP3 carries delay and padding in the LAME header ffmpeg writes; MP4 players need iTunSMPB for that
+	if (job.Split)
+	{
+		try
+		{
+			TagWriter::writeGapless(job.Staged, job.Cut.Frames);
+		}
+		catch (const std::exception &ex)
 		{
-			m_albumCaches[album.ID].MarkupHash = line;
-			firstLine = false;
+			std::cerr << "  Writing gapless info failed: " << ex.what() << std::endl;
+		}
+	}
+}
+
+std::string MasteringUtility::threadOptions(const EncodeJob &job, unsigned share, bool input) const
+{
+	const ThreadBudget::Profile profile = ThreadBudget::profile(job.Codec, m_options.ThreadProfiles);
+	const unsigned              budget = std::max(1u, ThreadBudget::availableCpus() / std::max(1u, share));
+	return input ? ThreadBudget::inputOptions(profile, budget)
+	             : ThreadBudget::outputOptions(profile, budget, job.Arguments);
+}
+
+std::vector<int> MasteringUtility::fanOutEncode(const std::vector<EncodeJob *> &jobs)
+{
+	const EncodeJob &first = *jobs.front();
+	const unsigned   share = scheduler().slots() * static_cast<unsigned>(jobs.size());
+	std::vector<std::pair<std::string, std::string>> commands;
+	for (const EncodeJob *job : jobs)
+		commands.emplace_back("ffmpeg -y ", job->Tagging + threadOptions(*job, share, false) + job->Encoding +
+		                                        Subprocess::quote(job->Staged.string()) + std::string(quietRedirect));
+	std::cout << "  Encoding " << jobs.size() << " outputs of " << first.Item->Path.filename().string()
+	          << " from one decode" << std::endl;
+
+	// Rendered inputs are in their delivery format already; the peaks are the same for every output
+	std::optional<PeakBuilder> peaks;
+	std::vector<int>           status =
+	    DspStage::fanOut(first.Input, commands, first.Streamed ? first.Format : DspStage::Format(), pool(),
+	                     graphSettings(m_options), m_options.Peaks ? PeakBuilder::tap(peaks) : nullptr);
+	std::optional<PeakFile> peakFile;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		if (status[i] != 0 || !peaks)
 			continue;
+		if (!peakFile)
+			peakFile = peaks->result();
+		writePeaks(*jobs[i], [&peakFile] { return *peakFile; });
+	}
+	return status;
+}
+
+void MasteringUtility::encodeSegments(EncodeJob &job)
+{
+	const SegmentEncoder::Codec codec = *SegmentEncoder::find(job.Codec, job.SampleRate);
+	const unsigned              threads = ThreadBudget::availableCpus();
+	const auto                  segments = SegmentEncoder::plan(job.Frames, threads, codec);
+
+	// Segments are cut at exact frames; the last one runs to the end in case the length estimate is short
+	std::filesystem::create_directories(job.WorkDir);
+	std::vector<DspStage::Track>       cuts(segments.size());
+	std::vector<std::filesystem::path> encoded(segments.size());
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		cuts[i].Start = static_cast<double>(segments[i].First) / job.SampleRate;
+		cuts[i].End = i + 1 < segments.size() ? static_cast<double>(segments[i].Last) / job.SampleRate : -1.0;
+		cuts[i].Output = job.WorkDir / ("segment" + std::to_string(i) + ".wav");
+		encoded[i] = job.WorkDir / ("segment" + std::to_string(i) + "." + codec.Format);
+	}
+	DspStage::split(job.Item->Path, cuts, job.Format, pool(), graphSettings(m_options));
+	std::cout << "  Encoding " << segments.size() << " segments in parallel" << std::endl;
+
+	// Every slot may run a segmented job, so the segments share the CPUs of one slot like fanned out outputs
+	const unsigned    parallel = static_cast<unsigned>(std::min<size_t>(segments.size(), threads));
+	const std::string limits = threadOptions(job, scheduler().slots() * parallel, false);
+	std::vector<int>  status = SegmentEncoder::encode(segments.size(), parallel, [&](size_t i) {
+		int result = runCommand("ffmpeg -y -i " + Subprocess::quote(cuts[i].Output.string()) + " " + limits +
+		                        job.Encoding + codec.Options + " -f " + codec.Format + " " +
+		                        Subprocess::quote(encoded[i].string()));
+		std::error_code ec;
+		std::filesystem::remove(cuts[i].Output, ec);
+		return result;
+	});
+
+	for (size_t i = 0; i < segments.size(); ++i)
+		if (status[i] != 0)
+		{
+			std::filesystem::remove_all(job.WorkDir);
+			throw std::runtime_error("ffmpeg exited with status " + std::to_string(status[i]) + " on segment " +
+			                         std::to_string(i));
 		}
 
-		std::stringstream        ss(line);
-		std::string              segment;
-		std::vector<std::string> parts;
+	// The joined stream is only remuxed; tags and album art are added on the way
+	std::filesystem::path joined = job.WorkDir / ("joined." + codec.Format);
+	int                   result;
+	try
+	{
+		SegmentEncoder::join(encoded, segments, codec, joined);
+		result = runCommand("ffmpeg -y -f " + codec.Format + " -i " + Subprocess::quote(joined.string()) + " " +
+		                    job.Tagging + "-c:a copy " + Subprocess::quote(job.Staged.string()));
+	}
+	catch (...)
+	{
+		std::filesystem::remove_all(job.WorkDir);
+		throw;
+	}
+	std::filesystem::remove_all(job.WorkDir);
+	if (result != 0)
+		throw std::runtime_error("ffmpeg exited with status " + std::to_string(result) + " joining the segments");
+}
 
-		while (std::getline(ss, segment, ','))
-			parts.push_back(trim(segment));
+void MasteringUtility::finishEncode(EncodeJob &job)
+{
+	auto &albumCache = m_albumCaches[job.Parent->ID];
+	auto  cacheIt = findCacheEntry(albumCache, *job.Item);
+	if (cacheIt == albumCache.Songs.end())
+	{
+		SongCacheEntry newEntry;
+		newEntry.SongID = std::to_string(job.Item->ID);
+		newEntry.Path = job.Item->Path;
+		albumCache.Songs.push_back(newEntry);
+		cacheIt = albumCache.Songs.end() - 1;
+	}
+	cacheIt->Hash = job.Hash;
+	cacheIt->EncodeKey = job.EncodeKey;
+	cacheIt->TagKey = job.TagKey;
+
+	// A peak file left from an earlier encode would no longer match the output
+	const std::array<std::string, 2> peaksValues = {job.Hash, job.EncodeKey};
+	cacheIt->PeaksKey = job.PeaksWritten ? settingsKey(peaksValues) : "";
+	if (!job.PeaksWritten)
+	{
+		std::error_code ec;
+		std::filesystem::remove(peaksPath(job.Output), ec);
+	}
 
-		if (parts.size() == 3)
+	if (!job.Fingerprint)
+	{
+		try
+		{
+			job.Fingerprint = AudioFingerprint::compute(job.Item->Path);
+		}
+		catch (const std::exception &)
 		{
-			SongCacheEntry entry;
-			entry.SongID = parts[0];
-			entry.Path = parts[1];
-			entry.Hash = parts[2];
-			m_albumCaches[album.ID].Songs.push_back(entry);
+			job.Fingerprint = "";
 		}
 	}
+	cacheIt->Fingerprint = *job.Fingerprint;
 }
 
-void MasteringUtility::saveCache(const Album &album) const
+void MasteringUtility::encodeTracks(std::vector<EncodeJob> &jobs, JobScheduler::Lane lane)
 {
-	std::filesystem::path cachePath = getCacheFilePath(album);
-	std::filesystem::create_directories(cachePath.parent_path());
+	std::vector<std::exception_ptr> errors(jobs.size());
 
-	std::ofstream cacheFile(cachePath);
+	// Tracks of one input and delivery format are cut in a single decoding pass
+	std::map<std::string, std::vector<size_t>> groups;
+	for (size_t i = 0; i < jobs.size(); ++i)
+		if (jobs[i].Split)
+			groups[renderKey(*jobs[i].Item, jobs[i].Format, jobs[i].Hash)].push_back(i);
 
-	if (!cacheFile.is_open())
+	std::unordered_map<std::string, std::string> fingerprints;
+	for (const auto &[key, members] : groups)
 	{
-		std::cerr << "[SaveCache] Could not open cache file for writing: " << cachePath << std::endl;
-		return;
+		const EncodeJob             &first = jobs[members.front()];
+		std::vector<DspStage::Track> cuts;
+		for (size_t i : members)
+			cuts.push_back(jobs[i].Cut);
+		try
+		{
+			DspStage::split(first.Item->Path, cuts, first.Format, pool(), graphSettings(m_options));
+			std::cout << "Split: " << first.Item->Path.filename().string() << " into " << cuts.size()
+			          << (cuts.size() == 1 ? " track" : " tracks") << std::endl;
+		}
+		catch (...)
+		{
+			for (size_t i : members)
+				errors[i] = std::current_exception();
+			continue;
+		}
+
+		// The shared input is fingerprinted once instead of once per track
+		auto [it, added] = fingerprints.try_emplace(first.Item->Path.string());
+		if (added)
+		{
+			try
+			{
+				it->second = AudioFingerprint::compute(first.Item->Path);
+			}
+			catch (const std::exception &)
+			{
+			}
+		}
+		for (size_t k = 0; k < members.size(); ++k)
+		{
+			jobs[members[k]].Cut.Frames = cuts[k].Frames;
+			jobs[members[k]].Fingerprint = it->second;
+		}
 	}
 
-	if (album.AFS)
-		cacheFile << "Mastering Utility Cache File Stream\n";
-	else
-		cacheFile << "Mastering Utility Cache File\n";
+	// ffmpeg encodes of one input are fed from a single decode: streamed ones per delivery format, the others
+	// if the input is plain PCM WAV that ffmpeg would only have parsed
+	std::map<std::string, std::vector<size_t>> shared;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const EncodeJob &job = jobs[i];
+		if (errors[i] || job.Split || job.Segmented || job.PeaksOnly || job.Codec == FlacEncoder::CodecName)
+			continue;
+		if (job.Streamed)
+			shared["stream:" + renderKey(*job.Item, job.Format, job.Hash)].push_back(i);
+		else if (isPlainPcm(job.Input))
+			shared["file:" + job.Input.string()].push_back(i);
+	}
 
-	auto it = m_albumCaches.find(album.ID);
-	if (it != m_albumCaches.end())
+	std::vector<std::vector<size_t>> units;
+	std::vector<bool>                grouped(jobs.size());
+	for (const auto &[key, members] : shared)
 	{
-		cacheFile << it->second.MarkupHash << "\n";
+		if (members.size() < 2)
+			continue;
+		units.push_back(members);
+		for (size_t i : members)
+			grouped[i] = true;
 
-		for (const auto &entry : it->second.Songs)
+		auto [it, added] = fingerprints.try_emplace(jobs[members.front()].Item->Path.string());
+		if (added)
 		{
-			cacheFile << entry.SongID << ", " << entry.Path.string() << ", " << entry.Hash << "\n";
+			try
+			{
+				it->second = AudioFingerprint::compute(jobs[members.front()].Item->Path);
+			}
+			catch (const std::exception &)
+			{
+			}
 		}
+		for (size_t i : members)
+			jobs[i].Fingerprint = it->second;
+	}
+	for (size_t i = 0; i < jobs.size(); ++i)
+		if (!grouped[i])
+			units.push_back({i});
+
+	auto run = [this](std::vector<EncodeJob> &unit, std::vector<std::exception_ptr> &failed) {
+		if (unit.size() > 1)
+		{
+			std::vector<EncodeJob *> group;
+			for (EncodeJob &job : unit)
+				group.push_back(&job);
+			try
+			{
+				std::vector<int> status = fanOutEncode(group);
+				for (size_t k = 0; k < unit.size(); ++k)
+					if (status[k] != 0)
+						failed[k] = std::make_exception_ptr(
+						    std::runtime_error("ffmpeg exited with status " + std::to_string(status[k])));
+			}
+			catch (...)
+			{
+				std::fill(failed.begin(), failed.end(), std::current_exception());
+			}
+			return;
+		}
+
+		if (failed[0])
+			return;
+		try
+		{
+			runEncode(unit[0]);
+		}
+		catch (...)
+		{
+			failed[0] = std::current_exception();
+		}
+	};
+
+	// A unit may run more than once: again after its encoders hung, or as a second copy beside a slow one. Every
+	// run starts from the prepared jobs, a second copy stages files of its own, and only the run the scheduler
+	// keeps puts its results in place
+	const std::vector<EncodeJob>          prepared = jobs;
+	const std::vector<std::exception_ptr> preparedErrors = errors;
+	auto attempt = [&run, &jobs, &errors, &units, &prepared, &preparedErrors](size_t u) {
+		const unsigned                  copy = JobScheduler::copy();
+		std::vector<EncodeJob>          unit;
+		std::vector<std::exception_ptr> failed;
+		for (size_t i : units[u])
+		{
+			unit.push_back(prepared[i]);
+			failed.push_back(preparedErrors[i]);
+			if (copy > 0)
+			{
+				EncodeJob &job = unit.back();
+				job.Staged = job.Staged.parent_path() / (job.Staged.stem().string() + ".copy" + std::to_string(copy) +
+				                                         job.Staged.extension().string());
+				if (!job.WorkDir.empty())
+					job.WorkDir += ".copy" + std::to_string(copy);
+			}
+		}
+		run(unit, failed);
+
+		if (!JobScheduler::claim())
+		{
+			for (const EncodeJob &job : unit)
+			{
+				std::error_code ec;
+				if (copy > 0)
+				{
+					std::filesystem::remove(job.Staged, ec);
+					std::filesystem::remove(peaksPath(job.Staged), ec);
+				}
+			}
+			return false;
+		}
+
+		// Only the watchdog kills the encoders of a run that is kept
+		const bool timedOut = Subprocess::current() && Subprocess::current()->killed();
+		for (size_t k = 0; k < unit.size(); ++k)
+		{
+			const size_t i = units[u][k];
+			if (timedOut && failed[k])
+				failed[k] = std::make_exception_ptr(std::runtime_error("ffmpeg timed out"));
+			if (copy > 0)
+			{
+				std::error_code ec;
+				if (!failed[k])
+					std::filesystem::rename(unit[k].Staged, prepared[i].Staged, ec);
+				if (!failed[k] && !ec && unit[k].PeaksWritten)
+					std::filesystem::rename(peaksPath(unit[k].Staged), peaksPath(prepared[i].Staged), ec);
+				if (ec)
+					failed[k] =
+					    std::make_exception_ptr(std::runtime_error("Failed to move " + unit[k].Staged.string()));
+				unit[k].Staged = prepared[i].Staged;
+				unit[k].WorkDir = prepared[i].WorkDir;
+			}
+			jobs[i] = std::move(unit[k]);
+			errors[i] = failed[k];
+			if (jobs[i].Split)
+			{
+				std::error_code ec;
+				std::filesystem::remove(jobs[i].Input, ec);
+			}
+		}
+		return true;
+	};
+
+	// Finished songs are committed in batches: songs that finish while a batch is being flushed wait for the
+	// next one, which the first of their workers commits for all of them
+	std::mutex              commitMutex;
+	std::condition_variable commitDone;
+	std::vector<size_t>     finished;
+	std::vector<bool>       committed(jobs.size());
+	bool                    committing = false;
+	auto commit = [&](const std::vector<size_t> &members) {
+		// The fingerprint is taken before the commit, which would otherwise wait for it
+		for (size_t i : members)
+		{
+			if (errors[i] || jobs[i].Fingerprint)
+				continue;
+			try
+			{
+				jobs[i].Fingerprint = AudioFingerprint::compute(jobs[i].Item->Path);
+			}
+			catch (const std::exception &)
+			{
+				jobs[i].Fingerprint = "";
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(commitMutex);
+		finished.insert(finished.end(), members.begin(), members.end());
+		while (!committed[members.front()])
+		{
+			if (committing)
+			{
+				commitDone.wait(lock);
+				continue;
+			}
+			committing = true;
+			std::vector<size_t> batch;
+			batch.swap(finished);
+			lock.unlock();
+			commitJobs(jobs, batch, errors);
+			lock.lock();
+			for (size_t i : batch)
+				committed[i] = true;
+			committing = false;
+			commitDone.notify_all();
+		}
+	};
+
+	// The encoders mostly wait for ffmpeg, so they get threads of their own; the native FLAC encoder and the
+	// resampler still share the worker pool, which is created here before the encoders use it
+	pool();
+	std::vector<JobScheduler::Job> work(units.size());
+	for (size_t u = 0; u < units.size(); ++u)
+	{
+		work[u].Reads = {jobs[units[u].front()].Input};
+		for (size_t i : units[u])
+			work[u].Writes.push_back(jobs[i].Staged);
+
+		// Every output of a shared decode is an encode of the whole input; encoders differ in speed, and so do
+		// segmented encodes from whole ones
+		const EncodeJob &first = jobs[units[u].front()];
+		bool             exact = false;
+		if (!first.PeaksOnly)
+			work[u].Work = inputSeconds(first.Input, exact) * units[u].size();
+		work[u].Estimated = !exact;
+		for (size_t i : units[u])
+		{
+			work[u].Kind += work[u].Kind.empty() ? "" : "+";
+			work[u].Kind += jobs[i].Codec + (jobs[i].Segmented ? " segments" : "");
+		}
+		work[u].Speculative = first.Codec != FlacEncoder::CodecName;
+		work[u].Run = [&attempt, &commit, &units, u] {
+			if (attempt(u))
+				commit(units[u]);
+		};
+	}
+
+	// Inputs are prefetched in the order the scheduler is going to start them
+	if (m_prefetcher)
+	{
+		for (const EncodeJob &job : jobs)
+			if (!job.PeaksOnly && embedsAlbumArt(*job.Item, *job.Parent))
+				m_prefetcher->queue(job.Parent->AlbumArt);
+		for (size_t u : scheduler().plan(work))
+			m_prefetcher->queue(work[u].Reads.front());
+	}
+	scheduler().run(
+	    work,
+	    [this, &work](size_t u) {
+		    if (m_prefetcher)
+			    m_prefetcher->reached(work[u].Reads.front());
+	    },
+	    lane);
+}
+
+void MasteringUtility::commitJobs(std::vector<EncodeJob> &jobs, const std::vector<size_t> &batch,
+                                  std::vector<std::exception_ptr> &errors)
+{
+	publishOutputs(jobs, batch, errors);
+
+	std::vector<const Album *> albums;
+	for (size_t i : batch)
+	{
+		try
+		{
+			if (errors[i])
+				std::rethrow_exception(errors[i]);
+			finishEncode(jobs[i]);
+			if (std::find(albums.begin(), albums.end(), jobs[i].Parent) == albums.end())
+				albums.push_back(jobs[i].Parent);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "[ProcessSong] Exception: " << ex.what() << std::endl;
+		}
+		catch (...)
+		{
+			std::cerr << "[ProcessSong] Unknown exception" << std::endl;
+		}
+	}
+
+	// One journal record per album for the whole batch
+	for (const Album *album : albums)
+	{
+		try
+		{
+			commitCache(*album);
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "[SaveCache] " << ex.what() << std::endl;
+		}
+	}
+}
+
+void MasteringUtility::publishOutputs(std::vector<EncodeJob> &jobs, const std::vector<size_t> &batch,
+                                      std::vector<std::exception_ptr> &errors)
+{
+	// Peak files travel with their output
+	auto staged = [](const EncodeJob &job) {
+		std::vector<std::pair<std::filesystem::path, std::filesystem::path>> files;
+		if (!job.PeaksOnly)
+			files.emplace_back(job.Staged, job.Output);
+		if (job.PeaksWritten)
+			files.emplace_back(peaksPath(job.Staged), peaksPath(job.Output));
+		return files;
+	};
+
+	// The staged files reach the disk before any of them replaces an output
+	std::vector<std::filesystem::path> flushed;
+	for (size_t i : batch)
+		if (!errors[i])
+			for (const auto &[from, to] : staged(jobs[i]))
+				flushed.push_back(from);
+	if (!flushed.empty() && !OutputPublisher::flush(flushed))
+		std::cerr << "  Flushing the staged outputs failed" << std::endl;
+
+	std::vector<std::filesystem::path> published;
+	for (size_t i : batch)
+	{
+		for (const auto &[from, to] : staged(jobs[i]))
+		{
+			try
+			{
+				if (!errors[i])
+				{
+					OutputPublisher::publish(from, to);
+					published.push_back(to);
+					continue;
+				}
+			}
+			catch (...)
+			{
+				errors[i] = std::current_exception();
+			}
+			std::error_code ec;
+			std::filesystem::remove(from, ec);
+		}
+	}
+	if (!published.empty() && !OutputPublisher::flush(published))
+		std::cerr << "  Flushing the published outputs failed" << std::endl;
+}
+
+const std::filesystem::path &MasteringUtility::renderDir()
+{
+	if (m_renderDir.empty())
+	{
+		auto stamp = std::chrono::steady_clock::now().time_since_epoch().count();
+		m_renderDir = std::filesystem::temp_directory_path() / ("masteringutil-" + std::to_string(stamp));
+		std::filesystem::create_directories(m_renderDir);
+	}
+	return m_renderDir;
+}
+
+std::filesystem::path MasteringUtility::renderInput(const Song &song, const DspStage::Format &format,
+                                                   const std::string &hash)
+{
+	std::string key = renderKey(song, format, hash);
+	if (auto it = m_renders.find(key); it != m_renders.end())
+	{
+		std::cout << "  Reusing rendered input" << std::endl;
+		return it->second;
+	}
+
+	std::filesystem::path output = renderDir() / (key + ".wav");
+	if (!DspStage::render(song.Path, output, format, pool(), graphSettings(m_options)))
+		output = song.Path;
+	else
+		std::cout << "  Rendered input (" << describeFormat(format) << ")" << std::endl;
+	m_renders[key] = output;
+	return output;
+}
+
+void MasteringUtility::clearRenders()
+{
+	m_renders.clear();
+	if (m_renderDir.empty())
+		return;
+	std::error_code ec;
+	std::filesystem::remove_all(m_renderDir, ec);
+	m_renderDir.clear();
+}
+
+void MasteringUtility::Master(const std::filesystem::path &markupFile)
+{
+	Master(markupFile, std::nullopt);
+}
+
+void MasteringUtility::Master(const std::filesystem::path &markupFile, std::optional<int> albumID,
+                              std::optional<int> songID)
+{
+	master(markupFile, [&](const Albums &albums) {
+		bool found = !albumID;
+		for (const auto &album : albums)
+		{
+			if (albumID && album.ID != *albumID)
+				continue;
+			found = true;
+			if (!songID)
+			{
+				processAlbum(album, nullptr);
+				continue;
+			}
+			auto song = std::find_if(album.SongsList.begin(), album.SongsList.end(),
+			                         [&songID](const Song &song) { return song.ID == *songID; });
+			if (song == album.SongsList.end())
+			{
+				std::cerr << "[Master] No song " << *songID << " in album " << album.ID << std::endl;
+				continue;
+			}
+			const std::vector<const Song *> only = {&*song};
+			processAlbum(album, &only);
+		}
+		if (!found)
+			std::cerr << "[Master] No album " << *albumID << " in " << markupFile << std::endl;
+	});
+}
+
+void MasteringUtility::Watch(const std::filesystem::path &markupFile)
+{
+	FileWatcher                     watcher;
+	std::set<std::filesystem::path> changed;
+	bool                            everything = true;
+	for (;;)
+	{
+		master(markupFile, [&](const Albums &albums) {
+			// Watching starts before the songs are processed, so changes made meanwhile are seen by the next pass
+			std::vector<std::filesystem::path> files = {markupFile};
+			for (const auto &album : albums)
+			{
+				if (!album.AlbumArt.empty())
+					files.push_back(album.Path / album.AlbumArt);
+				for (const auto &song : album.SongsList)
+					files.push_back(song.Path);
+			}
+			watcher.watch(files);
+
+			for (const auto &album : albums)
+			{
+				if (everything)
+				{
+					processAlbum(album, nullptr);
+					continue;
+				}
+
+				// Songs that embed new album art are encoded again even though their input did not change
+				const bool art =
+				    !album.AlbumArt.empty() && changed.contains(FileWatcher::normal(album.Path / album.AlbumArt));
+				std::vector<const Song *> songs;
+				for (const auto &song : album.SongsList)
+				{
+					if (changed.contains(FileWatcher::normal(song.Path)))
+						songs.push_back(&song);
+					else if (art && embedsAlbumArt(song, album))
+					{
+						m_forced.insert(&song);
+						songs.push_back(&song);
+					}
+				}
+				if (art || !songs.empty())
+					processAlbum(album, &songs);
+				m_forced.clear();
+			}
+		});
+
+		std::cout << "Watching for changes to " << markupFile.string() << std::endl;
+		std::vector<std::filesystem::path> batch = watcher.wait();
+		if (batch.empty())
+			return;
+		changed = {batch.begin(), batch.end()};
+		for (const auto &file : batch)
+			std::cout << "Changed: " << file.string() << std::endl;
+
+		// A new markup can change anything; the cache still limits the work to the songs that differ
+		everything = changed.contains(FileWatcher::normal(markupFile));
+	}
+}
+
+void MasteringUtility::master(const std::filesystem::path &markupFile, const std::function<void(const Albums &)> &process)
+{
+	try
+	{
+		m_markupFile = markupFile;
+		if (m_audioCodecs.empty())
+			m_audioCodecs = getAudioCodecs();
+		m_preflightReport.clear();
+		const std::filesystem::path oldDir = std::filesystem::current_path();
+
+		// A markup file is parsed again only once it changed
+		auto &[markupHash, albums] = m_markups[std::filesystem::absolute(markupFile).string()];
+		if (std::string currentHash = calculateFileHash(markupFile); currentHash.empty() || currentHash != markupHash)
+		{
+			albums.clear();
+			ParseMarkup(markupFile, albums);
+			markupHash = currentHash;
+		}
+
+		if (m_sharedScheduler)
+		{
+			m_deviceBaseline = m_scheduler->stats();
+			m_nodeBaseline = m_scheduler->nodeStats();
+			m_stragglerBaseline = m_scheduler->stragglerStats().value_or(JobScheduler::StragglerStats());
+			for (auto lane : {JobScheduler::Lane::Interactive, JobScheduler::Lane::Batch})
+				m_laneBaseline[static_cast<size_t>(lane)] = m_scheduler->laneStats(lane);
+		}
+		else
+			m_scheduler.reset();
+		if (m_options.PrefetchDepth > 0)
+			m_prefetcher = std::make_unique<Prefetcher>(m_options.PrefetchDepth);
+		process(albums);
+		if (m_prefetcher)
+		{
+			printPrefetchStats();
+			m_prefetcher.reset();
+		}
+		printDeviceStats();
+		clearRenders();
+		if (!m_options.PreflightReport.empty())
+			writePreflightReport();
+		std::filesystem::current_path(oldDir);
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "[Master] Exception: " << ex.what() << std::endl;
+	}
+	catch (...)
+	{
+		std::cerr << "[Master] Unknown exception" << std::endl;
+	}
+}
+
+void MasteringUtility::printPrefetchStats() const
+{
+	const Prefetcher::Stats stats = m_prefetcher->stats();
+	if (stats.Started == 0)
+		return;
+	std::cout << "Prefetch: " << stats.Hits << " of " << stats.Started << " inputs in memory when their encode started";
+	if (stats.Partial > 0)
+		std::cout << ", " << stats.Partial << " partly";
+	std::cout << "; " << std::fixed << std::setprecision(1) << stats.Bytes / 1048576.0 << " MiB read ahead";
+	if (stats.Loaded > 0)
+		std::cout << ", " << std::setprecision(0) << stats.LoadSeconds * 1000.0 / stats.Loaded
+		          << " ms read latency per input";
+	if (stats.Hits > 0)
+		std::cout << ", ready " << std::setprecision(1) << stats.LeadSeconds / stats.Hits << " s before use";
+	std::cout << std::defaultfloat << std::endl;
+}
+
+void MasteringUtility::printDeviceStats() const
+{
+	if (!m_scheduler)
+		return;
+
+	// A shared scheduler also counts the jobs of earlier runs
+	for (auto [id, stats] : m_scheduler->stats())
+	{
+		if (auto before = m_deviceBaseline.find(id); m_sharedScheduler && before != m_deviceBaseline.end())
+		{
+			stats.Jobs -= before->second.Jobs;
+			stats.Bytes -= before->second.Bytes;
+			stats.BusySeconds -= before->second.BusySeconds;
+		}
+		if (stats.Jobs == 0)
+			continue;
+		std::cout << "Device " << stats.Name << ": " << stats.Jobs << (stats.Jobs == 1 ? " job, " : " jobs, ")
+		          << std::fixed << std::setprecision(1) << stats.Bytes / 1048576.0 << " MiB";
+		if (stats.BusySeconds > 0.0)
+			std::cout << " in " << stats.BusySeconds << " s (" << stats.Bytes / 1048576.0 / stats.BusySeconds
+			          << " MiB/s)";
+		std::cout << std::defaultfloat << std::endl;
+	}
+
+	// Encodes per NUMA node, with the CPUs of the node
+	std::ostringstream nodes;
+	for (auto [id, stats] : m_scheduler->nodeStats())
+	{
+		if (auto before = m_nodeBaseline.find(id); m_sharedScheduler && before != m_nodeBaseline.end())
+			stats.Jobs -= before->second.Jobs;
+		if (stats.Jobs > 0)
+			nodes << (nodes.tellp() > 0 ? ", node " : "node ") << id << " (CPUs " << stats.Cpus << ") " << stats.Jobs
+			      << (stats.Jobs == 1 ? " encode" : " encodes");
+	}
+	if (nodes.tellp() > 0)
+		std::cout << "Placement (" << CpuPlacement::name(m_scheduler->placement()) << "): " << nodes.str() << std::endl;
+
+	// The controller's decisions are not counted per run; the range covers a shared scheduler's lifetime
+	if (auto concurrency = m_scheduler->concurrency(); concurrency && concurrency->Decisions > 0)
+	{
+		std::cout << "Concurrency: " << concurrency->Limit << " encodes at once, between " << concurrency->Lowest
+		          << " and " << concurrency->Highest << " so far; " << std::fixed << std::setprecision(1)
+		          << concurrency->Throughput << " s of audio per second in the last window" << std::defaultfloat
+		          << std::endl;
+	}
+
+	// Timeouts and second copies of this run
+	if (auto stragglers = m_scheduler->stragglerStats())
+	{
+		JobScheduler::StragglerStats before;
+		if (m_sharedScheduler)
+			before = m_stragglerBaseline;
+		const size_t timedOut = stragglers->TimedOut - before.TimedOut;
+		const size_t copies = stragglers->Copies - before.Copies;
+		if (timedOut > 0 || copies > 0)
+		{
+			std::cout << "Watchdog: " << timedOut << (timedOut == 1 ? " encode" : " encodes") << " timed out, "
+			          << stragglers->Retried - before.Retried << " run again";
+			if (copies > 0)
+				std::cout << "; " << copies << (copies == 1 ? " second copy" : " second copies")
+				          << " of slow encodes, " << stragglers->CopiesKept - before.CopiesKept << " finished first";
+			if (!stragglers->Factors.empty())
+			{
+				std::cout << "; s per second of audio expected:" << std::setprecision(3);
+				for (const auto &[kind, factor] : stragglers->Factors)
+					std::cout << " " << kind << " " << factor;
+				std::cout << std::setprecision(6);
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	// Waiting times of the interactive lane, which is only used for songs requested one at a time
+	JobScheduler::LaneStats interactive = m_scheduler->laneStats(JobScheduler::Lane::Interactive);
+	JobScheduler::LaneStats batch = m_scheduler->laneStats(JobScheduler::Lane::Batch);
+	const size_t            jobs = interactive.Jobs - (m_sharedScheduler ? m_laneBaseline[0].Jobs : 0);
+	if (jobs == 0)
+		return;
+	const size_t preempted = batch.Preempted - (m_sharedScheduler ? m_laneBaseline[1].Preempted : 0);
+	const double waited = interactive.WaitSeconds - (m_sharedScheduler ? m_laneBaseline[0].WaitSeconds : 0.0);
+	std::cout << "Interactive: " << jobs << (jobs == 1 ? " encode" : " encodes") << ", waited " << std::fixed
+	          << std::setprecision(0) << waited * 1000.0 / jobs << " ms on average for a slot, "
+	          << interactive.MaxWaitSeconds * 1000.0 << " ms at most";
+	if (preempted > 0)
+		std::cout << "; " << preempted << (preempted == 1 ? " batch encode" : " batch encodes") << " preempted";
+	std::cout << std::defaultfloat << std::endl;
+}
+
+std::filesystem::path MasteringUtility::getCacheFilePath(const Album &album) const
+{
+	// See info on file streams in NTFS:
+	// https://learn.microsoft.com/en-us/openspecs/windows_protocols/ms-fscc/c54dec26-1551-4d3a-a0ea-4fa40f848eb3
+	if (album.AFS)
+		return NTFS(album.markup) ? album.NewPath.string() + ":MASC" + std::to_string(album.ID)
+		                          : (album.NewPath / ".mas" / (std::to_string(album.ID) + ".masc")).string();
+	else
+		return (album.NewPath / ".mas" / (std::to_string(album.ID) + ".masc")).string();
+}
+/**
+ * @brief Parse a cached loudness measurement
+ * @param parts Fields: integrated, range, true peak
+ * @return Measurement, invalid if a field cannot be parsed
+ */
+static LoudnessMeter::Result parseLoudness(const std::string *parts)
+{
+	LoudnessMeter::Result result;
+	try
+	{
+		result.Integrated = std::stod(parts[0]);
+		result.Range = std::stod(parts[1]);
+		result.TruePeak = std::stod(parts[2]);
+	}
+	catch (...)
+	{
+		result = LoudnessMeter::Result();
+	}
+	return result;
+}
+
+/**
+ * @brief Write a loudness measurement as cache fields
+ * @param out Stream to write to
+ * @param result Measurement
+ */
+static void writeLoudness(std::ostream &out, const LoudnessMeter::Result &result)
+{
+	out << std::setprecision(10) << result.Integrated << ", " << result.Range << ", " << result.TruePeak;
+}
+
+/**
+ * @brief Write the cache lines of a song
+ * @param out Stream to write to
+ * @param entry Song cache entry
+ */
+static void writeCacheEntry(std::ostream &out, const MasteringUtility::SongCacheEntry &entry)
+{
+	out << entry.SongID << ", " << entry.Path.string() << ", " << entry.Hash << ", " << entry.EncodeKey << ", "
+	    << entry.TagKey << ", " << entry.Fingerprint;
+	if (entry.Loudness.valid())
+	{
+		out << ", " << entry.AnalysisHash << ", ";
+		writeLoudness(out, entry.Loudness);
+	}
+	out << "\n";
+	if (!entry.PeaksKey.empty())
+		out << "peaks, " << entry.SongID << ", " << entry.Path.string() << ", " << entry.PeaksKey << "\n";
+	if (entry.Preflight.valid())
+	{
+		const auto &result = entry.Preflight;
+		out << "preflight, " << entry.SongID << ", " << entry.Path.string() << ", " << entry.PreflightHash << ", "
+		    << result.Frames << ", " << result.Channels << ", " << result.SampleRate << ", " << std::setprecision(10)
+		    << result.Peak << ", " << result.DcOffset << ", " << result.ClippedSamples << ", " << result.ClipRuns
+		    << ", " << result.LeadingSilence << ", " << result.TrailingSilence << ", " << result.SilentChannels
+		    << "\n";
+	}
+}
+
+/**
+ * @brief Cache lines of an album as the journal stores them
+ * @param cache Album cache
+ * @return Album lines, and the lines of every song by song ID and path
+ */
+static std::pair<std::string, std::map<std::string, std::string>> cacheLines(
+    const MasteringUtility::AlbumCacheEntry &cache)
+{
+	std::ostringstream album;
+	if (!cache.MarkupHash.empty())
+		album << "markup, " << cache.MarkupHash << "\n";
+	if (cache.Loudness.valid())
+	{
+		album << "album, ";
+		writeLoudness(album, cache.Loudness);
+		album << "\n";
+	}
+
+	std::map<std::string, std::string> songs;
+	for (const auto &entry : cache.Songs)
+	{
+		std::ostringstream lines;
+		writeCacheEntry(lines, entry);
+		songs[entry.SongID + ", " + entry.Path.string()] = lines.str();
+	}
+	return {album.str(), std::move(songs)};
+}
+
+/**
+ * @brief Apply a line of a cache snapshot or journal to an album cache
+ * @param albumCache Album cache
+ * @param line Trimmed line
+ */
+static void applyCacheLine(MasteringUtility::AlbumCacheEntry &albumCache, const std::string &line)
+{
+	using SongCacheEntry = MasteringUtility::SongCacheEntry;
+
+	std::stringstream        ss(line);
+	std::string              segment;
+	std::vector<std::string> parts;
+
+	while (std::getline(ss, segment, ','))
+		parts.push_back(trim(segment));
+
+	// markup, <hash> (journal only, the snapshot keeps it in its first line)
+	if (parts.size() == 2 && parts[0] == "markup")
+	{
+		albumCache.MarkupHash = parts[1];
+		return;
+	}
+
+	// drop, <song>, <path> (journal only)
+	if (parts.size() == 3 && parts[0] == "drop")
+	{
+		std::erase_if(albumCache.Songs, [&parts](const SongCacheEntry &entry) {
+			return entry.SongID == parts[1] && entry.Path == parts[2];
+		});
+		return;
+	}
+
+	// album, <integrated>, <range>, <true peak>
+	if (parts.size() == 4 && parts[0] == "album")
+	{
+		albumCache.Loudness = parseLoudness(&parts[1]);
+		return;
+	}
+
+	// preflight, <song>, <path>, <hash>, <frames>, <channels>, <rate>, <peak>, <dc offset>, <clipped samples>,
+	//     <clip runs>, <leading silence>, <trailing silence>, <silent channels>
+	if (parts.size() == 14 && parts[0] == "preflight")
+	{
+		SongCacheEntry *entry = nullptr;
+		for (auto &song : albumCache.Songs)
+			if (song.SongID == parts[1] && song.Path == parts[2])
+				entry = &song;
+		if (!entry)
+		{
+			SongCacheEntry newEntry;
+			newEntry.SongID = parts[1];
+			newEntry.Path = parts[2];
+			albumCache.Songs.push_back(newEntry);
+			entry = &albumCache.Songs.back();
+		}
+		try
+		{
+			PreflightScanner::Result result;
+			result.Frames = std::stoull(parts[4]);
+			result.Channels = static_cast<unsigned>(std::stoul(parts[5]));
+			result.SampleRate = static_cast<unsigned>(std::stoul(parts[6]));
+			result.Peak = std::stod(parts[7]);
+			result.DcOffset = std::stod(parts[8]);
+			result.ClippedSamples = std::stoull(parts[9]);
+			result.ClipRuns = std::stoull(parts[10]);
+			result.LeadingSilence = std::stoull(parts[11]);
+			result.TrailingSilence = std::stoull(parts[12]);
+			result.SilentChannels = static_cast<unsigned>(std::stoul(parts[13]));
+			entry->PreflightHash = parts[3];
+			entry->Preflight = result;
+		}
+		catch (...)
+		{
+			// Scanned again
+		}
+		return;
+	}
+
+	// peaks, <song>, <path>, <peaks key>
+	if (parts.size() == 4 && parts[0] == "peaks")
+	{
+		for (auto &entry : albumCache.Songs)
+			if (entry.SongID == parts[1] && entry.Path == parts[2])
+				entry.PeaksKey = parts[3];
+		return;
+	}
+
+	// <song>, <path>, <hash>[, <encode key>, <tag key>[, <fingerprint>]]
+	//     [, <analysis hash>, <integrated>, <range>, <true peak>]
+	// (caches of older versions have no keys or fingerprint)
+	const size_t fields = parts.size();
+	if (fields == 3 || fields == 5 || fields == 6 || fields == 7 || fields == 9 || fields == 10)
+	{
+		SongCacheEntry entry;
+		entry.SongID = parts[0];
+		entry.Path = parts[1];
+		entry.Hash = parts[2];
+		size_t next = 3;
+		if (fields == 5 || fields == 6 || fields == 9 || fields == 10)
+		{
+			entry.EncodeKey = parts[3];
+			entry.TagKey = parts[4];
+			next = 5;
+		}
+		if (fields == 6 || fields == 10)
+			entry.Fingerprint = parts[next++];
+		if (fields - next == 4)
+		{
+			entry.AnalysisHash = parts[next];
+			entry.Loudness = parseLoudness(&parts[next + 1]);
+		}
+
+		// A journal record replaces the whole entry; its peaks and preflight lines follow
+		auto existing = std::find_if(albumCache.Songs.begin(), albumCache.Songs.end(),
+		                             [&entry](const SongCacheEntry &song) {
+			                             return song.SongID == entry.SongID && song.Path == entry.Path;
+		                             });
+		if (existing != albumCache.Songs.end())
+			*existing = entry;
+		else
+			albumCache.Songs.push_back(entry);
+	}
+}
+
+std::filesystem::path MasteringUtility::getJournalFilePath(const Album &album) const
+{
+	return getCacheFilePath(album).string() + ".journal";
+}
+
+std::string MasteringUtility::cacheStamp(const Album &album) const
+{
+	return calculateFileHash(getCacheFilePath(album)) + calculateFileHash(getJournalFilePath(album));
+}
+
+CacheJournal &MasteringUtility::journal(const Album &album)
+{
+	auto &journal = m_journals[album.ID];
+	if (!journal)
+		journal = std::make_unique<CacheJournal>(getJournalFilePath(album));
+	return *journal;
+}
+
+void MasteringUtility::loadCache(const Album &album)
+{
+	auto &albumCache = m_albumCaches[album.ID];
+	if (std::string stamp = cacheStamp(album); !albumCache.Stamp.empty() && albumCache.Stamp == stamp)
+		return;
+	albumCache = AlbumCacheEntry();
+	std::filesystem::path cachePath = getCacheFilePath(album);
+
+	std::ifstream cacheFile(cachePath);
+	if (cacheFile.is_open())
+	{
+		std::string line;
+		bool        firstLine = true;
+
+		while (std::getline(cacheFile, line))
+		{
+			line = trim(line);
+			if (line.empty() || line[0] == ';' || line.rfind("Mastering Utility Cache File", 0) == 0)
+				continue;
+
+			if (firstLine)
+			{
+				albumCache.MarkupHash = line;
+				firstLine = false;
+				continue;
+			}
+			applyCacheLine(albumCache, line);
+		}
+	}
+
+	// Songs committed since the snapshot, including those of an interrupted run
+	std::vector<std::string> records = CacheJournal::read(getJournalFilePath(album));
+	for (const auto &record : records)
+	{
+		std::stringstream lines(record);
+		std::string       line;
+		while (std::getline(lines, line))
+			if (line = trim(line); !line.empty() && line[0] != ';')
+				applyCacheLine(albumCache, line);
+	}
+
+	if (records.empty())
+	{
+		std::tie(albumCache.StoredAlbum, albumCache.StoredSongs) = cacheLines(albumCache);
+		albumCache.Stamp = cacheStamp(album);
+	}
+	else
+		compactCache(album);
+}
+
+bool MasteringUtility::saveCache(const Album &album) const
+{
+	std::filesystem::path cachePath = getCacheFilePath(album);
+	std::filesystem::create_directories(cachePath.parent_path());
+
+	// A file stream cannot be renamed, so it is rewritten in place
+	const bool            stream = album.AFS && NTFS(album.markup);
+	std::filesystem::path writePath = cachePath;
+	if (!stream)
+		writePath += ".tmp";
+
+	{
+		std::ofstream cacheFile(writePath);
+
+		if (!cacheFile.is_open())
+		{
+			std::cerr << "[SaveCache] Could not open cache file for writing: " << writePath << std::endl;
+			return false;
+		}
+
+		if (album.AFS)
+			cacheFile << "Mastering Utility Cache File Stream\n";
+		else
+			cacheFile << "Mastering Utility Cache File\n";
+
+		auto it = m_albumCaches.find(album.ID);
+		if (it != m_albumCaches.end())
+		{
+			cacheFile << it->second.MarkupHash << "\n";
+
+			if (it->second.Loudness.valid())
+			{
+				cacheFile << "album, ";
+				writeLoudness(cacheFile, it->second.Loudness);
+				cacheFile << "\n";
+			}
+
+			for (const auto &entry : it->second.Songs)
+				writeCacheEntry(cacheFile, entry);
+		}
+
+		if (!cacheFile.flush())
+		{
+			std::cerr << "[SaveCache] Could not write cache file: " << writePath << std::endl;
+			return false;
+		}
+	}
+	if (stream)
+		return true;
+
+	// The journal is only emptied once the new snapshot is on disk
+	try
+	{
+		OutputPublisher::flush({writePath});
+		OutputPublisher::publish(writePath, cachePath);
+		return OutputPublisher::flush({cachePath});
+	}
+	catch (const std::exception &ex)
+	{
+		std::cerr << "[SaveCache] " << ex.what() << std::endl;
+		return false;
+	}
+}
+
+void MasteringUtility::commitCache(const Album &album)
+{
+	auto it = m_albumCaches.find(album.ID);
+	if (it == m_albumCaches.end())
+		return;
+	AlbumCacheEntry &albumCache = it->second;
+
+	auto [albumLines, songs] = cacheLines(albumCache);
+	std::string record;
+	if (albumLines != albumCache.StoredAlbum)
+		record += albumLines;
+	for (const auto &[key, lines] : songs)
+	{
+		auto stored = albumCache.StoredSongs.find(key);
+		if (stored == albumCache.StoredSongs.end() || stored->second != lines)
+			record += lines;
+	}
+	for (const auto &[key, lines] : albumCache.StoredSongs)
+		if (!songs.contains(key))
+			record += "drop, " + key + "\n";
+	if (record.empty())
+		return;
+
+	CacheJournal &log = journal(album);
+	if (!log.append(record))
+	{
+		std::cerr << "[SaveCache] Could not write cache journal: " << log.path() << std::endl;
+		return;
+	}
+	albumCache.StoredAlbum = std::move(albumLines);
+	albumCache.StoredSongs = std::move(songs);
+	albumCache.Stamp = cacheStamp(album);
+
+	if (log.size() > JOURNAL_COMPACT_SIZE)
+		compactCache(album);
+}
+
+void MasteringUtility::compactCache(const Album &album)
+{
+	if (!saveCache(album))
+		return;
+	journal(album).clear();
+	auto &albumCache = m_albumCaches[album.ID];
+	std::tie(albumCache.StoredAlbum, albumCache.StoredSongs) = cacheLines(albumCache);
+	albumCache.Stamp = cacheStamp(album);
+}
+
+void MasteringUtility::refreshSourceHashes(const Album &album)
+{
+	auto &albumCache = m_albumCaches[album.ID];
+
+	// Only inputs that fail the cheap size and date check are fingerprinted
+	struct Candidate
+	{
+		const Song     *song;
+		SongCacheEntry *entry;
+		std::string     hash;
+		std::string     fingerprint;
+	};
+	std::vector<Candidate> candidates;
+	for (const Song &song : album.SongsList)
+	{
+		auto entry = findCacheEntry(albumCache, song);
+		if (entry == albumCache.Songs.end() || entry->Fingerprint.empty() || entry->Hash.empty())
+			continue;
+		std::string currentHash = calculateFileHash(song.Path);
+		if (!currentHash.empty() && currentHash != entry->Hash)
+			candidates.push_back({&song, &*entry, currentHash, ""});
+	}
+	if (candidates.empty())
+		return;
+
+	pool().parallelFor(candidates.size(), [&candidates](size_t i) {
+		try
+		{
+			candidates[i].fingerprint = AudioFingerprint::compute(candidates[i].song->Path);
+		}
+		catch (const std::exception &)
+		{
+			// A damaged input is simply re-encoded, which reports the error
+		}
+	});
+
+	for (auto &candidate : candidates)
+	{
+		if (candidate.fingerprint != candidate.entry->Fingerprint)
+			continue;
+		std::cout << "Unchanged audio: " << candidate.song->Title << " (only the file headers changed)\n";
+		if (candidate.entry->AnalysisHash == candidate.entry->Hash)
+			candidate.entry->AnalysisHash = candidate.hash;
+		if (candidate.entry->PreflightHash == candidate.entry->Hash)
+			candidate.entry->PreflightHash = candidate.hash;
+		candidate.entry->Hash = candidate.hash;
+	}
+}
+
+void MasteringUtility::analyzeAlbum(const Album &album)
+{
+	auto &albumCache = m_albumCaches[album.ID];
+
+	// Songs need (re)measuring when their input changed since the cached measurement
+	std::vector<std::string> hashes;
+	bool                     stale = !albumCache.Loudness.valid();
+	for (const Song &song : album.SongsList)
+	{
+		hashes.push_back(calculateFileHash(song.Path));
+		auto entry = findCacheEntry(albumCache, song);
+		if (entry == albumCache.Songs.end() || !entry->Loudness.valid() || entry->AnalysisHash != hashes.back())
+			stale = true;
+	}
+
+	if (stale)
+	{
+		// Album gating needs the blocks of every song, so measure them all, in parallel
+		std::vector<std::optional<LoudnessMeter>> meters(album.SongsList.size());
+		pool().parallelFor(album.SongsList.size(), [&](size_t i) {
+			try
+			{
+				meters[i] = LoudnessMeter::analyzeFile(album.SongsList[i].Path);
+			}
+			catch (const std::exception &ex)
+			{
+				std::cerr << "[Analyze] " << album.SongsList[i].Title << ": " << ex.what() << std::endl;
+			}
+		});
+
+		std::vector<const LoudnessMeter *> measured;
+		for (size_t i = 0; i < album.SongsList.size(); ++i)
+		{
+			const Song &song = album.SongsList[i];
+			auto        entry = findCacheEntry(albumCache, song);
+			if (entry == albumCache.Songs.end())
+			{
+				SongCacheEntry newEntry;
+				newEntry.SongID = std::to_string(song.ID);
+				newEntry.Path = song.Path;
+				albumCache.Songs.push_back(newEntry);
+				entry = albumCache.Songs.end() - 1;
+			}
+			entry->AnalysisHash = meters[i] ? hashes[i] : "";
+			entry->Loudness = meters[i] ? meters[i]->result() : LoudnessMeter::Result();
+			if (meters[i])
+				measured.push_back(&*meters[i]);
+		}
+
+		LoudnessMeter::Result albumLoudness =
+		    measured.empty() ? LoudnessMeter::Result() : LoudnessMeter::combine(measured);
+
+		albumCache.Loudness = albumLoudness;
+	}
+
+	auto print = [](const LoudnessMeter::Result &result) {
+		std::cout << std::fixed << std::setprecision(1) << result.Integrated << " LUFS, LRA " << result.Range
+		          << " LU, " << result.TruePeak << " dBTP" << std::defaultfloat;
+	};
+	for (const Song &song : album.SongsList)
+	{
+		auto entry = findCacheEntry(albumCache, song);
+		if (entry == albumCache.Songs.end() || !entry->Loudness.valid())
+			continue;
+		std::cout << "Loudness: " << song.Title << ": ";
+		print(entry->Loudness);
+		std::cout << "\n";
+	}
+	if (albumCache.Loudness.valid())
+	{
+		std::cout << "Loudness: " << album.Title << " (album): ";
+		print(albumCache.Loudness);
+		std::cout << std::endl;
+	}
+}
+
+/**
+ * @brief Quote a string for JSON
+ * @param value String
+ * @return Quoted and escaped string
+ */
+static std::string jsonString(const std::string &value)
+{
+	std::string out = "\"";
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+			out += '\\';
+		if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+			out += escaped;
+		}
+		else
+			out += c;
+	}
+	return out + "\"";
+}
+
+/**
+ * @brief Level in dBFS as a JSON number
+ * @param level Linear level
+ * @return Level with two decimals, null for silence
+ */
+static std::string jsonDecibels(double level)
+{
+	if (level <= 0.0)
+		return "null";
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(2) << 20.0 * std::log10(level);
+	return out.str();
+}
+
+/**
+ * @brief Describe the findings of a preflight scan
+ * @param result Scan result
+ * @return Findings with their details, comma-separated
+ */
+static std::string describeFindings(const PreflightScanner::Result &result)
+{
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	for (const auto &finding : result.findings())
+	{
+		if (out.tellp() > 0)
+			out << ", ";
+		out << finding;
+		if (finding == "silent-channel")
+			out << " (" << result.SilentChannels << " of " << result.Channels << ")";
+		else if (finding == "clipping")
+			out << " (" << result.ClipRuns << " runs, " << result.ClippedSamples << " samples)";
+		else if (finding == "dc-offset")
+			out << " (" << 20.0 * std::log10(result.DcOffset) << " dBFS)";
+	}
+	return out.str();
+}
+
+void MasteringUtility::preflightAlbum(const Album &album)
+{
+	auto &albumCache = m_albumCaches[album.ID];
+	m_preflightFailed.clear();
+
+	// Inputs shared by several songs (tracks of one long source) are scanned once
+	struct Scan
+	{
+		std::filesystem::path                   path;
+		std::optional<PreflightScanner::Result> result;
+		std::string                             error;
+	};
+	std::vector<Scan>        scans;
+	std::vector<std::string> hashes;
+	for (const Song &song : album.SongsList)
+	{
+		hashes.push_back(calculateFileHash(song.Path));
+		auto entry = findCacheEntry(albumCache, song);
+		if (entry != albumCache.Songs.end() && entry->Preflight.valid() && !hashes.back().empty() &&
+		    entry->PreflightHash == hashes.back())
+			continue;
+		if (std::none_of(scans.begin(), scans.end(), [&song](const Scan &scan) { return scan.path == song.Path; }))
+			scans.push_back({song.Path, std::nullopt, ""});
+	}
+
+	pool().parallelFor(scans.size(), [&scans](size_t i) {
+		try
+		{
+			scans[i].result = PreflightScanner::scanFile(scans[i].path);
+		}
+		catch (const std::exception &ex)
+		{
+			scans[i].error = ex.what();
+		}
+	});
+	if (!scans.empty())
+		std::cout << "Preflight: scanned " << scans.size() << (scans.size() == 1 ? " input\n" : " inputs\n");
+
+	for (size_t i = 0; i < album.SongsList.size(); ++i)
+	{
+		const Song &song = album.SongsList[i];
+		auto        entry = findCacheEntry(albumCache, song);
+		if (entry == albumCache.Songs.end())
+		{
+			SongCacheEntry newEntry;
+			newEntry.SongID = std::to_string(song.ID);
+			newEntry.Path = song.Path;
+			albumCache.Songs.push_back(newEntry);
+			entry = albumCache.Songs.end() - 1;
+		}
+
+		std::string error;
+		auto scan = std::find_if(scans.begin(), scans.end(), [&song](const Scan &s) { return s.path == song.Path; });
+		if (scan != scans.end())
+		{
+			entry->PreflightHash = scan->result ? hashes[i] : "";
+			entry->Preflight = scan->result.value_or(PreflightScanner::Result());
+			error = scan->error;
+		}
+
+		const PreflightScanner::Result &result = entry->Preflight;
+		std::string                     findings = result.valid() ? describeFindings(result) : "";
+		bool                            failed = m_options.PreflightStrict && (!error.empty() || !findings.empty());
+		if (failed)
+			m_preflightFailed.insert(&song);
+		if (!error.empty())
+			std::cerr << "[Preflight] " << song.Title << ": " << error << (failed ? " - not encoded" : "")
+			          << std::endl;
+		else if (!findings.empty())
+			std::cout << "Preflight: " << song.Title << ": " << findings << (failed ? " - not encoded" : "") << "\n";
+
+		if (m_options.PreflightReport.empty())
+			continue;
+		std::ostringstream out;
+		out << "{\"album\": " << jsonString(album.Title) << ", \"song\": " << jsonString(song.Title)
+		    << ", \"input\": " << jsonString(song.Path.string());
+		if (result.valid())
+		{
+			out << ", \"frames\": " << result.Frames << ", \"channels\": " << result.Channels
+			    << ", \"sample_rate\": " << result.SampleRate << ", \"peak_dbfs\": " << jsonDecibels(result.Peak)
+			    << ", \"dc_offset_dbfs\": " << jsonDecibels(result.DcOffset)
+			    << ", \"clipped_samples\": " << result.ClippedSamples << ", \"clip_runs\": " << result.ClipRuns
+			    << std::setprecision(6) << ", \"leading_silence\": "
+			    << static_cast<double>(result.LeadingSilence) / result.SampleRate
+			    << ", \"trailing_silence\": " << static_cast<double>(result.TrailingSilence) / result.SampleRate
+			    << ", \"silent_channels\": " << result.SilentChannels;
+		}
+		else
+			out << ", \"error\": " << jsonString(error.empty() ? "Not scanned" : error);
+		out << ", \"findings\": [";
+		if (result.valid())
+		{
+			auto list = result.findings();
+			for (size_t f = 0; f < list.size(); ++f)
+				out << (f ? ", " : "") << jsonString(list[f]);
+		}
+		out << "], \"skipped\": " << (failed ? "true" : "false") << "}";
+		m_preflightReport.push_back(out.str());
+	}
+}
+
+void MasteringUtility::writePreflightReport() const
+{
+	std::ofstream report(m_options.PreflightReport, std::ios::trunc);
+	if (!report)
+	{
+		std::cerr << "[Preflight] Could not open report for writing: " << m_options.PreflightReport << std::endl;
+		return;
 	}
+	report << "{\n  \"songs\": [";
+	for (size_t i = 0; i < m_preflightReport.size(); ++i)
+		report << (i ? ",\n    " : "\n    ") << m_preflightReport[i];
+	report << "\n  ]\n}\n";
+	std::cout << "Preflight report: " << m_options.PreflightReport.string() << "\n";
 }
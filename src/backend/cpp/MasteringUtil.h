@@ -35,16 +35,102 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #pragma once
+#include "DspGraph.h"
+#include "JobScheduler.h"
+#include "Loudness.h"
+#include "Prefetcher.h"
+#include "Preflight.h"
+#include "TagWriter.h"
+#include "ThreadBudget.h"
+#include "Waveform.h"
+#include <array>
+#include <cstdint>
+#include <exception>
 #include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
+class CacheJournal;
+class ThreadPool;
+
 /// @brief  Mastering Utility
 class MasteringUtility
 {
   public:
+	MasteringUtility();
+	~MasteringUtility();
+
+	/// @brief Processing options
+	class Options
+	{
+	  public:
+		/// @brief Measure loudness (BS.1770) of every song and album before encoding
+		bool Analyze = false;
+		/// @brief Write ReplayGain track and album tags (implies Analyze)
+		bool ReplayGain = false;
+		/// @brief Frames per block of the native DSP graph
+		size_t BlockSize = 4096;
+		/// @brief MP3 and AAC encodes of WAV inputs longer than this many seconds run in segments on all cores,
+		/// 0 to always encode in one piece
+		double SegmentThreshold = 1800.0;
+		/// @brief Scan every input for silence, clipping and DC offset before encoding
+		bool Preflight = false;
+		/// @brief Do not encode songs whose input has preflight findings (implies Preflight)
+		bool PreflightStrict = false;
+		/// @brief Write the preflight results of every song to this JSON file (implies Preflight)
+		std::filesystem::path PreflightReport;
+		/// @brief Write a waveform peak file (PeakFile) next to every output, named like it plus ".peaks"
+		bool Peaks = false;
+		/// @brief Inputs of upcoming songs to read into the page cache while the current ones encode, 0 to disable
+		size_t PrefetchDepth = 4;
+		/// @brief Encodes per storage device at once, 0 for 2 on spinning disks and no limit elsewhere
+		unsigned DeviceJobs = 0;
+		/// @brief How encodes of single songs share the encoder slots with batch work
+		JobScheduler::Policy Lanes;
+		/// @brief Bounds of the encodes at once, which follow the measured throughput unless the bounds are equal
+		ConcurrencyController::Settings Concurrency;
+		/// @brief Threads ffmpeg encodes of a codec put to use, by encoder name; other codecs get one
+		ThreadBudget::Profiles ThreadProfiles;
+		/// @brief Pinning of the encoders of every song to CPUs of one NUMA node
+		CpuPlacement::Policy Placement = CpuPlacement::Policy::None;
+		/// @brief Timeouts of hung encodes, their retries and second copies of slow ones
+		Watchdog::Settings Timeouts;
+	};
+
+	/**
+	 * @brief Set processing options
+	 * @param options Options to use for subsequent runs
+	 */
+	void SetOptions(const Options &options)
+	{
+		m_options = options;
+	}
+
+	/// @brief Current processing options
+	const Options &GetOptions() const
+	{
+		return m_options;
+	}
+
+	/**
+	 * @brief Run the encoders on a scheduler shared with other instances
+	 *
+	 * Instances that share a scheduler share its slots, so the encodes of
+	 * songs requested one at a time (ProcessSong(), Master() with a song)
+	 * can preempt the batch work of another instance. Options::Lanes and
+	 * Options::DeviceJobs are then those of the shared scheduler.
+	 *
+	 * @param scheduler Scheduler, null for one of this instance's own
+	 */
+	void SetScheduler(std::shared_ptr<JobScheduler> scheduler);
+
 	/// @brief Generic Metadata
 	class Metadata
 	{
@@ -111,7 +197,12 @@ class MasteringUtility
 
 		std::filesystem::path markup;
 
-		bool AFS;
+		bool AFS{};
+
+		/// @brief Byte offset of the album block in #markup (set by ParseMarkup)
+		size_t MarkupOffset{};
+		/// @brief Byte length of the album block in #markup, 0 if not parsed
+		size_t MarkupLength{};
 
 		/// @brief Equality operator for Album
 		bool operator==(const Album &other) const
@@ -131,6 +222,35 @@ class MasteringUtility
 	 */
 	void Master(const std::filesystem::path &markupFile);
 
+	/**
+	 * @brief Master one album, or one song of it, of a Markup File
+	 *
+	 * What a run learns is kept for the next one: the ffmpeg codec list,
+	 * the parsed markup (until the file changes), the caches of the albums
+	 * (until their files change) and the worker pool. A resident engine,
+	 * such as the launcher's --daemon, only pays for what changed.
+	 *
+	 * @param markupFile File to parse
+	 * @param albumID Album to process, all albums if not set
+	 * @param songID Song of the album to process, all of its songs if not set
+	 */
+	void Master(const std::filesystem::path &markupFile, std::optional<int> albumID,
+	            std::optional<int> songID = std::nullopt);
+
+	/**
+	 * @brief Master a Markup File, then remaster what changes until the process ends
+	 *
+	 * The markup file, every input and the album art are watched
+	 * (FileWatcher). After a burst of changes has settled, only the songs
+	 * whose input changed are processed again, plus the songs that embed
+	 * album art that changed. A changed markup file processes every album,
+	 * which re-encodes only the songs whose settings changed. Nothing runs
+	 * while nothing changes.
+	 *
+	 * @param markupFile File to parse
+	 */
+	void Watch(const std::filesystem::path &markupFile);
+
 	/**
 	 * @brief Parse a Markup File
 	 *
@@ -142,16 +262,28 @@ class MasteringUtility
 	/**
 	 * @brief Save a Markup File
 	 *
+	 * Albums that were read from @p markupFile by ParseMarkup() and have not
+	 * changed since are copied back byte for byte; only modified or new album
+	 * blocks are rewritten. The result is written in one go to a temporary
+	 * file that is flushed to disk and then replaces @p markupFile, and
+	 * nothing is written at all if the contents would not change.
+	 *
+	 * The albums' block ranges are updated to the saved file, so a later
+	 * save splices again.
 	 *
 	 * @param markupFile Path to Markup File to save
-	 * @param albums Vector of albums to save
+	 * @param albums Vector of albums to save, their MarkupOffset and MarkupLength are updated
 	 */
-	void SaveMarkup(const Albums &albums, const std::filesystem::path &markupFile);
+	void SaveMarkup(Albums &albums, const std::filesystem::path &markupFile);
 
 	/**
 	 * @brief Process an album
 	 *
-	 * Processes an album using ProcessSong()
+	 * Checks every song like ProcessSong() and encodes the songs that need
+	 * it in parallel. Songs that cut a track out of a longer input (-ss, -to
+	 * or -t in their arguments) are split first: every such input is decoded
+	 * once and split at the track points. The encoders are started by a
+	 * JobScheduler, which limits the jobs per storage device.
 	 * @param album Album to process
 	 */
 	void ProcessAlbum(const Album &album);
@@ -159,7 +291,8 @@ class MasteringUtility
 	/**
 	 * @brief Process a song
 	 *
-	 * Processes a song using FFMPEG
+	 * Processes a song using FFMPEG. If only the tags changed since the last
+	 * run, the existing output is retagged natively (TagWriter) instead.
 	 * @param song Song to process
 	 * @param album Parent album of song
 	 */
@@ -175,6 +308,22 @@ class MasteringUtility
 		std::filesystem::path Path;
 		/// @brief Hash of the input file
 		std::string Hash;
+		/// @brief Fingerprint of the input audio, empty if the input is not read natively
+		std::string Fingerprint;
+		/// @brief Hash of the settings that affect the encoded audio (codec, arguments, output)
+		std::string EncodeKey;
+		/// @brief Hash of the tags written to the output
+		std::string TagKey;
+		/// @brief Hash of the input file the loudness was measured on
+		std::string AnalysisHash;
+		/// @brief Measured loudness
+		LoudnessMeter::Result Loudness;
+		/// @brief Hash of the input file the preflight scan ran on
+		std::string PreflightHash;
+		/// @brief Preflight scan result
+		PreflightScanner::Result Preflight;
+		/// @brief Key of the input hash and encode key the peak file was built for, empty if there is none
+		std::string PeaksKey;
 
 		/// @brief Equality operator for SongCacheEntry
 		bool operator==(const SongCacheEntry &other) const
@@ -191,26 +340,334 @@ class MasteringUtility
 		std::string MarkupHash;
 		/// @brief Song cache entries
 		std::vector<SongCacheEntry> Songs;
+		/// @brief Measured album loudness
+		LoudnessMeter::Result Loudness;
+		/// @brief Album lines of the cache as they are on disk, see commitCache()
+		std::string StoredAlbum;
+		/// @brief Cache lines of every song as they are on disk, by song ID and path
+		std::map<std::string, std::string> StoredSongs;
+		/// @brief Size and date of the cache and journal files when they were last read or written
+		std::string Stamp;
 	};
 
   private:
+	/// @brief Encoding of a song, set up by prepareEncode()
+	class EncodeJob
+	{
+	  public:
+		/// @brief Song
+		const Song *Item = nullptr;
+		/// @brief Parent album of the song
+		const Album *Parent = nullptr;
+		/// @brief Audio input: the song's input, a render of it or a track cut out of it
+		std::filesystem::path Input;
+		/// @brief Output file
+		std::filesystem::path Output;
+		/// @brief File the encoder writes, moved over Output by publishOutputs() once the encode succeeded
+		std::filesystem::path Staged;
+		/// @brief Codec, FlacEncoder::CodecName for the native encoder
+		std::string Codec;
+		/// @brief Album and song arguments without the ones handled natively
+		std::string Arguments;
+		/// @brief ffmpeg options for tags and album art
+		std::string Tagging;
+		/// @brief ffmpeg options for the encoder
+		std::string Encoding;
+		/// @brief Delivery format, applied by the split or streamed into ffmpeg
+		DspStage::Format Format;
+		/// @brief Stream the input through the delivery format into ffmpeg
+		bool Streamed = false;
+		/// @brief The input is a track cut out of the song's input
+		bool Split = false;
+		/// @brief Track points, valid if Split
+		DspStage::Track Cut;
+		/// @brief Encode in segments on all cores, see encodeSegments()
+		bool Segmented = false;
+		/// @brief Length of the input in frames at the output rate, valid if Segmented
+		std::uint64_t Frames = 0;
+		/// @brief Output sample rate, valid if Segmented
+		unsigned SampleRate = 0;
+		/// @brief Directory of the segments, valid if Segmented
+		std::filesystem::path WorkDir;
+		/// @brief Tags of the output
+		TagWriter::Tags Tags;
+		/// @brief Hash of the song's input
+		std::string Hash;
+		/// @brief Settings key of the encoded audio
+		std::string EncodeKey;
+		/// @brief Settings key of the tags
+		std::string TagKey;
+		/// @brief Fingerprint of the song's input, computed by finishEncode() if not set
+		std::optional<std::string> Fingerprint;
+		/// @brief A peak file is to be written; not if ffmpeg filters the audio after the peaks are taken
+		bool Peaks = false;
+		/// @brief The output is up to date and only its peak file is missing
+		bool PeaksOnly = false;
+		/// @brief A peak file was written for the output
+		bool PeaksWritten = false;
+	};
+
+	/**
+	 * @brief Run Master() on a Markup File
+	 *
+	 * Parses the file unless it is unchanged since it was last parsed, and
+	 * sets up and tears down what a run needs around @p process.
+	 *
+	 * @param markupFile File to parse
+	 * @param process Processes the albums
+	 */
+	void master(const std::filesystem::path &markupFile, const std::function<void(const Albums &)> &process);
+
+	/**
+	 * @brief Process an album or some of its songs
+	 * @param album Album to process
+	 * @param only Songs of the album to encode, all songs if null
+	 */
+	void processAlbum(const Album &album, const std::vector<const Song *> *only);
+
+	/**
+	 * @brief Check the cache of a song and set up its encoding
+	 *
+	 * Prints why a song is skipped, retags outputs whose audio is unchanged
+	 * and reports errors.
+	 *
+	 * @param song Song
+	 * @param album Parent album
+	 * @param job Encoding to set up
+	 * @return false if there is nothing to encode
+	 */
+	bool prepareEncode(const Song &song, const Album &album, EncodeJob &job);
+
+	/// @brief Run the encoder of a job and write its peak file; safe to call for several jobs at once
+	void runEncode(EncodeJob &job);
+
+	/**
+	 * @brief ffmpeg options that keep an encode within its share of the CPUs (ThreadBudget)
+	 * @param job Encoding
+	 * @param share ffmpeg processes that run at once, this one included
+	 * @param input Options for the input, in front of "-i", instead of the output
+	 */
+	std::string threadOptions(const EncodeJob &job, unsigned share, bool input) const;
+
+	/**
+	 * @brief Write the peak file of a job
+	 *
+	 * Does nothing unless the job's Peaks is set. Errors are reported but do
+	 * not fail the job.
+	 *
+	 * @param job Encoding
+	 * @param build Builds the peaks
+	 */
+	static void writePeaks(EncodeJob &job, const std::function<PeakFile()> &build);
+
+	/**
+	 * @brief Encode several outputs of one input from a single decode
+	 *
+	 * The input is decoded and processed once and its PCM is passed to one
+	 * ffmpeg process per output (DspGraph::FanOutSink). An encoder that
+	 * fails does not fail the others.
+	 *
+	 * @param jobs Streamed jobs of one input and delivery format, or ffmpeg jobs of one plain PCM WAV input
+	 * @return Exit status of each encoder
+	 * @throws std::runtime_error if the input cannot be read or no encoder reads it
+	 */
+	std::vector<int> fanOutEncode(const std::vector<EncodeJob *> &jobs);
+
+	/**
+	 * @brief Encode a long input in overlapping segments in parallel and join them
+	 *
+	 * The input is cut into WAV segments in one pass, every segment is
+	 * encoded to an elementary stream by its own ffmpeg process, the streams
+	 * are joined at frame boundaries (SegmentEncoder) and the result is
+	 * remuxed into the output with the tags and album art.
+	 *
+	 * @param job Encoding with Segmented set
+	 * @throws std::runtime_error if a step fails
+	 */
+	void encodeSegments(EncodeJob &job);
+
+	/// @brief Record an encoded song in the cache
+	void finishEncode(EncodeJob &job);
+
+	/**
+	 * @brief Move the staged files of finished jobs over their outputs
+	 *
+	 * The staged files of a batch are flushed together, renamed over the
+	 * outputs and the renames flushed together, so a batch costs two
+	 * flushes however many songs it has (OutputPublisher). Staged files of
+	 * failed jobs are deleted and the outputs they would have replaced are
+	 * left alone.
+	 *
+	 * @param jobs Encoded jobs
+	 * @param batch Indices of the jobs to publish
+	 * @param errors Error of each job, set for jobs whose output could not be published
+	 */
+	void publishOutputs(std::vector<EncodeJob> &jobs, const std::vector<size_t> &batch,
+	                    std::vector<std::exception_ptr> &errors);
+
+	/**
+	 * @brief Publish a batch of finished jobs, record them in the cache and journal it
+	 *
+	 * Errors of the jobs are reported here.
+	 *
+	 * @param jobs Encoded jobs
+	 * @param batch Indices of the finished jobs
+	 * @param errors Error of each job
+	 */
+	void commitJobs(std::vector<EncodeJob> &jobs, const std::vector<size_t> &batch,
+	                std::vector<std::exception_ptr> &errors);
+
+	/**
+	 * @brief Encode songs, cutting split tracks out of their inputs first
+	 *
+	 * Each input is decoded once per delivery format for all of its tracks,
+	 * then the encoders run in parallel on the scheduler(). ffmpeg encodes
+	 * that share an input are fed from one decode, see fanOutEncode().
+	 * Songs are committed as they finish (commitJobs()): songs that finish
+	 * while a commit is being flushed are committed together by the next
+	 * one, so an interrupted run loses at most the songs in flight.
+	 *
+	 * @param jobs Encodings set up by prepareEncode()
+	 * @param lane Priority class of the encodes
+	 */
+	void encodeTracks(std::vector<EncodeJob> &jobs, JobScheduler::Lane lane = JobScheduler::Lane::Batch);
+
+	/// @brief Directory of the rendered inputs, created on first use
+	const std::filesystem::path &renderDir();
+
 	/// @brief Cache of processed albums: AlbumID -> AlbumCacheEntry
 	using AlbumCacheMap = std::unordered_map<int, AlbumCacheEntry>;
 
 	/// @brief Get the cache file path
 	std::filesystem::path getCacheFilePath(const Album &album) const;
 
-	/// @brief Load the cache for an album
+	/// @brief Get the cache journal file path
+	std::filesystem::path getJournalFilePath(const Album &album) const;
+
+	/// @brief Size and date of the cache and journal files of an album
+	std::string cacheStamp(const Album &album) const;
+
+	/**
+	 * @brief Load the cache for an album and replay its journal, compacting the journal if it has records
+	 *
+	 * A cache that was loaded before and whose files did not change since
+	 * is kept as it is.
+	 *
+	 * @param album Album
+	 */
 	void loadCache(const Album &album);
-	/// @brief Save the cache for an album
-	void saveCache(const Album &album) const;
+	/// @brief Save the cache for an album, replacing the previous snapshot in one step
+	bool saveCache(const Album &album) const;
+
+	/**
+	 * @brief Append what changed in the cache of an album since it was last stored to its journal
+	 *
+	 * Only songs whose cache lines differ from the stored ones are written,
+	 * as one durable record (CacheJournal), so each finished song costs an
+	 * append instead of a rewrite of the whole cache. The journal is
+	 * compacted into the snapshot once it is larger than
+	 * JOURNAL_COMPACT_SIZE.
+	 *
+	 * @param album Album
+	 */
+	void commitCache(const Album &album);
+
+	/// @brief Write the cache of an album as a new snapshot and empty its journal
+	void compactCache(const Album &album);
+
+	/// @brief Journal of an album's cache, opened on first use
+	CacheJournal &journal(const Album &album);
+
+	/// @brief Keep cache entries of inputs whose size or date changed but whose audio fingerprint did not
+	void refreshSourceHashes(const Album &album);
+
+	/// @brief Measure the loudness of an album and its songs, reusing cached results
+	void analyzeAlbum(const Album &album);
+
+	/**
+	 * @brief Scan the inputs of an album for silence, clipping and DC offset, reusing cached results
+	 *
+	 * Prints the findings, adds the songs to the report and, with
+	 * Options::PreflightStrict, marks songs with findings so they are not
+	 * encoded.
+	 *
+	 * @param album Album to scan
+	 */
+	void preflightAlbum(const Album &album);
+
+	/// @brief Write the preflight results collected by preflightAlbum() to Options::PreflightReport
+	void writePreflightReport() const;
+
+	/**
+	 * @brief Input of a song rendered to a delivery format
+	 *
+	 * Renders are kept until Master() returns, so songs and albums that ask
+	 * for the same input in the same format share one render.
+	 *
+	 * @param song Song
+	 * @param format Delivery format
+	 * @param hash Hash of the input file
+	 * @return Rendered WAV file, or the input itself if it is in the delivery format already
+	 */
+	std::filesystem::path renderInput(const Song &song, const DspStage::Format &format, const std::string &hash);
+
+	/// @brief Delete the rendered inputs
+	void clearRenders();
+
+	/// @brief Worker pool, created on first use
+	ThreadPool &pool();
+
+	/// @brief Encoder scheduler, created on first use
+	JobScheduler &scheduler();
+
+	/// @brief Print how the prefetched inputs were used
+	void printPrefetchStats() const;
+
+	/// @brief Print the jobs and throughput of every storage device the scheduler used
+	void printDeviceStats() const;
 
 	/// @brief Cache of processed albums: AlbumID -> AlbumCacheEntry
 	AlbumCacheMap m_albumCaches;
+	/// @brief Open cache journals: AlbumID -> journal
+	std::unordered_map<int, std::unique_ptr<CacheJournal>> m_journals;
 	/// @brief Set of audio codecs
 	std::unordered_set<std::string> m_audioCodecs;
 	/// @brief Markup file path
 	std::filesystem::path m_markupFile;
+	/// @brief Parsed markup files: absolute path -> size and date of the file, and its albums
+	std::unordered_map<std::string, std::pair<std::string, Albums>> m_markups;
+	/// @brief Processing options
+	Options m_options;
+	/// @brief Worker pool
+	std::unique_ptr<ThreadPool> m_pool;
+	/// @brief Encoder scheduler
+	std::shared_ptr<JobScheduler> m_scheduler;
+	/// @brief Whether m_scheduler was set by SetScheduler()
+	bool m_sharedScheduler = false;
+	/// @brief Device statistics of the scheduler when the current run started
+	std::map<std::uint64_t, JobScheduler::DeviceStats> m_deviceBaseline;
+	/// @brief Lane statistics of the scheduler when the current run started
+	std::array<JobScheduler::LaneStats, 2> m_laneBaseline;
+	/// @brief NUMA node statistics of the scheduler when the current run started
+	std::map<int, JobScheduler::NodeStats> m_nodeBaseline;
+	/// @brief Timeouts and speculative copies of the scheduler when the current run started
+	JobScheduler::StragglerStats m_stragglerBaseline;
+	/// @brief Number of this instance in the process, part of its staged file names
+	unsigned m_instance;
+	/// @brief Page cache prefetcher of upcoming inputs, set while Master() runs
+	std::unique_ptr<Prefetcher> m_prefetcher;
+	/// @brief Rendered inputs: settings key -> WAV file
+	std::unordered_map<std::string, std::filesystem::path> m_renders;
+	/// @brief Directory of the rendered inputs, created on first use
+	std::filesystem::path m_renderDir;
+	/// @brief Songs not to encode because of preflight findings
+	std::unordered_set<const Song *> m_preflightFailed;
+	/// @brief Songs to encode even though their cache entry is current, set by Watch() when their album art changed
+	std::unordered_set<const Song *> m_forced;
+	/// @brief Preflight report entries, one JSON object per song
+	std::vector<std::string> m_preflightReport;
 	/// @brief Buffer size
 	static constexpr size_t BUFFER_SIZE = 4096;
+	/// @brief Journal size in bytes above which commitCache() compacts it
+	static constexpr std::uint64_t JOURNAL_COMPACT_SIZE = 256 * 1024;
 };
\ No newline at end of file
@@ -0,0 +1,124 @@
+/**
+ * @file OutputPublisher.cpp
+ * @brief Durable, atomic replacement of outputs by staged files.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "OutputPublisher.h"
+#include <set>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+/// @brief Flush one file to disk
+static bool flushFile(const std::filesystem::path &path)
+{
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	bool flushed = FlushFileBuffers(file) != 0;
+	CloseHandle(file);
+	return flushed;
+}
+#else
+/// @brief Flush one file or directory to disk
+static bool flushFile(const std::filesystem::path &path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	bool flushed = fsync(fd) == 0;
+	::close(fd);
+	return flushed;
+}
+#endif
+
+bool OutputPublisher::flush(const std::vector<std::filesystem::path> &files)
+{
+	bool flushed = true;
+#ifdef __linux__
+	// One syncfs() writes back every dirty file and directory of the file system in a single pass
+	std::set<dev_t> devices;
+	for (const auto &file : files)
+	{
+		struct stat st;
+		if (stat(file.c_str(), &st) != 0 || !devices.insert(st.st_dev).second)
+			continue;
+		int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0 || syncfs(fd) != 0)
+			flushed = false;
+		if (fd >= 0)
+			::close(fd);
+	}
+#else
+	std::set<std::filesystem::path> directories;
+	for (const auto &file : files)
+	{
+		std::error_code ec;
+		if (!std::filesystem::exists(file, ec))
+			continue;
+		flushed = flushFile(file) && flushed;
+		directories.insert(file.parent_path().empty() ? std::filesystem::path(".") : file.parent_path());
+	}
+#ifndef _WIN32
+	// NTFS journals the rename itself; POSIX wants the directory flushed
+	for (const auto &directory : directories)
+		flushed = flushFile(directory) && flushed;
+#endif
+#endif
+	return flushed;
+}
+
+void OutputPublisher::publish(const std::filesystem::path &staged, const std::filesystem::path &output)
+{
+	std::error_code ec;
+	std::filesystem::rename(staged, output, ec);
+	if (!ec)
+		return;
+#ifdef _WIN32
+	const bool crossDevice = ec == std::error_code(ERROR_NOT_SAME_DEVICE, std::system_category());
+#else
+	const bool crossDevice = ec == std::errc::cross_device_link;
+#endif
+	if (!crossDevice)
+		throw std::filesystem::filesystem_error("Failed to publish", staged, output, ec);
+
+	// The copy is made durable under a temporary name, so the output is still replaced in one step
+	std::filesystem::path partial = output;
+	partial += ".partial";
+	try
+	{
+		std::filesystem::copy_file(staged, partial, std::filesystem::copy_options::overwrite_existing);
+		flushFile(partial);
+		std::filesystem::rename(partial, output);
+	}
+	catch (...)
+	{
+		std::filesystem::remove(partial, ec);
+		throw;
+	}
+	std::filesystem::remove(staged, ec);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file OutputPublisher.h
+ * @brief Durable, atomic replacement of outputs by staged files.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <filesystem>
+#include <vector>
+
+/**
+ * @brief Moves finished files from a staging directory over their outputs
+ *
+ * Encoders write into a staging directory next to the outputs, so an
+ * interrupted encode never leaves a truncated file under the output's
+ * name. A batch is published in three steps: flush() the staged files,
+ * publish() each of them with a rename, then flush() the outputs so the
+ * renames are on disk too.
+ */
+class OutputPublisher
+{
+  public:
+	/**
+	 * @brief Make files and the directory entries that name them durable
+	 *
+	 * On Linux this is one syncfs() per file system, however many files
+	 * there are. Elsewhere every file and every distinct directory is
+	 * flushed on its own. Files that do not exist are skipped.
+	 *
+	 * @param files Files to flush
+	 * @return false if a flush failed
+	 */
+	static bool flush(const std::vector<std::filesystem::path> &files);
+
+	/**
+	 * @brief Replace an output by a staged file
+	 *
+	 * The rename is atomic: readers see the old output or the new one.
+	 * If the output is on another file system, the staged file is copied
+	 * next to it first and renamed from there.
+	 *
+	 * @param staged Finished file
+	 * @param output File to replace
+	 * @throws std::filesystem::filesystem_error if the file cannot be moved
+	 */
+	static void publish(const std::filesystem::path &staged, const std::filesystem::path &output);
+};
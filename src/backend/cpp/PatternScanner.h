@@ -0,0 +1,193 @@
+/**
+ * @file PatternScanner.h
+ * @brief Compile-time built, case-insensitive multi-pattern scanner.
+ *
+ * The pattern set is compiled into an Aho-Corasick automaton (a full DFA over
+ * a compressed alphabet) by a constexpr constructor, so matching is a single
+ * table-driven pass over the input with no allocation.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * static constexpr std::array<std::string_view, 2> patterns = {"&&", "$("};
+ * static constexpr PatternScanner<patternStates(patterns)> scanner(patterns);
+ * bool unsafe = scanner.contains(input);
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+/**
+ * @brief Upper bound on the number of automaton states for a pattern set
+ * @param patterns Pattern set
+ * @return Total pattern length plus the root state
+ */
+template <size_t N> constexpr size_t patternStates(const std::array<std::string_view, N> &patterns)
+{
+	size_t states = 1;
+	for (auto pattern : patterns)
+		states += pattern.size();
+	return states;
+}
+
+/// @brief Case-insensitive Aho-Corasick scanner with MaxStates states
+template <size_t MaxStates> class PatternScanner
+{
+  public:
+	/// @brief Maximum number of distinct (case folded) pattern bytes
+	static constexpr size_t MaxClasses = 64;
+
+	/**
+	 * @brief Build the automaton
+	 * @param patterns Patterns to match, ASCII case-insensitive
+	 */
+	template <size_t N> constexpr explicit PatternScanner(const std::array<std::string_view, N> &patterns)
+	{
+		static_assert(MaxStates >= 1, "PatternScanner needs at least the root state");
+
+		// Alphabet: every byte that occurs in a pattern gets its own class, both
+		// letter cases share one; everything else is class 0
+		size_t classes = 1;
+		for (auto pattern : patterns)
+			for (char c : pattern)
+			{
+				auto folded = static_cast<unsigned char>(fold(c));
+				if (m_class[folded] != 0)
+					continue;
+				if (classes == MaxClasses)
+					throw "PatternScanner: too many distinct pattern bytes";
+				m_class[folded] = static_cast<std::uint8_t>(classes);
+				if (folded >= 'a' && folded <= 'z')
+					m_class[folded - 'a' + 'A'] = static_cast<std::uint8_t>(classes);
+				++classes;
+			}
+
+		// Trie; 0 in m_next means "no edge" until the failure pass fills it in
+		for (auto pattern : patterns)
+		{
+			if (pattern.empty())
+				continue;
+			size_t state = 0;
+			for (char c : pattern)
+			{
+				auto &edge = m_next[state][m_class[static_cast<unsigned char>(c)]];
+				if (edge == 0)
+					edge = static_cast<State>(m_states++);
+				state = edge;
+			}
+			if (pattern.size() > m_length[state])
+				m_length[state] = static_cast<std::uint8_t>(pattern.size());
+		}
+
+		// Breadth-first failure links, folded straight into a complete DFA
+		std::array<State, MaxStates> fail{};
+		std::array<State, MaxStates> queue{};
+		size_t                       head = 0, tail = 0;
+		for (size_t c = 0; c < MaxClasses; ++c)
+			if (m_next[0][c] != 0)
+				queue[tail++] = m_next[0][c];
+
+		while (head < tail)
+		{
+			State state = queue[head++];
+			if (m_length[fail[state]] > m_length[state])
+				m_length[state] = m_length[fail[state]];
+
+			for (size_t c = 0; c < MaxClasses; ++c)
+			{
+				State child = m_next[state][c];
+				if (child == 0)
+				{
+					m_next[state][c] = m_next[fail[state]][c];
+					continue;
+				}
+				fail[child] = m_next[fail[state]][c];
+				queue[tail++] = child;
+			}
+		}
+	}
+
+	/**
+	 * @brief Scan text in a single pass
+	 *
+	 * @p onMatch is called as `onMatch(end, length)` for the longest pattern
+	 * ending at each position, where the match covers `[end - length, end)`.
+	 * The byte at a position is read before @p onMatch is invoked, so the
+	 * callback may overwrite the match in a buffer aliased by @p text.
+	 *
+	 * @param text Text to scan
+	 * @param onMatch Match callback
+	 * @return Number of positions at which a pattern ended
+	 */
+	template <typename F> constexpr size_t scan(std::string_view text, F &&onMatch) const
+	{
+		size_t matches = 0;
+		State  state = 0;
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			state = m_next[state][m_class[static_cast<unsigned char>(text[i])]];
+			if (m_length[state] != 0)
+			{
+				++matches;
+				onMatch(i + 1, static_cast<size_t>(m_length[state]));
+			}
+		}
+		return matches;
+	}
+
+	/**
+	 * @brief Check whether any pattern occurs in text
+	 * @param text Text to scan
+	 * @return true on the first match
+	 */
+	constexpr bool contains(std::string_view text) const
+	{
+		State state = 0;
+		for (char c : text)
+		{
+			state = m_next[state][m_class[static_cast<unsigned char>(c)]];
+			if (m_length[state] != 0)
+				return true;
+		}
+		return false;
+	}
+
+  private:
+	/// @brief State index type
+	using State = std::conditional_t<(MaxStates <= 256), std::uint8_t, std::uint16_t>;
+
+	/// @brief ASCII lower case
+	static constexpr char fold(char c)
+	{
+		return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+	}
+
+	/// @brief Byte -> alphabet class
+	std::array<std::uint8_t, 256> m_class{};
+	/// @brief DFA transitions: state x class -> state
+	std::array<std::array<State, MaxClasses>, MaxStates> m_next{};
+	/// @brief Length of the longest pattern ending in each state, 0 if none
+	std::array<std::uint8_t, MaxStates> m_length{};
+	/// @brief Number of states in use
+	size_t m_states = 1;
+};
@@ -0,0 +1,233 @@
+/**
+ * @file Prefetcher.cpp
+ * @brief Background page cache warm-up of upcoming job inputs.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Prefetcher.h"
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// @brief Bytes loaded between two checks whether the job has started already
+static constexpr std::uint64_t loadChunk = 4u << 20;
+
+Prefetcher::Prefetcher(size_t depth, std::uint64_t budget) : m_depth(depth), m_budget(budget)
+{
+	if (m_budget == 0)
+		m_budget = availableMemory() / 4;
+}
+
+Prefetcher::~Prefetcher()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	if (m_thread.joinable())
+		m_thread.join();
+}
+
+void Prefetcher::queue(const std::filesystem::path &path)
+{
+	if (m_depth == 0)
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = m_position; i < m_entries.size(); ++i)
+			if (m_entries[i].Path == path)
+				return;
+		m_entries.emplace_back().Path = path;
+		if (!m_thread.joinable())
+			m_thread = std::thread(&Prefetcher::worker, this);
+	}
+	m_wake.notify_all();
+}
+
+void Prefetcher::reached(const std::filesystem::path &path)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		size_t index = m_position;
+		while (index < m_entries.size() && (m_entries[index].Started || m_entries[index].Path != path))
+			++index;
+		if (index == m_entries.size())
+			return;
+
+		Entry &entry = m_entries[index];
+		++m_stats.Started;
+		if (entry.Status == State::Loaded && entry.Complete)
+		{
+			++m_stats.Hits;
+			m_stats.LeadSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - entry.Done).count();
+		}
+		else if (entry.Status != State::Queued)
+			++m_stats.Partial;
+
+		// Jobs may start out of order; the window begins at the first file whose job has not started
+		entry.Started = true;
+		while (m_position < m_entries.size() && m_entries[m_position].Started)
+			++m_position;
+		m_next = std::max(m_next, m_position);
+	}
+	m_wake.notify_all();
+}
+
+Prefetcher::Stats Prefetcher::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+std::uint64_t Prefetcher::availableMemory()
+#ifdef _WIN32
+{
+	MEMORYSTATUSEX status{};
+	status.dwLength = sizeof(status);
+	if (GlobalMemoryStatusEx(&status))
+		return status.ullAvailPhys;
+	return 1ull << 30;
+}
+#else  // !_WIN32
+{
+#ifdef __linux__
+	// MemAvailable counts the page cache that can be reclaimed, free memory alone is usually tiny
+	std::ifstream meminfo("/proc/meminfo");
+	std::string   key;
+	std::uint64_t value;
+	while (meminfo >> key >> value)
+	{
+		if (key == "MemAvailable:")
+			return value * 1024;
+		meminfo.ignore(64, '\n');
+	}
+#endif
+#ifdef _SC_AVPHYS_PAGES
+	long pages = sysconf(_SC_AVPHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGESIZE);
+	if (pages > 0 && pageSize > 0)
+		return static_cast<std::uint64_t>(pages) * static_cast<std::uint64_t>(pageSize);
+#endif
+	return 1ull << 30;
+}
+#endif // _WIN32
+
+bool Prefetcher::cancelled(size_t index)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stop || m_entries[index].Started;
+}
+
+std::pair<std::uint64_t, bool> Prefetcher::load(size_t index, const std::filesystem::path &path, std::uint64_t limit)
+{
+	std::error_code ec;
+	const std::uint64_t size = std::filesystem::file_size(path, ec);
+	if (ec)
+		return {0, false};
+	const std::uint64_t wanted = std::min(size, limit);
+	std::uint64_t       done = 0;
+
+#ifdef __linux__
+	// readahead() fills the page cache in the kernel; files it does not support are read below
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return {0, false};
+	while (done < wanted && !cancelled(index))
+	{
+		const size_t chunk = static_cast<size_t>(std::min(loadChunk, wanted - done));
+		if (readahead(fd, static_cast<off64_t>(done), chunk) != 0)
+			break;
+		done += chunk;
+	}
+	::close(fd);
+	if (done == wanted || cancelled(index))
+		return {done, done == size};
+#endif
+
+	std::ifstream     file(path, std::ios::binary);
+	std::vector<char> scratch(1u << 20);
+	file.seekg(static_cast<std::streamoff>(done));
+	while (file && done < wanted && !cancelled(index))
+	{
+		const auto chunk = static_cast<std::streamsize>(std::min<std::uint64_t>(scratch.size(), wanted - done));
+		file.read(scratch.data(), chunk);
+		done += static_cast<std::uint64_t>(file.gcount());
+	}
+	return {done, done == size};
+}
+
+void Prefetcher::worker()
+{
+	// Files and bytes held for jobs that have not started yet
+	auto window = [this] {
+		std::pair<size_t, std::uint64_t> held{0, 0};
+		for (size_t i = m_position; i < m_next; ++i)
+		{
+			if (!m_entries[i].Started)
+			{
+				++held.first;
+				held.second += m_entries[i].Bytes;
+			}
+		}
+		return held;
+	};
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_wake.wait(lock, [this, &window] {
+			while (m_next < m_entries.size() && m_entries[m_next].Started)
+				++m_next;
+			auto [files, bytes] = window();
+			return m_stop || (m_next < m_entries.size() && files < m_depth && bytes < m_budget);
+		});
+		if (m_stop)
+			return;
+
+		const std::uint64_t         room = m_budget - window().second;
+		const size_t                index = m_next++;
+		const std::filesystem::path path = m_entries[index].Path;
+		m_entries[index].Status = State::Loading;
+		lock.unlock();
+
+		const auto start = std::chrono::steady_clock::now();
+		auto [bytes, complete] = load(index, path, room);
+		const auto done = std::chrono::steady_clock::now();
+
+		lock.lock();
+		Entry &entry = m_entries[index];
+		entry.Bytes = bytes;
+		entry.Complete = complete;
+		entry.Done = done;
+		entry.Status = State::Loaded;
+		m_stats.Bytes += bytes;
+		if (complete)
+		{
+			m_stats.LoadSeconds += std::chrono::duration<double>(done - start).count();
+			++m_stats.Loaded;
+		}
+	}
+}
@@ -0,0 +1,169 @@
+/**
+ * @file Prefetcher.h
+ * @brief Background page cache warm-up of upcoming job inputs.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Reads the inputs of upcoming jobs into the page cache while the current jobs run
+ *
+ * Files are queued in the order their jobs will run. A background thread
+ * loads the next ones, at most @c depth files whose jobs have not started
+ * and at most @c budget bytes in total, so an encoder that opens
+ * its input finds it in memory instead of waiting for the disk. On Linux
+ * the files are loaded with readahead(), which fills the page cache
+ * without copying anything to user space; elsewhere they are read through
+ * a small scratch buffer.
+ */
+class Prefetcher
+{
+  public:
+	/// @brief What happened to the prefetched inputs
+	class Stats
+	{
+	  public:
+		/// @brief Inputs whose job started
+		size_t Started = 0;
+		/// @brief Inputs that were fully loaded when their job started
+		size_t Hits = 0;
+		/// @brief Inputs that were being loaded or were cut short by the budget when their job started
+		size_t Partial = 0;
+		/// @brief Bytes loaded into the page cache
+		std::uint64_t Bytes = 0;
+		/// @brief Time spent loading, the read latency the encoders did not wait for
+		double LoadSeconds = 0.0;
+		/// @brief Inputs LoadSeconds covers
+		size_t Loaded = 0;
+		/// @brief Sum of the time between a hit finishing its load and its job starting
+		double LeadSeconds = 0.0;
+	};
+
+	/**
+	 * @param depth Number of files to keep loaded ahead of the running jobs
+	 * @param budget Bytes to keep loaded ahead, 0 for a quarter of the available memory
+	 */
+	explicit Prefetcher(size_t depth, std::uint64_t budget = 0);
+
+	/// @brief Stop loading and join the background thread
+	~Prefetcher();
+
+	Prefetcher(const Prefetcher &) = delete;
+	Prefetcher &operator=(const Prefetcher &) = delete;
+
+	/**
+	 * @brief Queue the input of an upcoming job
+	 *
+	 * Files that are queued and whose job has not started yet are not
+	 * queued again.
+	 *
+	 * @param path Input file
+	 */
+	void queue(const std::filesystem::path &path);
+
+	/**
+	 * @brief Report that the job reading a file starts now
+	 *
+	 * The file leaves the window, so the thread moves on to the next files.
+	 * Jobs may start in any order; files whose job never starts keep their
+	 * place until the prefetcher is destroyed. Files that were not queued
+	 * are ignored.
+	 *
+	 * @param path Input file
+	 */
+	void reached(const std::filesystem::path &path);
+
+	/// @brief Statistics so far
+	Stats stats() const;
+
+	/// @brief Physical memory that is available without swapping, an estimate where the system does not say
+	static std::uint64_t availableMemory();
+
+  private:
+	/// @brief Load state of a queued file
+	enum class State
+	{
+		Queued,
+		Loading,
+		Loaded
+	};
+
+	/// @brief Queued file
+	class Entry
+	{
+	  public:
+		/// @brief Input file
+		std::filesystem::path Path;
+		/// @brief Load state
+		State Status = State::Queued;
+		/// @brief Bytes loaded
+		std::uint64_t Bytes = 0;
+		/// @brief Whether the whole file was loaded
+		bool Complete = false;
+		/// @brief Whether its job has started
+		bool Started = false;
+		/// @brief When loading finished
+		std::chrono::steady_clock::time_point Done;
+	};
+
+	/// @brief Background loop
+	void worker();
+
+	/**
+	 * @brief Load the start of a file into the page cache, unlocked
+	 * @param index Entry to load
+	 * @param path Its path
+	 * @param limit Maximum number of bytes
+	 * @return Bytes loaded and whether it is the whole file
+	 */
+	std::pair<std::uint64_t, bool> load(size_t index, const std::filesystem::path &path, std::uint64_t limit);
+
+	/// @brief Whether the loading of an entry should stop
+	bool cancelled(size_t index);
+
+	/// @brief Number of files to keep loaded ahead
+	size_t m_depth;
+	/// @brief Bytes to keep loaded ahead
+	std::uint64_t m_budget;
+	/// @brief Queued files in job order
+	std::vector<Entry> m_entries;
+	/// @brief First entry whose job has not started
+	size_t m_position = 0;
+	/// @brief Next entry to load
+	size_t m_next = 0;
+	/// @brief Statistics
+	Stats m_stats;
+	/// @brief Background thread, started by the first queue()
+	std::thread m_thread;
+	/// @brief Guards everything above
+	mutable std::mutex m_mutex;
+	/// @brief Signals new files, started jobs or shutdown
+	std::condition_variable m_wake;
+	/// @brief Set when the prefetcher shuts down
+	bool m_stop = false;
+};
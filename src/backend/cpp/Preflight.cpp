@@ -0,0 +1,240 @@
+/**
+ * @file Preflight.cpp
+ * @brief Implementation of the preflight scanner
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Preflight.h"
+#include "AudioSource.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+
+/// @brief Counters of one channel over one block
+struct PlaneScan
+{
+	/// @brief Largest absolute sample value
+	float Peak = 0.0f;
+	/// @brief Sample sum
+	double Sum = 0.0;
+	/// @brief First sample above the silence level, the block length if there is none
+	size_t FirstSound = 0;
+	/// @brief Sample after the last sample above the silence level
+	size_t EndSound = 0;
+};
+
+/**
+ * @brief Extend or close a run of full-scale samples
+ * @param magnitude Absolute sample value
+ * @param run Length of the current run
+ * @param clipped Samples in completed clipping runs
+ * @param runs Completed clipping runs
+ */
+static void trackClip(float magnitude, std::uint64_t &run, std::uint64_t &clipped, std::uint64_t &runs)
+{
+	if (magnitude >= PreflightScanner::ClipLevel)
+	{
+		++run;
+		return;
+	}
+	if (run >= PreflightScanner::MinClipRun)
+	{
+		clipped += run;
+		++runs;
+	}
+	run = 0;
+}
+
+/**
+ * @brief Record the samples above the silence level in a group of four
+ * @param mask Bit k set if sample @p i + k is above the silence level
+ * @param i Index of the first sample of the group
+ * @param scan Counters
+ * @param frames Block length
+ */
+static void trackSound(int mask, size_t i, PlaneScan &scan, size_t frames)
+{
+	if (mask == 0)
+		return;
+	if (scan.FirstSound == frames)
+		scan.FirstSound = i + ((mask & 1) ? 0 : (mask & 2) ? 1 : (mask & 4) ? 2 : 3);
+	scan.EndSound = i + ((mask & 8) ? 4 : (mask & 4) ? 3 : (mask & 2) ? 2 : 1);
+}
+
+#if defined(MU_SIMD_NEON)
+/// @brief Lane mask of a NEON comparison, bit k for lane k
+static int laneMask(uint32x4_t compare)
+{
+	static const uint32_t bits[4] = {1, 2, 4, 8};
+	uint32x4_t            masked = vandq_u32(compare, vld1q_u32(bits));
+	uint32x2_t            half = vadd_u32(vget_low_u32(masked), vget_high_u32(masked));
+	return static_cast<int>(vget_lane_u32(vpadd_u32(half, half), 0));
+}
+#endif
+
+/**
+ * @brief Scan a block of one channel
+ * @param input Samples
+ * @param frames Number of samples
+ * @param scan Counters of the block
+ * @param run Length of the current full-scale run, carried across blocks
+ * @param clipped Samples in completed clipping runs
+ * @param runs Completed clipping runs
+ */
+static void scanPlane(const float *input, size_t frames, PlaneScan &scan, std::uint64_t &run,
+                      std::uint64_t &clipped, std::uint64_t &runs)
+{
+	scan.FirstSound = frames;
+	size_t i = 0;
+
+	// Peak and sum stay in vector registers; full-scale samples are rare, so only groups that hold one (or
+	// end a run) go through the scalar run counter
+#if defined(MU_SIMD_SSE2)
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 silence = _mm_set1_ps(PreflightScanner::SilenceLevel);
+	const __m128 clip = _mm_set1_ps(PreflightScanner::ClipLevel);
+	__m128       peak = _mm_setzero_ps(), sum = _mm_setzero_ps();
+	for (; i + 4 <= frames; i += 4)
+	{
+		__m128 value = _mm_loadu_ps(input + i);
+		__m128 magnitude = _mm_and_ps(value, absMask);
+		peak = _mm_max_ps(peak, magnitude);
+		sum = _mm_add_ps(sum, value);
+		trackSound(_mm_movemask_ps(_mm_cmpgt_ps(magnitude, silence)), i, scan, frames);
+		if (run > 0 || _mm_movemask_ps(_mm_cmpge_ps(magnitude, clip)) != 0)
+			for (size_t k = i; k < i + 4; ++k)
+				trackClip(std::fabs(input[k]), run, clipped, runs);
+	}
+	alignas(16) float lanes[4], sums[4];
+	_mm_store_ps(lanes, peak);
+	_mm_store_ps(sums, sum);
+	scan.Peak = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+	scan.Sum = static_cast<double>(sums[0]) + sums[1] + sums[2] + sums[3];
+#elif defined(MU_SIMD_NEON)
+	const float32x4_t silence = vdupq_n_f32(PreflightScanner::SilenceLevel);
+	const float32x4_t clip = vdupq_n_f32(PreflightScanner::ClipLevel);
+	float32x4_t       peak = vdupq_n_f32(0.0f), sum = vdupq_n_f32(0.0f);
+	for (; i + 4 <= frames; i += 4)
+	{
+		float32x4_t value = vld1q_f32(input + i);
+		float32x4_t magnitude = vabsq_f32(value);
+		peak = vmaxq_f32(peak, magnitude);
+		sum = vaddq_f32(sum, value);
+		trackSound(laneMask(vcgtq_f32(magnitude, silence)), i, scan, frames);
+		if (run > 0 || laneMask(vcgeq_f32(magnitude, clip)) != 0)
+			for (size_t k = i; k < i + 4; ++k)
+				trackClip(std::fabs(input[k]), run, clipped, runs);
+	}
+	float lanes[4], sums[4];
+	vst1q_f32(lanes, peak);
+	vst1q_f32(sums, sum);
+	scan.Peak = std::max({lanes[0], lanes[1], lanes[2], lanes[3]});
+	scan.Sum = static_cast<double>(sums[0]) + sums[1] + sums[2] + sums[3];
+#endif
+
+	for (; i < frames; ++i)
+	{
+		float magnitude = std::fabs(input[i]);
+		scan.Peak = std::max(scan.Peak, magnitude);
+		scan.Sum += input[i];
+		trackSound(magnitude > PreflightScanner::SilenceLevel ? 1 : 0, i, scan, frames);
+		trackClip(magnitude, run, clipped, runs);
+	}
+}
+
+std::vector<std::string> PreflightScanner::Result::findings() const
+{
+	std::vector<std::string> findings;
+	if (Peak <= SilenceLevel)
+		findings.push_back("silence");
+	else if (SilentChannels > 0)
+		findings.push_back("silent-channel");
+	if (ClipRuns > 0)
+		findings.push_back("clipping");
+	if (DcOffset > DcOffsetLimit)
+		findings.push_back("dc-offset");
+	return findings;
+}
+
+PreflightScanner::PreflightScanner(unsigned channels, unsigned sampleRate)
+    : m_channels(channels), m_sampleRate(sampleRate), m_peaks(channels), m_sums(channels), m_runs(channels)
+{
+}
+
+void PreflightScanner::process(const float *const *planes, size_t frames)
+{
+	for (unsigned c = 0; c < m_channels; ++c)
+	{
+		PlaneScan scan;
+		scanPlane(planes[c], frames, scan, m_runs[c], m_clipped, m_clipRuns);
+		m_peaks[c] = std::max(m_peaks[c], scan.Peak);
+		m_sums[c] += scan.Sum;
+		if (scan.FirstSound < frames)
+		{
+			m_firstSound = std::min(m_firstSound, m_frames + scan.FirstSound);
+			m_endSound = std::max(m_endSound, m_frames + scan.EndSound);
+		}
+	}
+	m_frames += frames;
+}
+
+PreflightScanner::Result PreflightScanner::result() const
+{
+	Result result;
+	result.Frames = m_frames;
+	result.Channels = m_channels;
+	result.SampleRate = m_sampleRate;
+	result.ClippedSamples = m_clipped;
+	result.ClipRuns = m_clipRuns;
+	for (unsigned c = 0; c < m_channels; ++c)
+	{
+		result.Peak = std::max(result.Peak, static_cast<double>(m_peaks[c]));
+		if (m_frames > 0)
+			result.DcOffset = std::max(result.DcOffset, std::fabs(m_sums[c] / static_cast<double>(m_frames)));
+		if (m_peaks[c] <= SilenceLevel)
+			++result.SilentChannels;
+		// A run that reaches the end of the input is complete
+		if (m_runs[c] >= MinClipRun)
+		{
+			result.ClippedSamples += m_runs[c];
+			++result.ClipRuns;
+		}
+	}
+	result.LeadingSilence = std::min(m_firstSound, m_frames);
+	result.TrailingSilence = m_frames - m_endSound;
+	return result;
+}
+
+PreflightScanner::Result PreflightScanner::scanFile(const std::filesystem::path &filePath)
+{
+	AudioSource source;
+	source.open(filePath);
+
+	PreflightScanner scanner(source.channels(), source.sampleRate());
+
+	constexpr size_t                blockFrames = 8192;
+	std::vector<std::vector<float>> buffers(source.channels(), std::vector<float>(blockFrames));
+	std::vector<float *>            planes;
+	for (auto &buffer : buffers)
+		planes.push_back(buffer.data());
+
+	while (size_t frames = source.read(planes.data(), blockFrames))
+		scanner.process(planes.data(), frames);
+
+	return scanner.result();
+}
@@ -0,0 +1,140 @@
+/**
+ * @file Preflight.h
+ * @brief Preflight scan of input audio for silence, clipping and DC offset.
+ *
+ * The scanner reads every sample once and keeps a handful of counters per
+ * channel: the peak, the sum for the DC offset, runs of full-scale samples
+ * and the first and last sample above the silence level. The inner loop
+ * runs on SSE2 or NEON and only drops to scalar code for the few samples
+ * that are at full scale.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * auto result = PreflightScanner::scanFile("mix.wav");
+ * for (const auto &finding : result.findings())
+ *     std::cout << finding << "\n";
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <vector>
+
+/// @brief Silence, clipping and DC offset scanner
+class PreflightScanner
+{
+  public:
+	/// @brief Scan result
+	class Result
+	{
+	  public:
+		/// @brief Length in frames
+		std::uint64_t Frames = 0;
+		/// @brief Number of channels, 0 if nothing was scanned
+		unsigned Channels = 0;
+		/// @brief Sample rate in Hz
+		unsigned SampleRate = 0;
+		/// @brief Largest absolute sample value
+		double Peak = 0.0;
+		/// @brief Largest absolute channel mean
+		double DcOffset = 0.0;
+		/// @brief Samples in runs of at least MinClipRun full-scale samples
+		std::uint64_t ClippedSamples = 0;
+		/// @brief Number of such runs
+		std::uint64_t ClipRuns = 0;
+		/// @brief Frames before the first sample above SilenceLevel
+		std::uint64_t LeadingSilence = 0;
+		/// @brief Frames after the last sample above SilenceLevel
+		std::uint64_t TrailingSilence = 0;
+		/// @brief Channels without a sample above SilenceLevel
+		unsigned SilentChannels = 0;
+
+		/// @brief Whether a scan is present
+		bool valid() const
+		{
+			return Channels > 0;
+		}
+
+		/**
+		 * @brief Problems found, in a fixed order
+		 * @return Any of "silence", "silent-channel", "clipping" and "dc-offset"
+		 */
+		std::vector<std::string> findings() const;
+	};
+
+	/**
+	 * @brief Create a scanner
+	 * @param channels Number of channels
+	 * @param sampleRate Sample rate in Hz
+	 */
+	PreflightScanner(unsigned channels, unsigned sampleRate);
+
+	/**
+	 * @brief Feed planar samples
+	 * @param planes One buffer per channel
+	 * @param frames Number of frames
+	 */
+	void process(const float *const *planes, size_t frames);
+
+	/// @brief Result for everything processed so far
+	Result result() const;
+
+	/**
+	 * @brief Scan a whole file
+	 *
+	 * @param filePath Input, read natively if it is a WAV file
+	 * @return Result
+	 * @throws std::runtime_error if the file cannot be read
+	 */
+	static Result scanFile(const std::filesystem::path &filePath);
+
+	/// @brief Samples at or below this level count as silence (one 16-bit step, -90.3 dBFS)
+	static constexpr float SilenceLevel = 1.0f / 32768.0f;
+	/// @brief Samples at or above this level are at full scale (the largest positive 16-bit value)
+	static constexpr float ClipLevel = 32767.0f / 32768.0f;
+	/// @brief Shortest run of full-scale samples that counts as clipping
+	static constexpr std::uint64_t MinClipRun = 3;
+	/// @brief Channel means above this level are a DC offset (-60 dBFS)
+	static constexpr double DcOffsetLimit = 0.001;
+
+  private:
+	/// @brief Number of channels
+	unsigned m_channels;
+	/// @brief Sample rate
+	unsigned m_sampleRate;
+	/// @brief Frames processed
+	std::uint64_t m_frames = 0;
+	/// @brief Peak per channel
+	std::vector<float> m_peaks;
+	/// @brief Sample sum per channel
+	std::vector<double> m_sums;
+	/// @brief Length of the current full-scale run per channel
+	std::vector<std::uint64_t> m_runs;
+	/// @brief Samples in completed clipping runs
+	std::uint64_t m_clipped = 0;
+	/// @brief Completed clipping runs
+	std::uint64_t m_clipRuns = 0;
+	/// @brief First frame with a sample above the silence level
+	std::uint64_t m_firstSound = std::numeric_limits<std::uint64_t>::max();
+	/// @brief Frame after the last frame with a sample above the silence level
+	std::uint64_t m_endSound = 0;
+};
@@ -0,0 +1,189 @@
+/**
+ * @file SegmentEncoder.cpp
+ * @brief Implementation of the segment planner and the elementary stream joiner
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "SegmentEncoder.h"
+#include "MappedFile.h"
+#include "Subprocess.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+/// @brief Shortest segment in frames; shorter inputs get fewer segments
+static constexpr std::uint64_t minSegmentFrames = 256;
+
+/// @brief Length of the MPEG-1/2/2.5 Layer III frame at @p p, 0 if there is none
+static size_t mp3FrameLength(const std::uint8_t *p, size_t available)
+{
+	if (available < 4 || p[0] != 0xFF || (p[1] & 0xE0) != 0xE0)
+		return 0;
+	const unsigned version = (p[1] >> 3) & 3; // 0: MPEG-2.5, 2: MPEG-2, 3: MPEG-1
+	const unsigned layer = (p[1] >> 1) & 3;   // 1: Layer III
+	const unsigned bitrateIndex = p[2] >> 4, rateIndex = (p[2] >> 2) & 3, padding = (p[2] >> 1) & 1;
+	if (version == 1 || layer != 1 || bitrateIndex == 0 || bitrateIndex == 15 || rateIndex == 3)
+		return 0;
+
+	static constexpr std::array<unsigned, 15> mpeg1 = {0,   32,  40,  48,  56,  64,  80, 96,
+	                                                   112, 128, 160, 192, 224, 256, 320};
+	static constexpr std::array<unsigned, 15> mpeg2 = {0,  8,  16, 24,  32,  40,  48, 56,
+	                                                   64, 80, 96, 112, 128, 144, 160};
+	static constexpr std::array<unsigned, 3>  rates = {44100, 48000, 32000};
+	const unsigned rate = rates[rateIndex] >> (version == 3 ? 0 : version == 2 ? 1 : 2);
+	const unsigned bitrate = (version == 3 ? mpeg1 : mpeg2)[bitrateIndex] * 1000;
+	return (version == 3 ? 144 : 72) * bitrate / rate + padding;
+}
+
+/// @brief Length of the single-block ADTS frame at @p p, 0 if there is none
+static size_t adtsFrameLength(const std::uint8_t *p, size_t available)
+{
+	if (available < 7 || p[0] != 0xFF || (p[1] & 0xF6) != 0xF0 || (p[6] & 3) != 0)
+		return 0;
+	size_t length = (static_cast<size_t>(p[3] & 3) << 11) | (static_cast<size_t>(p[4]) << 3) | (p[5] >> 5);
+	return length >= 7 ? length : 0;
+}
+
+/// @brief Whether an MP3 frame is a Xing, Info or VBRI header instead of audio
+static bool isMp3InfoFrame(const std::uint8_t *p, size_t length)
+{
+	const size_t end = std::min<size_t>(length, 64);
+	for (size_t i = 4; i + 4 <= end; ++i)
+		if (std::memcmp(p + i, "Xing", 4) == 0 || std::memcmp(p + i, "Info", 4) == 0 ||
+		    std::memcmp(p + i, "VBRI", 4) == 0)
+			return true;
+	return false;
+}
+
+std::optional<SegmentEncoder::Codec> SegmentEncoder::find(std::string_view codec, unsigned sampleRate)
+{
+	// LAME delays by 576 samples in the encoder and 529 in the decoder; without the bit reservoir no frame
+	// borrows bytes from the frame before it, so frames can be dropped and joined
+	if (codec == "libmp3lame")
+		return Codec{"mp3", sampleRate >= 32000 ? 1152u : 576u, 1105, "-write_xing 0 -id3v2_version 0 -reservoir 0"};
+	// ffmpeg's AAC encoder primes with one frame
+	if (codec == "aac")
+		return Codec{"adts", 1024, 1024, ""};
+	return std::nullopt;
+}
+
+std::vector<SegmentEncoder::Segment> SegmentEncoder::plan(std::uint64_t frames, unsigned count, const Codec &codec)
+{
+	const std::uint64_t size = codec.FrameSize, delay = codec.Delay;
+	// Frames encoded ahead of a boundary: the priming, then two more for encoder and decoder state to settle
+	const std::uint64_t lead = (delay + size - 1) / size + 2;
+	// Samples encoded behind a boundary, so the last kept frames see the audio that follows
+	const std::uint64_t overlap = 2 * size;
+
+	// Segments are whole frames long, so every boundary falls on a frame of each neighbour
+	std::uint64_t length = (frames / std::max(count, 1u) + size - 1) / size * size;
+	length = std::max(length, std::max(lead, minSegmentFrames) * size);
+
+	std::vector<Segment> segments;
+	for (std::uint64_t k = 0;; ++k)
+	{
+		// Segment k keeps the decoded samples [k * length, (k + 1) * length), the input lags them by the delay
+		Segment segment;
+		if (k > 0)
+		{
+			segment.First = k * length - delay - (lead * size - delay);
+			segment.Skip = lead;
+		}
+		std::uint64_t next = (k + 1) * length - delay;
+		if (k + 1 >= count || next + length / 2 >= frames)
+		{
+			segment.Last = frames;
+			segments.push_back(segment);
+			return segments;
+		}
+		segment.Last = next + overlap;
+		segment.Keep = length / size;
+		segments.push_back(segment);
+	}
+}
+
+void SegmentEncoder::join(const std::vector<std::filesystem::path> &files, const std::vector<Segment> &segments,
+                          const Codec &codec, const std::filesystem::path &output)
+{
+	if (files.size() != segments.size())
+		throw std::runtime_error("Segment count mismatch");
+	const bool    mp3 = codec.Format == "mp3";
+	std::ofstream out(output, std::ios::binary | std::ios::trunc);
+	if (!out)
+		throw std::runtime_error("Failed to open " + output.string());
+
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		const Segment &segment = segments[i];
+		MappedFile     file;
+		if (!file.open(files[i]))
+			throw std::runtime_error("Failed to open " + files[i].string());
+		const std::uint8_t *data = file.data();
+		const size_t        size = file.size();
+
+		size_t pos = 0;
+		if (size >= 10 && std::memcmp(data, "ID3", 3) == 0)
+			pos = 10 + ((data[6] & 0x7Fu) << 21 | (data[7] & 0x7Fu) << 14 | (data[8] & 0x7Fu) << 7 | (data[9] & 0x7Fu));
+
+		// An encode holds at least the input and the priming
+		const std::uint64_t end =
+		    segment.Keep ? segment.Skip + segment.Keep : std::numeric_limits<std::uint64_t>::max();
+		const std::uint64_t needed = segment.Keep ? end
+		                                          : (segment.Last - segment.First + codec.Delay + codec.FrameSize - 1) /
+		                                                codec.FrameSize;
+		std::uint64_t       index = 0;
+		size_t              keepFrom = 0;
+		for (bool first = true; pos < size && index < end; first = false)
+		{
+			size_t length = mp3 ? mp3FrameLength(data + pos, size - pos) : adtsFrameLength(data + pos, size - pos);
+			if (length == 0 || length > size - pos)
+				break; // trailing tags
+			if (!(first && mp3 && isMp3InfoFrame(data + pos, length)))
+			{
+				if (index == segment.Skip)
+					keepFrom = pos;
+				++index;
+			}
+			pos += length;
+		}
+		if (index < needed || index <= segment.Skip)
+			throw std::runtime_error("Segment is shorter than planned: " + files[i].string());
+		out.write(reinterpret_cast<const char *>(data + keepFrom), static_cast<std::streamsize>(pos - keepFrom));
+	}
+
+	out.close();
+	if (!out)
+		throw std::runtime_error("Failed to write " + output.string());
+}
+
+std::vector<int> SegmentEncoder::encode(size_t count, unsigned parallel,
+                                        const std::function<int(size_t)> &encodeSegment)
+{
+	std::vector<int>   status(count);
+	Subprocess::Group *group = Subprocess::current();
+	ThreadPool         encoders(parallel);
+	encoders.parallelFor(count, [&](size_t i) {
+		Subprocess::Scope scope(group);
+		status[i] = encodeSegment(i);
+	});
+	return status;
+}
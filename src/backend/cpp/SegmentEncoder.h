@@ -0,0 +1,121 @@
+/**
+ * @file SegmentEncoder.h
+ * @brief Planning and joining of segment-parallel MP3 and AAC encodes.
+ *
+ * A long input is cut into overlapping segments that are encoded on their
+ * own, one encoder per core. Segment boundaries are placed on codec frame
+ * boundaries of the decoded stream: every segment but the first starts a
+ * few frames early, so the frames kept from it were encoded with the audio
+ * before them, and every segment but the last ends a few frames late. The
+ * encoder delay (priming) and the overlap are then cut away at whole frames
+ * and the elementary streams (raw MP3 frames or ADTS) are joined without
+ * decoding.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * auto codec = SegmentEncoder::find("libmp3lame", 44100);
+ * auto segments = SegmentEncoder::plan(frames, 8, *codec);
+ * // encode segment i, frames [First, Last) of the input, to files[i]
+ * SegmentEncoder::join(files, segments, *codec, "joined.mp3");
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @brief Segment-parallel encoding helpers
+class SegmentEncoder
+{
+  public:
+	/// @brief Frame layout of an encoder
+	class Codec
+	{
+	  public:
+		/// @brief Elementary stream format as named by ffmpeg ("mp3" or "adts")
+		std::string Format;
+		/// @brief Samples per frame
+		unsigned FrameSize = 0;
+		/// @brief Encoder delay in samples
+		unsigned Delay = 0;
+		/// @brief ffmpeg output options that keep the frames of a segment independent and the stream raw
+		std::string Options;
+	};
+
+	/// @brief Part of the input encoded on its own
+	class Segment
+	{
+	  public:
+		/// @brief First input frame of the segment
+		std::uint64_t First = 0;
+		/// @brief Input frame behind the segment
+		std::uint64_t Last = 0;
+		/// @brief Encoded frames dropped at the start (priming and overlap)
+		std::uint64_t Skip = 0;
+		/// @brief Encoded frames kept after those, 0 to keep the rest of the stream
+		std::uint64_t Keep = 0;
+	};
+
+	/**
+	 * @brief Frame layout of an ffmpeg encoder
+	 * @param codec Encoder name
+	 * @param sampleRate Sample rate of the input
+	 * @return The layout, or nothing if the encoder cannot be encoded in segments
+	 */
+	static std::optional<Codec> find(std::string_view codec, unsigned sampleRate);
+
+	/**
+	 * @brief Cut an input into segments
+	 * @param frames Input length in frames
+	 * @param count Number of segments wanted; fewer are planned if the input is short
+	 * @param codec Encoder layout
+	 * @return Segments in order
+	 */
+	static std::vector<Segment> plan(std::uint64_t frames, unsigned count, const Codec &codec);
+
+	/**
+	 * @brief Join the encoded segments into one elementary stream
+	 * @param files Encoded segments in the order of @p segments
+	 * @param segments Segments as planned by plan()
+	 * @param codec Encoder layout
+	 * @param output File to write
+	 * @throws std::runtime_error if a segment is damaged or shorter than planned
+	 */
+	static void join(const std::vector<std::filesystem::path> &files, const std::vector<Segment> &segments,
+	                 const Codec &codec, const std::filesystem::path &output);
+
+	/**
+	 * @brief Encode the segments on threads of their own
+	 *
+	 * The threads start their processes in the caller's process group (Subprocess::current()),
+	 * so pausing, pinning and killing the job reach every segment encode.
+	 *
+	 * @param count Number of segments
+	 * @param parallel Segments encoded at once
+	 * @param encodeSegment Encodes segment i and returns the exit status
+	 * @return Exit status of every segment
+	 * @throws The first exception thrown by @p encodeSegment
+	 */
+	static std::vector<int> encode(size_t count, unsigned parallel, const std::function<int(size_t)> &encodeSegment);
+};
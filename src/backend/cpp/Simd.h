@@ -0,0 +1,94 @@
+/**
+ * @file Simd.h
+ * @brief SIMD instruction set selection and runtime CPU feature checks.
+ *
+ * The library is built for the baseline of each architecture (SSE2 on x86-64,
+ * NEON on AArch64). Kernels for newer extensions are compiled per function
+ * with MU_TARGET_* and selected at run time through the cpuHas* checks.
+ *
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MU_SIMD_SSE2 1
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <smmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define MU_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(MU_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+/// @brief Compile a function for SSSE3
+#define MU_TARGET_SSSE3 __attribute__((target("ssse3")))
+/// @brief Compile a function for SSE4.1
+#define MU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#else
+/// @brief Compile a function for SSSE3
+#define MU_TARGET_SSSE3
+/// @brief Compile a function for SSE4.1
+#define MU_TARGET_SSE41
+#endif
+
+/**
+ * @brief Check for SSSE3 support
+ * @return true if SSSE3 kernels may be used
+ */
+inline bool cpuHasSsse3()
+{
+#if defined(MU_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+	static const bool has = __builtin_cpu_supports("ssse3");
+	return has;
+#elif defined(MU_SIMD_SSE2)
+	static const bool has = [] {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+	}();
+	return has;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @brief Check for SSE4.1 support
+ * @return true if SSE4.1 kernels may be used
+ */
+inline bool cpuHasSse41()
+{
+#if defined(MU_SIMD_SSE2) && (defined(__GNUC__) || defined(__clang__))
+	static const bool has = __builtin_cpu_supports("sse4.1");
+	return has;
+#elif defined(MU_SIMD_SSE2)
+	static const bool has = [] {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 19)) != 0;
+	}();
+	return has;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,165 @@
+/**
+ * @file SpscRing.h
+ * @brief Lock-free single-producer, single-consumer ring buffer.
+ *
+ * The producer only writes the head index and the consumer only writes the
+ * tail index, so neither side ever takes a lock. A side that has to wait
+ * spins briefly, then yields, then sleeps, so a stage waiting on a slow
+ * encoder does not keep a core busy.
+ *
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/// @brief Bounded lock-free queue between exactly one producer and one consumer thread
+template <typename T> class SpscRing
+{
+  public:
+	/**
+	 * @brief Create a ring
+	 * @param capacity Minimum number of elements, rounded up to a power of two
+	 */
+	explicit SpscRing(size_t capacity)
+	    : m_data(std::bit_ceil(std::max<size_t>(capacity, 2))), m_mask(m_data.size() - 1)
+	{
+	}
+
+	/**
+	 * @brief Append elements, waiting for room as needed (producer)
+	 * @param data Elements
+	 * @param count Number of elements
+	 * @return false if the ring was cancelled before everything was written
+	 */
+	bool write(const T *data, size_t count)
+	{
+		Backoff backoff;
+		while (count > 0)
+		{
+			if (m_cancelled.load(std::memory_order_acquire))
+				return false;
+			size_t head = m_head.load(std::memory_order_relaxed);
+			size_t space = m_data.size() - (head - m_tail.load(std::memory_order_acquire));
+			if (space == 0)
+			{
+				backoff.pause();
+				continue;
+			}
+
+			size_t n = std::min(space, count);
+			size_t offset = head & m_mask;
+			size_t first = std::min(n, m_data.size() - offset);
+			std::copy_n(data, first, m_data.data() + offset);
+			std::copy_n(data + first, n - first, m_data.data());
+			m_head.store(head + n, std::memory_order_release);
+			data += n;
+			count -= n;
+			backoff.reset();
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Take elements, waiting until at least @p multiple are available (consumer)
+	 * @param data Destination
+	 * @param count Capacity of the destination, at least @p multiple
+	 * @param multiple The number of elements taken is a multiple of this, e.g. the channel count
+	 * @return Number of elements taken, 0 once the ring is closed and drained or cancelled
+	 */
+	size_t read(T *data, size_t count, size_t multiple = 1)
+	{
+		Backoff backoff;
+		for (;;)
+		{
+			if (m_cancelled.load(std::memory_order_acquire))
+				return 0;
+			// Closed is published after the last head update, so read it first
+			bool   closed = m_closed.load(std::memory_order_acquire);
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			size_t available = m_head.load(std::memory_order_acquire) - tail;
+			if (available >= multiple)
+			{
+				size_t n = std::min(available, count);
+				n -= n % multiple;
+				size_t offset = tail & m_mask;
+				size_t first = std::min(n, m_data.size() - offset);
+				std::copy_n(m_data.data() + offset, first, data);
+				std::copy_n(m_data.data(), n - first, data + first);
+				m_tail.store(tail + n, std::memory_order_release);
+				return n;
+			}
+			if (closed)
+				return 0;
+			backoff.pause();
+		}
+	}
+
+	/// @brief Mark the end of the stream (producer)
+	void close()
+	{
+		m_closed.store(true, std::memory_order_release);
+	}
+
+	/// @brief Abort both sides, e.g. after an error
+	void cancel()
+	{
+		m_cancelled.store(true, std::memory_order_release);
+	}
+
+  private:
+	/// @brief Spin, then yield, then sleep
+	class Backoff
+	{
+	  public:
+		void pause()
+		{
+			if (m_rounds >= 128)
+				std::this_thread::sleep_for(std::chrono::microseconds(50));
+			else if (m_rounds >= 64)
+				std::this_thread::yield();
+			++m_rounds;
+		}
+		void reset()
+		{
+			m_rounds = 0;
+		}
+
+	  private:
+		unsigned m_rounds = 0;
+	};
+
+	/// @brief Elements
+	std::vector<T> m_data;
+	/// @brief Capacity - 1
+	size_t m_mask;
+	/// @brief Elements written, owned by the producer
+	alignas(64) std::atomic<size_t> m_head{0};
+	/// @brief Elements read, owned by the consumer
+	alignas(64) std::atomic<size_t> m_tail{0};
+	/// @brief Set by the producer after the last write
+	alignas(64) std::atomic<bool> m_closed{false};
+	/// @brief Set to abort
+	std::atomic<bool> m_cancelled{false};
+};
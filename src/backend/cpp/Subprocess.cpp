@@ -0,0 +1,353 @@
+/**
+ * @file Subprocess.cpp
+ * @brief Encoder processes connected by a pipe, which can be paused and deprioritized.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Subprocess.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+/// @brief Group of the calling thread
+static thread_local Subprocess::Group *t_group = nullptr;
+
+Subprocess::Scope::Scope(Group *group) : m_previous(t_group)
+{
+	t_group = group;
+}
+
+Subprocess::Scope::~Scope()
+{
+	t_group = m_previous;
+}
+
+Subprocess::Group *Subprocess::current()
+{
+	return t_group;
+}
+
+#ifdef _WIN32
+Subprocess::SigPipeGuard::SigPipeGuard()
+{
+}
+
+Subprocess::SigPipeGuard::~SigPipeGuard()
+{
+}
+#else
+Subprocess::SigPipeGuard::SigPipeGuard()
+{
+	sigset_t pipe, pending;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	m_pending = sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1;
+	pthread_sigmask(SIG_BLOCK, &pipe, &m_previous);
+}
+
+Subprocess::SigPipeGuard::~SigPipeGuard()
+{
+	sigset_t pipe, pending;
+	sigemptyset(&pipe);
+	sigaddset(&pipe, SIGPIPE);
+	int signal;
+	if (!m_pending && sigpending(&pending) == 0 && sigismember(&pending, SIGPIPE) == 1)
+		sigwait(&pipe, &signal);
+	pthread_sigmask(SIG_SETMASK, &m_previous, nullptr);
+}
+#endif
+
+std::string Subprocess::quote(const std::string &value)
+{
+	std::string quoted = "\"";
+	quoted.reserve(value.size() + 2);
+#ifdef _WIN32
+	// Backslashes are only special in front of a quote, where each of them is doubled
+	size_t backslashes = 0;
+	for (char c : value)
+	{
+		if (c == '\\')
+			++backslashes;
+		else
+		{
+			if (c == '"')
+				quoted.append(backslashes + 1, '\\');
+			backslashes = 0;
+		}
+		quoted += c;
+	}
+	quoted.append(backslashes, '\\');
+#else
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\' || c == '$' || c == '`')
+			quoted += '\\';
+		quoted += c;
+	}
+#endif
+	return quoted + "\"";
+}
+
+void Subprocess::Group::pin(std::vector<int> cpus)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_cpus = std::move(cpus);
+}
+
+#ifdef _WIN32
+
+void Subprocess::Group::signal(int)
+{
+}
+
+void Subprocess::Group::pause()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_paused = true;
+}
+
+void Subprocess::Group::resume()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_paused = false;
+}
+
+void Subprocess::Group::deprioritize(int nice)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_nice = std::max(m_nice, nice);
+}
+
+void Subprocess::Group::kill()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_killed = true;
+}
+
+Subprocess::Subprocess(const std::string &command, Mode mode)
+{
+	m_stream = _popen(command.c_str(), mode == Mode::Read ? "rb" : "wb");
+	if (!m_stream)
+		throw std::runtime_error("Failed to start: " + command);
+}
+
+int Subprocess::close()
+{
+	if (!m_stream)
+		return -1;
+	int status = _pclose(m_stream);
+	m_stream = nullptr;
+	return status;
+}
+
+#else // !_WIN32
+
+void Subprocess::Group::signal(int signal)
+{
+	for (long pid : m_processes)
+		::kill(static_cast<pid_t>(pid), signal);
+}
+
+void Subprocess::Group::pause()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_paused)
+		return;
+	m_paused = true;
+	signal(SIGSTOP);
+}
+
+void Subprocess::Group::resume()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_paused)
+		return;
+	m_paused = false;
+	signal(SIGCONT);
+}
+
+void Subprocess::Group::deprioritize(int nice)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (nice <= m_nice)
+		return;
+	m_nice = nice;
+	for (long pid : m_processes)
+		setpriority(PRIO_PROCESS, static_cast<id_t>(pid), m_nice);
+}
+
+void Subprocess::Group::kill()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_killed = true;
+	signal(SIGKILL);
+}
+
+Subprocess::Subprocess(const std::string &command, Mode mode)
+{
+	int fds[2];
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		throw std::runtime_error("Failed to create a pipe");
+#else
+	if (pipe(fds) != 0)
+		throw std::runtime_error("Failed to create a pipe");
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#endif
+	const int ours = mode == Mode::Read ? fds[0] : fds[1];
+	const int theirs = mode == Mode::Read ? fds[1] : fds[0];
+
+	// Only the child's end becomes its standard input or output; the caller may ignore or block SIGPIPE, the child
+	// must not
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, theirs, mode == Mode::Read ? STDOUT_FILENO : STDIN_FILENO);
+	posix_spawnattr_t attributes;
+	posix_spawnattr_init(&attributes);
+	sigset_t defaults, mask;
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attributes, &defaults);
+	pthread_sigmask(SIG_BLOCK, nullptr, &mask);
+	sigdelset(&mask, SIGPIPE);
+	posix_spawnattr_setsigmask(&attributes, &mask);
+	posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+	const std::string line = "exec " + command;
+	char              shell[] = "/bin/sh", option[] = "-c";
+	char             *argv[] = {shell, option, const_cast<char *>(line.c_str()), nullptr};
+	pid_t             pid = -1;
+
+#ifdef __linux__
+	// The child inherits the affinity of the spawning thread, which takes the group's CPUs for the spawn
+	cpu_set_t previous, pinned;
+	bool      pinning = false;
+	if (t_group)
+	{
+		std::lock_guard<std::mutex> lock(t_group->m_mutex);
+		CPU_ZERO(&pinned);
+		for (int cpu : t_group->m_cpus)
+			if (cpu >= 0 && cpu < CPU_SETSIZE)
+				CPU_SET(cpu, &pinned);
+		pinning = CPU_COUNT(&pinned) > 0 && sched_getaffinity(0, sizeof(previous), &previous) == 0 &&
+		          sched_setaffinity(0, sizeof(pinned), &pinned) == 0;
+	}
+#endif
+	const int error = posix_spawn(&pid, "/bin/sh", &actions, &attributes, argv, environ);
+#ifdef __linux__
+	if (pinning)
+		sched_setaffinity(0, sizeof(previous), &previous);
+#endif
+	posix_spawnattr_destroy(&attributes);
+	posix_spawn_file_actions_destroy(&actions);
+	::close(theirs);
+	if (error != 0)
+	{
+		::close(ours);
+		throw std::runtime_error("Failed to start: " + command);
+	}
+	m_pid = pid;
+
+	m_stream = fdopen(ours, mode == Mode::Read ? "r" : "w");
+	if (!m_stream)
+	{
+		::close(ours);
+		close();
+		throw std::runtime_error("Failed to open the pipe of: " + command);
+	}
+
+	// A process that starts while its group is paused waits with the others, one of a killed group dies at once
+	m_group = t_group;
+	if (m_group)
+	{
+		std::lock_guard<std::mutex> lock(m_group->m_mutex);
+		m_group->m_processes.push_back(m_pid);
+		if (m_group->m_nice > 0)
+			setpriority(PRIO_PROCESS, static_cast<id_t>(m_pid), m_group->m_nice);
+		if (m_group->m_killed)
+			::kill(pid, SIGKILL);
+		else if (m_group->m_paused)
+			::kill(pid, SIGSTOP);
+	}
+}
+
+int Subprocess::close()
+{
+	if (m_pid < 0)
+		return -1;
+	if (m_stream)
+		std::fclose(m_stream);
+	m_stream = nullptr;
+
+	// The process stays in its group until it has exited, so a paused one is still resumed
+	siginfo_t info;
+	while (waitid(P_PID, static_cast<id_t>(m_pid), &info, WEXITED | WNOWAIT) != 0 && errno == EINTR)
+	{
+	}
+	if (m_group)
+	{
+		std::lock_guard<std::mutex> lock(m_group->m_mutex);
+		std::erase(m_group->m_processes, m_pid);
+	}
+	int status = -1;
+	while (waitpid(static_cast<pid_t>(m_pid), &status, 0) < 0 && errno == EINTR)
+	{
+	}
+	m_pid = -1;
+	return status;
+}
+
+#endif // _WIN32
+
+Subprocess::~Subprocess()
+{
+	close();
+}
+
+bool Subprocess::Group::paused() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_paused;
+}
+
+bool Subprocess::Group::killed() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_killed;
+}
+
+size_t Subprocess::Group::size() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_processes.size();
+}
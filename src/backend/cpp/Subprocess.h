@@ -0,0 +1,227 @@
+/**
+ * @file Subprocess.h
+ * @brief Encoder processes connected by a pipe, which can be paused and deprioritized.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <csignal>
+#endif
+
+/**
+ * @brief Runs a shell command with its standard input or output connected to a pipe, like popen()
+ *
+ * Unlike popen(), the process ID is known: the command is run with "exec",
+ * so it is the ID of the command itself rather than of a shell, and the
+ * process joins the Group of the thread that starts it. A Group is what
+ * JobScheduler pauses or deprioritizes to make room for other work, what
+ * pins the processes of a job to its CPUs (CpuPlacement) and what its
+ * watchdog kills when a job has hung (Watchdog).
+ *
+ * The command must be a single command, optionally with redirections. On
+ * Windows it is run with _popen() and groups have no effect.
+ */
+class Subprocess
+{
+  public:
+	/// @brief Direction of the pipe, seen from the caller
+	enum class Mode
+	{
+		/// @brief The caller reads the command's standard output
+		Read,
+		/// @brief The caller writes the command's standard input
+		Write
+	};
+
+	/**
+	 * @brief Processes started for one job, possibly from several threads
+	 *
+	 * Processes started while a group is paused start paused as well.
+	 */
+	class Group
+	{
+	  public:
+		/// @brief Pause the processes (SIGSTOP)
+		void pause();
+
+		/// @brief Continue paused processes (SIGCONT)
+		void resume();
+
+		/**
+		 * @brief Lower the scheduling priority of the processes, now and of those started later
+		 *
+		 * The priority cannot be raised again without privileges, so this lasts as long as the processes do.
+		 *
+		 * @param nice Nice value to add, 1 to 19
+		 */
+		void deprioritize(int nice);
+
+		/**
+		 * @brief Run processes started from now on on some CPUs only (Linux)
+		 *
+		 * A process is started with the CPUs as its affinity mask, so it never
+		 * runs elsewhere, not even before its first instruction.
+		 *
+		 * @param cpus CPU numbers, empty for no restriction
+		 */
+		void pin(std::vector<int> cpus);
+
+		/**
+		 * @brief Kill the processes (SIGKILL), now and those started later
+		 *
+		 * Whoever reads or writes their pipes sees the end of the stream, so a
+		 * job blocked on a hung process returns.
+		 */
+		void kill();
+
+		/// @brief Whether pause() was called without resume()
+		bool paused() const;
+
+		/// @brief Whether kill() was called
+		bool killed() const;
+
+		/// @brief Number of running processes
+		size_t size() const;
+
+	  private:
+		friend class Subprocess;
+
+		/// @brief Signal every process
+		void signal(int signal);
+
+		/// @brief IDs of the running processes
+		std::vector<long> m_processes;
+		/// @brief Set by pause()
+		bool m_paused = false;
+		/// @brief Set by kill()
+		bool m_killed = false;
+		/// @brief Nice value added to every process
+		int m_nice = 0;
+		/// @brief CPUs new processes run on, empty for any
+		std::vector<int> m_cpus;
+		/// @brief Guards the group
+		mutable std::mutex m_mutex;
+	};
+
+	/// @brief Makes a group the one that processes started on this thread join, for its lifetime
+	class Scope
+	{
+	  public:
+		/// @param group Group, null for none
+		explicit Scope(Group *group);
+
+		/// @brief Restore the previous group
+		~Scope();
+
+		Scope(const Scope &) = delete;
+		Scope &operator=(const Scope &) = delete;
+
+	  private:
+		/// @brief Group of the thread before
+		Group *m_previous;
+	};
+
+	/**
+	 * @brief Turns SIGPIPE into a write error on this thread, for its lifetime
+	 *
+	 * Writing to a command that has exited raises SIGPIPE, which would end
+	 * the whole process. The signal is blocked on the calling thread only, and
+	 * one raised by a write in the meantime is consumed before the previous
+	 * signal mask is restored, so the process's handling of SIGPIPE is left
+	 * alone. Does nothing on Windows.
+	 */
+	class SigPipeGuard
+	{
+	  public:
+		SigPipeGuard();
+
+		/// @brief Consume a SIGPIPE raised meanwhile and restore the signal mask
+		~SigPipeGuard();
+
+		SigPipeGuard(const SigPipeGuard &) = delete;
+		SigPipeGuard &operator=(const SigPipeGuard &) = delete;
+
+#ifndef _WIN32
+	  private:
+		/// @brief Signal mask of the thread before
+		sigset_t m_previous;
+		/// @brief A SIGPIPE was pending already, so it is not ours to consume
+		bool m_pending = false;
+#endif
+	};
+
+	/// @brief Group that processes started on this thread join, null for none
+	static Group *current();
+
+	/**
+	 * @brief Quote a value as one argument of a command
+	 *
+	 * The value is put in double quotes, with everything escaped that the
+	 * shell (or, on Windows, the program's argument parser) would otherwise
+	 * act on, so it reaches the program unchanged whatever it contains.
+	 *
+	 * @param value Value, such as a tag or a path
+	 * @return Quoted value
+	 */
+	static std::string quote(const std::string &value);
+
+	/**
+	 * @brief Start a command
+	 * @param command Shell command
+	 * @param mode Which end of the pipe the caller gets
+	 * @throws std::runtime_error if the command cannot be started
+	 */
+	Subprocess(const std::string &command, Mode mode);
+
+	/// @brief Close the pipe and wait for the command if close() was not called
+	~Subprocess();
+
+	Subprocess(const Subprocess &) = delete;
+	Subprocess &operator=(const Subprocess &) = delete;
+
+	/// @brief The caller's end of the pipe, null once closed
+	FILE *stream() const
+	{
+		return m_stream;
+	}
+
+	/// @brief Process ID of the command, -1 where it is not known
+	long pid() const
+	{
+		return m_pid;
+	}
+
+	/**
+	 * @brief Close the pipe and wait for the command to exit
+	 * @return Exit status as pclose() returns it, -1 if it was already closed
+	 */
+	int close();
+
+  private:
+	/// @brief The caller's end of the pipe
+	FILE *m_stream = nullptr;
+	/// @brief Process ID
+	long m_pid = -1;
+	/// @brief Group the process joined
+	Group *m_group = nullptr;
+};
@@ -0,0 +1,1349 @@
+/**
+ * @file TagWriter.cpp
+ * @brief Implementation of the native tag writer
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "TagWriter.h"
+#include "MappedFile.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using Field = TagWriter::Field;
+using Tags = TagWriter::Tags;
+
+/// @brief Number of managed fields
+static constexpr size_t fieldCount = static_cast<size_t>(Field::Count);
+
+/// @brief Native names of a managed field
+struct FieldNames
+{
+	/// @brief ID3v2 frame, TXXX frames use the Vorbis name as description
+	const char *ID3;
+	/// @brief Vorbis comment field, also the MP4 freeform and TXXX name
+	const char *Vorbis;
+	/// @brief MP4 ilst item, "----" for a freeform item
+	const char *MP4;
+	/// @brief RIFF INFO chunk, nullptr if INFO has none
+	const char *RIFF;
+};
+
+/// @brief Native names indexed by Field
+static constexpr std::array<FieldNames, fieldCount> fieldNames = {{
+    {"TIT2", "TITLE", "\xA9nam", "INAM"},
+    {"TPE1", "ARTIST", "\xA9" "ART", "IART"},
+    {"TALB", "ALBUM", "\xA9" "alb", "IPRD"},
+    {"TCON", "GENRE", "\xA9gen", "IGNR"},
+    {"TDRC", "DATE", "\xA9" "day", "ICRD"},
+    {"COMM", "DESCRIPTION", "\xA9" "cmt", "ICMT"},
+    {"TCOP", "COPYRIGHT", "cprt", "ICOP"},
+    {"TRCK", "TRACKNUMBER", "trkn", "ITRK"},
+    {"TXXX", "REPLAYGAIN_TRACK_GAIN", "----", nullptr},
+    {"TXXX", "REPLAYGAIN_TRACK_PEAK", "----", nullptr},
+    {"TXXX", "REPLAYGAIN_ALBUM_GAIN", "----", nullptr},
+    {"TXXX", "REPLAYGAIN_ALBUM_PEAK", "----", nullptr},
+}};
+
+/// @brief Vendor string of Vorbis comments created from scratch
+static constexpr std::string_view vendorString = "Daniel's Mastering Utility";
+
+/// @brief Replacement of a byte range of the file
+struct Edit
+{
+	/// @brief Start of the replaced range
+	std::uint64_t Offset;
+	/// @brief Length of the replaced range
+	std::uint64_t Length;
+	/// @brief New bytes
+	std::string Data;
+};
+
+/// @brief Read a big endian 32-bit value
+static std::uint32_t readBE32(const std::uint8_t *p)
+{
+	return (static_cast<std::uint32_t>(p[0]) << 24) | (static_cast<std::uint32_t>(p[1]) << 16) |
+	       (static_cast<std::uint32_t>(p[2]) << 8) | p[3];
+}
+
+/// @brief Read a big endian 64-bit value
+static std::uint64_t readBE64(const std::uint8_t *p)
+{
+	return (static_cast<std::uint64_t>(readBE32(p)) << 32) | readBE32(p + 4);
+}
+
+/// @brief Read a little endian 32-bit value
+static std::uint32_t readLE32(const std::uint8_t *p)
+{
+	return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) |
+	       (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+/// @brief Read a 28-bit ID3v2 syncsafe integer
+static std::uint32_t readSyncsafe(const std::uint8_t *p)
+{
+	return ((p[0] & 0x7Fu) << 21) | ((p[1] & 0x7Fu) << 14) | ((p[2] & 0x7Fu) << 7) | (p[3] & 0x7Fu);
+}
+
+/// @brief Append a big endian value of @p bytes bytes
+static void appendBE(std::string &out, std::uint64_t value, int bytes)
+{
+	for (int i = bytes - 1; i >= 0; --i)
+		out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+/// @brief Append a little endian 32-bit value
+static void appendLE32(std::string &out, std::uint32_t value)
+{
+	for (int i = 0; i < 4; ++i)
+		out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+/// @brief Append a 28-bit ID3v2 syncsafe integer
+static void appendSyncsafe(std::string &out, std::uint32_t value)
+{
+	for (int shift = 21; shift >= 0; shift -= 7)
+		out += static_cast<char>((value >> shift) & 0x7F);
+}
+
+/// @brief Compare ASCII strings ignoring case
+static bool equalsIgnoreCase(std::string_view a, std::string_view b)
+{
+	return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+		       return (x >= 'a' && x <= 'z' ? x - 32 : x) == (y >= 'a' && y <= 'z' ? y - 32 : y);
+	       });
+}
+
+/// @brief Bytes of the mapped file as a string view
+static std::string_view bytes(const std::uint8_t *data, std::uint64_t offset, std::uint64_t length)
+{
+	return std::string_view(reinterpret_cast<const char *>(data) + offset, static_cast<size_t>(length));
+}
+
+/// @brief Decode the next UTF-8 code point, U+FFFD for malformed input
+static char32_t nextCodePoint(std::string_view text, size_t &pos)
+{
+	auto     lead = static_cast<unsigned char>(text[pos++]);
+	int      extra = lead < 0x80 ? 0 : lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : -1;
+	char32_t code = extra == 3 ? lead & 0x07u : extra == 2 ? lead & 0x0Fu : extra == 1 ? lead & 0x1Fu : lead;
+	if (extra < 0)
+		return 0xFFFD;
+	for (int i = 0; i < extra; ++i)
+	{
+		if (pos >= text.size() || (static_cast<unsigned char>(text[pos]) & 0xC0) != 0x80)
+			return 0xFFFD;
+		code = (code << 6) | (static_cast<unsigned char>(text[pos++]) & 0x3F);
+	}
+	return code > 0x10FFFF ? 0xFFFD : code;
+}
+
+/// @brief Append UTF-8 text as UTF-16LE
+static void appendUtf16(std::string &out, std::string_view text)
+{
+	auto unit = [&out](char32_t value) {
+		out += static_cast<char>(value & 0xFF);
+		out += static_cast<char>(value >> 8);
+	};
+	for (size_t pos = 0; pos < text.size();)
+	{
+		char32_t code = nextCodePoint(text, pos);
+		if (code >= 0x10000)
+		{
+			unit(0xD800 + ((code - 0x10000) >> 10));
+			unit(0xDC00 + ((code - 0x10000) & 0x3FF));
+		}
+		else
+			unit(code);
+	}
+}
+
+/// @brief Convert UTF-8 text to Latin-1, characters outside it become '?'
+static std::string toLatin1(std::string_view text)
+{
+	std::string out;
+	for (size_t pos = 0; pos < text.size();)
+	{
+		char32_t code = nextCodePoint(text, pos);
+		out += code < 0x100 ? static_cast<char>(code) : '?';
+	}
+	return out;
+}
+
+/// @brief Parse "track" or "track/total"
+static std::pair<unsigned, unsigned> parseTrack(const std::string &value)
+{
+	unsigned track = 0, total = 0;
+	size_t   pos = 0;
+	for (; pos < value.size() && value[pos] >= '0' && value[pos] <= '9'; ++pos)
+		track = std::min(track * 10 + (value[pos] - '0'), 0xFFFFu);
+	if (pos < value.size() && value[pos] == '/')
+		for (++pos; pos < value.size() && value[pos] >= '0' && value[pos] <= '9'; ++pos)
+			total = std::min(total * 10 + (value[pos] - '0'), 0xFFFFu);
+	return {track, total};
+}
+
+/**
+ * @brief Apply edits to a file
+ *
+ * Edits that keep their length, and a last edit that runs to the end of the
+ * file, are written in place. Anything else rewrites the file into a
+ * temporary file that then replaces it.
+ *
+ * @param filePath File to edit
+ * @param edits Non-overlapping edits
+ * @param fileSize Current size of the file
+ * @return InPlace or Rewritten
+ */
+static TagWriter::Result applyEdits(const std::filesystem::path &filePath, std::vector<Edit> edits,
+                                    std::uint64_t fileSize)
+{
+	std::sort(edits.begin(), edits.end(), [](const Edit &a, const Edit &b) { return a.Offset < b.Offset; });
+
+	bool inPlace = true;
+	for (size_t i = 0; i < edits.size(); ++i)
+	{
+		bool atEnd = i + 1 == edits.size() && edits[i].Offset + edits[i].Length == fileSize;
+		if (edits[i].Data.size() != edits[i].Length && !atEnd)
+			inPlace = false;
+	}
+
+	if (inPlace)
+	{
+		std::fstream file(filePath, std::ios::in | std::ios::out | std::ios::binary);
+		if (!file)
+			throw std::runtime_error("Failed to open " + filePath.string() + " for writing");
+		for (const Edit &edit : edits)
+		{
+			file.seekp(static_cast<std::streamoff>(edit.Offset));
+			file.write(edit.Data.data(), static_cast<std::streamsize>(edit.Data.size()));
+		}
+		file.close();
+		if (!file)
+			throw std::runtime_error("Failed to write " + filePath.string());
+
+		// A last edit at the end of the file may have shrunk it
+		if (!edits.empty() && edits.back().Offset + edits.back().Length == fileSize &&
+		    edits.back().Data.size() < edits.back().Length)
+			std::filesystem::resize_file(filePath, edits.back().Offset + edits.back().Data.size());
+		return TagWriter::Result::InPlace;
+	}
+
+	std::filesystem::path temporary = filePath;
+	temporary += ".tmp";
+	try
+	{
+		std::ifstream source(filePath, std::ios::binary);
+		std::ofstream target(temporary, std::ios::binary | std::ios::trunc);
+		if (!source || !target)
+			throw std::runtime_error("Failed to open " + filePath.string() + " for rewriting");
+
+		std::vector<char> buffer(1 << 20);
+		std::uint64_t     position = 0;
+		auto              copyTo = [&](std::uint64_t end) {
+			while (position < end)
+			{
+				auto chunk = static_cast<std::streamsize>(std::min<std::uint64_t>(buffer.size(), end - position));
+				if (!source.read(buffer.data(), chunk))
+					throw std::runtime_error("Failed to read " + filePath.string());
+				target.write(buffer.data(), chunk);
+				position += static_cast<std::uint64_t>(chunk);
+			}
+		};
+
+		for (const Edit &edit : edits)
+		{
+			copyTo(edit.Offset);
+			target.write(edit.Data.data(), static_cast<std::streamsize>(edit.Data.size()));
+			position = edit.Offset + edit.Length;
+			source.seekg(static_cast<std::streamoff>(position));
+		}
+		copyTo(fileSize);
+
+		target.close();
+		if (!target)
+			throw std::runtime_error("Failed to write " + temporary.string());
+	}
+	catch (...)
+	{
+		std::error_code ec;
+		std::filesystem::remove(temporary, ec);
+		throw;
+	}
+
+	std::filesystem::rename(temporary, filePath);
+	return TagWriter::Result::Rewritten;
+}
+
+/// @brief Whether a Vorbis comment belongs to a managed field
+static bool managedVorbisComment(std::string_view comment)
+{
+	std::string_view name = comment.substr(0, comment.find('='));
+	if (equalsIgnoreCase(name, "COMMENT"))
+		return true;
+	for (const auto &names : fieldNames)
+		if (equalsIgnoreCase(name, names.Vorbis))
+			return true;
+	return false;
+}
+
+/**
+ * @brief Parse a Vorbis comment list
+ *
+ * @param data Start of the vendor string length
+ * @param size Bytes available
+ * @param[out] vendor Vendor string
+ * @param[out] kept Comments of unmanaged fields
+ * @return Number of bytes the list occupies
+ */
+static size_t readVorbisComments(const std::uint8_t *data, size_t size, std::string &vendor,
+                                 std::vector<std::string_view> &kept)
+{
+	auto field = [&](size_t &pos) {
+		if (pos + 4 > size || readLE32(data + pos) > size - pos - 4)
+			throw std::runtime_error("Damaged Vorbis comment");
+		std::uint32_t length = readLE32(data + pos);
+		pos += 4 + length;
+		return bytes(data, pos - length, length);
+	};
+
+	size_t pos = 0;
+	vendor = field(pos);
+	if (pos + 4 > size)
+		throw std::runtime_error("Damaged Vorbis comment");
+	std::uint32_t count = readLE32(data + pos);
+	pos += 4;
+	for (std::uint32_t i = 0; i < count; ++i)
+	{
+		std::string_view comment = field(pos);
+		if (!managedVorbisComment(comment))
+			kept.push_back(comment);
+	}
+	return pos;
+}
+
+/// @brief Append a Vorbis comment list with the kept comments and the managed tags
+static void appendVorbisComments(std::string &out, std::string_view vendor, const std::vector<std::string_view> &kept,
+                                 const Tags &tags)
+{
+	std::vector<std::string> comments(kept.begin(), kept.end());
+	for (size_t i = 0; i < fieldCount; ++i)
+		if (!tags[i].empty())
+			comments.push_back(std::string(fieldNames[i].Vorbis) + "=" + tags[i]);
+
+	appendLE32(out, static_cast<std::uint32_t>(vendor.size()));
+	out += vendor;
+	appendLE32(out, static_cast<std::uint32_t>(comments.size()));
+	for (const auto &comment : comments)
+	{
+		appendLE32(out, static_cast<std::uint32_t>(comment.size()));
+		out += comment;
+	}
+}
+
+/// @brief Decode the first string of an ID3v2 frame payload far enough to compare it with ASCII names
+static std::string id3Description(const std::uint8_t *p, size_t size, std::uint8_t encoding)
+{
+	std::string out;
+	bool        wide = encoding == 1 || encoding == 2;
+	size_t      pos = 0;
+	if (wide && size >= 2 && ((p[0] == 0xFF && p[1] == 0xFE) || (p[0] == 0xFE && p[1] == 0xFF)))
+		pos = 2;
+	bool bigEndian = encoding == 2 || (pos == 2 && p[0] == 0xFE);
+	for (; wide ? pos + 1 < size : pos < size; pos += wide ? 2 : 1)
+	{
+		std::uint8_t c = wide ? p[pos + (bigEndian ? 1 : 0)] : p[pos];
+		if (c == 0 && (!wide || p[pos + (bigEndian ? 0 : 1)] == 0))
+			break;
+		out += static_cast<char>(c);
+	}
+	return out;
+}
+
+/// @brief Whether an ID3v2 frame belongs to a managed field
+static bool managedId3Frame(const std::uint8_t *frame, std::uint32_t size)
+{
+	std::string_view id = bytes(frame, 0, 4);
+	const std::uint8_t *payload = frame + 10;
+
+	if (id == "TYER")
+		return true;
+	if (id == "COMM")
+		return size < 4 || id3Description(payload + 4, size - 4, payload[0]).empty();
+	if (id == "TXXX")
+	{
+		std::string description = size < 1 ? "" : id3Description(payload + 1, size - 1, payload[0]);
+		if (equalsIgnoreCase(description, "comment"))
+			return true;
+		for (const auto &names : fieldNames)
+			if (std::string_view(names.ID3) == "TXXX" && equalsIgnoreCase(description, names.Vorbis))
+				return true;
+		return false;
+	}
+	for (const auto &names : fieldNames)
+		if (id == names.ID3)
+			return true;
+	return false;
+}
+
+/// @brief Append an ID3v2 text, comment or user text frame
+static void appendId3Frame(std::string &out, unsigned version, std::string_view id, std::string_view description,
+                           std::string_view value)
+{
+	bool ascii = std::all_of(description.begin(), description.end(), [](char c) { return c >= 0; }) &&
+	             std::all_of(value.begin(), value.end(), [](char c) { return c >= 0; });
+	// ID3v2.4 stores UTF-8, ID3v2.3 only knows Latin-1 and UTF-16
+	char encoding = version == 4 ? 3 : ascii ? 0 : 1;
+
+	auto text = [&](std::string &payload, std::string_view string, bool terminate) {
+		if (encoding == 1)
+		{
+			payload += "\xFF\xFE";
+			appendUtf16(payload, string);
+			if (terminate)
+				payload.append(2, '\0');
+		}
+		else
+		{
+			payload += string;
+			if (terminate)
+				payload += '\0';
+		}
+	};
+
+	std::string payload(1, encoding);
+	if (id == "COMM")
+	{
+		payload += "eng";
+		text(payload, "", true);
+	}
+	else if (id == "TXXX")
+		text(payload, description, true);
+	text(payload, value, false);
+
+	out += id;
+	if (version == 4)
+		appendSyncsafe(out, static_cast<std::uint32_t>(payload.size()));
+	else
+		appendBE(out, payload.size(), 4);
+	out.append(2, '\0');
+	out += payload;
+}
+
+/// @brief Edits for an MP3 file: ID3v2 at the start, ID3v1 at the end if present
+static bool id3Edits(const std::uint8_t *data, std::uint64_t size, const Tags &tags, std::vector<Edit> &edits)
+{
+	unsigned      version = 4;
+	std::uint64_t tagSize = 0;
+	std::string   frames;
+
+	if (size >= 10 && std::memcmp(data, "ID3", 3) == 0)
+	{
+		version = data[3];
+		std::uint8_t flags = data[5];
+		// ID3v2.2 uses a different frame layout; unsynchronised tags and footers are rare enough to re-encode
+		if (version < 3 || version > 4 || (flags & 0x80) || (flags & 0x10))
+			return false;
+
+		tagSize = 10 + static_cast<std::uint64_t>(readSyncsafe(data + 6));
+		if (tagSize > size)
+			throw std::runtime_error("Truncated ID3v2 tag");
+
+		std::uint64_t pos = 10;
+		if (flags & 0x40)
+			pos += version == 3 ? 4 + readBE32(data + 10) : readSyncsafe(data + 10);
+
+		while (pos + 10 <= tagSize && data[pos] != 0)
+		{
+			std::uint32_t frameSize = version == 4 ? readSyncsafe(data + pos + 4) : readBE32(data + pos + 4);
+			if (frameSize > tagSize - pos - 10)
+				throw std::runtime_error("Damaged ID3v2 frame");
+			if (!managedId3Frame(data + pos, frameSize))
+				frames += bytes(data, pos, 10 + frameSize);
+			pos += 10 + frameSize;
+		}
+	}
+
+	for (size_t i = 0; i < fieldCount; ++i)
+	{
+		if (tags[i].empty())
+			continue;
+		std::string_view id = fieldNames[i].ID3;
+		if (i == static_cast<size_t>(Field::Date) && version == 3)
+			id = "TYER";
+		appendId3Frame(frames, version, id, fieldNames[i].Vorbis, tags[i]);
+	}
+
+	std::uint64_t needed = 10 + frames.size();
+	std::uint64_t total = needed <= tagSize ? tagSize : needed + TagWriter::Padding;
+	if (total - 10 >= (1u << 28))
+		throw std::runtime_error("ID3v2 tag too large");
+
+	std::string tag = "ID3";
+	tag += static_cast<char>(version);
+	tag.append(2, '\0');
+	appendSyncsafe(tag, static_cast<std::uint32_t>(total - 10));
+	tag += frames;
+	tag.resize(static_cast<size_t>(total), '\0');
+	edits.push_back({0, tagSize, std::move(tag)});
+
+	// Keep an existing ID3v1 tag in line with the new values
+	if (size >= tagSize + 128 && std::memcmp(data + size - 128, "TAG", 3) == 0)
+	{
+		auto fixed = [&tags](std::string &out, Field field, size_t length) {
+			std::string value = toLatin1(tags[static_cast<size_t>(field)]);
+			value.resize(length, '\0');
+			out += value;
+		};
+
+		std::string v1 = "TAG";
+		fixed(v1, Field::Title, 30);
+		fixed(v1, Field::Artist, 30);
+		fixed(v1, Field::Album, 30);
+		fixed(v1, Field::Date, 4);
+		fixed(v1, Field::Comment, 28);
+		v1 += '\0';
+		v1 += static_cast<char>(std::min(parseTrack(tags[static_cast<size_t>(Field::Track)]).first, 255u));
+		v1 += static_cast<char>(data[size - 1]);
+		edits.push_back({size - 128, 128, std::move(v1)});
+	}
+	return true;
+}
+
+/// @brief Edits for a native FLAC file
+static bool flacEdits(const std::uint8_t *data, std::uint64_t size, const Tags &tags, std::vector<Edit> &edits)
+{
+	std::vector<std::string_view> blocks;
+	std::vector<std::string_view> kept;
+	std::string                   vendor(vendorString);
+	size_t                        commentIndex = 1;
+
+	std::uint64_t pos = 4;
+	for (bool last = false; !last;)
+	{
+		if (pos + 4 > size)
+			throw std::runtime_error("Damaged FLAC metadata");
+		std::uint8_t  type = data[pos] & 0x7F;
+		std::uint32_t length = (static_cast<std::uint32_t>(data[pos + 1]) << 16) | (data[pos + 2] << 8) | data[pos + 3];
+		last = (data[pos] & 0x80) != 0;
+		if (length > size - pos - 4)
+			throw std::runtime_error("Damaged FLAC metadata");
+
+		if (type == 4) // VORBIS_COMMENT
+		{
+			commentIndex = blocks.size();
+			readVorbisComments(data + pos + 4, length, vendor, kept);
+		}
+		else if (type != 1) // everything but PADDING
+			blocks.push_back(bytes(data, pos, 4 + length));
+		pos += 4 + length;
+	}
+	if (blocks.empty())
+		throw std::runtime_error("FLAC file without STREAMINFO");
+
+	std::string comment;
+	appendVorbisComments(comment, vendor, kept, tags);
+	if (comment.size() >= (1u << 24))
+		throw std::runtime_error("Vorbis comment too large");
+
+	std::string header(1, '\x04');
+	appendBE(header, comment.size(), 3);
+	std::string commentBlock = header + comment;
+	blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(std::min(commentIndex, blocks.size())), commentBlock);
+
+	std::string metadata;
+	for (auto block : blocks)
+		metadata += block;
+
+	// Fill the old metadata area exactly, or append fresh padding
+	const std::uint64_t region = pos - 4;
+	std::uint64_t       padding = TagWriter::Padding;
+	if (metadata.size() == region)
+		padding = 0;
+	else if (metadata.size() + 4 <= region)
+		padding = region - metadata.size() - 4;
+
+	std::vector<size_t> headers;
+	for (size_t i = 0, offset = 0; i < blocks.size(); offset += blocks[i].size(), ++i)
+		headers.push_back(offset);
+	if (metadata.size() != region)
+	{
+		headers.push_back(metadata.size());
+		metadata += '\x01';
+		appendBE(metadata, padding, 3);
+		metadata.append(static_cast<size_t>(padding), '\0');
+	}
+	for (size_t offset : headers)
+		metadata[offset] = static_cast<char>(metadata[offset] & 0x7F);
+	metadata[headers.back()] = static_cast<char>(metadata[headers.back()] | 0x80);
+
+	edits.push_back({4, region, std::move(metadata)});
+	return true;
+}
+
+/// @brief Ogg page CRC table (polynomial 0x04C11DB7, unreflected)
+static constexpr std::array<std::uint32_t, 256> oggCrcTable = [] {
+	std::array<std::uint32_t, 256> table{};
+	for (std::uint32_t i = 0; i < 256; ++i)
+	{
+		std::uint32_t r = i << 24;
+		for (int bit = 0; bit < 8; ++bit)
+			r = (r & 0x80000000u) ? (r << 1) ^ 0x04C11DB7u : r << 1;
+		table[i] = r;
+	}
+	return table;
+}();
+
+/// @brief Update an Ogg page CRC
+static std::uint32_t oggCrc(std::uint32_t crc, const void *data, size_t size)
+{
+	auto p = static_cast<const std::uint8_t *>(data);
+	for (size_t i = 0; i < size; ++i)
+		crc = (crc << 8) ^ oggCrcTable[((crc >> 24) ^ p[i]) & 0xFF];
+	return crc;
+}
+
+/// @brief Ogg page location
+struct OggPage
+{
+	/// @brief Offset of the page header
+	std::uint64_t Offset;
+	/// @brief Header size including the lacing values
+	std::uint64_t HeaderSize;
+	/// @brief Body size
+	std::uint64_t BodySize;
+	/// @brief Stream serial number
+	std::uint32_t Serial;
+	/// @brief Page sequence number
+	std::uint32_t Sequence;
+};
+
+/// @brief Locate the Ogg page at @p pos, false at the end of the file
+static bool readOggPage(const std::uint8_t *data, std::uint64_t size, std::uint64_t pos, OggPage &page)
+{
+	if (pos >= size)
+		return false;
+	if (pos + 27 > size || std::memcmp(data + pos, "OggS", 4) != 0 || pos + 27 + data[pos + 26] > size)
+		throw std::runtime_error("Damaged Ogg page");
+
+	page.Offset = pos;
+	page.HeaderSize = 27 + data[pos + 26];
+	page.BodySize = 0;
+	for (unsigned i = 0; i < data[pos + 26]; ++i)
+		page.BodySize += data[pos + 27 + i];
+	page.Serial = readLE32(data + pos + 14);
+	page.Sequence = readLE32(data + pos + 18);
+	if (page.BodySize > size - pos - page.HeaderSize)
+		throw std::runtime_error("Damaged Ogg page");
+	return true;
+}
+
+/// @brief Edits for an Ogg Vorbis or Ogg Opus file
+static bool oggEdits(const std::uint8_t *data, std::uint64_t size, const Tags &tags, std::vector<Edit> &edits)
+{
+	OggPage first;
+	readOggPage(data, size, 0, first);
+	std::string_view identification = bytes(data, first.HeaderSize, first.BodySize);
+
+	bool opus = identification.substr(0, 8) == "OpusHead";
+	if (!opus && identification.substr(0, 7) != "\x01vorbis")
+		return false;
+	// Opus has comment headers only, Vorbis comment and setup headers
+	const size_t headerPackets = opus ? 1 : 2;
+
+	// Collect the header packets following the identification page
+	std::vector<std::string> packets(1);
+	std::uint64_t            pos = first.HeaderSize + first.BodySize;
+	std::uint64_t            headerStart = pos;
+	std::uint32_t            oldPages = 0;
+	OggPage                  page;
+	while (packets.size() <= headerPackets)
+	{
+		if (!readOggPage(data, size, pos, page))
+			throw std::runtime_error("Truncated Ogg headers");
+		if (page.Serial != first.Serial)
+			return false; // multiplexed streams
+
+		std::uint64_t body = pos + page.HeaderSize;
+		for (unsigned i = 0; i < data[pos + 26]; ++i)
+		{
+			if (packets.size() > headerPackets)
+				return false; // audio shares the last header page
+			std::uint8_t lacing = data[pos + 27 + i];
+			packets.back() += bytes(data, body, lacing);
+			body += lacing;
+			if (lacing < 255)
+				packets.emplace_back();
+		}
+		pos += page.HeaderSize + page.BodySize;
+		++oldPages;
+	}
+	packets.pop_back();
+	const std::uint64_t headerEnd = pos;
+
+	// Rebuild the comment packet, keeping Opus binary data after the comments
+	std::string_view              old = packets[0];
+	std::string_view              magic = opus ? "OpusTags" : "\x03vorbis";
+	std::string                   vendor;
+	std::vector<std::string_view> kept;
+	if (old.substr(0, magic.size()) != magic)
+		throw std::runtime_error("Damaged Ogg comment header");
+	size_t used = magic.size() + readVorbisComments(reinterpret_cast<const std::uint8_t *>(old.data()) + magic.size(),
+	                                                old.size() - magic.size(), vendor, kept);
+
+	std::string comment(magic);
+	appendVorbisComments(comment, vendor, kept, tags);
+	if (opus)
+	{
+		if (used < old.size() && (old[used] & 1))
+			comment += old.substr(used);
+	}
+	else
+		comment += '\x01'; // framing bit
+	packets[0] = std::move(comment);
+
+	// Paginate the header packets again
+	std::string   pages;
+	std::uint32_t sequence = first.Sequence + 1;
+	std::string   lacing, body;
+	bool          continued = false;
+	auto          flush = [&](bool nextContinued) {
+		std::string header = "OggS";
+		header += '\0';
+		header += continued ? '\x01' : '\0';
+		header.append(8, '\0'); // header pages have granule position 0
+		appendLE32(header, first.Serial);
+		appendLE32(header, sequence++);
+		appendLE32(header, 0);
+		header += static_cast<char>(lacing.size());
+		header += lacing;
+		std::uint32_t crc = oggCrc(oggCrc(0, header.data(), header.size()), body.data(), body.size());
+		for (int i = 0; i < 4; ++i)
+			header[22 + i] = static_cast<char>((crc >> (8 * i)) & 0xFF);
+		pages += header + body;
+		lacing.clear();
+		body.clear();
+		continued = nextContinued;
+	};
+	for (const std::string &packet : packets)
+	{
+		size_t offset = 0, segment;
+		do
+		{
+			if (lacing.size() == 255)
+				flush(offset > 0);
+			segment = std::min<size_t>(255, packet.size() - offset);
+			lacing += static_cast<char>(segment);
+			body.append(packet, offset, segment);
+			offset += segment;
+		} while (segment == 255);
+	}
+	flush(false);
+
+	edits.push_back({headerStart, headerEnd - headerStart, std::move(pages)});
+
+	// Renumber the remaining pages of the stream when the header page count changed
+	const std::uint32_t newPages = sequence - first.Sequence - 1;
+	if (newPages != oldPages)
+	{
+		for (pos = headerEnd; readOggPage(data, size, pos, page); pos += page.HeaderSize + page.BodySize)
+		{
+			if (page.Serial != first.Serial)
+				continue;
+			std::string header(bytes(data, pos, page.HeaderSize));
+			std::string fields;
+			appendLE32(fields, page.Sequence + newPages - oldPages);
+			appendLE32(fields, 0);
+			header.replace(18, 8, fields);
+			std::uint32_t crc = oggCrc(oggCrc(0, header.data(), header.size()), data + pos + page.HeaderSize,
+			                           static_cast<size_t>(page.BodySize));
+			fields.resize(4);
+			appendLE32(fields, crc);
+			edits.push_back({pos + 18, 8, std::move(fields)});
+		}
+	}
+	return true;
+}
+
+/// @brief MP4 box location
+struct Mp4Box
+{
+	/// @brief Offset of the box header
+	std::uint64_t Offset;
+	/// @brief Header size (8, or 16 with a 64-bit size)
+	std::uint64_t HeaderSize;
+	/// @brief Total size including the header
+	std::uint64_t Size;
+	/// @brief Four character type
+	std::string_view Type;
+};
+
+/// @brief Locate the box at @p pos inside [pos, end), false if there is none
+static bool readMp4Box(const std::uint8_t *data, std::uint64_t pos, std::uint64_t end, Mp4Box &box)
+{
+	if (pos + 8 > end)
+		return false;
+	box.Offset = pos;
+	box.HeaderSize = 8;
+	box.Size = readBE32(data + pos);
+	box.Type = bytes(data, pos + 4, 4);
+	if (box.Size == 1)
+	{
+		if (pos + 16 > end)
+			throw std::runtime_error("Damaged MP4 box");
+		box.HeaderSize = 16;
+		box.Size = readBE64(data + pos + 8);
+	}
+	else if (box.Size == 0)
+		box.Size = end - pos;
+	if (box.Size < box.HeaderSize || box.Size > end - pos)
+		throw std::runtime_error("Damaged MP4 box");
+	return true;
+}
+
+/// @brief Append an MP4 box
+static void appendMp4Box(std::string &out, std::string_view type, std::string_view payload)
+{
+	if (payload.size() + 8 > std::numeric_limits<std::uint32_t>::max())
+		throw std::runtime_error("MP4 box too large");
+	appendBE(out, payload.size() + 8, 4);
+	out += type;
+	out += payload;
+}
+
+/// @brief Append an ilst data box
+static void appendMp4Data(std::string &out, std::uint32_t type, std::string_view value)
+{
+	std::string payload;
+	appendBE(payload, type, 4);
+	appendBE(payload, 0, 4); // locale
+	payload += value;
+	appendMp4Box(out, "data", payload);
+}
+
+/// @brief Name of a freeform ("----") ilst item
+static std::string_view mp4FreeformName(const std::uint8_t *data, const Mp4Box &item)
+{
+	Mp4Box child;
+	for (std::uint64_t pos = item.Offset + item.HeaderSize; readMp4Box(data, pos, item.Offset + item.Size, child);
+	     pos += child.Size)
+		if (child.Type == "name" && child.Size >= child.HeaderSize + 4)
+			return bytes(data, child.Offset + child.HeaderSize + 4, child.Size - child.HeaderSize - 4);
+	return {};
+}
+
+/// @brief Append a freeform ("----") ilst item in the iTunes namespace
+static void appendMp4Freeform(std::string &out, std::string_view name, std::string_view value)
+{
+	std::string item, mean(4, '\0'), itemName(4, '\0');
+	mean += "com.apple.iTunes";
+	itemName += name;
+	appendMp4Box(item, "mean", mean);
+	appendMp4Box(item, "name", itemName);
+	appendMp4Data(item, 1, value);
+	appendMp4Box(out, "----", item);
+}
+
+/// @brief State of a moov rewrite
+struct Mp4Rewrite
+{
+	/// @brief Mapped file
+	const std::uint8_t *Data;
+	/// @brief New tags, nullptr to keep the managed items
+	const Tags *Values;
+	/// @brief Name of a freeform item to set besides the tags, empty for none
+	std::string_view FreeformName;
+	/// @brief Value of that item
+	std::string_view FreeformValue;
+	/// @brief Chunk offsets at or after this position move...
+	std::uint64_t ShiftFrom;
+	/// @brief ...by this many bytes
+	std::int64_t Shift;
+};
+
+/// @brief Rebuild an ilst box with the managed items replaced
+static std::string rebuildIlst(const Mp4Rewrite &rewrite, const Mp4Box &ilst)
+{
+	const std::uint64_t end = ilst.Offset + ilst.Size;
+	std::string         payload;
+	Mp4Box              item;
+	for (std::uint64_t pos = ilst.Offset + ilst.HeaderSize; readMp4Box(rewrite.Data, pos, end, item); pos += item.Size)
+	{
+		bool managed = rewrite.Values && item.Type == "gnre";
+		for (const auto &names : fieldNames)
+		{
+			if (!rewrite.Values || item.Type != names.MP4)
+				continue;
+			managed |= item.Type != "----" || equalsIgnoreCase(mp4FreeformName(rewrite.Data, item), names.Vorbis);
+		}
+		if (!rewrite.FreeformName.empty() && item.Type == "----")
+			managed |= equalsIgnoreCase(mp4FreeformName(rewrite.Data, item), rewrite.FreeformName);
+		if (!managed)
+			payload += bytes(rewrite.Data, item.Offset, item.Size);
+	}
+
+	if (!rewrite.FreeformName.empty())
+		appendMp4Freeform(payload, rewrite.FreeformName, rewrite.FreeformValue);
+
+	static const Tags none;
+	const Tags       &tags = rewrite.Values ? *rewrite.Values : none;
+	for (size_t i = 0; i < fieldCount; ++i)
+	{
+		if (tags[i].empty())
+			continue;
+
+		std::string value;
+		if (i == static_cast<size_t>(Field::Track))
+		{
+			auto [track, total] = parseTrack(tags[i]);
+			std::string number(2, '\0');
+			appendBE(number, track, 2);
+			appendBE(number, total, 2);
+			number.append(2, '\0');
+			appendMp4Data(value, 0, number);
+		}
+		else if (std::string_view(fieldNames[i].MP4) == "----")
+		{
+			appendMp4Freeform(payload, fieldNames[i].Vorbis, tags[i]);
+			continue;
+		}
+		else
+			appendMp4Data(value, 1, tags[i]);
+		appendMp4Box(payload, fieldNames[i].MP4, value);
+	}
+
+	std::string out;
+	appendMp4Box(out, "ilst", payload);
+	return out;
+}
+
+/**
+ * @brief Rebuild a box of the moov tree
+ *
+ * Containers on the way to the ilst are rebuilt (and created if missing),
+ * chunk offset tables are shifted and every other box is copied verbatim.
+ *
+ * @param rewrite Rewrite state
+ * @param box Box to rebuild
+ * @param parent Type of the parent box
+ * @return New box
+ */
+static std::string rebuildMp4Box(const Mp4Rewrite &rewrite, const Mp4Box &box, std::string_view parent)
+{
+	const std::uint8_t *data = rewrite.Data;
+	std::uint64_t       start = box.Offset + box.HeaderSize;
+	std::uint64_t       end = box.Offset + box.Size;
+
+	if (box.Type == "stco" || box.Type == "co64")
+	{
+		std::string payload(bytes(data, start, end - start));
+		if (rewrite.Shift == 0)
+			return std::string(bytes(data, box.Offset, box.HeaderSize)) + payload;
+
+		const size_t width = box.Type == "stco" ? 4 : 8;
+		if (payload.size() < 8 || readBE32(data + start + 4) > (payload.size() - 8) / width)
+			throw std::runtime_error("Damaged MP4 chunk offset table");
+		std::uint32_t count = readBE32(data + start + 4);
+		for (std::uint32_t i = 0; i < count; ++i)
+		{
+			const std::uint8_t *entry = data + start + 8 + i * width;
+			std::uint64_t       offset = width == 4 ? readBE32(entry) : readBE64(entry);
+			if (offset >= rewrite.ShiftFrom)
+				offset += static_cast<std::uint64_t>(rewrite.Shift);
+			if (width == 4 && offset > std::numeric_limits<std::uint32_t>::max())
+				throw std::runtime_error("MP4 chunk offsets overflow");
+			std::string value;
+			appendBE(value, offset, static_cast<int>(width));
+			payload.replace(8 + i * width, width, value);
+		}
+		std::string out;
+		appendMp4Box(out, box.Type, payload);
+		return out;
+	}
+
+	bool tagMeta = box.Type == "meta" && parent == "udta";
+	bool container = box.Type == "moov" || box.Type == "trak" || box.Type == "mdia" || box.Type == "minf" ||
+	                 box.Type == "stbl" || (box.Type == "udta" && parent == "moov") || tagMeta;
+	if (box.Type == "ilst" && parent == "meta")
+		return rebuildIlst(rewrite, box);
+	if (!container)
+		return std::string(bytes(data, box.Offset, box.Size));
+
+	std::string payload;
+	// meta is a full box, except in some QuickTime files
+	if (tagMeta && !(end - start >= 8 && std::memcmp(data + start + 4, "hdlr", 4) == 0))
+	{
+		payload.append(bytes(data, start, 4));
+		start += 4;
+	}
+
+	std::string_view wanted = box.Type == "moov" ? "udta" : box.Type == "udta" ? "meta" : tagMeta ? "ilst" : "";
+	bool             found = false;
+	Mp4Box           child;
+	for (std::uint64_t pos = start; readMp4Box(data, pos, end, child); pos += child.Size)
+	{
+		found |= child.Type == wanted;
+		payload += rebuildMp4Box(rewrite, child, box.Type);
+	}
+
+	// Create the path down to the ilst where it is missing
+	if (!wanted.empty() && !found)
+	{
+		std::string ilst = rebuildIlst(rewrite, Mp4Box{0, 8, 8, "ilst"});
+		if (wanted == "ilst")
+			payload += ilst;
+		else
+		{
+			std::string hdlr, meta(4, '\0');
+			hdlr.append(8, '\0');
+			hdlr += "mdirappl";
+			hdlr.append(9, '\0');
+			appendMp4Box(meta, "hdlr", hdlr);
+			meta += ilst;
+			std::string metaBox;
+			appendMp4Box(metaBox, "meta", meta);
+			if (wanted == "meta")
+				payload += metaBox;
+			else
+				appendMp4Box(payload, "udta", metaBox);
+		}
+	}
+
+	std::string out;
+	appendMp4Box(out, box.Type, payload);
+	return out;
+}
+
+/// @brief Append a free box of @p size bytes
+static void appendFreeBox(std::string &out, std::uint64_t size)
+{
+	appendMp4Box(out, "free", std::string(static_cast<size_t>(size - 8), '\0'));
+}
+
+/**
+ * @brief Edits for an MP4 file
+ * @param data Mapped file
+ * @param size File size
+ * @param rewrite Tags and freeform item to write; the offsets are filled in here
+ * @param edits Edits to append to
+ * @return false if the file cannot be edited
+ */
+static bool mp4Edits(const std::uint8_t *data, std::uint64_t size, Mp4Rewrite rewrite, std::vector<Edit> &edits)
+{
+	Mp4Box moov{}, box;
+	bool   haveMoov = false;
+	for (std::uint64_t pos = 0; readMp4Box(data, pos, size, box); pos += box.Size)
+	{
+		if (box.Type == "moof")
+			return false; // fragmented files carry offsets in every fragment
+		if (box.Type == "moov")
+		{
+			moov = box;
+			haveMoov = true;
+		}
+	}
+	if (!haveMoov)
+		throw std::runtime_error("MP4 file without moov box");
+
+	// A free box right behind moov is space the new moov may grow into
+	std::uint64_t region = moov.Size;
+	Mp4Box        next;
+	if (readMp4Box(data, moov.Offset + moov.Size, size, next) && (next.Type == "free" || next.Type == "skip"))
+		region += next.Size;
+
+	rewrite.ShiftFrom = moov.Offset + region;
+	rewrite.Shift = 0;
+	std::string newMoov = rebuildMp4Box(rewrite, moov, "");
+	if (newMoov.size() == region || newMoov.size() + 8 <= region)
+	{
+		if (newMoov.size() < region)
+			appendFreeBox(newMoov, region - newMoov.size());
+		edits.push_back({moov.Offset, region, std::move(newMoov)});
+		return true;
+	}
+
+	// moov at the end of the file moves nothing
+	if (moov.Offset + region == size)
+	{
+		edits.push_back({moov.Offset, region, std::move(newMoov)});
+		return true;
+	}
+
+	// Media data behind moov moves, so shift the chunk offsets pointing there
+	rewrite.Shift = static_cast<std::int64_t>(newMoov.size() + TagWriter::Padding) - static_cast<std::int64_t>(region);
+	newMoov = rebuildMp4Box(rewrite, moov, "");
+	appendFreeBox(newMoov, TagWriter::Padding);
+	edits.push_back({moov.Offset, region, std::move(newMoov)});
+	return true;
+}
+
+/// @brief Find the first child of @p parent with type @p type
+static bool findMp4Box(const std::uint8_t *data, const Mp4Box &parent, std::string_view type, Mp4Box &child)
+{
+	for (std::uint64_t pos = parent.Offset + parent.HeaderSize;
+	     readMp4Box(data, pos, parent.Offset + parent.Size, child); pos += child.Size)
+		if (child.Type == type)
+			return true;
+	return false;
+}
+
+/**
+ * @brief Encoder delay and encoded length of the first audio track of an MP4 file
+ * @param data Mapped file
+ * @param size File size
+ * @param delay Media time of the first edit, i.e. the priming samples
+ * @param length Sum of the sample durations of the track
+ * @return false if there is no audio track with an edit list
+ */
+static bool mp4AudioTiming(const std::uint8_t *data, std::uint64_t size, std::uint64_t &delay, std::uint64_t &length)
+{
+	Mp4Box moov, box;
+	bool   haveMoov = false;
+	for (std::uint64_t pos = 0; !haveMoov && readMp4Box(data, pos, size, box); pos += box.Size)
+		if (box.Type == "moov")
+		{
+			moov = box;
+			haveMoov = true;
+		}
+	if (!haveMoov)
+		return false;
+
+	Mp4Box trak;
+	for (std::uint64_t pos = moov.Offset + moov.HeaderSize; readMp4Box(data, pos, moov.Offset + moov.Size, trak);
+	     pos += trak.Size)
+	{
+		Mp4Box mdia, hdlr, minf, stbl, stts, edts, elst;
+		if (trak.Type != "trak" || !findMp4Box(data, trak, "mdia", mdia) || !findMp4Box(data, mdia, "hdlr", hdlr) ||
+		    hdlr.Size < hdlr.HeaderSize + 12 || bytes(data, hdlr.Offset + hdlr.HeaderSize + 8, 4) != "soun")
+			continue;
+		if (!findMp4Box(data, mdia, "minf", minf) || !findMp4Box(data, minf, "stbl", stbl) ||
+		    !findMp4Box(data, stbl, "stts", stts) || !findMp4Box(data, trak, "edts", edts) ||
+		    !findMp4Box(data, edts, "elst", elst))
+			return false;
+
+		// stts: version and flags, entry count, then (sample count, sample duration) pairs
+		const std::uint8_t *table = data + stts.Offset + stts.HeaderSize;
+		std::uint64_t       tableSize = stts.Size - stts.HeaderSize;
+		if (tableSize < 8 || readBE32(table + 4) > (tableSize - 8) / 8)
+			throw std::runtime_error("Damaged MP4 time-to-sample table");
+		length = 0;
+		for (std::uint32_t i = 0, count = readBE32(table + 4); i < count; ++i)
+			length += static_cast<std::uint64_t>(readBE32(table + 8 + i * 8)) * readBE32(table + 12 + i * 8);
+
+		// elst: version and flags, entry count, then (duration, media time, rate); empty edits have time -1
+		const std::uint8_t *edits = data + elst.Offset + elst.HeaderSize;
+		std::uint64_t       editsSize = elst.Size - elst.HeaderSize;
+		const bool          wide = editsSize > 0 && edits[0] == 1;
+		const std::uint64_t entrySize = wide ? 20 : 12;
+		if (editsSize < 8 || readBE32(edits + 4) > (editsSize - 8) / entrySize)
+			throw std::runtime_error("Damaged MP4 edit list");
+		for (std::uint32_t i = 0, count = readBE32(edits + 4); i < count; ++i)
+		{
+			const std::uint8_t *entry = edits + 8 + i * entrySize;
+			std::int64_t        time = wide ? static_cast<std::int64_t>(readBE64(entry + 8))
+			                                : static_cast<std::int32_t>(readBE32(entry + 4));
+			if (time >= 0)
+			{
+				delay = static_cast<std::uint64_t>(time);
+				return true;
+			}
+		}
+		return false;
+	}
+	return false;
+}
+
+/// @brief Edits for a WAV file
+static bool wavEdits(const std::uint8_t *data, std::uint64_t size, const Tags &tags, std::vector<Edit> &edits)
+{
+	const bool    rf64 = std::memcmp(data, "RIFF", 4) != 0;
+	std::uint64_t listOffset = 0, listSize = 0, dataOffset = 0;
+
+	std::uint64_t pos = 12;
+	while (pos + 8 <= size)
+	{
+		std::uint64_t chunkSize = readLE32(data + pos + 4);
+		std::uint64_t next = pos + 8 + chunkSize + (chunkSize & 1);
+		if (std::memcmp(data + pos, "data", 4) == 0)
+		{
+			dataOffset = pos;
+			if (rf64)
+				break; // the real size is in ds64 and nothing after it matters here
+		}
+		else if (std::memcmp(data + pos, "LIST", 4) == 0 && chunkSize >= 4 && listSize == 0 &&
+		         std::memcmp(data + pos + 8, "INFO", 4) == 0)
+		{
+			listOffset = pos;
+			listSize = std::min(next, size) - pos;
+		}
+		else if (listSize != 0 && listOffset + listSize == pos &&
+		         (std::memcmp(data + pos, "JUNK", 4) == 0 || std::memcmp(data + pos, "PAD ", 4) == 0))
+			listSize = std::min(next, size) - listOffset; // padding right after the LIST
+		pos = next;
+	}
+
+	std::string info = "INFO";
+	if (listSize != 0)
+	{
+		std::uint64_t end = std::min<std::uint64_t>(listOffset + 8 + readLE32(data + listOffset + 4), size);
+		std::uint64_t sub = listOffset + 12;
+		while (sub + 8 <= end)
+		{
+			std::uint64_t subSize = readLE32(data + sub + 4);
+			std::uint64_t next = sub + 8 + subSize + (subSize & 1);
+			if (next > end)
+				throw std::runtime_error("Damaged RIFF INFO chunk");
+			std::string_view id = bytes(data, sub, 4);
+			bool             managed = id == "IPRT";
+			for (const auto &names : fieldNames)
+				managed |= names.RIFF && id == names.RIFF;
+			if (!managed)
+				info += bytes(data, sub, next - sub);
+			sub = next;
+		}
+	}
+	else if (dataOffset == 0)
+		throw std::runtime_error("WAV file without data chunk");
+
+	for (size_t i = 0; i < fieldCount; ++i)
+	{
+		if (!fieldNames[i].RIFF || tags[i].empty())
+			continue;
+		std::string value = tags[i] + '\0';
+		if (value.size() & 1)
+			value += '\0';
+		info += fieldNames[i].RIFF;
+		appendLE32(info, static_cast<std::uint32_t>(tags[i].size() + 1));
+		info += value;
+	}
+
+	std::string list = "LIST";
+	appendLE32(list, static_cast<std::uint32_t>(info.size()));
+	list += info;
+	if (listSize == 0 && info.size() == 4)
+		return true; // nothing to write
+
+	auto junk = [](std::string &out, std::uint64_t total) {
+		out += "JUNK";
+		appendLE32(out, static_cast<std::uint32_t>(total - 8));
+		out.append(static_cast<size_t>(total - 8), '\0');
+	};
+
+	const std::uint64_t regionStart = listSize != 0 ? listOffset : dataOffset;
+	if (list.size() == listSize || list.size() + 8 <= listSize)
+	{
+		if (list.size() < listSize)
+			junk(list, listSize - list.size());
+		edits.push_back({regionStart, listSize, std::move(list)});
+		return true;
+	}
+	if (rf64)
+		return false; // growing would need the ds64 sizes rewritten
+
+	// A LIST at the end of the file can simply grow, anywhere else it gets padding for next time
+	if (regionStart + listSize != size)
+		junk(list, TagWriter::Padding);
+	std::uint64_t riffSize = readLE32(data + 4) + list.size() - listSize;
+	if (riffSize > std::numeric_limits<std::uint32_t>::max())
+		return false;
+
+	std::string riffField;
+	appendLE32(riffField, static_cast<std::uint32_t>(riffSize));
+	edits.push_back({4, 4, std::move(riffField)});
+	edits.push_back({regionStart, listSize, std::move(list)});
+	return true;
+}
+
+TagWriter::Result TagWriter::write(const std::filesystem::path &filePath, const Tags &tags)
+{
+	std::vector<Edit> edits;
+	std::uint64_t     size;
+	{
+		MappedFile file;
+		if (!file.open(filePath))
+			throw std::runtime_error("Failed to open " + filePath.string());
+		const std::uint8_t *data = file.data();
+		size = file.size();
+
+		auto is = [&](std::uint64_t offset, std::string_view magic) {
+			return size >= offset + magic.size() && bytes(data, offset, magic.size()) == magic;
+		};
+		std::string extension = filePath.extension().string();
+
+		bool supported = false;
+		if (is(0, "ID3") || (equalsIgnoreCase(extension, ".mp3") && size >= 2 && data[0] == 0xFF &&
+		                     (data[1] & 0xE0) == 0xE0))
+			supported = id3Edits(data, size, tags, edits);
+		else if (is(0, "fLaC"))
+			supported = flacEdits(data, size, tags, edits);
+		else if (is(0, "OggS"))
+			supported = oggEdits(data, size, tags, edits);
+		else if ((is(0, "RIFF") || is(0, "RF64") || is(0, "BW64")) && is(8, "WAVE"))
+			supported = wavEdits(data, size, tags, edits);
+		else if (is(4, "ftyp"))
+			supported = mp4Edits(data, size, Mp4Rewrite{data, &tags, {}, {}, 0, 0}, edits);
+
+		if (!supported)
+			return Result::Unsupported;
+	}
+	// The mapping is closed here, so the file can be replaced on every platform
+	return applyEdits(filePath, std::move(edits), size);
+}
+
+std::string TagWriter::vorbisComments(const Tags &tags)
+{
+	std::string out;
+	appendVorbisComments(out, vendorString, {}, tags);
+	return out;
+}
+
+TagWriter::Result TagWriter::writeGapless(const std::filesystem::path &filePath, std::uint64_t samples)
+{
+	std::vector<Edit> edits;
+	std::uint64_t     size;
+	{
+		MappedFile file;
+		if (!file.open(filePath))
+			throw std::runtime_error("Failed to open " + filePath.string());
+		const std::uint8_t *data = file.data();
+		size = file.size();
+
+		std::uint64_t delay, length;
+		if (size < 8 || bytes(data, 4, 4) != "ftyp" || !mp4AudioTiming(data, size, delay, length))
+			return Result::Unsupported;
+
+		// Delay, padding and original length in the layout iTunes writes
+		std::uint64_t      padding = length > delay + samples ? length - delay - samples : 0;
+		std::ostringstream value;
+		value << std::uppercase << std::hex << std::setfill('0') << " 00000000 " << std::setw(8) << delay << " "
+		      << std::setw(8) << padding << " " << std::setw(16) << samples;
+		for (int i = 0; i < 8; ++i)
+			value << " 00000000";
+		std::string text = value.str();
+		if (!mp4Edits(data, size, Mp4Rewrite{data, nullptr, "iTunSMPB", text, 0, 0}, edits))
+			return Result::Unsupported;
+	}
+	return applyEdits(filePath, std::move(edits), size);
+}
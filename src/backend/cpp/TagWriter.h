@@ -0,0 +1,123 @@
+/**
+ * @file TagWriter.h
+ * @brief In-place metadata writer for encoded audio files.
+ *
+ * Replaces the tags the utility manages in ID3v2.3/2.4 (MP3), Vorbis comments
+ * (FLAC, Ogg Vorbis, Ogg Opus), MP4 ilst atoms (M4A/AAC/ALAC) and RIFF INFO
+ * (WAV) without touching the audio. All other tags, pictures and chunks are
+ * kept. The new tags are written in place when they fit into the existing
+ * tag and its padding; otherwise the file is rewritten once, with padding
+ * for the next edit.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * TagWriter::Tags tags;
+ * tags[static_cast<size_t>(TagWriter::Field::Title)] = "New Title";
+ * TagWriter::write("song.mp3", tags);
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/// @brief Native tag writer
+class TagWriter
+{
+  public:
+	/// @brief Tag fields managed by the writer
+	enum class Field
+	{
+		Title,
+		Artist,
+		Album,
+		Genre,
+		/// @brief Release date or year
+		Date,
+		Comment,
+		Copyright,
+		/// @brief Track number, optionally "track/total"
+		Track,
+		/// @brief ReplayGain 2.0 track gain, e.g. "-3.21 dB"
+		TrackGain,
+		/// @brief ReplayGain 2.0 track peak (linear)
+		TrackPeak,
+		/// @brief ReplayGain 2.0 album gain
+		AlbumGain,
+		/// @brief ReplayGain 2.0 album peak (linear)
+		AlbumPeak,
+		/// @brief Number of fields
+		Count
+	};
+
+	/// @brief Tag values (UTF-8) indexed by Field; an empty value removes the tag
+	using Tags = std::array<std::string, static_cast<size_t>(Field::Count)>;
+
+	/// @brief Outcome of write()
+	enum class Result
+	{
+		/// @brief The format is not supported, the file is untouched
+		Unsupported,
+		/// @brief The tags were updated in place
+		InPlace,
+		/// @brief The file was rewritten through a temporary file
+		Rewritten
+	};
+
+	/**
+	 * @brief Replace the managed tags of a file
+	 *
+	 * Fields a format has no place for (ReplayGain in RIFF INFO) are skipped.
+	 *
+	 * @param filePath File to update
+	 * @param tags New values of all managed fields
+	 * @return How the file was updated
+	 * @throws std::runtime_error if the file is damaged or cannot be written
+	 */
+	static Result write(const std::filesystem::path &filePath, const Tags &tags);
+
+	/**
+	 * @brief Write gapless playback info (iTunSMPB) to an MP4 file
+	 *
+	 * The encoder delay is read from the edit list of the audio track and
+	 * the padding follows from its encoded length, so players that go by
+	 * iTunSMPB drop exactly the priming and padding samples. Tags are kept.
+	 *
+	 * @param filePath MP4 file written by an encoder
+	 * @param samples Number of samples per channel of the original audio
+	 * @return Unsupported if the file is not MP4 or its audio track has no edit list
+	 * @throws std::runtime_error if the file is damaged or cannot be written
+	 */
+	static Result writeGapless(const std::filesystem::path &filePath, std::uint64_t samples);
+
+	/**
+	 * @brief Build the Vorbis comment list of a new file
+	 *
+	 * Used by encoders that write FLAC or Ogg headers themselves.
+	 *
+	 * @param tags Tag values
+	 * @return Vendor string, comment count and comments as stored in a VORBIS_COMMENT block
+	 */
+	static std::string vorbisComments(const Tags &tags);
+
+	/// @brief Padding in bytes reserved when a file has to be rewritten
+	static constexpr size_t Padding = 4096;
+};
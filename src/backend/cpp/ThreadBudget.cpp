@@ -0,0 +1,165 @@
+/**
+ * @file ThreadBudget.cpp
+ * @brief CPUs the process may use and the threads each encoder gets of them.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+unsigned ThreadBudget::quotaCpus(const std::string &cpuMax)
+{
+	std::istringstream in(cpuMax);
+	std::string        quota;
+	long long          period = 100000;
+	if (!(in >> quota) || quota == "max")
+		return 0;
+	in >> period;
+	long long value = 0;
+	try
+	{
+		value = std::stoll(quota);
+	}
+	catch (const std::exception &)
+	{
+		return 0;
+	}
+	if (value <= 0 || period <= 0)
+		return 0;
+	return static_cast<unsigned>(std::max(1LL, (value + period - 1) / period));
+}
+
+#ifdef __linux__
+/// @brief Fewest CPUs the quotas of the process's cgroup and its parents allow, 0 without a limit
+static unsigned cgroupCpus()
+{
+	// cgroup v2 lists the process's group as "0::<path>", v1 once per controller
+	std::ifstream cgroups("/proc/self/cgroup");
+	std::string   line, unified, cpu;
+	while (std::getline(cgroups, line))
+	{
+		const size_t first = line.find(':'), second = line.find(':', first + 1);
+		if (second == std::string::npos)
+			continue;
+		const std::string controllers = "," + line.substr(first + 1, second - first - 1) + ",";
+		if (line.rfind("0::", 0) == 0)
+			unified = line.substr(second + 1);
+		else if (controllers.find(",cpu,") != std::string::npos)
+			cpu = line.substr(second + 1);
+	}
+
+	auto read = [](const std::filesystem::path &file) {
+		std::ifstream in(file);
+		std::string   text;
+		std::getline(in, text);
+		return text;
+	};
+
+	// Every group up to the root of the mount counts; inside a container the group's path may not exist in its
+	// own mount, whose root is the group then
+	unsigned cpus = 0;
+	auto     walk = [&cpus](const std::filesystem::path &root, const std::string &group, const auto &quota) {
+		std::filesystem::path dir = root;
+		if (std::filesystem::path relative = std::filesystem::path(group).relative_path(); !relative.empty())
+			dir /= relative;
+		for (;; dir = dir.parent_path())
+		{
+			if (unsigned limit = quota(dir); limit > 0)
+				cpus = cpus == 0 ? limit : std::min(cpus, limit);
+			if (dir == root || dir == dir.parent_path())
+				break;
+		}
+	};
+	walk("/sys/fs/cgroup", unified,
+	     [&read](const std::filesystem::path &dir) { return ThreadBudget::quotaCpus(read(dir / "cpu.max")); });
+	for (const char *mount : {"/sys/fs/cgroup/cpu", "/sys/fs/cgroup/cpu,cpuacct"})
+		walk(mount, cpu, [&read](const std::filesystem::path &dir) {
+			return ThreadBudget::quotaCpus(read(dir / "cpu.cfs_quota_us") + " " + read(dir / "cpu.cfs_period_us"));
+		});
+	return cpus;
+}
+#endif
+
+unsigned ThreadBudget::availableCpus()
+{
+	static const unsigned cpus = [] {
+		unsigned count = std::max(1u, std::thread::hardware_concurrency());
+#if defined(__linux__)
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+			count = std::min(count, static_cast<unsigned>(CPU_COUNT(&set)));
+		if (unsigned quota = cgroupCpus(); quota > 0)
+			count = std::min(count, quota);
+#elif defined(_WIN32)
+		DWORD_PTR process, system;
+		if (GetProcessAffinityMask(GetCurrentProcess(), &process, &system) && process != 0)
+		{
+			unsigned mask = 0;
+			for (; process; process &= process - 1)
+				++mask;
+			count = std::min(count, mask);
+		}
+#endif
+		return count;
+	}();
+	return cpus;
+}
+
+ThreadBudget::Profile ThreadBudget::profile(const std::string &codec, const Profiles &profiles)
+{
+	auto it = profiles.find(codec);
+	return it != profiles.end() ? it->second : Profile();
+}
+
+std::string ThreadBudget::inputOptions(const Profile &profile, unsigned budget)
+{
+	return "-threads " + std::to_string(std::clamp(profile.Threads, 1u, std::max(1u, budget))) + " ";
+}
+
+std::string ThreadBudget::outputOptions(const Profile &profile, unsigned budget, const std::string &arguments)
+{
+	// Whole words only: "-threads" is not "-filter_threads"
+	auto given = [&arguments](const std::string &option) {
+		std::istringstream words(arguments);
+		std::string        word;
+		while (words >> word)
+			if (word == option)
+				return true;
+		return false;
+	};
+	budget = std::max(1u, budget);
+	std::string options;
+	if (!given("-threads"))
+		options += "-threads " + std::to_string(std::clamp(profile.Threads, 1u, budget)) + " ";
+	if (!given("-filter_threads"))
+		options += "-filter_threads " + std::to_string(std::clamp(profile.FilterThreads, 1u, budget)) + " ";
+	return options;
+}
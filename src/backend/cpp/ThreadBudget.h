@@ -0,0 +1,100 @@
+/**
+ * @file ThreadBudget.h
+ * @brief CPUs the process may use and the threads each encoder gets of them.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <map>
+#include <string>
+
+/**
+ * @brief Keeps the threads of parallel encodes within the CPUs of the process
+ *
+ * Left alone, ffmpeg starts a thread per hardware thread for frame-threaded
+ * decoders such as FLAC and for the filter graph, in every one of the
+ * encodes that run at once, and the hardware threads are more than a
+ * container or a restricted affinity mask lets the process use. Every
+ * encode is therefore given a budget, the available CPUs divided by the
+ * encodes at once, and passes "-threads" and "-filter_threads" to ffmpeg
+ * from the profile of its codec, capped to that budget.
+ *
+ * ffmpeg's audio encoders do not use threads of their own, so the built-in
+ * profile is one thread for every codec; profiles for other codecs can be
+ * given.
+ */
+class ThreadBudget
+{
+  public:
+	/// @brief Threads an encode of a codec puts to use
+	class Profile
+	{
+	  public:
+		/// @brief Threads of the decoder and the encoder ("-threads")
+		unsigned Threads = 1;
+		/// @brief Threads of the filter graph ("-filter_threads")
+		unsigned FilterThreads = 1;
+	};
+
+	/// @brief Profiles by ffmpeg encoder name
+	using Profiles = std::map<std::string, Profile>;
+
+	/**
+	 * @brief CPUs the process may use
+	 *
+	 * The fewest of the hardware threads, the CPUs in the affinity mask and
+	 * the CPU quota of the cgroup (cpu.max, or cpu.cfs_quota_us of cgroup v1,
+	 * of the process's cgroup and its parents), rounded up. Determined once.
+	 *
+	 * @return At least 1
+	 */
+	static unsigned availableCpus();
+
+	/**
+	 * @brief CPUs a cgroup quota allows
+	 * @param cpuMax Contents of cpu.max, "<quota> <period>" or "max <period>"
+	 * @return CPUs rounded up, 0 without a limit
+	 */
+	static unsigned quotaCpus(const std::string &cpuMax);
+
+	/**
+	 * @brief Profile of a codec
+	 * @param codec ffmpeg encoder name
+	 * @param profiles Profiles that replace the built-in one
+	 */
+	static Profile profile(const std::string &codec, const Profiles &profiles);
+
+	/**
+	 * @brief ffmpeg options for the input of an encode, in front of its "-i"
+	 * @param profile Profile of the codec
+	 * @param budget Threads the encode may use
+	 */
+	static std::string inputOptions(const Profile &profile, unsigned budget);
+
+	/**
+	 * @brief ffmpeg options for the output of an encode
+	 *
+	 * Options the arguments set already are left out, so the markup can
+	 * override the profile.
+	 *
+	 * @param profile Profile of the codec
+	 * @param budget Threads the encode may use
+	 * @param arguments Album and song arguments of the encode
+	 */
+	static std::string outputOptions(const Profile &profile, unsigned budget, const std::string &arguments);
+};
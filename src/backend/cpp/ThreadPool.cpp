@@ -0,0 +1,75 @@
+/**
+ * @file ThreadPool.cpp
+ * @brief Implementation of the worker thread pool
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "ThreadPool.h"
+#include "ThreadBudget.h"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+	if (threads == 0)
+		threads = ThreadBudget::availableCpus();
+
+	m_workers.reserve(threads);
+	for (unsigned i = 0; i < threads; ++i)
+		m_workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (auto &thread : m_workers)
+		thread.join();
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task)
+{
+	auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+	auto future = packaged->get_future();
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_tasks.emplace_back([packaged] { (*packaged)(); });
+	}
+	m_wake.notify_one();
+	return future;
+}
+
+void ThreadPool::worker()
+{
+	for (;;)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [this] { return m_stop || !m_tasks.empty(); });
+			if (m_tasks.empty())
+				return;
+			task = std::move(m_tasks.front());
+			m_tasks.pop_front();
+		}
+		task();
+	}
+}
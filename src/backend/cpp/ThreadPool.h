@@ -0,0 +1,107 @@
+/**
+ * @file ThreadPool.h
+ * @brief Fixed size worker thread pool.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief Fixed size worker thread pool
+class ThreadPool
+{
+  public:
+	/**
+	 * @brief Start the workers
+	 * @param threads Number of workers, 0 for one per available CPU (ThreadBudget::availableCpus())
+	 */
+	explicit ThreadPool(unsigned threads = 0);
+
+	/// @brief Finish queued tasks and join the workers
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	/**
+	 * @brief Queue a task
+	 * @param task Task to run
+	 * @return Future that holds the task's exception, if any
+	 */
+	std::future<void> submit(std::function<void()> task);
+
+	/**
+	 * @brief Run fn(0) ... fn(count - 1) on the pool and wait for all of them
+	 *
+	 * @param count Number of iterations
+	 * @param fn Iteration body
+	 * @throws The first exception thrown by an iteration
+	 */
+	template <typename F> void parallelFor(size_t count, F &&fn)
+	{
+		std::vector<std::future<void>> pending;
+		pending.reserve(count);
+		for (size_t i = 0; i < count; ++i)
+			pending.push_back(submit([&fn, i] { fn(i); }));
+
+		std::exception_ptr error;
+		for (auto &future : pending)
+		{
+			try
+			{
+				future.get();
+			}
+			catch (...)
+			{
+				if (!error)
+					error = std::current_exception();
+			}
+		}
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	/// @brief Number of workers
+	unsigned size() const
+	{
+		return static_cast<unsigned>(m_workers.size());
+	}
+
+  private:
+	/// @brief Worker loop
+	void worker();
+
+	/// @brief Worker threads
+	std::vector<std::thread> m_workers;
+	/// @brief Queued tasks
+	std::deque<std::function<void()>> m_tasks;
+	/// @brief Guards m_tasks and m_stop
+	std::mutex m_mutex;
+	/// @brief Signals new tasks or shutdown
+	std::condition_variable m_wake;
+	/// @brief Set when the pool shuts down
+	bool m_stop = false;
+};
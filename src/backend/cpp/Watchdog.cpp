@@ -0,0 +1,83 @@
+/**
+ * @file Watchdog.cpp
+ * @brief Learns how long jobs take and when one has hung.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Watchdog.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+Watchdog::Watchdog(const Settings &settings) : m_settings(settings)
+{
+	if (m_settings.Initial <= 0.0)
+		m_settings.Initial = Settings().Initial;
+}
+
+void Watchdog::record(const std::string &kind, double work, double seconds)
+{
+	if (work <= 0.0 || seconds < 0.0)
+		return;
+	std::deque<double> &factors = m_factors[kind];
+	factors.push_back(seconds / work);
+	if (factors.size() > Recent)
+		factors.pop_front();
+}
+
+double Watchdog::factor(const std::string &kind) const
+{
+	auto it = m_factors.find(kind);
+	if (it == m_factors.end())
+		return m_settings.Initial;
+	std::vector<double> sorted(it->second.begin(), it->second.end());
+	std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+	return sorted[sorted.size() / 2];
+}
+
+std::map<std::string, double> Watchdog::factors() const
+{
+	std::map<std::string, double> result;
+	for (const auto &[kind, factors] : m_factors)
+		result[kind] = factor(kind);
+	return result;
+}
+
+double Watchdog::expected(const std::string &kind, double work) const
+{
+	return std::max(0.0, work) * factor(kind);
+}
+
+double Watchdog::timeout(const std::string &kind, double work) const
+{
+	if (m_settings.Margin <= 0.0 || work <= 0.0)
+		return 0.0;
+	return std::max(m_settings.MinTimeout, m_settings.Margin * expected(kind, work));
+}
+
+double Watchdog::straggling(const std::string &kind, double work) const
+{
+	if (m_settings.Speculate <= 0.0 || work <= 0.0)
+		return 0.0;
+	return m_settings.Speculate * expected(kind, work);
+}
+
+double Watchdog::backoff(unsigned retry) const
+{
+	return m_settings.Backoff * std::pow(2.0, std::max(1u, retry) - 1.0);
+}
@@ -0,0 +1,127 @@
+/**
+ * @file Watchdog.h
+ * @brief Learns how long jobs take and when one has hung.
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <string>
+
+/**
+ * @brief Timeouts of jobs from their length and the speed of the jobs before them
+ *
+ * Every finished job adds its realtime factor, the seconds it ran per
+ * second of audio it encoded, to those of its kind, and the median of the
+ * recent factors of a kind is the one expected of the next job of that
+ * kind. Kinds, such as the encoder, are learned apart because their speeds
+ * differ by orders of magnitude. A job times out once it has run a multiple
+ * of its expected time, but never before a fixed minimum, so a short song
+ * on a busy machine is not mistaken for a hung one. Until the first job of
+ * a kind finished, an initial factor stands in.
+ *
+ * Near the end of a batch, a job that has run a smaller multiple of its
+ * expected time counts as a straggler, which JobScheduler may run a second
+ * copy of. Not thread-safe; JobScheduler calls it under its lock.
+ */
+class Watchdog
+{
+  public:
+	/// @brief Timeouts, retries and speculation
+	class Settings
+	{
+	  public:
+		/// @brief Timeout as a multiple of the expected time, 0 for no timeouts
+		double Margin = 5.0;
+		/// @brief Shortest timeout in seconds
+		double MinTimeout = 60.0;
+		/// @brief Realtime factor assumed until jobs finished
+		double Initial = 1.0;
+		/// @brief Times a job that timed out is run again
+		unsigned Retries = 2;
+		/// @brief Seconds before the first retry, doubled for every further one
+		double Backoff = 2.0;
+		/// @brief Running time, as a multiple of the expected time, from which a job is a straggler; 0 for none
+		double Speculate = 0.0;
+	};
+
+	/// @param settings Timeouts, retries and speculation
+	explicit Watchdog(const Settings &settings);
+
+	/// @brief Timeouts, retries and speculation
+	const Settings &settings() const
+	{
+		return m_settings;
+	}
+
+	/**
+	 * @brief Learn from a job that finished
+	 * @param kind Kind of the job
+	 * @param work Seconds of audio the job encoded
+	 * @param seconds Seconds it ran
+	 */
+	void record(const std::string &kind, double work, double seconds);
+
+	/// @brief Median realtime factor of the recent jobs of a kind, the initial one before any finished
+	double factor(const std::string &kind) const;
+
+	/// @brief Median realtime factor of every kind learned from so far
+	std::map<std::string, double> factors() const;
+
+	/**
+	 * @brief Expected running time of a job
+	 * @param kind Kind of the job
+	 * @param work Seconds of audio the job encodes
+	 * @return Seconds
+	 */
+	double expected(const std::string &kind, double work) const;
+
+	/**
+	 * @brief Running time after which a job is killed
+	 * @param kind Kind of the job
+	 * @param work Seconds of audio the job encodes
+	 * @return Seconds, 0 for none: timeouts are off or the work is unknown
+	 */
+	double timeout(const std::string &kind, double work) const;
+
+	/**
+	 * @brief Running time from which a job is a straggler
+	 * @param kind Kind of the job
+	 * @param work Seconds of audio the job encodes
+	 * @return Seconds, 0 for never: speculation is off or the work is unknown
+	 */
+	double straggling(const std::string &kind, double work) const;
+
+	/**
+	 * @brief Wait before a job is run again
+	 * @param retry 1 for the first retry
+	 * @return Seconds
+	 */
+	double backoff(unsigned retry) const;
+
+  private:
+	/// @brief Realtime factors the median is taken of
+	static constexpr size_t Recent = 32;
+
+	/// @brief Timeouts, retries and speculation
+	Settings m_settings;
+	/// @brief Realtime factors of the recent jobs of every kind, oldest first
+	std::map<std::string, std::deque<double>> m_factors;
+};
@@ -0,0 +1,450 @@
+/**
+ * @file WavReader.cpp
+ * @brief Implementation of the native WAV reader
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "WavReader.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/// @brief WAVE_FORMAT_PCM
+static constexpr std::uint16_t formatPCM = 0x0001;
+/// @brief WAVE_FORMAT_IEEE_FLOAT
+static constexpr std::uint16_t formatFloat = 0x0003;
+/// @brief WAVE_FORMAT_EXTENSIBLE
+static constexpr std::uint16_t formatExtensible = 0xFFFE;
+
+/// @brief Largest channel count convertToPlanar() handles
+static constexpr unsigned maxChannels = 64;
+
+/// @brief Read a little endian 16-bit value
+static std::uint16_t readLE16(const std::uint8_t *p)
+{
+	return static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+}
+
+/// @brief Read a little endian 32-bit value
+static std::uint32_t readLE32(const std::uint8_t *p)
+{
+	return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) |
+	       (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+/// @brief Read a little endian 64-bit value
+static std::uint64_t readLE64(const std::uint8_t *p)
+{
+	return static_cast<std::uint64_t>(readLE32(p)) | (static_cast<std::uint64_t>(readLE32(p + 4)) << 32);
+}
+
+/// @brief Compare a four character code
+static bool isFourCC(const std::uint8_t *p, const char *id)
+{
+	return std::memcmp(p, id, 4) == 0;
+}
+
+bool WavReader::open(const std::filesystem::path &filePath)
+{
+	close();
+
+	if (!m_file.open(filePath))
+		return false;
+
+	const std::uint8_t *data = m_file.data();
+	const std::uint64_t size = m_file.size();
+	if (size < 12 || !isFourCC(data + 8, "WAVE"))
+	{
+		close();
+		return false;
+	}
+	if (isFourCC(data, "RF64") || isFourCC(data, "BW64"))
+		m_rf64 = true;
+	else if (!isFourCC(data, "RIFF"))
+	{
+		close();
+		return false;
+	}
+
+	const std::string name = filePath.string();
+	std::uint64_t     ds64DataSize = 0;
+	bool              haveFormat = false, haveData = false;
+	std::uint64_t     dataSize = 0;
+	std::uint64_t     pos = 12;
+
+	while (pos + 8 <= size)
+	{
+		Chunk chunk;
+		std::memcpy(chunk.ID.data(), data + pos, 4);
+		chunk.Offset = pos + 8;
+		chunk.Size = readLE32(data + pos + 4);
+
+		if (isFourCC(data + pos, "data"))
+		{
+			if (m_rf64 && chunk.Size == 0xFFFFFFFF)
+				chunk.Size = ds64DataSize;
+			// Tolerate truncated files and streaming writers that never patched the size
+			if (chunk.Size == 0 || chunk.Size > size - chunk.Offset)
+				chunk.Size = size - chunk.Offset;
+		}
+		else if (chunk.Size > size - chunk.Offset)
+			throw std::runtime_error("Truncated " + std::string(chunk.ID.data(), 4) + " chunk in " + name);
+
+		const std::uint8_t *payload = data + chunk.Offset;
+		if (isFourCC(data + pos, "ds64") && chunk.Size >= 16)
+		{
+			ds64DataSize = readLE64(payload + 8);
+		}
+		else if (isFourCC(data + pos, "fmt ") && chunk.Size >= 16)
+		{
+			std::uint16_t tag = readLE16(payload);
+			m_channels = readLE16(payload + 2);
+			m_sampleRate = readLE32(payload + 4);
+			m_blockAlign = readLE16(payload + 12);
+			unsigned containerBits = readLE16(payload + 14);
+			m_bitsPerSample = containerBits;
+
+			if (tag == formatExtensible && chunk.Size >= 40)
+			{
+				unsigned validBits = readLE16(payload + 18);
+				if (validBits != 0 && validBits <= containerBits)
+					m_bitsPerSample = validBits;
+				// The first two bytes of the sub-format GUID carry the actual format tag
+				tag = readLE16(payload + 24);
+			}
+
+			if (tag == formatPCM)
+			{
+				switch (containerBits)
+				{
+				case 8:
+					m_format = SampleFormat::UInt8;
+					break;
+				case 16:
+					m_format = SampleFormat::Int16;
+					break;
+				case 24:
+					m_format = SampleFormat::Int24;
+					break;
+				case 32:
+					m_format = SampleFormat::Int32;
+					break;
+				}
+			}
+			else if (tag == formatFloat)
+			{
+				if (containerBits == 32)
+					m_format = SampleFormat::Float32;
+				else if (containerBits == 64)
+					m_format = SampleFormat::Float64;
+			}
+			haveFormat = true;
+		}
+		else if (isFourCC(data + pos, "bext") && chunk.Size >= 346)
+		{
+			// Description[256], Originator[32], OriginatorReference[32], Date[10], Time[8], TimeReference
+			m_timeReference = readLE64(payload + 338);
+		}
+
+		if (isFourCC(data + pos, "data") && !haveData)
+		{
+			haveData = true;
+			m_dataOffset = chunk.Offset;
+			dataSize = chunk.Size;
+		}
+
+		m_chunks.push_back(chunk);
+
+		std::uint64_t next = chunk.Offset + chunk.Size + (chunk.Size & 1);
+		if (next <= pos)
+			break;
+		pos = next;
+	}
+
+	if (!haveFormat)
+		throw std::runtime_error("Missing fmt chunk in " + name);
+	if (!haveData)
+		throw std::runtime_error("Missing data chunk in " + name);
+	if (m_format == SampleFormat::Unknown || m_channels == 0 || m_channels > maxChannels ||
+	    m_blockAlign != m_channels * bytesPerSample(m_format))
+		throw std::runtime_error("Unsupported sample format in " + name);
+
+	m_frames = dataSize / m_blockAlign;
+	m_file.adviseSequential(static_cast<size_t>(m_dataOffset), static_cast<size_t>(sampleDataSize()));
+	return true;
+}
+
+void WavReader::close()
+{
+	m_file.close();
+	m_chunks.clear();
+	m_format = SampleFormat::Unknown;
+	m_channels = m_sampleRate = m_bitsPerSample = m_blockAlign = 0;
+	m_frames = m_dataOffset = m_timeReference = 0;
+	m_rf64 = false;
+}
+
+size_t WavReader::read(std::uint64_t firstFrame, size_t frameCount, float *const *planes) const
+{
+	if (firstFrame >= m_frames)
+		return 0;
+	frameCount = static_cast<size_t>(std::min<std::uint64_t>(frameCount, m_frames - firstFrame));
+	convertToPlanar(sampleData() + firstFrame * m_blockAlign, m_format, m_channels, frameCount, planes);
+	return frameCount;
+}
+
+unsigned WavReader::bytesPerSample(SampleFormat format)
+{
+	switch (format)
+	{
+	case SampleFormat::UInt8:
+		return 1;
+	case SampleFormat::Int16:
+		return 2;
+	case SampleFormat::Int24:
+		return 3;
+	case SampleFormat::Int32:
+	case SampleFormat::Float32:
+		return 4;
+	case SampleFormat::Float64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Convert 16-bit samples to float
+ * @param src Samples
+ * @param dst Destination
+ * @param count Number of samples
+ */
+static void convertInt16(const std::uint8_t *src, float *dst, size_t count)
+{
+	constexpr float scale = 1.0f / 32768.0f;
+	size_t          i = 0;
+#if defined(MU_SIMD_SSE2)
+	const __m128 vscale = _mm_set1_ps(scale);
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 2));
+		// Duplicate each sample into both halves of a 32-bit lane, then shift the copy down to sign extend
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+	}
+#elif defined(MU_SIMD_NEON)
+	for (; i + 8 <= count; i += 8)
+	{
+		int16x8_t v = vld1q_s16(reinterpret_cast<const int16_t *>(src + i * 2));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), scale));
+		vst1q_f32(dst + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), scale));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = static_cast<float>(static_cast<std::int16_t>(readLE16(src + i * 2))) * scale;
+}
+
+#if defined(MU_SIMD_SSE2)
+/**
+ * @brief Convert packed 24-bit samples to float with SSSE3
+ * @param src Samples
+ * @param dst Destination
+ * @param count Number of samples
+ * @return Number of samples converted
+ */
+MU_TARGET_SSSE3 static size_t convertInt24Ssse3(const std::uint8_t *src, float *dst, size_t count)
+{
+	// Move the three bytes of each sample to the top of a 32-bit lane; the result is the sample scaled by 2^8
+	const __m128i shuffle = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+	const __m128  vscale = _mm_set1_ps(1.0f / 2147483648.0f);
+	size_t        i = 0;
+	// Each load reads 16 bytes but consumes 12, so stop while 4 bytes of slack remain
+	for (; i + 6 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 3));
+		__m128i s = _mm_shuffle_epi8(v, shuffle);
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(s), vscale));
+	}
+	return i;
+}
+#endif
+
+/**
+ * @brief Convert packed 24-bit samples to float
+ * @param src Samples
+ * @param dst Destination
+ * @param count Number of samples
+ */
+static void convertInt24(const std::uint8_t *src, float *dst, size_t count)
+{
+	size_t i = 0;
+#if defined(MU_SIMD_SSE2)
+	if (cpuHasSsse3())
+		i = convertInt24Ssse3(src, dst, count);
+#endif
+	constexpr float scale = 1.0f / 2147483648.0f;
+	for (; i < count; ++i)
+	{
+		const std::uint8_t *p = src + i * 3;
+		auto value = static_cast<std::int32_t>((static_cast<std::uint32_t>(p[0]) << 8) |
+		                                       (static_cast<std::uint32_t>(p[1]) << 16) |
+		                                       (static_cast<std::uint32_t>(p[2]) << 24));
+		dst[i] = static_cast<float>(value) * scale;
+	}
+}
+
+/**
+ * @brief Convert 32-bit samples to float
+ * @param src Samples
+ * @param dst Destination
+ * @param count Number of samples
+ */
+static void convertInt32(const std::uint8_t *src, float *dst, size_t count)
+{
+	constexpr float scale = 1.0f / 2147483648.0f;
+	size_t          i = 0;
+#if defined(MU_SIMD_SSE2)
+	const __m128 vscale = _mm_set1_ps(scale);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+		_mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(v), vscale));
+	}
+#elif defined(MU_SIMD_NEON)
+	for (; i + 4 <= count; i += 4)
+	{
+		int32x4_t v = vld1q_s32(reinterpret_cast<const int32_t *>(src + i * 4));
+		vst1q_f32(dst + i, vmulq_n_f32(vcvtq_f32_s32(v), scale));
+	}
+#endif
+	for (; i < count; ++i)
+		dst[i] = static_cast<float>(static_cast<std::int32_t>(readLE32(src + i * 4))) * scale;
+}
+
+/**
+ * @brief Convert interleaved samples of any format to interleaved float
+ * @param src Samples
+ * @param format Sample encoding
+ * @param dst Destination
+ * @param count Number of samples
+ */
+static void convertInterleaved(const std::uint8_t *src, WavReader::SampleFormat format, float *dst, size_t count)
+{
+	using SampleFormat = WavReader::SampleFormat;
+	switch (format)
+	{
+	case SampleFormat::UInt8:
+		for (size_t i = 0; i < count; ++i)
+			dst[i] = (static_cast<float>(src[i]) - 128.0f) * (1.0f / 128.0f);
+		break;
+	case SampleFormat::Int16:
+		convertInt16(src, dst, count);
+		break;
+	case SampleFormat::Int24:
+		convertInt24(src, dst, count);
+		break;
+	case SampleFormat::Int32:
+		convertInt32(src, dst, count);
+		break;
+	case SampleFormat::Float32:
+		std::memcpy(dst, src, count * sizeof(float));
+		break;
+	case SampleFormat::Float64:
+		for (size_t i = 0; i < count; ++i)
+		{
+			double value;
+			std::memcpy(&value, src + i * 8, sizeof(value));
+			dst[i] = static_cast<float>(value);
+		}
+		break;
+	default:
+		std::fill(dst, dst + count, 0.0f);
+		break;
+	}
+}
+
+/**
+ * @brief Split interleaved stereo into two planes
+ * @param src Interleaved samples
+ * @param left Left plane
+ * @param right Right plane
+ * @param frames Number of frames
+ */
+static void deinterleaveStereo(const float *src, float *left, float *right, size_t frames)
+{
+	size_t i = 0;
+#if defined(MU_SIMD_SSE2)
+	for (; i + 4 <= frames; i += 4)
+	{
+		__m128 a = _mm_loadu_ps(src + i * 2);
+		__m128 b = _mm_loadu_ps(src + i * 2 + 4);
+		_mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		_mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+	}
+#elif defined(MU_SIMD_NEON)
+	for (; i + 4 <= frames; i += 4)
+	{
+		float32x4x2_t v = vld2q_f32(src + i * 2);
+		vst1q_f32(left + i, v.val[0]);
+		vst1q_f32(right + i, v.val[1]);
+	}
+#endif
+	for (; i < frames; ++i)
+	{
+		left[i] = src[i * 2];
+		right[i] = src[i * 2 + 1];
+	}
+}
+
+void WavReader::convertToPlanar(const std::uint8_t *src, SampleFormat format, unsigned channels, size_t frames,
+                                float *const *planes)
+{
+	if (channels == 0)
+		return;
+
+	if (channels == 1)
+	{
+		convertInterleaved(src, format, planes[0], frames);
+		return;
+	}
+
+	// Convert a cache-sized block at a time, then split it into the planes
+	constexpr size_t                      scratchSamples = 4096;
+	alignas(16) static thread_local float scratch[scratchSamples];
+	const size_t                          blockFrames = scratchSamples / channels;
+	const size_t                          frameBytes = static_cast<size_t>(channels) * bytesPerSample(format);
+
+	for (size_t done = 0; done < frames;)
+	{
+		size_t block = std::min(blockFrames, frames - done);
+		convertInterleaved(src + done * frameBytes, format, scratch, block * channels);
+
+		if (channels == 2)
+			deinterleaveStereo(scratch, planes[0] + done, planes[1] + done, block);
+		else
+			for (size_t f = 0; f < block; ++f)
+				for (unsigned c = 0; c < channels; ++c)
+					planes[c][done + f] = scratch[f * channels + c];
+
+		done += block;
+	}
+}
@@ -0,0 +1,210 @@
+/**
+ * @file WavReader.h
+ * @brief Native WAV / RF64 / BWF reader with SIMD sample conversion.
+ *
+ * The file is memory mapped and samples are converted straight from the
+ * mapped data chunk to planar float, so inspecting or analysing PCM inputs
+ * does not need an ffmpeg decode.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * WavReader wav;
+ * if (wav.open("input.wav"))
+ * {
+ *     std::vector<float> left(wav.frames()), right(wav.frames());
+ *     float *planes[] = {left.data(), right.data()};
+ *     wav.read(0, wav.frames(), planes);
+ * }
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "MappedFile.h"
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+/// @brief Native WAV reader
+class WavReader
+{
+  public:
+	/// @brief PCM sample encodings
+	enum class SampleFormat
+	{
+		/// @brief Not a supported encoding
+		Unknown,
+		/// @brief 8-bit unsigned integer
+		UInt8,
+		/// @brief 16-bit signed integer
+		Int16,
+		/// @brief 24-bit signed integer, packed
+		Int24,
+		/// @brief 32-bit signed integer
+		Int32,
+		/// @brief 32-bit IEEE float
+		Float32,
+		/// @brief 64-bit IEEE float
+		Float64
+	};
+
+	/// @brief RIFF chunk location
+	class Chunk
+	{
+	  public:
+		/// @brief Four character chunk ID
+		std::array<char, 4> ID{};
+		/// @brief Byte offset of the chunk payload in the file
+		std::uint64_t Offset{};
+		/// @brief Payload size in bytes (without padding)
+		std::uint64_t Size{};
+	};
+
+	/**
+	 * @brief Open a WAV file
+	 *
+	 * Accepts RIFF/WAVE, RF64 and BW64 files with PCM, IEEE float or
+	 * WAVE_FORMAT_EXTENSIBLE data. JUNK, LIST, bext and any other chunks are
+	 * skipped but recorded in chunks().
+	 *
+	 * @param filePath File to open
+	 * @return false if the file is not a WAV file
+	 * @throws std::runtime_error if the file is a WAV file that cannot be read
+	 */
+	bool open(const std::filesystem::path &filePath);
+
+	/// @brief Close the file
+	void close();
+
+	/**
+	 * @brief Read frames as planar float
+	 *
+	 * @param firstFrame First frame to read
+	 * @param frameCount Number of frames to read
+	 * @param planes One destination buffer per channel
+	 * @return Number of frames read
+	 */
+	size_t read(std::uint64_t firstFrame, size_t frameCount, float *const *planes) const;
+
+	/**
+	 * @brief Convert interleaved PCM to planar float
+	 *
+	 * Integer samples are scaled to [-1, 1).
+	 *
+	 * @param src Interleaved samples
+	 * @param format Sample encoding
+	 * @param channels Number of channels
+	 * @param frames Number of frames
+	 * @param planes One destination buffer per channel
+	 */
+	static void convertToPlanar(const std::uint8_t *src, SampleFormat format, unsigned channels, size_t frames,
+	                            float *const *planes);
+
+	/**
+	 * @brief Size of one sample in bytes
+	 * @param format Sample encoding
+	 * @return Bytes per sample, 0 for SampleFormat::Unknown
+	 */
+	static unsigned bytesPerSample(SampleFormat format);
+
+	/// @brief Sample encoding
+	SampleFormat format() const
+	{
+		return m_format;
+	}
+	/// @brief Number of channels
+	unsigned channels() const
+	{
+		return m_channels;
+	}
+	/// @brief Sample rate in Hz
+	unsigned sampleRate() const
+	{
+		return m_sampleRate;
+	}
+	/// @brief Valid bits per sample
+	unsigned bitsPerSample() const
+	{
+		return m_bitsPerSample;
+	}
+	/// @brief Bytes per frame
+	unsigned blockAlign() const
+	{
+		return m_blockAlign;
+	}
+	/// @brief Number of frames in the data chunk
+	std::uint64_t frames() const
+	{
+		return m_frames;
+	}
+	/// @brief Whether the file uses 64-bit sizes (RF64 / BW64)
+	bool isRF64() const
+	{
+		return m_rf64;
+	}
+	/// @brief BWF time reference in samples since midnight, 0 without a bext chunk
+	std::uint64_t timeReference() const
+	{
+		return m_timeReference;
+	}
+	/// @brief Start of the interleaved sample data
+	const std::uint8_t *sampleData() const
+	{
+		return m_file.data() + m_dataOffset;
+	}
+	/// @brief Size of the sample data in bytes (whole frames only)
+	std::uint64_t sampleDataSize() const
+	{
+		return m_frames * m_blockAlign;
+	}
+	/// @brief Byte offset of the sample data in the file
+	std::uint64_t sampleDataOffset() const
+	{
+		return m_dataOffset;
+	}
+	/// @brief All chunks in file order
+	const std::vector<Chunk> &chunks() const
+	{
+		return m_chunks;
+	}
+
+  private:
+	/// @brief Mapped file
+	MappedFile m_file;
+	/// @brief Chunks in file order
+	std::vector<Chunk> m_chunks;
+	/// @brief Sample encoding
+	SampleFormat m_format = SampleFormat::Unknown;
+	/// @brief Number of channels
+	unsigned m_channels = 0;
+	/// @brief Sample rate
+	unsigned m_sampleRate = 0;
+	/// @brief Valid bits per sample
+	unsigned m_bitsPerSample = 0;
+	/// @brief Bytes per frame
+	unsigned m_blockAlign = 0;
+	/// @brief Number of frames
+	std::uint64_t m_frames = 0;
+	/// @brief Offset of the data chunk payload
+	std::uint64_t m_dataOffset = 0;
+	/// @brief BWF time reference
+	std::uint64_t m_timeReference = 0;
+	/// @brief RF64 / BW64 file
+	bool m_rf64 = false;
+};
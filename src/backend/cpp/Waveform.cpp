@@ -0,0 +1,329 @@
+/**
+ * @file Waveform.cpp
+ * @brief Implementation of the peak builder and the peak file format
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include "Waveform.h"
+#include "AudioSource.h"
+#include "MappedFile.h"
+#include "Simd.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+/// @brief Size of the file header in bytes
+static constexpr size_t headerSize = 32;
+/// @brief Size of a level table entry in bytes
+static constexpr size_t levelEntrySize = 16;
+
+/// @brief Append a little-endian integer of @p bytes bytes
+static void appendLE(std::string &out, std::uint64_t value, int bytes)
+{
+	for (int i = 0; i < bytes; ++i)
+		out += static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+/// @brief Read a little-endian integer of @p bytes bytes
+static std::uint64_t readLE(const std::uint8_t *p, int bytes)
+{
+	std::uint64_t value = 0;
+	for (int i = bytes; i-- > 0;)
+		value = (value << 8) | p[i];
+	return value;
+}
+
+/**
+ * @brief Smallest and largest sample of a buffer
+ * @param samples Samples
+ * @param count Number of samples, at least 1
+ * @param low Receives the minimum
+ * @param high Receives the maximum
+ */
+static void minMax(const float *samples, size_t count, float &low, float &high)
+{
+	size_t i = 0;
+	low = high = samples[0];
+#if defined(MU_SIMD_SSE2)
+	if (count >= 8)
+	{
+		__m128 low0 = _mm_loadu_ps(samples), high0 = low0;
+		__m128 low1 = _mm_loadu_ps(samples + 4), high1 = low1;
+		for (i = 8; i + 8 <= count; i += 8)
+		{
+			__m128 a = _mm_loadu_ps(samples + i), b = _mm_loadu_ps(samples + i + 4);
+			low0 = _mm_min_ps(low0, a);
+			high0 = _mm_max_ps(high0, a);
+			low1 = _mm_min_ps(low1, b);
+			high1 = _mm_max_ps(high1, b);
+		}
+		alignas(16) float lows[4], highs[4];
+		_mm_store_ps(lows, _mm_min_ps(low0, low1));
+		_mm_store_ps(highs, _mm_max_ps(high0, high1));
+		low = std::min({lows[0], lows[1], lows[2], lows[3]});
+		high = std::max({highs[0], highs[1], highs[2], highs[3]});
+	}
+#elif defined(MU_SIMD_NEON)
+	if (count >= 8)
+	{
+		float32x4_t low0 = vld1q_f32(samples), high0 = low0;
+		float32x4_t low1 = vld1q_f32(samples + 4), high1 = low1;
+		for (i = 8; i + 8 <= count; i += 8)
+		{
+			float32x4_t a = vld1q_f32(samples + i), b = vld1q_f32(samples + i + 4);
+			low0 = vminq_f32(low0, a);
+			high0 = vmaxq_f32(high0, a);
+			low1 = vminq_f32(low1, b);
+			high1 = vmaxq_f32(high1, b);
+		}
+		float lows[4], highs[4];
+		vst1q_f32(lows, vminq_f32(low0, low1));
+		vst1q_f32(highs, vmaxq_f32(high0, high1));
+		low = std::min({lows[0], lows[1], lows[2], lows[3]});
+		high = std::max({highs[0], highs[1], highs[2], highs[3]});
+	}
+#endif
+	for (; i < count; ++i)
+	{
+		low = std::min(low, samples[i]);
+		high = std::max(high, samples[i]);
+	}
+}
+
+/// @brief Sample value as int16, rounded down for minimums and up for maximums
+static std::int16_t toPeak(float value, bool maximum)
+{
+	double scaled = static_cast<double>(value) * 32767.0;
+	scaled = maximum ? std::ceil(scaled) : std::floor(scaled);
+	return static_cast<std::int16_t>(std::clamp(scaled, -32767.0, 32767.0));
+}
+
+void PeakFile::save(const std::filesystem::path &filePath) const
+{
+	std::string out;
+	out.append("MUPK", 4);
+	appendLE(out, Version, 2);
+	appendLE(out, Channels, 2);
+	appendLE(out, SampleRate, 4);
+	appendLE(out, Frames, 8);
+	appendLE(out, Levels.empty() ? BaseFrames : Levels.front().FramesPerPeak, 4);
+	appendLE(out, Levels.size(), 2);
+	appendLE(out, Factor, 2);
+	appendLE(out, 0, 4);
+
+	std::uint64_t offset = headerSize + Levels.size() * levelEntrySize;
+	for (const Level &level : Levels)
+	{
+		appendLE(out, Channels ? level.Peaks.size() / (2 * Channels) : 0, 8);
+		appendLE(out, offset, 8);
+		offset += level.Peaks.size() * 2;
+	}
+	for (const Level &level : Levels)
+		for (std::int16_t value : level.Peaks)
+			appendLE(out, static_cast<std::uint16_t>(value), 2);
+
+	std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+	file.write(out.data(), static_cast<std::streamsize>(out.size()));
+	file.close();
+	if (!file)
+		throw std::runtime_error("Failed to write " + filePath.string());
+}
+
+PeakFile PeakFile::load(const std::filesystem::path &filePath)
+{
+	MappedFile file;
+	if (!file.open(filePath))
+		throw std::runtime_error("Failed to open " + filePath.string());
+	const std::uint8_t *data = file.data();
+	const size_t        size = file.size();
+	if (size < headerSize || std::memcmp(data, "MUPK", 4) != 0 || readLE(data + 4, 2) != Version)
+		throw std::runtime_error("Not a peak file: " + filePath.string());
+
+	PeakFile peaks;
+	peaks.Channels = static_cast<unsigned>(readLE(data + 6, 2));
+	peaks.SampleRate = static_cast<unsigned>(readLE(data + 8, 4));
+	peaks.Frames = readLE(data + 12, 8);
+	std::uint64_t framesPerPeak = readLE(data + 20, 4);
+	const size_t  levels = static_cast<size_t>(readLE(data + 24, 2));
+	const auto    factor = readLE(data + 26, 2);
+	if (size < headerSize + levels * levelEntrySize)
+		throw std::runtime_error("Truncated peak file: " + filePath.string());
+
+	for (size_t l = 0; l < levels; ++l, framesPerPeak *= factor)
+	{
+		const std::uint8_t *entry = data + headerSize + l * levelEntrySize;
+		const std::uint64_t values = readLE(entry, 8) * 2 * peaks.Channels;
+		const std::uint64_t offset = readLE(entry + 8, 8);
+		if (offset > size || values > (size - offset) / 2)
+			throw std::runtime_error("Truncated peak file: " + filePath.string());
+
+		Level level;
+		level.FramesPerPeak = static_cast<std::uint32_t>(framesPerPeak);
+		level.Peaks.resize(static_cast<size_t>(values));
+		for (size_t i = 0; i < level.Peaks.size(); ++i)
+			level.Peaks[i] = static_cast<std::int16_t>(readLE(data + offset + 2 * i, 2));
+		peaks.Levels.push_back(std::move(level));
+	}
+	return peaks;
+}
+
+PeakBuilder::PeakBuilder(unsigned channels, unsigned sampleRate)
+    : m_channels(channels), m_sampleRate(sampleRate), m_current(2 * static_cast<size_t>(channels)),
+      m_planes(channels)
+{
+}
+
+void PeakBuilder::process(const float *const *planes, size_t frames)
+{
+	size_t done = 0;
+	while (done < frames)
+	{
+		// Fill the current peak up to its end, one SIMD reduction per channel
+		const size_t span = std::min<size_t>(frames - done, PeakFile::BaseFrames - m_fill);
+		for (unsigned c = 0; c < m_channels; ++c)
+		{
+			float low, high;
+			minMax(planes[c] + done, span, low, high);
+			float &currentLow = m_current[2 * c], &currentHigh = m_current[2 * c + 1];
+			currentLow = m_fill ? std::min(currentLow, low) : low;
+			currentHigh = m_fill ? std::max(currentHigh, high) : high;
+		}
+		m_fill += static_cast<std::uint32_t>(span);
+		done += span;
+		if (m_fill == PeakFile::BaseFrames)
+		{
+			m_peaks.insert(m_peaks.end(), m_current.begin(), m_current.end());
+			m_fill = 0;
+		}
+	}
+	m_frames += frames;
+}
+
+void PeakBuilder::processInterleaved(const float *samples, size_t frames)
+{
+	std::vector<float *> planes;
+	for (auto &plane : m_planes)
+	{
+		plane.resize(frames);
+		planes.push_back(plane.data());
+	}
+	for (size_t i = 0; i < frames; ++i)
+		for (unsigned c = 0; c < m_channels; ++c)
+			planes[c][i] = samples[i * m_channels + c];
+	process(planes.data(), frames);
+}
+
+PeakFile PeakBuilder::result() const
+{
+	PeakFile peaks;
+	peaks.Channels = m_channels;
+	peaks.SampleRate = m_sampleRate;
+	peaks.Frames = m_frames;
+
+	std::vector<float> level = m_peaks;
+	if (m_fill > 0)
+		level.insert(level.end(), m_current.begin(), m_current.end());
+
+	const size_t  width = 2 * static_cast<size_t>(m_channels);
+	std::uint32_t framesPerPeak = PeakFile::BaseFrames;
+	while (width > 0)
+	{
+		PeakFile::Level out;
+		out.FramesPerPeak = framesPerPeak;
+		out.Peaks.resize(level.size());
+		for (size_t i = 0; i < level.size(); ++i)
+			out.Peaks[i] = toPeak(level[i], i % 2 == 1);
+		peaks.Levels.push_back(std::move(out));
+
+		const size_t count = level.size() / width;
+		if (count <= PeakFile::TopPeaks || framesPerPeak > std::numeric_limits<std::uint32_t>::max() / PeakFile::Factor)
+			break;
+
+		// Every peak of the next level combines Factor peaks of this one
+		std::vector<float> next;
+		next.reserve((count + PeakFile::Factor - 1) / PeakFile::Factor * width);
+		for (size_t first = 0; first < count; first += PeakFile::Factor)
+		{
+			const size_t last = std::min<size_t>(first + PeakFile::Factor, count);
+			for (size_t v = 0; v < width; ++v)
+			{
+				float value = level[first * width + v];
+				for (size_t p = first + 1; p < last; ++p)
+					value = v % 2 ? std::max(value, level[p * width + v]) : std::min(value, level[p * width + v]);
+				next.push_back(value);
+			}
+		}
+		level = std::move(next);
+		framesPerPeak *= PeakFile::Factor;
+	}
+	return peaks;
+}
+
+PeakFile PeakBuilder::fromFile(const std::filesystem::path &filePath)
+{
+	AudioSource source;
+	source.open(filePath);
+
+	PeakBuilder builder(source.channels(), source.sampleRate());
+
+	constexpr size_t                blockFrames = 8192;
+	std::vector<std::vector<float>> buffers(source.channels(), std::vector<float>(blockFrames));
+	std::vector<float *>            planes;
+	for (auto &buffer : buffers)
+		planes.push_back(buffer.data());
+
+	while (size_t frames = source.read(planes.data(), blockFrames))
+		builder.process(planes.data(), frames);
+
+	return builder.result();
+}
+
+/// @brief Passes the audio through and feeds a PeakBuilder
+class PeakTapStage : public DspGraph::Stage
+{
+  public:
+	explicit PeakTapStage(std::optional<PeakBuilder> &target) : m_target(target)
+	{
+	}
+
+	void prepare(unsigned channels, unsigned sampleRate) override
+	{
+		m_channels = channels;
+		m_target.emplace(channels, sampleRate);
+	}
+
+	size_t process(const float *input, size_t frames, float *output) override
+	{
+		m_target->processInterleaved(input, frames);
+		std::copy(input, input + frames * m_channels, output);
+		return frames;
+	}
+
+  private:
+	std::optional<PeakBuilder> &m_target;
+	unsigned                    m_channels = 0;
+};
+
+std::unique_ptr<DspGraph::Stage> PeakBuilder::tap(std::optional<PeakBuilder> &target)
+{
+	return std::make_unique<PeakTapStage>(target);
+}
@@ -0,0 +1,173 @@
+/**
+ * @file Waveform.h
+ * @brief Multi-resolution min/max peak files for drawing waveforms.
+ *
+ * A peak file holds the smallest and largest sample of every channel for
+ * consecutive runs of frames, at several zoom levels: level 0 has one peak
+ * per 256 frames, each further level combines 4 peaks of the level below,
+ * and levels are added until the coarsest one holds at most 1024 peaks.
+ * A three minute song at 44.1 kHz needs about 330 KiB in stereo.
+ *
+ * File format, all integers little-endian:
+ *
+ * | Offset | Type     | Field                                        |
+ * |--------|----------|----------------------------------------------|
+ * | 0      | char[4]  | "MUPK"                                       |
+ * | 4      | uint16   | Version, 1                                   |
+ * | 6      | uint16   | Channels                                     |
+ * | 8      | uint32   | Sample rate in Hz                            |
+ * | 12     | uint64   | Length in frames                             |
+ * | 20     | uint32   | Frames per peak of level 0                   |
+ * | 24     | uint16   | Number of levels                             |
+ * | 26     | uint16   | Peaks of a level combined into one above it  |
+ * | 28     | uint32   | Reserved, 0                                  |
+ * | 32     | 16 bytes | Per level: uint64 peak count, uint64 offset  |
+ *
+ * The offset of a level points to its peaks in time order. Each peak is a
+ * pair of int16 (minimum, maximum) per channel, channels interleaved, with
+ * full scale at 32767; minimums are rounded down and maximums up. The last
+ * peak of a level may cover fewer frames than the others.
+ *
+ * @author Daniel McGuire
+ *
+ * @code
+ * PeakFile peaks = PeakBuilder::fromFile("master.wav");
+ * peaks.save("master.flac.peaks");
+ * @endcode
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+#include "DspGraph.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <vector>
+
+/// @brief Min/max peaks at several zoom levels
+class PeakFile
+{
+  public:
+	/// @brief Peaks of one zoom level
+	class Level
+	{
+	  public:
+		/// @brief Frames covered by each peak
+		std::uint32_t FramesPerPeak = 0;
+		/// @brief Minimum and maximum per channel for every peak
+		std::vector<std::int16_t> Peaks;
+	};
+
+	/// @brief Number of channels
+	unsigned Channels = 0;
+	/// @brief Sample rate in Hz
+	unsigned SampleRate = 0;
+	/// @brief Length in frames
+	std::uint64_t Frames = 0;
+	/// @brief Levels, finest first
+	std::vector<Level> Levels;
+
+	/**
+	 * @brief Write the file
+	 * @param filePath File to write
+	 * @throws std::runtime_error if the file cannot be written
+	 */
+	void save(const std::filesystem::path &filePath) const;
+
+	/**
+	 * @brief Read a file
+	 * @param filePath File to read
+	 * @return Peaks
+	 * @throws std::runtime_error if the file cannot be read or is not a peak file
+	 */
+	static PeakFile load(const std::filesystem::path &filePath);
+
+	/// @brief Frames per peak of level 0
+	static constexpr std::uint32_t BaseFrames = 256;
+	/// @brief Peaks of a level combined into one peak of the level above
+	static constexpr unsigned Factor = 4;
+	/// @brief Levels are added until the coarsest holds at most this many peaks
+	static constexpr std::uint64_t TopPeaks = 1024;
+	/// @brief File format version
+	static constexpr unsigned Version = 1;
+};
+
+/// @brief Builds a PeakFile from streamed audio
+class PeakBuilder
+{
+  public:
+	/**
+	 * @brief Create a builder
+	 * @param channels Number of channels
+	 * @param sampleRate Sample rate in Hz
+	 */
+	PeakBuilder(unsigned channels, unsigned sampleRate);
+
+	/**
+	 * @brief Feed planar samples
+	 * @param planes One buffer per channel
+	 * @param frames Number of frames
+	 */
+	void process(const float *const *planes, size_t frames);
+
+	/**
+	 * @brief Feed interleaved samples
+	 * @param samples Interleaved frames
+	 * @param frames Number of frames
+	 */
+	void processInterleaved(const float *samples, size_t frames);
+
+	/// @brief Peaks of everything processed so far
+	PeakFile result() const;
+
+	/**
+	 * @brief Build the peaks of a whole file
+	 *
+	 * @param filePath Input, read natively if it is a WAV file
+	 * @return Peaks
+	 * @throws std::runtime_error if the file cannot be read
+	 */
+	static PeakFile fromFile(const std::filesystem::path &filePath);
+
+	/**
+	 * @brief Graph stage that passes the audio through and builds its peaks
+	 *
+	 * The builder is created in @p target when the graph starts, with the
+	 * format the stage receives.
+	 *
+	 * @param target Builder to create and feed; must outlive the graph run
+	 * @return Stage
+	 */
+	static std::unique_ptr<DspGraph::Stage> tap(std::optional<PeakBuilder> &target);
+
+  private:
+	/// @brief Number of channels
+	unsigned m_channels;
+	/// @brief Sample rate
+	unsigned m_sampleRate;
+	/// @brief Frames processed
+	std::uint64_t m_frames = 0;
+	/// @brief Completed level 0 peaks: minimum and maximum per channel
+	std::vector<float> m_peaks;
+	/// @brief Peak being filled: minimum and maximum per channel
+	std::vector<float> m_current;
+	/// @brief Frames in the peak being filled
+	std::uint32_t m_fill = 0;
+	/// @brief Deinterleaving buffers for processInterleaved()
+	std::vector<std::vector<float>> m_planes;
+};
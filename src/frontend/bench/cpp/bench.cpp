@@ -0,0 +1,527 @@
+/**
+ * @file bench.cpp
+ * @brief Mastering Utility Benchmarks
+ * @author Daniel McGuire
+ */
+
+// Copyright 2025 Daniel McGuire
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#include <AudioSource.h>
+#include <DspGraph.h>
+#include <Fingerprint.h>
+#include <FlacEncoder.h>
+#include <MasteringUtil.h>
+#include <Preflight.h>
+#include <TagWriter.h>
+#include <WavReader.h>
+#include <Waveform.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <dconsole.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/// @brief Benchmark clock
+using BenchClock = std::chrono::steady_clock;
+
+/**
+ * @brief Write a synthetic markup file
+ * @param path File to write
+ * @param albumCount Number of albums
+ * @param songCount Number of songs per album
+ */
+static void writeMarkup(const std::filesystem::path &path, int albumCount, int songCount)
+{
+	std::ofstream file(path, std::ios::binary);
+	file << "; Mastering Utility\n";
+	for (int a = 1; a <= albumCount; ++a)
+	{
+		file << "album " << a << " (\"Album " << a << "\", \"Artist\", \"Copyright\", \"cover.png\", \"./\", "
+		     << "\"./out\", \"Genre\", \"2025\", \"Comment\", \"-ar 44100 -af loudnorm=I=-14:TP=-1 | tee\", "
+		     << "\"false\")\n{\n";
+		for (int s = 1; s <= songCount; ++s)
+			file << "    song " << s << " (\"Song " << s << "\", \"Artist\", " << s << ", \"in" << s
+			     << ".wav\", \"out" << s << ".mp3\", \"libmp3lame\", \"Genre\", \"2025\", \"Comment\", "
+			     << "\"-b:a 320k -compression_level 0 -write_xing 1 && echo\")\n";
+		file << "}\n\n";
+	}
+}
+
+/**
+ * @brief Parse benchmark
+ *
+ * Measures ParseMarkup() on a large catalog, which is dominated by field
+ * splitting and argument sanitization.
+ *
+ * @param dir Scratch directory
+ * @param iterations Number of parses
+ */
+static void benchParse(const std::filesystem::path &dir, int iterations)
+{
+	constexpr int albumCount = 200;
+	constexpr int songCount = 30;
+
+	std::filesystem::path markup = dir / "bench.mas";
+	writeMarkup(markup, albumCount, songCount);
+
+	MasteringUtility masterer;
+	size_t           parsedSongs = 0;
+	auto             start = BenchClock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		MasteringUtility::Albums albums;
+		masterer.ParseMarkup(markup, albums);
+		for (const auto &album : albums)
+			parsedSongs += album.SongsList.size();
+	}
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+	std::cout << "parse: " << albumCount << " albums x " << songCount << " songs, " << iterations << " runs, "
+	          << (elapsed.count() * 1000.0 / iterations) << " ms/parse, "
+	          << (static_cast<double>(parsedSongs) / elapsed.count()) << " songs/s\n";
+}
+
+/**
+ * @brief Write a synthetic WAV file
+ * @param path File to write
+ * @param formatTag 1 for integer PCM, 3 for IEEE float
+ * @param bits Bits per sample
+ * @param channels Number of channels
+ * @param frames Number of frames
+ */
+static void writeWav(const std::filesystem::path &path, unsigned formatTag, unsigned bits, unsigned channels,
+                     uint64_t frames)
+{
+	auto le = [](std::ofstream &out, uint32_t value, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			out.put(static_cast<char>((value >> (8 * i)) & 0xFF));
+	};
+
+	const unsigned blockAlign = channels * bits / 8;
+	const uint64_t dataSize = frames * blockAlign;
+
+	std::ofstream file(path, std::ios::binary);
+	file << "RIFF";
+	le(file, static_cast<uint32_t>(dataSize + 36), 4);
+	file << "WAVEfmt ";
+	le(file, 16, 4);
+	le(file, formatTag, 2);
+	le(file, channels, 2);
+	le(file, 48000, 4);
+	le(file, 48000 * blockAlign, 4);
+	le(file, blockAlign, 2);
+	le(file, bits, 2);
+	file << "data";
+	le(file, static_cast<uint32_t>(dataSize), 4);
+
+	// Pseudo-random payload; the values don't matter for conversion speed
+	std::vector<char> block(1 << 20);
+	uint32_t          state = 0x12345678;
+	for (auto &byte : block)
+	{
+		state = state * 1664525u + 1013904223u;
+		byte = static_cast<char>(state >> 24);
+	}
+	if (formatTag == 3)
+		for (size_t i = 0; i + 4 <= block.size(); i += 4)
+		{
+			float value = static_cast<float>(static_cast<int8_t>(block[i])) / 128.0f;
+			std::memcpy(block.data() + i, &value, sizeof(value));
+		}
+	for (uint64_t written = 0; written < dataSize; written += block.size())
+		file.write(block.data(), static_cast<std::streamsize>(std::min<uint64_t>(block.size(), dataSize - written)));
+}
+
+/**
+ * @brief WAV conversion benchmark
+ *
+ * Measures WavReader::read() from the mapped data chunk to planar float for
+ * each supported sample width, and AudioFingerprint::compute() on the same
+ * file. Throughput is reported in GB/s of PCM input.
+ *
+ * @param dir Scratch directory
+ * @param iterations Number of passes over each file
+ */
+static void benchWav(const std::filesystem::path &dir, int iterations)
+{
+	struct Case
+	{
+		const char *name;
+		unsigned    formatTag;
+		unsigned    bits;
+	};
+	constexpr Case   cases[] = {{"int16", 1, 16}, {"int24", 1, 24}, {"int32", 1, 32}, {"float32", 3, 32}};
+	constexpr size_t frames = 48000 * 60 * 2;
+
+	for (const Case &c : cases)
+	{
+		std::filesystem::path path = dir / (std::string("bench_") + c.name + ".wav");
+		writeWav(path, c.formatTag, c.bits, 2, frames);
+
+		WavReader wav;
+		wav.open(path);
+
+		std::vector<float> left(frames), right(frames);
+		float             *planes[] = {left.data(), right.data()};
+		wav.read(0, frames, planes); // fault the mapping in
+
+		auto start = BenchClock::now();
+		for (int i = 0; i < iterations; ++i)
+			wav.read(0, frames, planes);
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+		double bytes = static_cast<double>(wav.sampleDataSize()) * iterations;
+		std::cout << "wav " << c.name << ": " << (bytes / elapsed.count() / 1e9) << " GB/s";
+		wav.close();
+
+		start = BenchClock::now();
+		for (int i = 0; i < iterations; ++i)
+			AudioFingerprint::compute(path);
+		elapsed = BenchClock::now() - start;
+		std::cout << ", fingerprint " << (bytes / elapsed.count() / 1e9) << " GB/s";
+
+		start = BenchClock::now();
+		for (int i = 0; i < iterations; ++i)
+			PreflightScanner::scanFile(path);
+		elapsed = BenchClock::now() - start;
+		std::cout << ", preflight " << (bytes / elapsed.count() / 1e9) << " GB/s";
+
+		start = BenchClock::now();
+		for (int i = 0; i < iterations; ++i)
+			PeakBuilder::fromFile(path);
+		elapsed = BenchClock::now() - start;
+		std::cout << ", peaks " << (bytes / elapsed.count() / 1e9) << " GB/s\n";
+
+		std::filesystem::remove(path);
+	}
+}
+
+/**
+ * @brief Retag benchmark
+ *
+ * Tags a catalog of 1000 MP3 streams with TagWriter: once from scratch,
+ * which inserts an ID3v2 tag by rewriting each file, then repeatedly with
+ * changed titles, which fits into the padding and is written in place.
+ *
+ * @param dir Scratch directory
+ * @param iterations Number of in-place passes over the catalog
+ */
+static void benchRetag(const std::filesystem::path &dir, int iterations)
+{
+	constexpr int    trackCount = 1000;
+	constexpr size_t frameCount = 160; // about 4 s of 128 kbit/s frames, 64 KiB
+
+	std::string audio;
+	for (size_t i = 0; i < frameCount; ++i)
+		audio += std::string("\xFF\xFB\x90\x64", 4) + std::string(413, static_cast<char>(i));
+
+	std::vector<std::filesystem::path> tracks;
+	for (int i = 0; i < trackCount; ++i)
+	{
+		tracks.push_back(dir / ("retag_" + std::to_string(i) + ".mp3"));
+		std::ofstream(tracks.back(), std::ios::binary) << audio;
+	}
+
+	TagWriter::Tags tags;
+	tags[static_cast<size_t>(TagWriter::Field::Artist)] = "Benchmark Artist";
+	tags[static_cast<size_t>(TagWriter::Field::Album)] = "Benchmark Album";
+
+	auto pass = [&](int run) {
+		auto start = BenchClock::now();
+		for (size_t i = 0; i < tracks.size(); ++i)
+		{
+			tags[static_cast<size_t>(TagWriter::Field::Title)] =
+			    "Track " + std::to_string(i) + " take " + std::to_string(run);
+			TagWriter::write(tracks[i], tags);
+		}
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+		return elapsed.count();
+	};
+
+	double rewrite = pass(0);
+	double inPlace = 0.0;
+	for (int i = 1; i <= iterations; ++i)
+		inPlace += pass(i);
+
+	std::cout << "retag: " << trackCount << " tracks, first tag " << (rewrite * 1000.0) << " ms, in place "
+	          << (inPlace * 1000.0 / iterations) << " ms/catalog\n";
+
+	for (const auto &track : tracks)
+		std::filesystem::remove(track);
+}
+
+/**
+ * @brief Native FLAC encoder benchmark
+ *
+ * Encodes 30 seconds of a synthetic 48 kHz 24-bit stereo mix (detuned
+ * partials, a slow envelope and a little noise) at compression levels 0, 5
+ * and 8 on all workers, and level 5 on a single worker. Speed is reported as
+ * a multiple of real time, size as a share of the PCM data.
+ *
+ * @param dir Scratch directory
+ * @param iterations Number of encodes per configuration
+ */
+static void benchFlac(const std::filesystem::path &dir, int iterations)
+{
+	constexpr unsigned rate = 48000;
+	constexpr size_t   frames = rate * 30;
+
+	std::string data;
+	data.reserve(frames * 6);
+	uint32_t state = 0x12345678;
+	for (size_t i = 0; i < frames; ++i)
+	{
+		double t = static_cast<double>(i) / rate;
+		double envelope = 0.6 + 0.4 * std::sin(2 * 3.14159265358979 * 0.25 * t);
+		for (int c = 0; c < 2; ++c)
+		{
+			double value = 0;
+			for (int partial = 1; partial <= 6; ++partial)
+				value += std::sin(2 * 3.14159265358979 * (110.0 + c * 0.7) * partial * t) / (partial * 4);
+			state = state * 1664525u + 1013904223u;
+			value = value * envelope + static_cast<double>(static_cast<int16_t>(state >> 16)) / 32768.0 * 1e-3;
+			auto sample = static_cast<int32_t>(value * 8388607.0);
+			for (int b = 0; b < 3; ++b)
+				data += static_cast<char>((sample >> (8 * b)) & 0xFF);
+		}
+	}
+
+	auto le = [](std::string &out, uint32_t value, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			out += static_cast<char>((value >> (8 * i)) & 0xFF);
+	};
+	std::string header = "RIFF";
+	le(header, static_cast<uint32_t>(data.size() + 36), 4);
+	header += "WAVEfmt ";
+	le(header, 16, 4);
+	le(header, 1, 2);
+	le(header, 2, 2);
+	le(header, rate, 4);
+	le(header, rate * 6, 4);
+	le(header, 6, 2);
+	le(header, 24, 2);
+	header += "data";
+	le(header, static_cast<uint32_t>(data.size()), 4);
+
+	std::filesystem::path input = dir / "bench_flac.wav";
+	std::filesystem::path output = dir / "bench_flac.flac";
+	std::ofstream(input, std::ios::binary) << header << data;
+
+	WavReader wav;
+	wav.open(input);
+	TagWriter::Tags tags;
+	tags[static_cast<size_t>(TagWriter::Field::Title)] = "Benchmark";
+
+	ThreadPool single(1), all;
+	struct Case
+	{
+		int         level;
+		ThreadPool *pool;
+	};
+	const Case cases[] = {{0, &all}, {5, &single}, {5, &all}, {8, &all}};
+	for (const Case &c : cases)
+	{
+		FlacEncoder::Settings settings;
+		settings.CompressionLevel = c.level;
+
+		auto start = BenchClock::now();
+		for (int i = 0; i < iterations; ++i)
+			FlacEncoder::encode(wav, output, tags, settings, *c.pool);
+		std::chrono::duration<double> elapsed = BenchClock::now() - start;
+
+		double realtime = 30.0 * iterations / elapsed.count();
+		double share = 100.0 * static_cast<double>(std::filesystem::file_size(output)) / data.size();
+		std::cout << "flac level " << c.level << " (" << c.pool->size() << " threads): " << realtime
+		          << "x realtime, " << share << "% of PCM\n";
+	}
+
+	wav.close();
+	std::filesystem::remove(input);
+	std::filesystem::remove(output);
+}
+
+/**
+ * @brief THD+N of a sine
+ *
+ * The fundamental is fitted by least squares and removed; the rest is
+ * distortion and noise.
+ *
+ * @param samples Signal, scaled to [-1, 1)
+ * @param frequency Frequency of the sine in cycles per sample
+ * @return Ratio of the residual to the signal in dB
+ */
+static double thdPlusNoise(const std::vector<double> &samples, double frequency)
+{
+	double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		double phase = 2 * 3.14159265358979 * frequency * i;
+		double s = std::sin(phase), c = std::cos(phase);
+		ss += s * s;
+		sc += s * c;
+		cc += c * c;
+		ys += samples[i] * s;
+		yc += samples[i] * c;
+	}
+	double det = ss * cc - sc * sc;
+	double a = (ys * cc - yc * sc) / det, b = (yc * ss - ys * sc) / det;
+
+	double signal = 0, residual = 0;
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		double phase = 2 * 3.14159265358979 * frequency * i;
+		double fit = a * std::sin(phase) + b * std::cos(phase);
+		signal += fit * fit;
+		residual += (samples[i] - fit) * (samples[i] - fit);
+	}
+	return 10 * std::log10(residual / signal);
+}
+
+/// @brief Convert 30 seconds of a 96 kHz sine to 44.1 kHz, then to 16 bits with and without noise shaping
+static void benchDsp(int iterations)
+{
+	constexpr unsigned inputRate = 96000, outputRate = 44100;
+	constexpr size_t   frames = inputRate * 30, block = 16384;
+
+	std::vector<float> input(frames);
+	for (size_t i = 0; i < frames; ++i)
+		input[i] = static_cast<float>(0.891 * std::sin(2 * 3.14159265358979 * 997.0 * i / inputRate));
+
+	std::vector<float> output;
+	auto               start = BenchClock::now();
+	for (int i = 0; i < iterations; ++i)
+	{
+		Resampler resampler(inputRate, outputRate);
+		output.resize(resampler.maxOutput(frames) + resampler.maxOutput(0));
+		size_t count = 0;
+		for (size_t j = 0; j < frames; j += block)
+			count += resampler.process(input.data() + j, std::min(block, frames - j), output.data() + count);
+		count += resampler.flush(output.data() + count);
+		output.resize(count);
+	}
+	std::chrono::duration<double> elapsed = BenchClock::now() - start;
+	std::cout << "resample 96k -> 44.1k: " << 30.0 * iterations / elapsed.count() << "x realtime per channel\n";
+
+	// Skip the filter's start and end transients
+	const size_t        skip = outputRate / 10;
+	std::vector<double> measured(output.begin() + skip, output.end() - skip);
+	std::cout << "THD+N float: " << thdPlusNoise(measured, 997.0 / outputRate) << " dB";
+
+	std::vector<int32_t> quantized(output.size());
+	for (auto [mode, name] : {std::pair{Ditherer::Mode::Triangular, "16-bit TPDF"},
+	                          std::pair{Ditherer::Mode::Shaped, "16-bit shaped"}})
+	{
+		start = BenchClock::now();
+		for (int i = 0; i < iterations; ++i)
+			Ditherer(16, mode, outputRate, 1).process(output.data(), output.size(), quantized.data());
+		elapsed = BenchClock::now() - start;
+		for (size_t i = 0; i < measured.size(); ++i)
+			measured[i] = quantized[i + skip] / 32768.0;
+		std::cout << ", " << name << ": " << thdPlusNoise(measured, 997.0 / outputRate) << " dB ("
+		          << 30.0 * iterations / elapsed.count() << "x realtime)";
+	}
+	std::cout << "\n";
+}
+
+/// @brief Sink that drops the audio
+class NullSink : public DspGraph::Sink
+{
+  public:
+	void open(unsigned, unsigned) override
+	{
+	}
+	void write(const float *, size_t) override
+	{
+	}
+	void close() override
+	{
+	}
+};
+
+/**
+ * @brief DSP graph benchmark
+ *
+ * Runs a gain, limiter, fade and dither chain over 30 seconds of 48 kHz
+ * 24-bit stereo, once on the calling thread and once with every stage on its
+ * own thread, at a small and a large block size.
+ *
+ * @param dir Scratch directory
+ * @param iterations Number of runs per case
+ */
+static void benchGraph(const std::filesystem::path &dir, int iterations)
+{
+	std::filesystem::path input = dir / "bench_graph.wav";
+	writeWav(input, 1, 24, 2, 48000 * 30);
+
+	for (bool threaded : {false, true})
+	{
+		for (size_t blockSize : {256, 4096})
+		{
+			DspGraph::Settings settings;
+			settings.Threaded = threaded;
+			settings.BlockSize = blockSize;
+
+			auto start = BenchClock::now();
+			for (int i = 0; i < iterations; ++i)
+			{
+				DspGraph graph;
+				graph.addFilters("volume=-1dB,alimiter=limit=0.9:level=0,afade=t=out:st=25:d=5");
+				graph.add(DspGraph::dither(16, Ditherer::Mode::Shaped));
+				AudioSource source;
+				source.open(input);
+				NullSink sink;
+				graph.run(source, sink, settings);
+			}
+			std::chrono::duration<double> elapsed = BenchClock::now() - start;
+			std::cout << "dsp graph " << (threaded ? "threaded" : "serial") << ", " << blockSize
+			          << " frames: " << 30.0 * iterations / elapsed.count() << "x realtime\n";
+		}
+	}
+	std::filesystem::remove(input);
+}
+
+/// @brief CRT Entry Point
+int main(int argc, char **argv)
+{
+	DConsole conlib;
+	conlib.supressUnknownArgument = true;
+	conlib.registerFlag("iterations", DConsole::f::string, 'n');
+	conlib.parse(argc, argv);
+
+	int         iterations = 20;
+	std::string iterationsArg = conlib.f_string("iterations");
+	if (!iterationsArg.empty())
+		iterations = std::max(1, std::stoi(iterationsArg));
+
+	std::filesystem::path dir = std::filesystem::temp_directory_path() / "masteringutil_bench";
+	std::filesystem::create_directories(dir);
+
+	benchParse(dir, iterations);
+	benchWav(dir, iterations);
+	benchRetag(dir, iterations);
+	benchFlac(dir, iterations);
+	benchDsp(iterations);
+	benchGraph(dir, iterations);
+
+	std::filesystem::remove_all(dir);
+	return 0;
+}
@@ -19,10 +19,14 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <JobServer.h>
 #include <MasteringUtil.h>
 #include <dconsole.h>
 #include <filesystem>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
 #include <string>
 
 /// @brief CRT Entry Point
@@ -36,9 +40,150 @@ int main(int argc, char *argv[])
 	conlib.supressUnknownArgument = true;
 	conlib.registerFlag("help", DConsole::f::boolean, 'h');
 	conlib.registerFlag("markupfile", DConsole::f::string, 'f');
+	conlib.registerFlag("analyze", DConsole::f::boolean, 'a');
+	conlib.registerFlag("replaygain", DConsole::f::boolean, 'r');
+	conlib.registerFlag("blocksize", DConsole::f::string, 'b');
+	conlib.registerFlag("segment", DConsole::f::string, 's');
+	conlib.registerFlag("preflight", DConsole::f::boolean, 'p');
+	conlib.registerFlag("strict", DConsole::f::boolean, 'x');
+	conlib.registerFlag("report", DConsole::f::string, 'o');
+	conlib.registerFlag("peaks", DConsole::f::boolean, 'w');
+	conlib.registerFlag("prefetch", DConsole::f::string, 'k');
+	conlib.registerFlag("devicejobs", DConsole::f::string, 'd');
+	conlib.registerFlag("album", DConsole::f::string, 'l');
+	conlib.registerFlag("song", DConsole::f::string, 'g');
+	conlib.registerFlag("daemon", DConsole::f::boolean, 'm');
+	conlib.registerFlag("submit", DConsole::f::boolean, 'j');
+	conlib.registerFlag("socket", DConsole::f::string, 'u');
+	conlib.registerFlag("priority", DConsole::f::string, 'i');
+	conlib.registerFlag("watch", DConsole::f::boolean, 't');
+	conlib.registerFlag("preempt", DConsole::f::string, 'e');
+	conlib.registerFlag("reserve", DConsole::f::string, 'v');
+	conlib.registerFlag("aging", DConsole::f::string, 'y');
+	conlib.registerFlag("jobs", DConsole::f::string, 'n');
+	conlib.registerFlag("jobslog", DConsole::f::string, 'c');
+	conlib.registerFlag("threads", DConsole::f::string, 'q');
+	conlib.registerFlag("pin", DConsole::f::string, 'z');
+	conlib.registerFlag("timeout", DConsole::f::string, 'T');
+	conlib.registerFlag("retries", DConsole::f::string, 'R');
+	conlib.registerFlag("speculate", DConsole::f::string, 'S');
 
 	conlib.parse(argc, argv);
 
+	MasteringUtility::Options options;
+	options.Analyze = conlib.f_boolean("analyze");
+	options.ReplayGain = conlib.f_boolean("replaygain");
+	std::string blockSize = conlib.f_string("blocksize");
+	if (!blockSize.empty())
+		options.BlockSize = std::stoul(blockSize);
+	std::string segment = conlib.f_string("segment");
+	if (!segment.empty())
+		options.SegmentThreshold = std::stod(segment);
+	options.Preflight = conlib.f_boolean("preflight");
+	options.PreflightStrict = conlib.f_boolean("strict");
+	options.PreflightReport = conlib.f_string("report");
+	options.Peaks = conlib.f_boolean("peaks");
+	std::string prefetch = conlib.f_string("prefetch");
+	if (!prefetch.empty())
+		options.PrefetchDepth = std::stoul(prefetch);
+	std::string deviceJobs = conlib.f_string("devicejobs");
+	if (!deviceJobs.empty())
+		options.DeviceJobs = static_cast<unsigned>(std::stoul(deviceJobs));
+	if (std::string preempt = conlib.f_string("preempt"); preempt == "none")
+		options.Lanes.Preempt = JobScheduler::Preemption::None;
+	else if (preempt == "nice")
+		options.Lanes.Preempt = JobScheduler::Preemption::Nice;
+	else if (!preempt.empty() && preempt != "pause")
+	{
+		std::cerr << "Unknown preemption: " << preempt << " (none, nice or pause)\n";
+		return 1;
+	}
+	std::string reserve = conlib.f_string("reserve");
+	if (!reserve.empty())
+		options.Lanes.Reserved = static_cast<unsigned>(std::stoul(reserve));
+	if (std::string aging = conlib.f_string("aging"); !aging.empty())
+		options.Lanes.Aging = std::stod(aging);
+	// A single number fixes the encodes at once, a range bounds the controller
+	if (std::string jobs = conlib.f_string("jobs"); !jobs.empty())
+	{
+		const size_t dash = jobs.find('-');
+		options.Concurrency.Min = static_cast<unsigned>(std::stoul(jobs.substr(0, dash)));
+		options.Concurrency.Max = dash == std::string::npos ? options.Concurrency.Min
+		                                                    : static_cast<unsigned>(std::stoul(jobs.substr(dash + 1)));
+	}
+	options.Concurrency.Log = conlib.f_string("jobslog");
+	if (std::string pin = conlib.f_string("pin"); pin == "compact")
+		options.Placement = CpuPlacement::Policy::Compact;
+	else if (pin == "scatter")
+		options.Placement = CpuPlacement::Policy::Scatter;
+	else if (!pin.empty() && pin != "none")
+	{
+		std::cerr << "Unknown pinning: " << pin << " (none, compact or scatter)\n";
+		return 1;
+	}
+	if (std::string timeout = conlib.f_string("timeout"); !timeout.empty())
+		options.Timeouts.Margin = std::stod(timeout);
+	if (std::string retries = conlib.f_string("retries"); !retries.empty())
+		options.Timeouts.Retries = static_cast<unsigned>(std::stoul(retries));
+	if (std::string speculate = conlib.f_string("speculate"); !speculate.empty())
+		options.Timeouts.Speculate = std::stod(speculate);
+	// <codec>=<threads>[:<filter threads>], separated by commas
+	std::stringstream threads(conlib.f_string("threads"));
+	for (std::string entry; std::getline(threads, entry, ',');)
+	{
+		const size_t equals = entry.find('='), colon = entry.find(':', equals);
+		if (equals == std::string::npos)
+		{
+			std::cerr << "Invalid thread profile: " << entry << " (<codec>=<threads>[:<filter threads>])\n";
+			return 1;
+		}
+		ThreadBudget::Profile &profile = options.ThreadProfiles[entry.substr(0, equals)];
+		profile.Threads = static_cast<unsigned>(std::stoul(entry.substr(equals + 1, colon - equals - 1)));
+		if (colon != std::string::npos)
+			profile.FilterThreads = static_cast<unsigned>(std::stoul(entry.substr(colon + 1)));
+	}
+	masterer.SetOptions(options);
+
+	std::filesystem::path socketPath{conlib.f_string("socket")};
+	if (socketPath.empty())
+		socketPath = JobServer::defaultSocket();
+
+	// The engine stays resident and runs the jobs submitted to it
+	if (conlib.f_boolean("daemon"))
+	{
+		try
+		{
+			// Song jobs run on an engine of their own, next to the catalog jobs, and share the encoder slots
+			// with them; one slot is kept free for them unless told otherwise
+			if (reserve.empty())
+				options.Lanes.Reserved = 1;
+			auto scheduler = std::make_shared<JobScheduler>(0, options.DeviceJobs);
+			scheduler->setPolicy(options.Lanes);
+			scheduler->setConcurrency(options.Concurrency);
+			scheduler->setPlacement(options.Placement);
+			scheduler->setWatchdog(options.Timeouts);
+			MasteringUtility songs;
+			songs.SetOptions(options);
+			songs.SetScheduler(scheduler);
+			masterer.SetOptions(options);
+			masterer.SetScheduler(scheduler);
+
+			JobServer server(socketPath);
+			std::cout << "Waiting for jobs on " << socketPath.string() << "\n";
+			server.run([&masterer, &songs](const JobServer::Request &request) {
+				if (!request.Directory.empty())
+					std::filesystem::current_path(request.Directory);
+				(request.Song ? songs : masterer).Master(request.Markup, request.Album, request.Song);
+			});
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Error in daemon: " << ex.what() << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
 	std::filesystem::path markupPath{conlib.f_string("markupfile")};
 	if (markupPath.empty())
 	{
@@ -47,9 +192,41 @@ int main(int argc, char *argv[])
 		else
 			return 1;
 	}
+	std::optional<int> album;
+	std::optional<int> song;
+	if (std::string value = conlib.f_string("album"); !value.empty())
+		album = std::stoi(value);
+	if (std::string value = conlib.f_string("song"); !value.empty())
+		song = std::stoi(value);
+
+	if (conlib.f_boolean("submit"))
+	{
+		JobServer::Request request;
+		request.Markup = std::filesystem::absolute(markupPath);
+		request.Directory = std::filesystem::current_path();
+		request.Album = album;
+		request.Song = song;
+		if (std::string value = conlib.f_string("priority"); !value.empty())
+			request.Priority = std::stoi(value);
+		try
+		{
+			return JobServer::submit(socketPath, request, std::cout) ? 0 : 1;
+		}
+		catch (const std::exception &ex)
+		{
+			std::cerr << "Error submitting job: " << ex.what() << "\n";
+			return 1;
+		}
+	}
 	try
 	{
-		masterer.Master(markupPath);
+		// Runs until the process is ended
+		if (conlib.f_boolean("watch"))
+		{
+			masterer.Watch(markupPath);
+			return 0;
+		}
+		masterer.Master(markupPath, album, song);
 		std::cout << "Mastering finished!\n";
 	}
 	catch (const std::exception &ex)
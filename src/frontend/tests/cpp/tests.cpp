@@ -19,14 +19,44 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
+#include <CacheJournal.h>
+#include <ConcurrencyController.h>
+#include <CpuPlacement.h>
+#include <DspGraph.h>
+#include <FileWatcher.h>
+#include <Fingerprint.h>
+#include <FlacEncoder.h>
+#include <JobScheduler.h>
+#include <JobServer.h>
 #include <MasteringUtil.h>
+#include <OutputPublisher.h>
+#include <Prefetcher.h>
+#include <Preflight.h>
+#include <SegmentEncoder.h>
+#include <Subprocess.h>
+#include <TagWriter.h>
+#include <ThreadBudget.h>
+#include <WavReader.h>
+#include <Watchdog.h>
+#include <Waveform.h>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <dconsole.h>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <mutex>
 #include <random>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
 
 /**
  * @brief Generates a random string
@@ -65,6 +95,46 @@ bool compareStrings(const std::string &a, const std::string &b, const std::strin
 	return true;
 }
 
+/**
+ * @brief Writes a 24-bit stereo WAV file with JUNK and LIST chunks around the data
+ * @param path File to write
+ * @param samples Interleaved samples in 24-bit range
+ */
+void writeTestWav(const std::filesystem::path &path, const std::vector<int32_t> &samples)
+{
+	auto le = [](std::string &out, uint32_t value, int bytes) {
+		for (int i = 0; i < bytes; ++i)
+			out += static_cast<char>((value >> (8 * i)) & 0xFF);
+	};
+
+	std::string body = "WAVE";
+	body += "JUNK";
+	le(body, 28, 4);
+	body.append(28, '\0');
+	body += "fmt ";
+	le(body, 16, 4);
+	le(body, 1, 2);         // PCM
+	le(body, 2, 2);         // channels
+	le(body, 48000, 4);     // sample rate
+	le(body, 48000 * 6, 4); // byte rate
+	le(body, 6, 2);         // block align
+	le(body, 24, 2);        // bits per sample
+	body += "data";
+	le(body, static_cast<uint32_t>(samples.size() * 3), 4);
+	for (int32_t sample : samples)
+		le(body, static_cast<uint32_t>(sample), 3);
+	if (samples.size() % 2)
+		body += '\0';
+	body += "LIST";
+	le(body, 12, 4);
+	body += "INFOISFT";
+	le(body, 0, 4);
+
+	std::string file = "RIFF";
+	le(file, static_cast<uint32_t>(body.size()), 4);
+	std::ofstream(path, std::ios::binary) << file << body;
+}
+
 /// @brief CRT Entry Point
 int main(int argc, char **argv)
 {
@@ -222,6 +292,1020 @@ int main(int argc, char **argv)
 			allOk &= compareStrings(oSong.Comment, pSong.Comment, "Song Comment");
 		}
 	}
+
+	// Incremental save: untouched album blocks must be kept byte for byte, on later saves too
+	if (inputAlbums.size() == albums.size() && albums.size() == 2)
+	{
+		auto readFile = [](const std::filesystem::path &path) {
+			std::ifstream in(path, std::ios::binary);
+			return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		};
+
+		// Hand-written comments mark the original blocks, a rewritten block loses them
+		std::string before = readFile(outFile);
+		for (size_t at = before.find("{\n"); at != std::string::npos; at = before.find("{\n", at))
+		{
+			at += 2;
+			before.insert(at, "    ; hand written\n");
+		}
+		std::ofstream(outFile, std::ios::binary | std::ios::trunc) << before;
+		inputAlbums.clear();
+		masterer.ParseMarkup(outFile, inputAlbums);
+		auto writeTime = std::filesystem::last_write_time(outFile);
+
+		masterer.SaveMarkup(inputAlbums, outFile);
+		allOk &= compareStrings(std::to_string(writeTime == std::filesystem::last_write_time(outFile)), "1",
+		                        "Unchanged save skipped");
+
+		// Edits of the first album move the second one, which is still copied from the file
+		const std::string second = before.substr(inputAlbums[1].MarkupOffset);
+		std::string       untouched;
+		for (const std::string title : {"Edited Album 1", "Edited Album 1, Longer"})
+		{
+			inputAlbums[0].Title = title;
+			masterer.SaveMarkup(inputAlbums, outFile);
+			std::string after = readFile(outFile);
+			untouched += std::to_string(after.size() >= second.size() &&
+			                            after.compare(after.size() - second.size(), second.size(), second) == 0 &&
+			                            after.compare(inputAlbums[1].MarkupOffset, std::string::npos, second) == 0);
+		}
+		allOk &= compareStrings(untouched, "11", "Untouched album block");
+
+		MasteringUtility::Albums edited;
+		masterer.ParseMarkup(outFile, edited);
+		allOk &= compareStrings(edited.size() > 1 ? edited[0].Title : "", "Edited Album 1, Longer",
+		                        "Edited album block");
+	}
+
+	// Argument sanitization: shell control sequences are blanked out
+	{
+		std::filesystem::path sanitizeFile = tempDir / "sanitize.mas";
+		std::ofstream(sanitizeFile) << "album 1 (\"A\", \"B\", \"C\", \"art.png\", \"./\", \"./out\", \"G\", "
+		                               "\"2025\", \"\", \"-ar 44100 && rm x | tee; ls\")\n{\n}\n";
+
+		MasteringUtility::Albums sanitized;
+		masterer.ParseMarkup(sanitizeFile, sanitized);
+		allOk &= compareStrings(sanitized.empty() ? "" : sanitized[0].arguments, "-ar 44100    rm x   tee  ls",
+		                        "Argument sanitization");
+	}
+
+#ifndef _WIN32
+	// Quoted values: quotes and shell characters in a title reach the program unchanged
+	{
+		const std::string title = "12\" Mix $(echo no) ${HOME} `echo no` back\\slash 'single' & more";
+		Subprocess        echo("printf %s " + Subprocess::quote(title), Subprocess::Mode::Read);
+		std::string       printed;
+		char              buffer[256];
+		while (std::fgets(buffer, sizeof(buffer), echo.stream()))
+			printed += buffer;
+		echo.close();
+		allOk &= compareStrings(printed, title, "Quoted value");
+	}
+#endif
+
+	// Native WAV reader: 24-bit samples behind a JUNK chunk come back as planar float
+	{
+		std::vector<int32_t> samples;
+		for (int32_t i = 0; i < 37; ++i)
+		{
+			samples.push_back(i * 100000 - 1800000);
+			samples.push_back(i % 2 ? 8388607 : -8388608);
+		}
+
+		std::filesystem::path wavFile = tempDir / "test.wav";
+		writeTestWav(wavFile, samples);
+
+		WavReader wav;
+		bool      opened = wav.open(wavFile);
+		allOk &= compareStrings(std::to_string(opened), "1", "WAV open");
+		allOk &= compareStrings(std::to_string(wav.frames()), "37", "WAV frames");
+		allOk &= compareStrings(std::to_string(wav.chunks().size()), "4", "WAV chunks");
+
+		std::vector<float> left(37), right(37);
+		float             *planes[] = {left.data(), right.data()};
+		wav.read(0, 37, planes);
+
+		bool samplesOk = true;
+		for (size_t i = 0; i < 37; ++i)
+		{
+			samplesOk &= std::fabs(left[i] - static_cast<float>(samples[i * 2]) / 8388608.0f) < 1e-6f;
+			samplesOk &= std::fabs(right[i] - static_cast<float>(samples[i * 2 + 1]) / 8388608.0f) < 1e-6f;
+		}
+		allOk &= compareStrings(std::to_string(samplesOk), "1", "WAV samples");
+	}
+
+	// Audio fingerprint: header edits keep it, sample edits change it
+	{
+		std::vector<int32_t> samples(200);
+		for (size_t i = 0; i < samples.size(); ++i)
+			samples[i] = static_cast<int32_t>(i * 40000) - 4000000;
+
+		std::filesystem::path wavFile = tempDir / "fingerprint.wav";
+		writeTestWav(wavFile, samples);
+		std::string original = AudioFingerprint::compute(wavFile);
+
+		TagWriter::Tags tags;
+		tags[static_cast<size_t>(TagWriter::Field::Title)] = "Re-exported";
+		TagWriter::write(wavFile, tags);
+		std::string retagged = AudioFingerprint::compute(wavFile);
+
+		samples[100] += 1;
+		writeTestWav(wavFile, samples);
+		std::string edited = AudioFingerprint::compute(wavFile);
+
+		allOk &= compareStrings(std::to_string(original.size()), "16", "Fingerprint length");
+		allOk &= compareStrings(retagged, original, "Fingerprint after header edit");
+		allOk &= compareStrings(std::to_string(edited != original), "1", "Fingerprint after sample edit");
+	}
+
+	// Native FLAC: with verification on, the encoder decodes every frame again and compares it with the input
+	{
+		std::vector<int32_t> samples(2 * 10000);
+		for (size_t i = 0; i < samples.size() / 2; ++i)
+		{
+			samples[i * 2] = static_cast<int32_t>(std::sin(i * 0.01) * 4000000.0) + static_cast<int32_t>(i % 7);
+			samples[i * 2 + 1] = samples[i * 2] / 2 - static_cast<int32_t>(i % 5);
+		}
+		std::fill(samples.begin() + 2000, samples.begin() + 12000, 0);
+
+		std::filesystem::path wavFile = tempDir / "native.wav";
+		std::filesystem::path flacFile = tempDir / "native.flac";
+		writeTestWav(wavFile, samples);
+
+		WavReader wav;
+		wav.open(wavFile);
+		ThreadPool      pool(2);
+		TagWriter::Tags tags;
+		tags[static_cast<size_t>(TagWriter::Field::Title)] = "Native";
+
+		std::string result = "OK";
+		for (int level : {0, 5, 8})
+		{
+			FlacEncoder::Settings settings;
+			settings.CompressionLevel = level;
+			settings.Verify = true;
+			try
+			{
+				FlacEncoder::encode(wav, flacFile, tags, settings, pool);
+			}
+			catch (const std::exception &ex)
+			{
+				result = ex.what();
+			}
+		}
+
+		std::ifstream flac(flacFile, std::ios::binary);
+		std::string   header(42, '\0');
+		flac.read(header.data(), 42);
+		uint64_t totalSamples = 0;
+		for (int i = 21; i < 26; ++i)
+			totalSamples = (totalSamples << 8) | static_cast<unsigned char>(header[i]);
+		totalSamples &= 0xFFFFFFFFFull;
+
+		allOk &= compareStrings(result, "OK", "FLAC encode and verify");
+		allOk &= compareStrings(header.substr(0, 4), "fLaC", "FLAC stream marker");
+		allOk &= compareStrings(std::to_string(totalSamples), "10000", "FLAC total samples");
+	}
+
+	// Resampling and dither: a 48 kHz sine converted to 44.1 kHz in uneven blocks must match the ideal sine
+	{
+		const size_t       inputCount = 48000;
+		std::vector<float> input(inputCount);
+		for (size_t i = 0; i < inputCount; ++i)
+			input[i] = static_cast<float>(0.5 * std::sin(2.0 * 3.14159265358979 * 1000.0 * i / 48000.0));
+
+		Resampler          resampler(48000, 44100);
+		std::vector<float> output(resampler.maxOutput(inputCount) + resampler.maxOutput(0));
+		size_t             count = 0;
+		for (size_t i = 0; i < inputCount; i += 1000)
+			count += resampler.process(input.data() + i, std::min<size_t>(1000, inputCount - i), output.data() + count);
+		count += resampler.flush(output.data() + count);
+
+		double maxError = 0.0;
+		for (size_t i = 200; i + 200 < count; ++i)
+		{
+			double ideal = 0.5 * std::sin(2.0 * 3.14159265358979 * 1000.0 * i / 44100.0);
+			maxError = std::max(maxError, std::abs(output[i] - ideal));
+		}
+
+		std::vector<int32_t> quantized(count);
+		Ditherer(16, Ditherer::Mode::Triangular, 44100, 1).process(output.data(), count, quantized.data());
+		double maxDither = 0.0;
+		for (size_t i = 0; i < count; ++i)
+			maxDither = std::max(maxDither, std::abs(quantized[i] - output[i] * 32768.0));
+
+		allOk &= compareStrings(std::to_string(count), "44100", "Resampled length");
+		allOk &= compareStrings(std::to_string(maxError < 1e-5), "1", "Resampled sine error below -100 dB");
+		allOk &= compareStrings(std::to_string(maxDither <= 2.0), "1", "TPDF dither within 2 LSB");
+	}
+
+	// DSP graph: threaded and serial runs with different block sizes must write the same file, under the limit
+	{
+		std::vector<int32_t> samples(2 * 10000);
+		for (size_t i = 0; i < samples.size() / 2; ++i)
+		{
+			double burst = (i / 1000) % 2 ? 0.99 : 0.2;
+			samples[i * 2] = static_cast<int32_t>(burst * std::sin(i * 0.05) * 8388607.0);
+			samples[i * 2 + 1] = -samples[i * 2];
+		}
+		std::filesystem::path wavFile = tempDir / "graph.wav";
+		writeTestWav(wavFile, samples);
+
+		DspStage::Format format;
+		format.Filters = "volume=6dB,alimiter=limit=0.5:attack=2:level=0,afade=t=in:d=0.01";
+		DspGraph::Settings serial, threaded;
+		serial.Threaded = false;
+		serial.BlockSize = 4096;
+		threaded.BlockSize = 100;
+
+		ThreadPool            pool(2);
+		std::filesystem::path serialFile = tempDir / "graph_serial.wav";
+		std::filesystem::path threadedFile = tempDir / "graph_threaded.wav";
+		DspStage::render(wavFile, serialFile, format, pool, serial);
+		DspStage::render(wavFile, threadedFile, format, pool, threaded);
+
+		auto readAll = [](const std::filesystem::path &path) {
+			std::ifstream in(path, std::ios::binary);
+			return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		};
+		WavReader          wav;
+		std::vector<float> left(10000), right(10000);
+		float             *planes[] = {left.data(), right.data()};
+		wav.open(threadedFile);
+		size_t frames = wav.read(0, 10000, planes);
+		float  peak = 0.0f;
+		for (size_t i = 0; i < frames; ++i)
+			peak = std::max({peak, std::abs(left[i]), std::abs(right[i])});
+
+		allOk &= compareStrings(std::to_string(readAll(serialFile) == readAll(threadedFile)), "1",
+		                        "DSP graph threaded output");
+		allOk &= compareStrings(std::to_string(wav.frames()), "10000", "DSP graph length");
+		allOk &= compareStrings(std::to_string(peak <= 0.5f + 2.0f / 8388608.0f), "1", "Limiter ceiling");
+	}
+
+	// Fan-out: every encoder gets the same PCM, one that stops reading early does not hold the others back
+#ifndef _WIN32
+	{
+		const size_t       frames = 20000;
+		std::vector<float> interleaved(frames * 2);
+		for (size_t i = 0; i < interleaved.size(); ++i)
+			interleaved[i] = static_cast<float>(0.9 * std::sin(i * 0.001) * ((i % 2) ? -1.0 : 1.0));
+
+		std::string expected;
+		for (float sample : interleaved)
+		{
+			auto value = static_cast<int32_t>(std::lrint(std::clamp(sample * 8388608.0, -8388608.0, 8388607.0)));
+			for (int b = 0; b < 3; ++b)
+				expected += static_cast<char>(value >> (8 * b));
+		}
+
+		// The encoders ignore the raw input options behind the comment
+		std::vector<std::filesystem::path>               files;
+		std::vector<std::pair<std::string, std::string>> commands;
+		for (const char *reader : {"cat", "cat", "head -c 1000"})
+		{
+			files.push_back(tempDir / ("fanout" + std::to_string(files.size()) + ".raw"));
+			commands.emplace_back(std::string(reader) + " > \"" + files.back().string() + "\" # ", "");
+		}
+		DspGraph::FanOutSink sink(commands, 24);
+		sink.open(2, 48000);
+		for (size_t i = 0; i < frames; i += 3000)
+			sink.write(interleaved.data() + i * 2, std::min<size_t>(3000, frames - i));
+		sink.close();
+
+		auto readAll = [](const std::filesystem::path &path) {
+			std::ifstream in(path, std::ios::binary);
+			return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		};
+		bool same = readAll(files[0]) == expected && readAll(files[1]) == expected;
+		allOk &= compareStrings(std::to_string(same), "1", "Fan-out PCM");
+		allOk &= compareStrings(std::to_string(std::filesystem::file_size(files[2])), "1000", "Fan-out early exit");
+		allOk &= compareStrings(std::to_string(sink.status() == std::vector<int>(3, 0)), "1", "Fan-out status");
+
+		// The early exit was a write error only; the process's handling of SIGPIPE is left alone
+		struct sigaction pipeAction;
+		sigaction(SIGPIPE, nullptr, &pipeAction);
+		allOk &= compareStrings(std::to_string(pipeAction.sa_handler == SIG_DFL), "1", "Fan-out SIGPIPE");
+	}
+#endif
+
+	// Track split: tracks cut from one input join bit-exactly; iTunSMPB follows the edit list of an MP4 file
+	{
+		std::vector<int32_t> samples(2 * 10000);
+		for (size_t i = 0; i < samples.size(); ++i)
+			samples[i] = static_cast<int32_t>((i * 2654435761u) % 16777216u) - 8388608;
+		std::filesystem::path wavFile = tempDir / "set.wav";
+		writeTestWav(wavFile, samples);
+
+		std::vector<DspStage::Track> tracks(3);
+		tracks[0].End = 0.05;
+		tracks[1].Start = 0.05;
+		tracks[1].End = 0.125;
+		tracks[2].Start = 0.125;
+		for (size_t i = 0; i < tracks.size(); ++i)
+			tracks[i].Output = tempDir / ("track" + std::to_string(i) + ".wav");
+		ThreadPool pool(2);
+		DspStage::split(wavFile, tracks, DspStage::Format(), pool);
+
+		WavReader          source;
+		std::vector<float> left(10000), right(10000);
+		float             *planes[] = {left.data(), right.data()};
+		source.open(wavFile);
+		source.read(0, 10000, planes);
+		bool   joined = true;
+		size_t position = 0;
+		for (const auto &track : tracks)
+		{
+			WavReader          wav;
+			std::vector<float> trackLeft(10000), trackRight(10000);
+			float             *trackPlanes[] = {trackLeft.data(), trackRight.data()};
+			joined &= wav.open(track.Output) && wav.frames() == track.Frames;
+			size_t frames = wav.read(0, 10000, trackPlanes);
+			for (size_t i = 0; i < frames && position + i < 10000; ++i)
+				joined &= trackLeft[i] == left[position + i] && trackRight[i] == right[position + i];
+			position += frames;
+		}
+
+		auto box = [](const std::string &type, const std::string &payload) {
+			std::string out;
+			for (int shift = 24; shift >= 0; shift -= 8)
+				out += static_cast<char>(((payload.size() + 8) >> shift) & 0xFF);
+			return out + type + payload;
+		};
+		auto be32 = [](uint32_t value) {
+			return std::string{static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+			                   static_cast<char>(value >> 8), static_cast<char>(value)};
+		};
+		// 12 AAC frames of 1024 samples, the first 1024 samples are priming
+		std::string elst = box("elst", be32(0) + be32(1) + be32(10000) + be32(1024) + be32(0x10000));
+		std::string stts = box("stts", be32(0) + be32(1) + be32(12) + be32(1024));
+		std::string hdlr = box("hdlr", be32(0) + be32(0) + "soun" + std::string(13, '\0'));
+		std::string trak = box("trak", box("edts", elst) + box("mdia", hdlr + box("minf", box("stbl", stts))));
+		std::filesystem::path mp4File = tempDir / "gapless.m4a";
+		std::ofstream(mp4File, std::ios::binary) << box("ftyp", "M4A " + be32(0)) << box("moov", trak)
+		                                         << box("mdat", std::string(64, '\0'));
+		auto result = TagWriter::writeGapless(mp4File, 10000);
+		std::ifstream in(mp4File, std::ios::binary);
+		std::string   contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+		allOk &= compareStrings(std::to_string(tracks[0].Frames) + " " + std::to_string(tracks[1].Frames) + " " +
+		                            std::to_string(tracks[2].Frames),
+		                        "2400 3600 4000", "Track split lengths");
+		allOk &= compareStrings(std::to_string(joined), "1", "Track split samples");
+		allOk &= compareStrings(std::to_string(result != TagWriter::Result::Unsupported &&
+		                                       contents.find(" 00000000 00000400 000004F0 0000000000002710") !=
+		                                           std::string::npos),
+		                        "1", "Gapless info");
+	}
+
+	// Preflight: silence, a clipping run split across blocks and a DC offset on one channel of a quiet sine
+	{
+		const size_t       frames = 10000;
+		std::vector<float> left(frames, 0.0f), right(frames, 0.0f);
+		for (size_t i = 1000; i < 9000; ++i)
+		{
+			left[i] = static_cast<float>(0.25 * std::sin(2.0 * 3.14159265358979 * i / 100.0) + 0.01);
+			right[i] = static_cast<float>(0.25 * std::sin(2.0 * 3.14159265358979 * i / 100.0));
+		}
+		for (size_t i = 4998; i < 5003; ++i)
+			right[i] = -1.0f;
+		right[6000] = right[6001] = 1.0f; // too short to count
+
+		PreflightScanner scanner(2, 44100);
+		for (size_t i = 0; i < frames; i += 4999)
+		{
+			const float *planes[2] = {left.data() + i, right.data() + i};
+			scanner.process(planes, std::min<size_t>(4999, frames - i));
+		}
+		auto        result = scanner.result();
+		std::string findings;
+		for (const auto &finding : result.findings())
+			findings += finding + " ";
+
+		std::vector<float> silent(1000, 0.0f);
+		const float       *silentPlanes[1] = {silent.data()};
+		PreflightScanner   silence(1, 44100);
+		silence.process(silentPlanes, silent.size());
+
+		allOk &= compareStrings(findings, "clipping dc-offset ", "Preflight findings");
+		allOk &= compareStrings(std::to_string(result.ClipRuns) + " " + std::to_string(result.ClippedSamples), "1 5",
+		                        "Preflight clipping");
+		allOk &= compareStrings(std::to_string(result.LeadingSilence) + " " + std::to_string(result.TrailingSilence),
+		                        "1000 1000", "Preflight silence");
+		allOk &= compareStrings(silence.result().findings().front(), "silence", "Preflight digital silence");
+	}
+
+	// Waveform peaks: level 0 matches a scalar min/max, the pyramid stops at 1024 peaks and survives a round trip
+	{
+		const size_t       frames = 300000;
+		std::vector<float> left(frames), right(frames, 0.1f);
+		for (size_t i = 0; i < frames; ++i)
+			left[i] = static_cast<float>(0.5 * std::sin(2.0 * 3.14159265358979 * i / 777.0));
+		right[100000] = 0.9f;
+		right[200001] = -0.8f;
+
+		PeakBuilder builder(2, 48000);
+		for (size_t i = 0; i < frames; i += 1000)
+		{
+			const float *planes[2] = {left.data() + i, right.data() + i};
+			builder.process(planes, std::min<size_t>(1000, frames - i));
+		}
+		PeakFile peaks = builder.result();
+
+		bool levelOk = peaks.Levels.size() == 2 && peaks.Levels[0].Peaks.size() == 1172 * 4;
+		for (size_t p = 0; levelOk && p < 1172; ++p)
+		{
+			const size_t end = std::min(frames, (p + 1) * 256);
+			float        low = left[p * 256], high = low;
+			for (size_t i = p * 256; i < end; ++i)
+			{
+				low = std::min(low, left[i]);
+				high = std::max(high, left[i]);
+			}
+			levelOk = peaks.Levels[0].Peaks[p * 4] == static_cast<int16_t>(std::floor(low * 32767.0)) &&
+			          peaks.Levels[0].Peaks[p * 4 + 1] == static_cast<int16_t>(std::ceil(high * 32767.0));
+		}
+
+		std::filesystem::path peaksFile = tempDir / "peaks.peaks";
+		peaks.save(peaksFile);
+		PeakFile loaded = PeakFile::load(peaksFile);
+		bool     sameLevels = loaded.Levels.size() == peaks.Levels.size();
+		for (size_t l = 0; sameLevels && l < loaded.Levels.size(); ++l)
+			sameLevels = loaded.Levels[l].Peaks == peaks.Levels[l].Peaks &&
+			             loaded.Levels[l].FramesPerPeak == peaks.Levels[l].FramesPerPeak;
+
+		const auto &top = loaded.Levels.back();
+		allOk &= compareStrings(std::to_string(levelOk), "1", "Peaks level 0");
+		allOk &= compareStrings(std::to_string(loaded.Levels.size()) + " " + std::to_string(top.FramesPerPeak) + " " +
+		                            std::to_string(top.Peaks.size() / 4),
+		                        "2 1024 293", "Peaks levels");
+		allOk &= compareStrings(std::to_string(top.Peaks[97 * 4 + 3]) + " " + std::to_string(top.Peaks[195 * 4 + 2]),
+		                        "29491 -26214", "Peaks spikes");
+		allOk &= compareStrings(std::to_string(sameLevels && loaded.Frames == frames && loaded.SampleRate == 48000),
+		                        "1", "Peaks round trip");
+	}
+
+	// Prefetch: two files are loaded ahead, the third only once the first job has started
+	{
+		std::vector<std::filesystem::path> files;
+		std::uint64_t                      sizes[3] = {300000, 200000, 100000};
+		for (size_t i = 0; i < 3; ++i)
+		{
+			files.push_back(tempDir / ("prefetch" + std::to_string(i) + ".bin"));
+			std::ofstream(files.back(), std::ios::binary) << std::string(sizes[i], static_cast<char>('a' + i));
+		}
+
+		Prefetcher prefetcher(2);
+
+		auto waitFor = [&prefetcher](std::uint64_t bytes) {
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+			while (prefetcher.stats().Bytes < bytes && std::chrono::steady_clock::now() < deadline)
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			return prefetcher.stats().Bytes;
+		};
+		for (const auto &file : files)
+			prefetcher.queue(file);
+		prefetcher.queue(files[0]);
+		waitFor(sizes[0] + sizes[1]);
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		std::uint64_t ahead = prefetcher.stats().Bytes;
+
+		prefetcher.reached(files[0]);
+		prefetcher.reached(tempDir / "unknown.bin");
+		std::uint64_t after = waitFor(sizes[0] + sizes[1] + sizes[2]);
+		auto          stats = prefetcher.stats();
+
+		allOk &= compareStrings(std::to_string(ahead), "500000", "Prefetch depth");
+		allOk &= compareStrings(std::to_string(after), "600000", "Prefetch window moves");
+		allOk &= compareStrings(std::to_string(stats.Started) + " " + std::to_string(stats.Hits), "1 1",
+		                        "Prefetch hits");
+	}
+
+	// Job scheduler: a device limit of one serializes jobs on one disk, the slots alone do not
+	{
+		std::vector<JobScheduler::Job> jobs(6);
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			jobs[i].Reads.push_back(tempDir / ("job" + std::to_string(i) + ".bin"));
+			std::ofstream(jobs[i].Reads.back(), std::ios::binary) << std::string(1000, 'x');
+		}
+
+		auto peakJobs = [&jobs](JobScheduler &scheduler) {
+			std::mutex mutex;
+			int        running = 0, peak = 0;
+			for (auto &job : jobs)
+			{
+				job.Run = [&] {
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						peak = std::max(peak, ++running);
+					}
+					std::this_thread::sleep_for(std::chrono::milliseconds(20));
+					std::lock_guard<std::mutex> lock(mutex);
+					--running;
+				};
+			}
+			scheduler.run(jobs);
+			return peak;
+		};
+		JobScheduler serial(4, 1), parallel(4, 4);
+		int          serialPeak = peakJobs(serial);
+		int          parallelPeak = peakJobs(parallel);
+		const auto  &stats = serial.stats();
+
+		allOk &= compareStrings(std::to_string(serialPeak), "1", "Scheduler device limit");
+		allOk &= compareStrings(std::to_string(parallelPeak > 1), "1", "Scheduler slots");
+		allOk &= compareStrings(std::to_string(stats.size()) + " " +
+		                            (stats.empty() ? "" : std::to_string(stats.begin()->second.Jobs) + " " +
+		                                                      std::to_string(stats.begin()->second.Bytes)),
+		                        "1 6 6000", "Scheduler device stats");
+		allOk &= compareStrings(std::to_string(serial.plan(jobs).size()), "6", "Scheduler plan");
+	}
+
+	// Concurrency controller: idle CPUs add a job, a step without gain is taken back, iowait cuts the jobs and
+	// no jobs are added for a while after a cut
+	{
+		ConcurrencyController::Settings settings;
+		settings.Max = 8;
+		settings.Log = tempDir / "concurrency.csv";
+		std::string limits;
+		{
+			ConcurrencyController controller(settings, 4);
+			for (auto [throughput, cpu, iowait] : {std::tuple{10.0, 0.5, 0.0}, std::tuple{12.0, 0.6, 0.0},
+			                                      std::tuple{12.1, 0.7, 0.0}, std::tuple{12.0, 0.5, 0.5},
+			                                      std::tuple{9.0, 0.5, 0.0}})
+			{
+				ConcurrencyController::Sample sample;
+				sample.Throughput = throughput;
+				sample.Cpu = cpu;
+				sample.IoWait = iowait;
+				limits += std::to_string(controller.decide(sample).To) + " ";
+			}
+		}
+		std::ifstream logFile(settings.Log);
+		std::string   line;
+		size_t        lines = 0;
+		while (std::getline(logFile, line))
+			++lines;
+		allOk &= compareStrings(limits + std::to_string(lines), "5 6 5 3 3 6", "Concurrency decisions");
+
+		// Equal bounds fix the slots; an adaptive scheduler judges windows of jobs that kept the slots busy
+		JobScheduler                    fixed(4), adaptive(2);
+		ConcurrencyController::Settings bounds;
+		bounds.Min = bounds.Max = 3;
+		fixed.setConcurrency(bounds);
+		bounds.Min = 1;
+		bounds.Max = 4;
+		bounds.Interval = 0.0;
+		adaptive.setConcurrency(bounds);
+		std::vector<JobScheduler::Job> jobs(12);
+		for (auto &job : jobs)
+		{
+			job.Run = [] { std::this_thread::sleep_for(std::chrono::milliseconds(20)); };
+			job.Work = 1.0;
+		}
+		adaptive.run(jobs);
+		auto decided = adaptive.concurrency();
+		allOk &= compareStrings(std::to_string(fixed.slots()) + " " + std::to_string(fixed.concurrency().has_value()) +
+		                            " " + std::to_string(decided && decided->Decisions > 0),
+		                        "3 0 1", "Concurrency bounds");
+	}
+
+	// Thread budget: cgroup quotas round up, the profile is capped to the budget and options set in the markup win
+	{
+		ThreadBudget::Profile profile;
+		profile.Threads = 4;
+		profile.FilterThreads = 2;
+		ThreadBudget::Profiles profiles = {{"libopus", profile}};
+		const unsigned         cpus = ThreadBudget::availableCpus();
+		const bool             bounded = cpus >= 1 && cpus <= std::max(1u, std::thread::hardware_concurrency());
+		allOk &= compareStrings(std::to_string(ThreadBudget::quotaCpus("150000 100000")) + " " +
+		                            std::to_string(ThreadBudget::quotaCpus("max 100000")) + " " +
+		                            std::to_string(bounded),
+		                        "2 0 1", "Thread budget quota");
+		const ThreadBudget::Profile opus = ThreadBudget::profile("libopus", profiles);
+		const ThreadBudget::Profile lame = ThreadBudget::profile("libmp3lame", profiles);
+		allOk &= compareStrings(ThreadBudget::outputOptions(opus, 3, "-b:a 96k") + "| " +
+		                            ThreadBudget::outputOptions(lame, 8, "") + "| " +
+		                            ThreadBudget::outputOptions(profile, 8, "-threads 8"),
+		                        "-threads 3 -filter_threads 2 | -threads 1 -filter_threads 1 | -filter_threads 2 ",
+		                        "Thread budget options");
+	}
+
+	// CPU placement: scatter alternates the nodes, compact fills one node first; a pinned process inherits its CPUs
+	{
+		auto place = [](CpuPlacement::Policy policy, unsigned width) {
+			CpuPlacement placement(policy, {{0, {0, 1, 2, 3}}, {1, {4, 5, 6, 7}}});
+			std::string  placed;
+			for (int i = 0; i < 3; ++i)
+			{
+				CpuPlacement::Slot slot = placement.acquire(width);
+				placed += std::to_string(slot.Node) + ":" + CpuPlacement::formatList(slot.Cpus) + " ";
+			}
+			return placed;
+		};
+		allOk &= compareStrings(place(CpuPlacement::Policy::Scatter, 1) + "| " +
+		                            place(CpuPlacement::Policy::Compact, 2) + "| " +
+		                            CpuPlacement::formatList(CpuPlacement::parseList("10-11,0-3,8")),
+		                        "0:0 1:4 0:1 | 0:0-1 0:2-3 1:4-5 | 0-3,8,10-11", "CPU placement");
+#ifdef __linux__
+		const std::vector<CpuPlacement::Node> nodes = CpuPlacement::topology();
+		if (!nodes.empty())
+		{
+			const int         cpu = nodes.front().Cpus.front();
+			Subprocess::Group group;
+			group.pin({cpu});
+			std::string allowed;
+			{
+				Subprocess::Scope scope(&group);
+				Subprocess        status("grep Cpus_allowed_list /proc/self/status", Subprocess::Mode::Read);
+				char              line[256] = {};
+				if (std::fgets(line, sizeof(line), status.stream()))
+					allowed = line;
+				status.close();
+			}
+			allowed.erase(allowed.find_last_not_of(" \t\n") + 1);
+			allowed = allowed.substr(allowed.find_last_of(" \t") + 1);
+			allOk &= compareStrings(allowed, std::to_string(cpu), "CPU pinning");
+		}
+#endif
+	}
+
+#ifndef _WIN32
+	// Scheduler lanes: with every slot taken by batch encoders, a single song starts at once, by preempting a
+	// batch encoder or in a reserved slot
+	{
+		auto interactiveWait = [](JobScheduler::Policy policy, bool encoders) {
+			JobScheduler scheduler(2, 8);
+			scheduler.setPolicy(policy);
+			std::vector<JobScheduler::Job> batch(4), single(1);
+			for (auto &job : batch)
+				if (encoders)
+					job.Run = [] { Subprocess("sleep 0.3", Subprocess::Mode::Read).close(); };
+				else
+					job.Run = [] { std::this_thread::sleep_for(std::chrono::milliseconds(300)); };
+			single[0].Run = [] { Subprocess("sleep 0.1", Subprocess::Mode::Read).close(); };
+
+			std::thread catalog([&] { scheduler.run(batch); });
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			scheduler.run(single, nullptr, JobScheduler::Lane::Interactive);
+			catalog.join();
+			return std::make_pair(scheduler.laneStats(JobScheduler::Lane::Interactive).MaxWaitSeconds,
+			                      scheduler.laneStats(JobScheduler::Lane::Batch));
+		};
+		JobScheduler::Policy pause;
+		auto [pauseWait, pauseBatch] = interactiveWait(pause, true);
+		JobScheduler::Policy nice;
+		nice.Preempt = JobScheduler::Preemption::Nice;
+		auto [niceWait, niceBatch] = interactiveWait(nice, true);
+		JobScheduler::Policy reserve;
+		reserve.Reserved = 1;
+		reserve.Preempt = JobScheduler::Preemption::None;
+		auto [reserveWait, reserveBatch] = interactiveWait(reserve, true);
+
+		// Batch jobs that run no encoder cannot be paused, so the interactive job waits for one to finish
+		auto [nativeWait, nativeBatch] = interactiveWait(pause, false);
+
+		allOk &= compareStrings(std::to_string(pauseWait < 0.05) + " " + std::to_string(pauseBatch.Preempted) +
+		                            " " + std::to_string(pauseBatch.Jobs),
+		                        "1 1 4", "Scheduler preemption");
+		allOk &= compareStrings(std::to_string(niceWait < 0.05) + " " + std::to_string(niceBatch.Preempted) + " " +
+		                            std::to_string(niceBatch.Jobs),
+		                        "1 1 4", "Scheduler renice");
+		allOk &= compareStrings(std::to_string(reserveWait < 0.05) + " " + std::to_string(reserveBatch.Preempted),
+		                        "1 0", "Scheduler reservation");
+		allOk &= compareStrings(std::to_string(nativeWait > 0.1) + " " + std::to_string(nativeBatch.Preempted),
+		                        "1 0", "Scheduler in-process batch");
+	}
+#endif
+
+	// Watchdog: timeouts follow the median realtime factor of the finished jobs of a kind, with a floor
+	{
+		Watchdog::Settings settings;
+		settings.Margin = 4.0;
+		settings.MinTimeout = 1.0;
+		settings.Initial = 0.5;
+		settings.Speculate = 2.0;
+		settings.Backoff = 1.0;
+		Watchdog     watchdog(settings);
+		const double initial = watchdog.timeout("mp3", 10.0);
+		for (double seconds : {1.0, 2.0, 30.0})
+			watchdog.record("mp3", 10.0, seconds);
+		allOk &= compareStrings(std::to_string(static_cast<int>(initial)) + " " +
+		                            std::to_string(static_cast<int>(watchdog.timeout("mp3", 10.0))) + " " +
+		                            std::to_string(static_cast<int>(watchdog.straggling("mp3", 10.0))) + " " +
+		                            std::to_string(static_cast<int>(watchdog.timeout("mp3", 0.0))) + " " +
+		                            std::to_string(static_cast<int>(watchdog.timeout("flac", 10.0))) + " " +
+		                            std::to_string(static_cast<int>(watchdog.backoff(1))) + " " +
+		                            std::to_string(static_cast<int>(watchdog.backoff(3))),
+		                        "20 8 4 0 20 1 4", "Watchdog timeouts");
+	}
+
+#ifndef _WIN32
+	// Stragglers: a hung encoder is killed and its job run again; a slow job gets a second copy that wins
+	{
+		Watchdog::Settings settings;
+		settings.Initial = 0.1;
+		settings.MinTimeout = 0.3;
+		settings.Retries = 1;
+		settings.Backoff = 0.05;
+		JobScheduler retrying(1);
+		retrying.setWatchdog(settings);
+		std::vector<JobScheduler::Job> hung(1);
+		std::string                    claims;
+		hung[0].Work = 1.0;
+		hung[0].Run = [&claims] {
+			Subprocess(claims.empty() ? "sleep 5" : "sleep 0.05", Subprocess::Mode::Read).close();
+			claims += JobScheduler::claim() ? "kept " : "dropped ";
+		};
+		const auto start = std::chrono::steady_clock::now();
+		retrying.run(hung);
+		const bool prompt = std::chrono::steady_clock::now() - start < std::chrono::seconds(3);
+		const auto retried = retrying.stragglerStats().value_or(JobScheduler::StragglerStats());
+		allOk &= compareStrings(claims + std::to_string(retried.TimedOut) + " " + std::to_string(retried.Retried) +
+		                            " " + std::to_string(prompt),
+		                        "dropped kept 1 1 1", "Watchdog retry");
+
+		// A compressed input's length is only estimated, far too short; after quick jobs it still runs to the end
+		JobScheduler estimating(1);
+		estimating.setWatchdog(settings);
+		std::vector<JobScheduler::Job> compressed(3);
+		std::string                    finished;
+		for (auto &job : compressed)
+		{
+			job.Kind = "mp3";
+			job.Work = 10.0;
+			job.Run = [&finished] {
+				Subprocess("sleep 0.01", Subprocess::Mode::Read).close();
+				finished += JobScheduler::claim() ? "kept " : "dropped ";
+			};
+		}
+		compressed.back().Work = 0.01;
+		compressed.back().Estimated = true;
+		compressed.back().Run = [&finished] {
+			Subprocess("sleep 0.5", Subprocess::Mode::Read).close();
+			finished += JobScheduler::claim() ? "kept" : "dropped";
+		};
+		estimating.run(compressed);
+		const auto estimated = estimating.stragglerStats().value_or(JobScheduler::StragglerStats());
+		allOk &= compareStrings(finished + " " + std::to_string(estimated.TimedOut), "kept kept kept 0",
+		                        "Watchdog estimated length");
+
+		// Copies of the slow job claim in the order they finish
+		settings.Margin = 0.0;
+		settings.Speculate = 2.0;
+		JobScheduler speculating(2);
+		speculating.setWatchdog(settings);
+		std::vector<JobScheduler::Job> batch(2);
+		std::mutex                     mutex;
+		std::map<unsigned, bool>       kept;
+		batch[0].Run = [] { Subprocess("sleep 0.05", Subprocess::Mode::Read).close(); };
+		batch[1].Run = [&mutex, &kept] {
+			const unsigned copy = JobScheduler::copy();
+			Subprocess(copy == 0 ? "sleep 5" : "sleep 0.05", Subprocess::Mode::Read).close();
+			const bool claimed = JobScheduler::claim();
+			std::lock_guard<std::mutex> lock(mutex);
+			kept[copy] = claimed;
+		};
+		for (auto &job : batch)
+		{
+			job.Work = 1.0;
+			job.Speculative = true;
+		}
+		const auto begin = std::chrono::steady_clock::now();
+		speculating.run(batch);
+		const bool quick = std::chrono::steady_clock::now() - begin < std::chrono::seconds(3);
+		const auto copied = speculating.stragglerStats().value_or(JobScheduler::StragglerStats());
+		allOk &= compareStrings(std::to_string(kept[0]) + " " + std::to_string(kept[1]) + " " +
+		                            std::to_string(copied.Copies) + " " + std::to_string(copied.CopiesKept) + " " +
+		                            std::to_string(quick),
+		                        "0 1 1 1 1", "Speculative copy");
+	}
+#endif
+
+	// Staged outputs: a flushed staged file replaces the output in one rename
+	{
+		std::filesystem::path stagingDir = tempDir / "staging";
+		std::filesystem::create_directories(stagingDir);
+		std::filesystem::path staged = stagingDir / "song.mp3";
+		std::filesystem::path output = tempDir / "published.mp3";
+		std::ofstream(output, std::ios::binary) << "old";
+		std::ofstream(staged, std::ios::binary) << "new output";
+
+		bool flushed = OutputPublisher::flush({staged, tempDir / "missing.mp3"});
+		OutputPublisher::publish(staged, output);
+		std::ifstream in(output, std::ios::binary);
+		std::string   contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+		allOk &= compareStrings(std::to_string(flushed), "1", "Staged flush");
+		allOk &= compareStrings(contents, "new output", "Published output");
+		allOk &= compareStrings(std::to_string(std::filesystem::exists(staged)), "0", "Staged file moved");
+	}
+
+	// Cache journal: a torn record is ignored and cut off before the next append
+	{
+		std::filesystem::path journalFile = tempDir / "journal.masc.journal";
+		{
+			CacheJournal journal(journalFile);
+			journal.append("1, a.wav, hash1\n");
+			journal.append("2, b.wav, hash2\npeaks, 2, b.wav, key\n");
+		}
+		std::ofstream(journalFile, std::ios::app | std::ios::binary) << "3, c.wav, hash3\n; commit 00";
+		auto torn = CacheJournal::read(journalFile);
+
+		CacheJournal journal(journalFile);
+		journal.append("3, c.wav, hash4\n");
+		auto resumed = CacheJournal::read(journalFile);
+		journal.clear();
+
+		allOk &= compareStrings(std::to_string(torn.size()), "2", "Journal torn record");
+		allOk &= compareStrings(resumed.size() == 3 ? resumed[1] + resumed[2] : "",
+		                        "2, b.wav, hash2\npeaks, 2, b.wav, key\n3, c.wav, hash4\n", "Journal resumed");
+		allOk &= compareStrings(std::to_string(CacheJournal::read(journalFile).size()), "0", "Journal cleared");
+	}
+
+	// Job server: a request survives its round trip, and a submitted job streams its output back
+	{
+		JobServer::Request request;
+		request.Markup = tempDir / "catalog.mas";
+		request.Directory = tempDir;
+		request.Album = 2;
+		request.Song = 7;
+		request.Priority = 5;
+		auto parsed = JobServer::Request::parse(request.format());
+		bool same = parsed.Markup == request.Markup && parsed.Directory == request.Directory &&
+		            parsed.Album == request.Album && parsed.Song == request.Song && parsed.Priority == request.Priority;
+		allOk &= compareStrings(std::to_string(same), "1", "Job request round trip");
+
+#ifndef _WIN32
+		std::filesystem::path socket = tempDir / "jobs.sock";
+		JobServer             server(socket);
+		std::string           received;
+		auto handler = [&received](const JobServer::Request &job) {
+			received = job.Markup.filename().string() + " " + std::to_string(job.Album.value_or(0));
+			std::cout << "Mastering " << received << std::endl;
+		};
+		std::thread        engine([&server, &handler] { server.run(handler); });
+		std::ostringstream progress;
+		bool               finished = JobServer::submit(socket, request, progress);
+		server.stop();
+		engine.join();
+
+		allOk &= compareStrings(received, "catalog.mas 2", "Job server request");
+		allOk &= compareStrings(std::to_string(finished && progress.str().find("Mastering catalog.mas 2\n") == 0),
+		                        "1", "Job server progress");
+
+		// A song job runs while a catalog job does, and each client only sees the output of its own job
+		std::filesystem::path   laneSocket = tempDir / "lanes.sock";
+		JobServer               lanes(laneSocket);
+		std::mutex              mutex;
+		std::condition_variable songDone;
+		bool                    song = false;
+		auto                    laneHandler = [&](const JobServer::Request &job) {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (job.Song)
+			{
+				std::cout << "Song " << *job.Song << std::endl;
+				song = true;
+				songDone.notify_all();
+				return;
+			}
+			const bool overtaken = songDone.wait_for(lock, std::chrono::seconds(5), [&song] { return song; });
+			std::cout << "Catalog " << overtaken << std::endl;
+		};
+		std::thread        laneEngine([&lanes, &laneHandler] { lanes.run(laneHandler); });
+		std::ostringstream catalogProgress, songProgress;
+		JobServer::Request catalogRequest = request;
+		catalogRequest.Song.reset();
+		std::thread catalog([&] { JobServer::submit(laneSocket, catalogRequest, catalogProgress); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		JobServer::submit(laneSocket, request, songProgress);
+		catalog.join();
+		lanes.stop();
+		laneEngine.join();
+
+		allOk &= compareStrings(catalogProgress.str().substr(0, catalogProgress.str().find('\n')) + ", " +
+		                            songProgress.str().substr(0, songProgress.str().find('\n')),
+		                        "Catalog 1, Song 7", "Job server song lane");
+#endif
+	}
+
+	// File watcher: two quick writes to a watched file are one change, an unwatched neighbour is ignored
+	{
+		std::filesystem::path watchedFile = tempDir / "watched.wav";
+		std::filesystem::path otherFile = tempDir / "unwatched.wav";
+		std::ofstream(watchedFile) << "first";
+
+		FileWatcher watcher(std::chrono::milliseconds(200));
+		watcher.watch({watchedFile});
+		std::thread writer([&] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			std::ofstream(watchedFile) << "second";
+			std::ofstream(otherFile) << "other";
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			std::ofstream(watchedFile) << "second, longer";
+		});
+		auto changed = watcher.wait();
+		writer.join();
+
+		allOk &= compareStrings(std::to_string(changed.size()), "1", "File watcher batch");
+		allOk &= compareStrings(changed.empty() ? "" : changed[0].string(), FileWatcher::normal(watchedFile).string(),
+		                        "File watcher path");
+	}
+
+	// Segment join: consecutive segments meet on frame boundaries and their kept frames are joined in order
+	{
+		auto codec = SegmentEncoder::find("libmp3lame", 44100);
+		auto segments = SegmentEncoder::plan(1000000, 3, *codec);
+
+		// 128 kbps frames of 417 bytes, the payload marks segment and frame
+		std::vector<std::filesystem::path> files;
+		std::string                        expected;
+		bool                               aligned = codec && segments.size() == 3;
+		std::uint64_t                      kept = 0;
+		for (size_t i = 0; i < segments.size(); ++i)
+		{
+			const auto   &segment = segments[i];
+			std::uint64_t count = (segment.Last - segment.First + codec->Delay) / codec->FrameSize + 2;
+			std::string   stream;
+			for (std::uint64_t f = 0; f < count; ++f)
+			{
+				std::string frame =
+				    std::string("\xFF\xFB\x90\x64", 4) + std::string(413, static_cast<char>(i * 64 + f % 64));
+				stream += frame;
+				if (f >= segment.Skip && (segment.Keep == 0 || f < segment.Skip + segment.Keep))
+					expected += frame;
+			}
+			// Kept audio starts where the previous segment's kept audio ended
+			aligned &= segment.First + segment.Skip * codec->FrameSize == kept * codec->FrameSize;
+			kept += segment.Keep;
+			files.push_back(tempDir / ("segment" + std::to_string(i) + ".mp3"));
+			std::ofstream(files.back(), std::ios::binary) << stream;
+		}
+		std::filesystem::path joinedFile = tempDir / "joined.mp3";
+		SegmentEncoder::join(files, segments, *codec, joinedFile);
+		std::ifstream in(joinedFile, std::ios::binary);
+		std::string   joined((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+		allOk &= compareStrings(std::to_string(aligned), "1", "Segment boundaries");
+		allOk &= compareStrings(std::to_string(joined == expected), "1", "Segment join");
+	}
+
+#ifndef _WIN32
+	// Segment encodes: the encoder threads start their processes in the job's group, so killing it stops them all
+	{
+		Subprocess::Group group;
+		size_t            seen = 0;
+		std::thread       watchdog([&group, &seen] {
+			const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(3);
+			while ((seen = group.size()) < 2 && std::chrono::steady_clock::now() < deadline)
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			group.kill();
+		});
+		std::vector<int> status;
+		const auto       start = std::chrono::steady_clock::now();
+		{
+			Subprocess::Scope scope(&group);
+			status = SegmentEncoder::encode(2, 2, [](size_t) {
+				return Subprocess("sleep 5", Subprocess::Mode::Read).close();
+			});
+		}
+		watchdog.join();
+		const bool prompt = std::chrono::steady_clock::now() - start < std::chrono::seconds(4);
+		allOk &= compareStrings(std::to_string(seen) + " " + std::to_string(status[0] != 0 && status[1] != 0) + " " +
+		                            std::to_string(prompt),
+		                        "2 1 1", "Segment encode group");
+	}
+#endif
+
+	// Native retag: a new ID3v2 tag gets padding, the next edit fits into it, the audio is never touched
+	{
+		std::string audio;
+		for (int i = 0; i < 8; ++i)
+			audio += std::string("\xFF\xFB\x90\x64", 4) + std::string(413, static_cast<char>(i));
+
+		std::filesystem::path mp3File = tempDir / "retag.mp3";
+		std::ofstream(mp3File, std::ios::binary) << audio;
+
+		TagWriter::Tags tags;
+		tags[static_cast<size_t>(TagWriter::Field::Title)] = "First Title";
+		auto first = TagWriter::write(mp3File, tags);
+		tags[static_cast<size_t>(TagWriter::Field::Title)] = "Second Title";
+		auto second = TagWriter::write(mp3File, tags);
+
+		std::ifstream in(mp3File, std::ios::binary);
+		std::string   contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		bool tagged = contents.find("Second Title") != std::string::npos &&
+		              contents.find("First Title") == std::string::npos;
+		bool audioKept = contents.size() > audio.size() &&
+		                 contents.compare(contents.size() - audio.size(), audio.size(), audio) == 0;
+
+		allOk &= compareStrings(std::to_string(first == TagWriter::Result::Rewritten), "1", "Retag rewrite");
+		allOk &= compareStrings(std::to_string(second == TagWriter::Result::InPlace), "1", "Retag in place");
+		allOk &= compareStrings(std::to_string(tagged), "1", "Retag title");
+		allOk &= compareStrings(std::to_string(audioKept), "1", "Retag audio");
+	}
+
 	auto end = std::chrono::high_resolution_clock::now(); // end timer
 
 	std::filesystem::remove_all(tempDir);
@@ -492,7 +492,7 @@ bool confirmSaveInteractively(const std::filesystem::path &markupPath)
  * @param albums Albums to serialize into the Markup format.
  * @param markupPath Destination file path, including filename.
  */
-void saveMarkupFile(MasteringUtility &masterer, const MasteringUtility::Albums &albums,
+void saveMarkupFile(MasteringUtility &masterer, MasteringUtility::Albums &albums,
                     const std::filesystem::path &markupPath)
 {
 	masterer.SaveMarkup(albums, markupPath);